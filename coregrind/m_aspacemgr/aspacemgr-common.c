@@ -203,6 +203,11 @@ SysRes ML_(am_do_munmap_NO_NOTIFY)(Addr start, SizeT length)
    return VG_(do_syscall2)(__NR_munmap, (UWord)start, length );
 }
 
+SysRes ML_(am_do_mprotect_NO_NOTIFY)(Addr start, SizeT length, UInt prot)
+{
+   return local_do_mprotect_NO_NOTIFY(start, length, prot);
+}
+
 #if HAVE_MREMAP
 /* The following are used only to implement mremap(). */
 
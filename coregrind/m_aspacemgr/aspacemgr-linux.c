@@ -478,25 +478,26 @@ static void show_nsegment ( Int logLevel, Int segNo, const NSegment* seg )
       case SkAnonC: case SkAnonV: case SkShmC:
          VG_(debugLog)(
             logLevel, "aspacem",
-            "%3d: %s %010lx-%010lx %s %c%c%c%c%c\n",
+            "%3d: %s %010lx-%010lx %s %c%c%c%c%c%c%s\n",
             segNo, show_SegKind(seg->kind),
             seg->start, seg->end, len_buf,
             seg->hasR ? 'r' : '-', seg->hasW ? 'w' : '-', 
             seg->hasX ? 'x' : '-', seg->hasT ? 'T' : '-',
-            seg->isCH ? 'H' : '-'
+            seg->isCH ? 'H' : '-', seg->isShared ? 'S' : '-',
+            seg->isWP ? " (wp)" : ""
          );
          break;
 
       case SkFileC: case SkFileV:
          VG_(debugLog)(
             logLevel, "aspacem",
-            "%3d: %s %010lx-%010lx %s %c%c%c%c%c d=0x%03llx "
+            "%3d: %s %010lx-%010lx %s %c%c%c%c%c%c d=0x%03llx "
             "i=%-7llu o=%-7lld (%d,%d)\n",
             segNo, show_SegKind(seg->kind),
             seg->start, seg->end, len_buf,
             seg->hasR ? 'r' : '-', seg->hasW ? 'w' : '-', 
             seg->hasX ? 'x' : '-', seg->hasT ? 'T' : '-', 
-            seg->isCH ? 'H' : '-',
+            seg->isCH ? 'H' : '-', seg->isShared ? 'S' : '-',
             seg->dev, seg->ino, seg->offset,
             ML_(am_segname_get_seqnr)(seg->fnIdx), seg->fnIdx
          );
@@ -622,25 +623,27 @@ static Bool sane_NSegment ( const NSegment* s )
             s->smode == SmFixed
             && s->dev == 0 && s->ino == 0 && s->offset == 0 && s->fnIdx == -1 
             && !s->hasR && !s->hasW && !s->hasX && !s->hasT
-            && !s->isCH;
+            && !s->isCH && !s->isWP && !s->isShared;
 
       case SkAnonC: case SkAnonV: case SkShmC:
          return 
             s->smode == SmFixed 
             && s->dev == 0 && s->ino == 0 && s->offset == 0 && s->fnIdx == -1
-            && (s->kind==SkAnonC ? True : !s->isCH);
+            && (s->kind==SkAnonC ? True
+                                 : !s->isCH && !s->isWP && !s->isShared);
 
       case SkFileC: case SkFileV:
          return 
             s->smode == SmFixed
             && ML_(am_sane_segname)(s->fnIdx)
-            && !s->isCH;
+            && !s->isCH && !s->isWP
+            && (s->kind==SkFileC ? True : !s->isShared);
 
       case SkResvn: 
          return 
             s->dev == 0 && s->ino == 0 && s->offset == 0 && s->fnIdx == -1 
             && !s->hasR && !s->hasW && !s->hasX && !s->hasT
-            && !s->isCH;
+            && !s->isCH && !s->isWP && !s->isShared;
 
       default:
          return False;
@@ -672,7 +675,8 @@ static Bool maybe_merge_nsegments ( NSegment* s1, const NSegment* s2 )
 
       case SkAnonC: case SkAnonV:
          if (s1->hasR == s2->hasR && s1->hasW == s2->hasW 
-             && s1->hasX == s2->hasX && s1->isCH == s2->isCH) {
+             && s1->hasX == s2->hasX && s1->isCH == s2->isCH
+             && s1->isWP == s2->isWP && s1->isShared == s2->isShared) {
             s1->end = s2->end;
             s1->hasT |= s2->hasT;
             return True;
@@ -682,6 +686,7 @@ static Bool maybe_merge_nsegments ( NSegment* s1, const NSegment* s2 )
       case SkFileC: case SkFileV:
          if (s1->hasR == s2->hasR 
              && s1->hasW == s2->hasW && s1->hasX == s2->hasX
+             && s1->isShared == s2->isShared
              && s1->dev == s2->dev && s1->ino == s2->ino
              && s2->offset == s1->offset
                               + ((ULong)s2->start) - ((ULong)s1->start) ) {
@@ -849,9 +854,11 @@ static void sync_check_mapping_callback ( Addr addr, SizeT len, UInt prot,
              || nsegments[i].kind == SkFileV
              || nsegments[i].kind == SkShmC;
 
+      /* A write-protected segment (isWP) is writable as far as the
+         client knows, but not as far as the kernel knows. */
       seg_prot = 0;
       if (nsegments[i].hasR) seg_prot |= VKI_PROT_READ;
-      if (nsegments[i].hasW) seg_prot |= VKI_PROT_WRITE;
+      if (nsegments[i].hasW && !nsegments[i].isWP) seg_prot |= VKI_PROT_WRITE;
       if (nsegments[i].hasX) seg_prot |= VKI_PROT_EXEC;
 
       cmp_offsets
@@ -1493,6 +1500,8 @@ static void init_nsegment ( /*OUT*/NSegment* seg )
    seg->offset   = 0;
    seg->fnIdx    = -1;
    seg->hasR = seg->hasW = seg->hasX = seg->hasT = seg->isCH = False;
+   seg->isWP = False;
+   seg->isShared = False;
 }
 
 /* Make an NSegment which holds a reservation. */
@@ -2168,6 +2177,7 @@ VG_(am_notify_client_mmap)( Addr a, SizeT len, UInt prot, UInt flags,
    seg.hasR   = toBool(prot & VKI_PROT_READ);
    seg.hasW   = toBool(prot & VKI_PROT_WRITE);
    seg.hasX   = toBool(prot & VKI_PROT_EXEC);
+   seg.isShared = toBool(flags & VKI_MAP_SHARED);
    if (!(flags & VKI_MAP_ANONYMOUS)) {
       // Nb: We ignore offset requests in anonymous mmaps (see bug #126722)
       seg.offset = offset;
@@ -2253,6 +2263,15 @@ Bool VG_(am_notify_mprotect)( Addr start, SizeT len, UInt prot )
       /* Apply the permissions to all relevant segments. */
       switch (nsegments[i].kind) {
          case SkAnonC: case SkAnonV: case SkFileC: case SkFileV: case SkShmC:
+            /* The client's mprotect has replaced any write protection
+               of ours.  If it left the segment writable, then writes
+               to code translated from it will no longer be noticed,
+               so those translations have to go. */
+            if (nsegments[i].isWP) {
+               nsegments[i].isWP = False;
+               if (newW && nsegments[i].hasT)
+                  needDiscard = True;
+            }
             nsegments[i].hasR = newR;
             nsegments[i].hasW = newW;
             nsegments[i].hasX = newX;
@@ -2891,6 +2910,144 @@ void VG_(am_set_segment_hasT)( Addr addr )
    nsegments[i].hasT = True;
 }
 
+/* Make the kernel's idea of the permissions of segment I agree with
+   ours, taking isWP into account. */
+static Bool set_kernel_prot_for_WP ( Int i )
+{
+   UInt   prot = 0;
+   SysRes sres;
+   if (nsegments[i].hasR) prot |= VKI_PROT_READ;
+   if (nsegments[i].hasW && !nsegments[i].isWP) prot |= VKI_PROT_WRITE;
+   if (nsegments[i].hasX) prot |= VKI_PROT_EXEC;
+   sres = ML_(am_do_mprotect_NO_NOTIFY)(
+             nsegments[i].start, nsegments[i].end - nsegments[i].start + 1,
+             prot );
+   return !sr_isError(sres);
+}
+
+/* Take write access to START .. START+LEN-1 away from the client,
+   without it being able to tell: hasW is unchanged, only isWP is set.
+   Writes to the range then fault, and the core can notice writes to
+   code it has translated.  The range must lie entirely in SkAnonC
+   segments that were not mapped MAP_SHARED: writes made through
+   another mapping of the same memory, in this process or another one,
+   would not fault.  Returns False if it does not, or if there are too few
+   free entries in nsegments[] to be splitting segments up for this.
+   Returns True if the range is now (or already was) protected. */
+Bool VG_(am_set_client_WP)( Addr start, SizeT len )
+{
+   Int  i, iLo, iHi;
+   Bool allWP = True;
+
+   aspacem_assert(VG_IS_PAGE_ALIGNED(start));
+   aspacem_assert(VG_IS_PAGE_ALIGNED(len));
+
+   if (len == 0 || start + len - 1 < start)
+      return False;
+
+   iLo = find_nsegment_idx(start);
+   iHi = find_nsegment_idx(start + len - 1);
+   for (i = iLo; i <= iHi; i++) {
+      if (nsegments[i].kind != SkAnonC || nsegments[i].isShared)
+         return False;
+      if (!nsegments[i].isWP)
+         allWP = False;
+   }
+   if (allWP)
+      return True;
+
+   /* Protecting part of a segment splits it.  Don't let that use up
+      the entries needed for real mappings. */
+   if (nsegments_used + 2 > (3 * VG_N_SEGMENTS) / 4)
+      return False;
+
+   split_nsegments_lo_and_hi( start, start+len-1, &iLo, &iHi );
+
+   iLo = find_nsegment_idx(start);
+   iHi = find_nsegment_idx(start + len - 1);
+
+   for (i = iLo; i <= iHi; i++) {
+      if (nsegments[i].isWP)
+         continue;
+      nsegments[i].isWP = True;
+      if (nsegments[i].hasW && !set_kernel_prot_for_WP(i)) {
+         nsegments[i].isWP = False;
+         (void)preen_nsegments();
+         return False;
+      }
+   }
+
+   (void)preen_nsegments();
+   AM_SANITY_CHECK;
+   return True;
+}
+
+/* Undo VG_(am_set_client_WP) for any part of START .. START+LEN-1 that
+   it was applied to, giving the client its write access back.  Returns
+   True if any part of the range was protected. */
+Bool VG_(am_clear_client_WP)( Addr start, SizeT len )
+{
+   Int  i, iLo, iHi;
+   Bool anyWP = False;
+
+   Addr lo, hi;
+
+   if (len == 0 || start + len - 1 < start)
+      return False;
+
+   lo = VG_PGROUNDDN(start);
+   hi = VG_PGROUNDDN(start + len - 1) + VKI_PAGE_SIZE - 1;
+
+   iLo = find_nsegment_idx(lo);
+   iHi = find_nsegment_idx(hi);
+   for (i = iLo; i <= iHi; i++) {
+      if (nsegments[i].isWP) {
+         anyWP = True;
+         break;
+      }
+   }
+   if (!anyWP)
+      return False;
+
+   split_nsegments_lo_and_hi( lo, hi, &iLo, &iHi );
+
+   iLo = find_nsegment_idx(lo);
+   iHi = find_nsegment_idx(hi);
+
+   for (i = iLo; i <= iHi; i++) {
+      if (!nsegments[i].isWP)
+         continue;
+      nsegments[i].isWP = False;
+      if (nsegments[i].hasW) {
+         Bool ok = set_kernel_prot_for_WP(i);
+         aspacem_assert(ok);
+      }
+   }
+
+   (void)preen_nsegments();
+   AM_SANITY_CHECK;
+   return True;
+}
+
+/* Find the lowest range protected by VG_(am_set_client_WP) that lies
+   at or above FROM.  Adjacent protected segments are reported as one
+   range.  Returns False if there is none. */
+Bool VG_(am_next_client_WP)( Addr from, /*OUT*/Addr* start,
+                                        /*OUT*/SizeT* len )
+{
+   Int i, j;
+   for (i = find_nsegment_idx(from); i < nsegments_used; i++) {
+      if (!nsegments[i].isWP)
+         continue;
+      for (j = i; j+1 < nsegments_used && nsegments[j+1].isWP; j++)
+         ;
+      *start = nsegments[i].start;
+      *len   = nsegments[j].end - nsegments[i].start + 1;
+      return True;
+   }
+   return False;
+}
+
 
 /* --- --- --- reservations --- --- --- */
 
@@ -3679,7 +3836,8 @@ static void add_mapping_callback(Addr addr, SizeT len, UInt prot,
          // GrP fixme
          seg_prot = 0;
          if (nsegments[i].hasR) seg_prot |= VKI_PROT_READ;
-         if (nsegments[i].hasW) seg_prot |= VKI_PROT_WRITE;
+         if (nsegments[i].hasW && !nsegments[i].isWP)
+            seg_prot |= VKI_PROT_WRITE;
 #        if defined(VGA_x86)
          // GrP fixme sloppyXcheck 
          // darwin: kernel X ignored and spuriously changes? (vm_copy)
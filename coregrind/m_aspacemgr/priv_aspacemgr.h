@@ -94,6 +94,10 @@ extern UInt   ML_(am_sprintf) ( HChar* buf, const HChar *format, ... );
 /* wrapper for munmap */
 extern SysRes ML_(am_do_munmap_NO_NOTIFY)(Addr start, SizeT length);
 
+/* wrapper for mprotect */
+extern SysRes ML_(am_do_mprotect_NO_NOTIFY)(Addr start, SizeT length,
+                                            UInt prot);
+
 /* wrapper for the ghastly 'mremap' syscall */
 extern SysRes ML_(am_do_extend_mapping_NO_NOTIFY)( 
                  Addr  old_addr, 
@@ -1,6 +1,6 @@
 
 /*--------------------------------------------------------------------*/
-/*--- A separately-chained hash table.               m_hashtable.c ---*/
+/*--- An open-addressing hash table.                m_hashtable.c ---*/
 /*--------------------------------------------------------------------*/
 
 /*
@@ -40,27 +40,65 @@
 /*--- Declarations                                                 ---*/
 /*--------------------------------------------------------------------*/
 
-#define CHAIN_NO(key,tbl) (((UWord)(key)) % tbl->n_chains)
+/* The table is an array of slots, with linear probing.  A slot holds
+   a key and the most recently added node with that key; older nodes
+   with the same key hang off it through their 'next' fields.  As the
+   key is in the slot, following a probe sequence never touches the
+   nodes themselves.
+
+   A slot is empty (node == NULL), in use, or DELETED: its key has been
+   removed, but later keys may have probed past it.  Slots in use or
+   DELETED count towards the load, which is kept at most 1/2.
+
+   When the load gets too high, a new array of slots is allocated --
+   twice as big, or as big if most of the load is DELETED slots -- but
+   the keys are not all moved at once.  Instead each add and remove
+   moves the keys of the next MIGRATE_STEP slots of the old array, so
+   no single operation pays for the whole rehash.  Until the old array
+   has been emptied, lookups look in both; a key is only ever in one
+   of them.  Migrated slots in the old array are marked DELETED, so
+   that the probe sequences of the keys still there are unaffected. */
+
+typedef
+   struct {
+      UWord       key;
+      VgHashNode* node;
+   }
+   HTSlot;
+
+#define DELETED         ((VgHashNode*)1)
+#define MIGRATE_STEP    8
+#define MIN_LOG2_SLOTS  8
 
 struct _VgHashTable {
-   UInt         n_chains;   // should be prime
+   HTSlot*      slots;
+   UInt         log2_slots;
+   UInt         n_used;      // slots of 'slots' in use or DELETED
+   HTSlot*      old_slots;   // being emptied into 'slots', or NULL
+   UInt         old_log2_slots;
+   UInt         old_next;    // next slot of 'old_slots' to migrate
+   UInt         n_keys;      // distinct keys
    UInt         n_elements;
-   VgHashNode*  iterNode;   // current iterator node
-   UInt         iterChain;  // next chain to be traversed by the iterator
-   VgHashNode** chains;     // expanding array of hash chains
-   Bool         iterOK;     // table safe to iterate over?
-   const HChar* name;       // name of table (for debugging only)
+   VgHashNode*  iterNode;    // current iterator node
+   UInt         iterArr;     // 0: traversing old_slots, 1: slots
+   UInt         iterSlot;    // next slot to be traversed by the iterator
+   Bool         iterOK;      // table safe to iterate over?
+   const HChar* name;        // name of table (for debugging only)
 };
 
-#define N_HASH_PRIMES 20
+static inline UWord slot_no ( UWord key, UInt log2_slots )
+{
+#  if VG_WORDSIZE == 8
+   return (UWord)((key * 0x9E3779B97F4A7C15ULL) >> (64 - log2_slots));
+#  else
+   return (UWord)((key * 0x9E3779B9U) >> (32 - log2_slots));
+#  endif
+}
 
-static const SizeT primes[N_HASH_PRIMES] = {
-         769UL,         1543UL,         3079UL,          6151UL,
-       12289UL,        24593UL,        49157UL,         98317UL,
-      196613UL,       393241UL,       786433UL,       1572869UL,
-     3145739UL,      6291469UL,     12582917UL,      25165843UL,
-    50331653UL,    100663319UL,    201326611UL,     402653189UL
-};
+static inline Bool slot_in_use ( const HTSlot* s )
+{
+   return s->node != NULL && s->node != DELETED;
+}
 
 /*--------------------------------------------------------------------*/
 /*--- Functions                                                    ---*/
@@ -68,16 +106,15 @@ static const SizeT primes[N_HASH_PRIMES] = {
 
 VgHashTable *VG_(HT_construct) ( const HChar* name )
 {
-   /* Initialises to zero, ie. all entries NULL */
-   SizeT       n_chains = primes[0];
-   SizeT       sz       = n_chains * sizeof(VgHashNode*);
-   VgHashTable *table   = VG_(calloc)("hashtable.Hc.1",
-                                      1, sizeof(struct _VgHashTable));
-   table->chains        = VG_(calloc)("hashtable.Hc.2", 1, sz);
-   table->n_chains      = n_chains;
-   table->n_elements    = 0;
-   table->iterOK        = True;
-   table->name          = name;
+   /* Initialises to zero, ie. all slots empty */
+   VgHashTable *table = VG_(calloc)("hashtable.Hc.1",
+                                    1, sizeof(struct _VgHashTable));
+   table->slots       = VG_(calloc)("hashtable.Hc.2",
+                                    1 << MIN_LOG2_SLOTS, sizeof(HTSlot));
+   table->log2_slots  = MIN_LOG2_SLOTS;
+   table->iterArr     = 2;
+   table->iterOK      = True;
+   table->name        = name;
    vg_assert(name);
    return table;
 }
@@ -87,70 +124,143 @@ UInt VG_(HT_count_nodes) ( const VgHashTable *table )
    return table->n_elements;
 }
 
-static void resize ( VgHashTable *table )
+/* Returns the slot of 'slots' holding key, or NULL. */
+static HTSlot* find_in ( HTSlot* slots, UInt log2_slots, UWord key )
 {
-   Int          i;
-   SizeT        sz;
-   SizeT        old_chains = table->n_chains;
-   SizeT        new_chains = old_chains + 1;
-   VgHashNode** chains;
-   VgHashNode * node;
-
-   /* If we've run out of primes, do nothing. */
-   if (old_chains == primes[N_HASH_PRIMES-1])
-      return;
+   UWord mask = ((UWord)1 << log2_slots) - 1;
+   UWord i    = slot_no(key, log2_slots);
 
-   vg_assert(old_chains >= primes[0] 
-             && old_chains < primes[N_HASH_PRIMES-1]);
+   while (slots[i].node != NULL) {
+      if (slots[i].key == key && slots[i].node != DELETED)
+         return &slots[i];
+      i = (i + 1) & mask;
+   }
+   return NULL;
+}
+
+static HTSlot* find_slot ( const VgHashTable *table, UWord key )
+{
+   HTSlot* s = find_in(table->slots, table->log2_slots, key);
+   if (s == NULL && table->old_slots != NULL)
+      s = find_in(table->old_slots, table->old_log2_slots, key);
+   return s;
+}
+
+/* Puts a key, known not to be in the table, in a free slot of
+   'slots'. */
+static void insert_key ( VgHashTable *table, UWord key, VgHashNode* node )
+{
+   UWord   mask = ((UWord)1 << table->log2_slots) - 1;
+   UWord   i    = slot_no(key, table->log2_slots);
+   HTSlot* dst  = NULL;
+
+   while (table->slots[i].node != NULL) {
+      if (table->slots[i].node == DELETED && dst == NULL)
+         dst = &table->slots[i];
+      i = (i + 1) & mask;
+   }
+   if (dst == NULL) {
+      dst = &table->slots[i];
+      table->n_used++;
+   }
+   dst->key  = key;
+   dst->node = node;
+}
+
+/* Moves the keys of the next n_slots slots of old_slots, if any. */
+static void migrate ( VgHashTable *table, UInt n_slots )
+{
+   UInt old_n_slots = 1 << table->old_log2_slots;
 
-   for (i = 0; i < N_HASH_PRIMES; i++) {
-      if (primes[i] > new_chains) {
-         new_chains = primes[i];
-         break;
+   while (n_slots > 0 && table->old_next < old_n_slots) {
+      HTSlot* s = &table->old_slots[table->old_next++];
+      if (slot_in_use(s)) {
+         insert_key(table, s->key, s->node);
+         s->node = DELETED;
       }
+      n_slots--;
    }
+   if (table->old_next == old_n_slots) {
+      VG_(free)(table->old_slots);
+      table->old_slots = NULL;
+   }
+}
+
+static void maybe_resize ( VgHashTable *table )
+{
+   UInt n_slots = 1 << table->log2_slots;
+   UInt new_log2_slots;
+
+   if (2 * (ULong)table->n_used <= n_slots)
+      return;
 
-   vg_assert(new_chains > old_chains);
-   vg_assert(new_chains > primes[0] 
-             && new_chains <= primes[N_HASH_PRIMES-1]);
+   /* Can only happen if a resize is started while the previous one
+      is still in progress, which the sizes below are chosen to
+      avoid; but if it does, finish that one first. */
+   if (table->old_slots != NULL) {
+      migrate(table, 1 << table->old_log2_slots);
+      if (2 * (ULong)table->n_used <= n_slots)
+         return;
+   }
+
+   new_log2_slots = table->log2_slots;
+   if (4 * (ULong)table->n_keys > n_slots) {
+      /* If we've got as big as we can, do nothing. */
+      if (table->log2_slots == 31)
+         return;
+      new_log2_slots++;
+   }
 
    VG_(debugLog)(
       1, "hashtable",
-         "resizing table `%s' from %lu to %lu (total elems %lu)\n",
-         table->name, (UWord)old_chains, (UWord)new_chains,
+         "resizing table `%s' from %lu to %lu slots (total elems %lu)\n",
+         table->name, (UWord)n_slots, (UWord)1 << new_log2_slots,
          (UWord)table->n_elements );
 
-   table->n_chains = new_chains;
-   sz = new_chains * sizeof(VgHashNode*);
-   chains = VG_(calloc)("hashtable.resize.1", 1, sz);
-
-   for (i = 0; i < old_chains; i++) {
-      node = table->chains[i];
-      while (node != NULL) {
-         VgHashNode* next = node->next;
-         UWord chain = CHAIN_NO(node->key, table);
-         node->next = chains[chain];
-         chains[chain] = node;
-         node = next;
-      }
-   }
+   table->old_slots      = table->slots;
+   table->old_log2_slots = table->log2_slots;
+   table->old_next       = 0;
+   table->slots          = VG_(calloc)("hashtable.resize.1",
+                                       1 << new_log2_slots, sizeof(HTSlot));
+   table->log2_slots     = new_log2_slots;
+   table->n_used         = 0;
+}
 
-   VG_(free)(table->chains);
-   table->chains = chains;
+/* Unlinks node, whose predecessor's next field (or slot's node field)
+   is *prev_next_ptr, from the nodes with the key of slot s. */
+static void unlink_node ( VgHashTable *table, HTSlot* s,
+                          VgHashNode** prev_next_ptr, VgHashNode* node )
+{
+   *prev_next_ptr = node->next;
+   if (s->node == NULL) {
+      s->node = DELETED;
+      table->n_keys--;
+   }
+   table->n_elements--;
 }
 
-/* Puts a new, heap allocated VgHashNode, into the VgHashTable.  Prepends
-   the node to the appropriate chain.  No duplicate key detection is done. */
+/* Puts a new, heap allocated VgHashNode, into the VgHashTable.  If the
+   key is already present, the node is put in front of the ones with the
+   same key.  No duplicate key detection is done. */
 void VG_(HT_add_node) ( VgHashTable *table, void* vnode )
 {
-   VgHashNode* node     = (VgHashNode*)vnode;
-   UWord chain          = CHAIN_NO(node->key, table);
-   node->next           = table->chains[chain];
-   table->chains[chain] = node;
-   table->n_elements++;
-   if ( (1 * (ULong)table->n_elements) > (1 * (ULong)table->n_chains) ) {
-      resize(table);
+   VgHashNode* node = (VgHashNode*)vnode;
+   HTSlot*     s;
+
+   if (table->old_slots != NULL)
+      migrate(table, MIGRATE_STEP);
+
+   s = find_slot(table, node->key);
+   if (s != NULL) {
+      node->next = s->node;
+      s->node    = node;
+   } else {
+      node->next = NULL;
+      insert_key(table, node->key, node);
+      table->n_keys++;
+      maybe_resize(table);
    }
+   table->n_elements++;
 
    /* Table has been modified; hence HT_Next should assert. */
    table->iterOK = False;
@@ -159,15 +269,8 @@ void VG_(HT_add_node) ( VgHashTable *table, void* vnode )
 /* Looks up a VgHashNode by key in the table.  Returns NULL if not found. */
 void* VG_(HT_lookup) ( const VgHashTable *table, UWord key )
 {
-   VgHashNode* curr = table->chains[ CHAIN_NO(key, table) ];
-
-   while (curr) {
-      if (key == curr->key) {
-         return curr;
-      }
-      curr = curr->next;
-   }
-   return NULL;
+   HTSlot* s = find_slot(table, key);
+   return s == NULL ? NULL : s->node;
 }
 
 /* Looks up a VgHashNode by node in the table.  Returns NULL if not found.
@@ -176,10 +279,11 @@ void* VG_(HT_gen_lookup) ( const VgHashTable *table, const void* node,
                            HT_Cmp_t cmp )
 {
    const VgHashNode* hnode = node; // GEN!!!
-   VgHashNode* curr = table->chains[ CHAIN_NO(hnode->key, table) ]; // GEN!!!
+   HTSlot*     s    = find_slot(table, hnode->key); // GEN!!!
+   VgHashNode* curr = s == NULL ? NULL : s->node;
 
    while (curr) {
-      if (hnode->key == curr->key && cmp (hnode, curr) == 0) { // GEN!!!
+      if (cmp (hnode, curr) == 0) { // GEN!!!
          return curr;
       }
       curr = curr->next;
@@ -190,23 +294,21 @@ void* VG_(HT_gen_lookup) ( const VgHashTable *table, const void* node,
 /* Removes a VgHashNode from the table.  Returns NULL if not found. */
 void* VG_(HT_remove) ( VgHashTable *table, UWord key )
 {
-   UWord        chain         = CHAIN_NO(key, table);
-   VgHashNode*  curr          =   table->chains[chain];
-   VgHashNode** prev_next_ptr = &(table->chains[chain]);
+   HTSlot*     s;
+   VgHashNode* curr;
 
    /* Table has been modified; hence HT_Next should assert. */
    table->iterOK = False;
 
-   while (curr) {
-      if (key == curr->key) {
-         *prev_next_ptr = curr->next;
-         table->n_elements--;
-         return curr;
-      }
-      prev_next_ptr = &(curr->next);
-      curr = curr->next;
-   }
-   return NULL;
+   if (table->old_slots != NULL)
+      migrate(table, MIGRATE_STEP);
+
+   s = find_slot(table, key);
+   if (s == NULL)
+      return NULL;
+   curr = s->node;
+   unlink_node(table, s, &s->node, curr);
+   return curr;
 }
 
 /* Removes a VgHashNode by node from the table.  Returns NULL if not found.
@@ -214,17 +316,24 @@ void* VG_(HT_remove) ( VgHashTable *table, UWord key )
 void* VG_(HT_gen_remove) ( VgHashTable *table, const void* node, HT_Cmp_t cmp  )
 {
    const VgHashNode* hnode    = node; // GEN!!!
-   UWord        chain         = CHAIN_NO(hnode->key, table); // GEN!!!
-   VgHashNode*  curr          =   table->chains[chain];
-   VgHashNode** prev_next_ptr = &(table->chains[chain]);
+   HTSlot*      s;
+   VgHashNode*  curr;
+   VgHashNode** prev_next_ptr;
 
    /* Table has been modified; hence HT_Next should assert. */
    table->iterOK = False;
 
+   if (table->old_slots != NULL)
+      migrate(table, MIGRATE_STEP);
+
+   s = find_slot(table, hnode->key); // GEN!!!
+   if (s == NULL)
+      return NULL;
+   curr          = s->node;
+   prev_next_ptr = &s->node;
    while (curr) {
-      if (hnode->key == curr->key && cmp(hnode, curr) == 0) { // GEN!!!
-         *prev_next_ptr = curr->next;
-         table->n_elements--;
+      if (cmp(hnode, curr) == 0) { // GEN!!!
+         unlink_node(table, s, prev_next_ptr, curr);
          return curr;
       }
       prev_next_ptr = &(curr->next);
@@ -233,96 +342,126 @@ void* VG_(HT_gen_remove) ( VgHashTable *table, const void* node, HT_Cmp_t cmp  )
    return NULL;
 }
 
-void VG_(HT_print_stats) ( const VgHashTable *table, HT_Cmp_t cmp )
+/* Calls fn on each slot in use, old ones first. */
+static void for_each_slot ( const VgHashTable *table,
+                            void (*fn)(const VgHashTable*, const HTSlot*,
+                                       UWord probe_len, void*),
+                            void* opaque )
+{
+   UInt a, i;
+
+   for (a = 0; a < 2; a++) {
+      HTSlot* slots     = a == 0 ? table->old_slots : table->slots;
+      UInt    log2      = a == 0 ? table->old_log2_slots : table->log2_slots;
+      UWord   mask      = ((UWord)1 << log2) - 1;
+      if (slots == NULL)
+         continue;
+      for (i = 0; i <= mask; i++) {
+         if (slot_in_use(&slots[i]))
+            fn(table, &slots[i],
+               ((i - slot_no(slots[i].key, log2)) & mask) + 1, opaque);
+      }
+   }
+}
+
+#define MAXOCCUR 20
+
+typedef
+   struct {
+      UInt    elt_occurences[MAXOCCUR+1];
+      UInt    key_occurences[MAXOCCUR+1];
+      UInt    probe_occurences[MAXOCCUR+1];
+      HT_Cmp_t cmp;
+   }
+   HTStats;
+
+static void stats_for_slot ( const VgHashTable* table, const HTSlot* s,
+                             UWord probe_len, void* opaque )
 {
-   #define MAXOCCUR 20
-   UInt elt_occurences[MAXOCCUR+1];
-   UInt key_occurences[MAXOCCUR+1];
-   UInt cno_occurences[MAXOCCUR+1];
-   /* Key occurence  : how many ht elements have the same key.
-      elt_occurences : how many elements are inserted multiple time.
-      cno_occurences : how many chains have that length.
+   /* Key occurence    : how many ht elements have the same key.
+      elt_occurences   : how many elements are inserted multiple time.
+      probe_occurences : how many keys are that many probes away from
+                         their home slot.
       The last entry in these arrays collects all occurences >= MAXOCCUR. */
    #define INCOCCUR(occur,n) (n >= MAXOCCUR ? occur[MAXOCCUR]++ : occur[n]++)
-   UInt i;
-   UInt nkey, nelt, ncno;
+   HTStats*    st = opaque;
    VgHashNode *cnode, *node;
+   UInt        nkey = 0, nelt;
 
-   VG_(memset)(key_occurences, 0, sizeof(key_occurences));
-   VG_(memset)(elt_occurences, 0, sizeof(elt_occurences));
-   VG_(memset)(cno_occurences, 0, sizeof(cno_occurences));
+   INCOCCUR(st->probe_occurences, probe_len);
 
-   // Note that the below algorithm is quadractic in nr of elements in a chain
-   // but if that happens, the hash table/function is really bad and that
+   // Note that the below algorithm is quadractic in nr of elements with
+   // the same key, but if that happens, the keys are really bad and that
    // should be fixed.
-   for (i = 0; i < table->n_chains; i++) {
-      ncno = 0;
-      for (cnode = table->chains[i]; cnode != NULL; cnode = cnode->next) {
-         ncno++;
-
-         nkey = 0;
-         // Is the same cnode->key existing before cnode ?
-         for (node = table->chains[i]; node != cnode; node = node->next) {
-            if (node->key == cnode->key)
-               nkey++;
-         }
-         // If cnode->key not in a previous node, count occurences of key.
-         if (nkey == 0) {
-            for (node = cnode; node != NULL; node = node->next) {
-               if (node->key == cnode->key)
-                  nkey++;
-            }
-            INCOCCUR(key_occurences, nkey);
-         }
-
-         nelt = 0;
-         // Is the same cnode element existing before cnode ?
-         for (node = table->chains[i]; node != cnode; node = node->next) {
-            if (node->key == cnode->key
-                && (cmp == NULL || cmp (node, cnode) == 0)) {
+   for (cnode = s->node; cnode != NULL; cnode = cnode->next) {
+      nkey++;
+
+      nelt = 0;
+      // Is the same cnode element existing before cnode ?
+      for (node = s->node; node != cnode; node = node->next) {
+         if (st->cmp == NULL || st->cmp (node, cnode) == 0)
+            nelt++;
+      }
+      // If cnode element not in a previous node, count occurences of elt.
+      if (nelt == 0) {
+         for (node = cnode; node != NULL; node = node->next) {
+            if (st->cmp == NULL || st->cmp (node, cnode) == 0)
                nelt++;
-            }
-         }
-         // If cnode element not in a previous node, count occurences of elt.
-         if (nelt == 0) {
-            for (node = cnode; node != NULL; node = node->next) {
-               if (node->key == cnode->key
-                   && (cmp == NULL || cmp (node, cnode) == 0)) {
-                  nelt++;
-               }
-            }
-            INCOCCUR(elt_occurences, nelt);
          }
+         INCOCCUR(st->elt_occurences, nelt);
       }
-      INCOCCUR(cno_occurences, ncno);
    }
+   INCOCCUR(st->key_occurences, nkey);
+   #undef INCOCCUR
+}
+
+void VG_(HT_print_stats) ( const VgHashTable *table, HT_Cmp_t cmp )
+{
+   HTStats st;
+   UInt    i;
+   UInt    nkey, nelt;
+   ULong   nprobe;
+
+   VG_(memset)(&st, 0, sizeof(st));
+   st.cmp = cmp;
+   for_each_slot(table, stats_for_slot, &st);
 
    VG_(message)(Vg_DebugMsg, 
                 "nr occurences of"
-                " chains of len N,"
+                " probes of len N,"
                 " N-plicated keys,"
                 " N-plicated elts\n");
-   nkey = nelt = ncno = 0;
+   nkey = nelt = 0;
+   nprobe = 0;
    for (i = 0; i <= MAXOCCUR; i++) {
-      if (elt_occurences[i] > 0 
-          || key_occurences[i] > 0 
-          || cno_occurences[i] > 0)
+      if (st.elt_occurences[i] > 0 
+          || st.key_occurences[i] > 0 
+          || st.probe_occurences[i] > 0)
          VG_(message)(Vg_DebugMsg,
-                      "%s=%2u : nr chain %6u, nr keys %6u, nr elts %6u\n",
+                      "%s=%2u : nr probe %6u, nr keys %6u, nr elts %6u\n",
                       i == MAXOCCUR ? ">" : "N", i,
-                      cno_occurences[i], key_occurences[i], elt_occurences[i]);
-      nkey += key_occurences[i];
-      nelt += elt_occurences[i];
-      ncno += cno_occurences[i];
+                      st.probe_occurences[i], st.key_occurences[i],
+                      st.elt_occurences[i]);
+      nkey += st.key_occurences[i];
+      nelt += st.elt_occurences[i];
+      nprobe += (ULong)i * st.probe_occurences[i];
    }
    VG_(message)(Vg_DebugMsg, 
-                "total nr of unique   slots: %6u, keys %6u, elts %6u."
-                " Avg chain len %3.1f\n",
-                ncno, nkey, nelt,
-                (Double)nelt/(Double)(ncno == cno_occurences[0] ?
-                                      1 : ncno - cno_occurences[0]));
+                "total nr of slots: %6u, keys %6u, elts %6u."
+                " Avg probe len %3.1f\n",
+                1u << table->log2_slots, nkey, nelt,
+                (Double)nprobe/(Double)(nkey == 0 ? 1 : nkey));
 }
 
+static void add_to_array ( const VgHashTable* table, const HTSlot* s,
+                           UWord probe_len, void* opaque )
+{
+   VgHashNode*** next = opaque;
+   VgHashNode*   node;
+
+   for (node = s->node; node != NULL; node = node->next)
+      *(*next)++ = node;
+}
 
 /* Allocates a suitably-sized array, copies pointers to all the hashtable
    elements into it, then returns both the array and the size of it.  The
@@ -330,9 +469,8 @@ void VG_(HT_print_stats) ( const VgHashTable *table, HT_Cmp_t cmp )
 */
 VgHashNode** VG_(HT_to_array) (const VgHashTable *table, /*OUT*/ UInt* n_elems)
 {
-   UInt       i, j;
    VgHashNode** arr;
-   VgHashNode*  node;
+   VgHashNode** next;
 
    *n_elems = table->n_elements;
    if (*n_elems == 0)
@@ -340,13 +478,9 @@ VgHashNode** VG_(HT_to_array) (const VgHashTable *table, /*OUT*/ UInt* n_elems)
 
    arr = VG_(malloc)( "hashtable.Hta.1", *n_elems * sizeof(VgHashNode*) );
 
-   j = 0;
-   for (i = 0; i < table->n_chains; i++) {
-      for (node = table->chains[i]; node != NULL; node = node->next) {
-         arr[j++] = node;
-      }
-   }
-   vg_assert(j == *n_elems);
+   next = arr;
+   for_each_slot(table, add_to_array, &next);
+   vg_assert(next - arr == *n_elems);
 
    return arr;
 }
@@ -355,17 +489,18 @@ void VG_(HT_ResetIter)(VgHashTable *table)
 {
    vg_assert(table);
    table->iterNode  = NULL;
-   table->iterChain = 0;
+   table->iterArr   = 0;
+   table->iterSlot  = 0;
    table->iterOK    = True;
 }
 
 void* VG_(HT_Next)(VgHashTable *table)
 {
-   Int i;
    vg_assert(table);
    /* See long comment on HT_Next prototype in pub_tool_hashtable.h.
       In short if this fails, it means the caller tried to modify the
-      table whilst iterating over it, which is a bug. */
+      table whilst iterating over it, which is a bug.  Note that only
+      modifications migrate keys from old_slots to slots. */
    vg_assert(table->iterOK);
 
    if (table->iterNode && table->iterNode->next) {
@@ -373,11 +508,19 @@ void* VG_(HT_Next)(VgHashTable *table)
       return table->iterNode;
    }
 
-   for (i = table->iterChain; i < table->n_chains; i++) {
-      if (table->chains[i]) {
-         table->iterNode  = table->chains[i];
-         table->iterChain = i + 1;  // Next chain to be traversed
-         return table->iterNode;
+   for (; table->iterArr < 2; table->iterArr++, table->iterSlot = 0) {
+      HTSlot* slots = table->iterArr == 0 ? table->old_slots : table->slots;
+      UInt    n_slots;
+      if (slots == NULL)
+         continue;
+      n_slots = 1 << (table->iterArr == 0 ? table->old_log2_slots
+                                          : table->log2_slots);
+      while (table->iterSlot < n_slots) {
+         HTSlot* s = &slots[table->iterSlot++];
+         if (slot_in_use(s)) {
+            table->iterNode = s->node;
+            return table->iterNode;
+         }
       }
    }
    return NULL;
@@ -385,16 +528,24 @@ void* VG_(HT_Next)(VgHashTable *table)
 
 void VG_(HT_destruct)(VgHashTable *table, void(*freenode_fn)(void*))
 {
-   UInt       i;
+   UInt       a, i;
    VgHashNode *node, *node_next;
 
-   for (i = 0; i < table->n_chains; i++) {
-      for (node = table->chains[i]; node != NULL; node = node_next) {
-         node_next = node->next;
-         freenode_fn(node);
+   for (a = 0; a < 2; a++) {
+      HTSlot* slots = a == 0 ? table->old_slots : table->slots;
+      if (slots == NULL)
+         continue;
+      for (i = 0; i < 1 << (a == 0 ? table->old_log2_slots
+                                   : table->log2_slots); i++) {
+         if (!slot_in_use(&slots[i]))
+            continue;
+         for (node = slots[i].node; node != NULL; node = node_next) {
+            node_next = node->next;
+            freenode_fn(node);
+         }
       }
+      VG_(free)(slots);
    }
-   VG_(free)(table->chains);
    VG_(free)(table);
 }
 
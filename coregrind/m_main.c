@@ -66,6 +66,7 @@
 #include "pub_core_translate.h"     // For VG_(translate)
 #include "pub_core_trampoline.h"
 #include "pub_core_transtab.h"
+#include "pub_core_transcache.h"
 #include "pub_core_inner.h"
 #if defined(ENABLE_INNER_CLIENT_REQUEST)
 #include "pub_core_clreq.h"
@@ -165,6 +166,8 @@ static void usage_NORETURN ( Bool debug_help )
 "                              checks for self-modifying code: none, only for\n"
 "                              code found in stacks, for all code, or for all\n"
 "                              code except that from file-backed mappings\n"
+"    --smc-write-protect=no|yes  where possible, write-protect code covered\n"
+"                              by --smc-check instead of checking it [no]\n"
 "    --read-inline-info=yes|no read debug info about inlined function calls\n"
 "                              and use it to do better stack traces.  [yes]\n"
 "                              on Linux/Android/Solaris for Memcheck/Helgrind/DRD\n"
@@ -195,6 +198,10 @@ static void usage_NORETURN ( Bool debug_help )
 "           more sectors may increase performance, but use more memory.\n"
 "    --avg-transtab-entry-size=<number> avg size in bytes of a translated\n"
 "           basic block [0, meaning use tool provided default]\n"
+"    --trans-cache-file=<file> keep translations in <file> for reuse by\n"
+"           later runs with the same tool and options [none]\n"
+"    --translate-ahead=<number> translate up to <number> likely next blocks\n"
+"           whenever a thread blocks in a syscall [0]\n"
 "    --aspace-minaddr=0xPP     avoid mapping memory below 0xPP [guessed]\n"
 "    --valgrind-stacksize=<number> size of valgrind (host) thread's stack\n"
 "                               (in bytes) ["
@@ -692,6 +699,10 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
       else if VG_BINT_CLO(arg, "--num-transtab-sectors",
                                VG_(clo_num_transtab_sectors),
                                MIN_N_SECTORS, MAX_N_SECTORS) {}
+      else if VG_STR_CLO (arg, "--trans-cache-file",
+                               VG_(clo_trans_cache_file)) {}
+      else if VG_BINT_CLO(arg, "--translate-ahead",
+                               VG_(clo_translate_ahead), 0, 1000) {}
       else if VG_BINT_CLO(arg, "--avg-transtab-entry-size",
                                VG_(clo_avg_transtab_entry_size),
                                50, 5000) {}
@@ -707,6 +718,8 @@ void main_process_cmd_line_options ( /*OUT*/Bool* logging_to_fd,
                           VG_(clo_smc_check), Vg_SmcAll) {}
       else if VG_XACT_CLO(arg, "--smc-check=all-non-file",
                           VG_(clo_smc_check), Vg_SmcAllNonFile) {}
+      else if VG_BOOL_CLO(arg, "--smc-write-protect",
+                          VG_(clo_smc_write_protect)) {}
 
       else if VG_USETX_CLO (arg, "--kernel-variant",
                             "bproc,"
@@ -2154,6 +2167,14 @@ Int valgrind_main ( Int argc, HChar **argv, HChar **envp )
    VG_(debugLog)(1, "main", "Initialise TT/TC\n");
    VG_(init_tt_tc)();
 
+   //--------------------------------------------------------------
+   // Load the persistent translation cache, if requested
+   //   p: tl_post_clo_init [for VG_(needs).cacheable_translations]
+   //   p: setup_file_descriptors [for VG_(safe_fd)]
+   //--------------------------------------------------------------
+   VG_(debugLog)(1, "main", "Initialise persistent translation cache\n");
+   VG_(init_transcache)(toolname);
+
    //--------------------------------------------------------------
    // Initialise the redirect table.
    //   p: init_tt_tc [so it can call VG_(search_transtab) safely]
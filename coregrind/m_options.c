@@ -88,6 +88,7 @@ XArray *VG_(clo_suppressions);   // array of strings
 XArray *VG_(clo_fullpath_after); // array of strings
 const HChar* VG_(clo_extra_debuginfo_path) = NULL;
 const HChar* VG_(clo_debuginfo_server) = NULL;
+const HChar* VG_(clo_trans_cache_file) = NULL;
 Bool   VG_(clo_allow_mismatched_debuginfo) = False;
 UChar  VG_(clo_trace_flags)    = 0; // 00000000b
 Bool   VG_(clo_profyle_sbs)    = False;
@@ -135,6 +136,7 @@ Bool   VG_(clo_dsymutil)       = True;
 Bool   VG_(clo_sigill_diag)    = True;
 UInt   VG_(clo_unw_stack_scan_thresh) = 0; /* disabled by default */
 UInt   VG_(clo_unw_stack_scan_frames) = 5;
+UInt   VG_(clo_translate_ahead) = 0;
 
 // Set clo_smc_check so that it provides transparent self modifying
 // code support for "correct" programs at the smallest achievable
@@ -150,6 +152,8 @@ VgSmc VG_(clo_smc_check) = Vg_SmcStack;
 #  error "Unknown arch"
 #endif
 
+Bool  VG_(clo_smc_write_protect) = False;
+
 #if defined(VGO_darwin)
 UInt VG_(clo_resync_filter) = 1; /* enabled, but quiet */
 #else
@@ -489,7 +489,7 @@ static void os_state_clear(ThreadState *tst)
    tst->os_state.lwpid       = 0;
    tst->os_state.threadgroup = 0;
 #  if defined(VGO_linux)
-   /* no other fields to clear */
+   tst->os_state.robust_list = 0;
 #  elif defined(VGO_darwin)
    tst->os_state.post_mach_trap_fn = NULL;
    tst->os_state.pthread           = 0;
@@ -877,6 +877,10 @@ void run_thread_for_a_while ( /*OUT*/HWord* two_words,
    do_pre_run_checks( tst );
    /* end Paranoia */
 
+   /* Get rid of code from pages the core has written to since
+      generated code last ran (--smc-write-protect=yes). */
+   VG_(smc_wp_flush_pending)();
+
    /* Futz with the XIndir stats counters. */
    vg_assert(VG_(stats__n_xindirs_32) == 0);
    vg_assert(VG_(stats__n_xindir_misses_32) == 0);
@@ -1452,6 +1456,9 @@ VgSchedReturnCode VG_(scheduler) ( ThreadId tid )
       case VG_TRC_INNER_COUNTERZERO:
 	 /* Timeslice is out.  Let a new thread be scheduled. */
 	 vg_assert(dispatch_ctr == 0);
+         /* Where the thread is now tells the transtab which code is
+            hot. */
+         VG_(sample_transtab_use)( VG_(get_IP)(tid) );
 	 break;
 
       case VG_TRC_FAULT_SIGNAL:
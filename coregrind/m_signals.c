@@ -225,6 +225,7 @@
 #include "pub_core_syscall.h"
 #include "pub_core_syswrap.h"
 #include "pub_core_tooliface.h"
+#include "pub_core_translate.h"    // VG_(smc_wp_handle_write_fault)
 #include "pub_core_coredump.h"
 
 
@@ -2744,6 +2745,14 @@ void sync_signalhandler_from_kernel ( ThreadId tid,
       /* Stack extension occurred, so we don't need to do anything else; upon
          returning from this function, we'll restart the host (hence guest)
          instruction. */
+   } else if (info->si_signo == VKI_SIGSEGV
+              && info->si_code == VKI_SEGV_ACCERR
+              && VG_(smc_wp_handle_write_fault)(
+                    (Addr)info->VKI_SIGINFO_si_addr)) {
+      /* A write to a page that was write-protected because code had
+         been translated from it (--smc-write-protect=yes).  The
+         translations are gone and the page is writable again, so
+         likewise restart the instruction. */
    } else {
       /* OK, this is a signal we really have to deal with.  If it came
          from the client's code, then we can jump back into the scheduler
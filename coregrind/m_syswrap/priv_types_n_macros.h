@@ -33,6 +33,7 @@
 #define __PRIV_TYPES_N_MACROS_H
 
 #include "pub_core_basics.h"    // Addr
+#include "pub_core_translate.h" // VG_(smc_wp_*)
 
 /* requires #include "pub_core_options.h" */
 /* requires #include "pub_core_signals.h" */
@@ -621,8 +622,14 @@ static inline UWord getERR ( SyscallStatus* st ) {
 #define PRE_MEM_RASCIIZ(zzname, zzaddr) \
    VG_TRACK( pre_mem_read_asciiz, Vg_CoreSysCall, tid, zzname, zzaddr)
 
+/* The kernel's writes don't fault, they fail, so any write protection
+   added by --smc-write-protect=yes has to go first, and must stay off
+   until the syscall is done. */
 #define PRE_MEM_WRITE(zzname, zzaddr, zzlen) \
-   VG_TRACK( pre_mem_write, Vg_CoreSysCall, tid, zzname, zzaddr, zzlen)
+   do { \
+      VG_(smc_wp_unprotect_for_syscall)(tid, zzaddr, zzlen); \
+      VG_TRACK( pre_mem_write, Vg_CoreSysCall, tid, zzname, zzaddr, zzlen); \
+   } while (0)
 
 #define POST_MEM_WRITE(zzaddr, zzlen) \
    VG_TRACK( post_mem_write, Vg_CoreSysCall, tid, zzaddr, zzlen)
@@ -377,6 +377,7 @@ PRE(sys_clone)
          PRA5("clone", int *, child_tidptr);
       }
       PRE_MEM_WRITE("clone(child_tidptr)", ARG4, sizeof(Int));
+      VG_(smc_wp_never_protect)(ARG4, sizeof(Int));
       if (!VG_(am_is_valid_for_client)(ARG4, sizeof(Int), VKI_PROT_WRITE)) {
          SET_STATUS_Failure( VKI_EFAULT );
          return;
@@ -120,6 +120,40 @@ static VgSchedReturnCode thread_wrapper(Word /*ThreadId*/ tidW)
    clone-related stuff
    ------------------------------------------------------------------ */
 
+/* When the thread exits, the kernel marks the futexes on its robust
+   list as owner-dead, and does not care whether the writes succeed.
+   So take any --smc-write-protect=yes protection off them first.  The
+   list is client data and may be garbage, hence the limit and the
+   checks; anything missed only means a futex isn't updated, as
+   happens natively with a corrupted list. */
+static void smc_wp_robust_list ( ThreadState* tst )
+{
+   struct vki_robust_list_head* head;
+   Addr entry, futex;
+   Int  n;
+
+   if (!VG_(clo_smc_write_protect) || tst->os_state.robust_list == 0)
+      return;
+   head = (struct vki_robust_list_head*)tst->os_state.robust_list;
+   if (!VG_(am_is_valid_for_client)((Addr)head, sizeof(*head),
+                                    VKI_PROT_READ))
+      return;
+
+   entry = (Addr)head->list_op_pending;
+   if (entry != 0)
+      VG_(smc_wp_never_protect)(entry + head->futex_offset, sizeof(Int));
+
+   entry = (Addr)head->list.next;
+   for (n = 0; n < 2048 && entry != (Addr)&head->list; n++) {
+      if (!VG_(am_is_valid_for_client)(entry, sizeof(struct vki_robust_list),
+                                       VKI_PROT_READ))
+         break;
+      futex = entry + head->futex_offset;
+      VG_(smc_wp_never_protect)(futex, sizeof(Int));
+      entry = (Addr)((struct vki_robust_list*)entry)->next;
+   }
+}
+
 /* Run a thread all the way to the end, then do appropriate exit actions
    (this is the last-one-out-turn-off-the-lights bit).  */
 static void run_a_thread_NORETURN ( Word tidW )
@@ -206,6 +240,8 @@ static void run_a_thread_NORETURN ( Word tidW )
 
       /* OK, thread is dead, but others still exist.  Just exit. */
 
+      smc_wp_robust_list(tst);
+
       /* This releases the run lock */
       VG_(exit_thread)(tid);
       vg_assert(tst->status == VgTs_Zombie);
@@ -1253,6 +1289,10 @@ PRE(sys_set_robust_list)
       the thread exits so the current contents is irrelevant. */
    if (ARG1 != 0)
       PRE_MEM_READ("set_robust_list(head)", ARG1, ARG2);
+
+   /* Remember the list, so that the futexes on it can be kept writable
+      when the thread exits (see smc_wp_robust_list). */
+   VG_(get_ThreadState)(tid)->os_state.robust_list = ARG1;
 }
 
 PRE(sys_get_robust_list)
@@ -1627,6 +1667,11 @@ PRE(sys_set_tid_address)
 {
    PRINT("sys_set_tid_address ( %#lx )", ARG1);
    PRE_REG_READ1(long, "set_tid_address", int *, tidptr);
+
+   /* The kernel clears *tidptr when the thread exits, and wakes its
+      joiner, but only if the write succeeds. */
+   if (ARG1 != 0)
+      VG_(smc_wp_never_protect)(ARG1, sizeof(Int));
 }
 
 PRE(sys_tkill)
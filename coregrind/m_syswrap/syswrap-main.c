@@ -51,6 +51,7 @@
 #include "pub_core_mallocfree.h"
 #include "pub_core_syswrap.h"
 #include "pub_core_gdbserver.h"     // VG_(gdbserver_report_syscall)
+#include "pub_core_translate.h"     // VG_(translate_ahead), VG_(smc_wp_*)
 
 #include "priv_types_n_macros.h"
 #include "priv_syswrap-main.h"
@@ -423,6 +424,132 @@ Bool eq_SyscallArgs ( SyscallArgs* a1, SyscallArgs* a2 )
           && a1->arg8 == a2->arg8;
 }
 
+/* --smc-write-protect=yes: the kernel's writes to pages the core has
+   write-protected fail with EFAULT.  Those declared with PRE_MEM_WRITE
+   are taken care of by the macro; for other writes, guess that the
+   syscall args pointing into protected pages are written to. */
+static
+Bool smc_wp_unprotect_args ( ThreadId tid, SyscallArgs* args )
+{
+   UWord a[8];
+   a[0] = args->arg1; a[1] = args->arg2; a[2] = args->arg3;
+   a[3] = args->arg4; a[4] = args->arg5; a[5] = args->arg6;
+   a[6] = args->arg7; a[7] = args->arg8;
+   return VG_(smc_wp_unprotect_args)(tid, a, 8);
+}
+
+/* Syscalls which only return information, and whose pre-handlers have
+   no side effects, so that they can be issued again if the first
+   attempt failed with EFAULT.  For these, protected pages are only
+   unprotected (by smc_wp_unprotect_args) if the kernel really did try
+   to write to one. */
+static
+Bool smc_wp_may_restart ( Word sysno )
+{
+#  if defined(VGO_linux)
+   switch (sysno) {
+#     if defined(__NR_stat)
+      case __NR_stat:
+#     endif
+#     if defined(__NR_lstat)
+      case __NR_lstat:
+#     endif
+#     if defined(__NR_fstat)
+      case __NR_fstat:
+#     endif
+#     if defined(__NR_stat64)
+      case __NR_stat64:
+#     endif
+#     if defined(__NR_lstat64)
+      case __NR_lstat64:
+#     endif
+#     if defined(__NR_fstat64)
+      case __NR_fstat64:
+#     endif
+#     if defined(__NR_newfstatat)
+      case __NR_newfstatat:
+#     endif
+#     if defined(__NR_fstatat64)
+      case __NR_fstatat64:
+#     endif
+#     if defined(__NR_statfs)
+      case __NR_statfs:
+#     endif
+#     if defined(__NR_fstatfs)
+      case __NR_fstatfs:
+#     endif
+#     if defined(__NR_statfs64)
+      case __NR_statfs64:
+#     endif
+#     if defined(__NR_fstatfs64)
+      case __NR_fstatfs64:
+#     endif
+#     if defined(__NR_getcwd)
+      case __NR_getcwd:
+#     endif
+#     if defined(__NR_readlink)
+      case __NR_readlink:
+#     endif
+#     if defined(__NR_readlinkat)
+      case __NR_readlinkat:
+#     endif
+#     if defined(__NR_uname)
+      case __NR_uname:
+#     endif
+#     if defined(__NR_sysinfo)
+      case __NR_sysinfo:
+#     endif
+#     if defined(__NR_times)
+      case __NR_times:
+#     endif
+#     if defined(__NR_getrusage)
+      case __NR_getrusage:
+#     endif
+#     if defined(__NR_getrlimit)
+      case __NR_getrlimit:
+#     endif
+#     if defined(__NR_ugetrlimit)
+      case __NR_ugetrlimit:
+#     endif
+#     if defined(__NR_gettimeofday)
+      case __NR_gettimeofday:
+#     endif
+#     if defined(__NR_clock_gettime)
+      case __NR_clock_gettime:
+#     endif
+#     if defined(__NR_clock_getres)
+      case __NR_clock_getres:
+#     endif
+#     if defined(__NR_getresuid)
+      case __NR_getresuid:
+#     endif
+#     if defined(__NR_getresgid)
+      case __NR_getresgid:
+#     endif
+#     if defined(__NR_getgroups)
+      case __NR_getgroups:
+#     endif
+#     if defined(__NR_sched_getaffinity)
+      case __NR_sched_getaffinity:
+#     endif
+#     if defined(__NR_getsockname)
+      case __NR_getsockname:
+#     endif
+#     if defined(__NR_getpeername)
+      case __NR_getpeername:
+#     endif
+#     if defined(__NR_getsockopt)
+      case __NR_getsockopt:
+#     endif
+         return True;
+      default:
+         return False;
+   }
+#  else
+   return False;
+#  endif
+}
+
 static
 Bool eq_SyscallStatus ( UInt sysno, SyscallStatus* s1, SyscallStatus* s2 )
 {
@@ -1670,6 +1797,7 @@ typedef
       SyscallArgs   args;
       SyscallStatus status;
       UWord         flags;
+      Bool          smc_wp_retry;  /* restarted after an smc-wp EFAULT */
    }
    SyscallInfo;
 
@@ -1819,6 +1947,10 @@ void VG_(client_syscall) ( ThreadId tid, UInt trc )
    sci = & syscallInfo[tid];
    vg_assert(sci->status.what == SsIdle);
 
+   /* A previous syscall which never got to VG_(post_syscall) may
+      have left ranges marked as in use by the kernel. */
+   VG_(smc_wp_syscall_done)(tid);
+
    getSyscallArgsFromGuestState( &sci->orig_args, &tst->arch.vex, trc );
 
    /* Copy .orig_args to .args.  The pre-handler may modify .args, but
@@ -1971,6 +2103,16 @@ void VG_(client_syscall) ( ThreadId tid, UInt trc )
          and PostOnFail are ok. */
       vg_assert(0 == (sci->flags & ~(SfMayBlock | SfPostOnFail | SfPollAfter)));
 
+      /* Doing the syscall again would not be safe: the kernel may
+         have acted on it before failing to write the results, and
+         the pre-handler has already run.  So any page the kernel
+         might write must be writable beforehand.  The same goes for
+         a call restarted below, since its pages may have been
+         protected again in the meantime. */
+      if (!smc_wp_may_restart(sysno) || sci->smc_wp_retry)
+         (void)smc_wp_unprotect_args(tid, &sci->args);
+      sci->smc_wp_retry = False;
+
       if (sci->flags & SfMayBlock) {
 
          /* Syscall may block, so run it asynchronously */
@@ -1995,6 +2137,10 @@ void VG_(client_syscall) ( ThreadId tid, UInt trc )
             do_syscall_for_client() directly modifies the guest state. */
          vg_assert(!(sci->flags & SfNoWriteResult));
 
+         /* We may be about to sleep for a while, so now is a cheap
+            time to translate code we will probably need soon. */
+         VG_(translate_ahead)(tid);
+
          /* Drop the bigLock */
          VG_(release_BigLock)(tid, VgTs_WaitSys, "VG_(client_syscall)[async]");
          /* Urr.  We're now in a race against other threads trying to
@@ -2056,6 +2202,26 @@ void VG_(client_syscall) ( ThreadId tid, UInt trc )
            PRINT("[sync] --> %s", VG_(sr_as_string)(sci->status.sres));
          }
       }
+
+      /* With --smc-write-protect=yes, a syscall which can safely be
+         done again may have failed to write to a page protected by
+         the core that the pre-handler didn't declare with
+         PRE_MEM_WRITE.  If one of its args points into such a page,
+         unprotect it and restart the call, exactly as when a signal
+         arrives before it starts.  Otherwise the EFAULT is genuine,
+         and no protection is touched. */
+      if (sr_isError(sci->status.sres)
+          && sr_Err(sci->status.sres) == VKI_EFAULT
+          && smc_wp_may_restart(sysno)
+          && smc_wp_unprotect_args(tid, &sci->args)) {
+         PRINT(" --> [smc-wp] restarting\n");
+         sci->smc_wp_retry = True;
+         putSyscallArgsIntoGuestState( &sci->orig_args, &tst->arch.vex );
+         ML_(fixup_guest_state_to_restart_syscall)(&tst->arch);
+         VG_(smc_wp_syscall_done)(tid);
+         sci->status.what = SsIdle;
+         return;
+      }
    }
 
    vg_assert(sci->status.what == SsComplete);
@@ -2186,6 +2352,7 @@ void VG_(post_syscall) (ThreadId tid)
    /* The syscall is done. */
    vg_assert(sci->status.what == SsComplete);
    sci->status.what = SsIdle;
+   VG_(smc_wp_syscall_done)(tid);
 
    /* The pre/post wrappers may have concluded that pending signals
       might have been created, and will have set SfPollAfter to
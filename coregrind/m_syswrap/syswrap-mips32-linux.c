@@ -645,6 +645,7 @@ PRE (sys_clone)
             PRA5 ("clone", int *, child_tidptr);
           }
         PRE_MEM_WRITE ("clone(child_tidptr)", ARG5, sizeof (Int));
+        VG_(smc_wp_never_protect)(ARG5, sizeof(Int));
         if (!VG_ (am_is_valid_for_client)(ARG5, sizeof (Int), VKI_PROT_WRITE))
           {
             badarg = True;
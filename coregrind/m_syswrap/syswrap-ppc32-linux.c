@@ -552,6 +552,7 @@ PRE(sys_clone)
    }
    if (ARG1 & (VKI_CLONE_CHILD_SETTID | VKI_CLONE_CHILD_CLEARTID)) {
       PRE_MEM_WRITE("clone(child_tidptr)", ARG5, sizeof(Int));
+      VG_(smc_wp_never_protect)(ARG5, sizeof(Int));
       if (!VG_(am_is_valid_for_client)(ARG5, sizeof(Int), 
                                              VKI_PROT_WRITE)) {
          SET_STATUS_Failure( VKI_EFAULT );
@@ -517,6 +517,7 @@ PRE(sys_clone)
   }
   if (ARG1 & (VKI_CLONE_CHILD_SETTID | VKI_CLONE_CHILD_CLEARTID)) {
     PRE_MEM_WRITE("clone(child_tidptr)", ARG4, sizeof(Int));
+    VG_(smc_wp_never_protect)(ARG4, sizeof(Int));
     if (!VG_(am_is_valid_for_client)(ARG4, sizeof(Int), VKI_PROT_WRITE)) {
       SET_STATUS_Failure( VKI_EFAULT );
       return;
@@ -99,7 +99,9 @@ VgNeeds VG_(needs) = {
    .var_info	         = False,
    .malloc_replacement   = False,
    .xml_output           = False,
-   .final_IR_tidy_pass   = False
+   .final_IR_tidy_pass   = False,
+   .cacheable_translations = False,
+   .thread_safe_instrumentation = False
 };
 
 /* static */
@@ -220,6 +222,8 @@ NEEDS(libc_freeres)
 NEEDS(cxx_freeres)
 NEEDS(core_errors)
 NEEDS(var_info)
+NEEDS(cacheable_translations)
+NEEDS(thread_safe_instrumentation)
 
 void VG_(needs_superblock_discards)(
    void (*discard)(Addr, VexGuestExtents)
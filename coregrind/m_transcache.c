@@ -0,0 +1,590 @@
+
+/*--------------------------------------------------------------------*/
+/*--- Persistent translation cache.                 m_transcache.c ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   Copyright (C) 2000-2015 Julian Seward
+      jseward@acm.org
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#include "pub_core_basics.h"
+#include "pub_core_vki.h"
+#include "pub_core_libcbase.h"
+#include "pub_core_libcassert.h"
+#include "pub_core_libcfile.h"
+#include "pub_core_libcprint.h"
+#include "pub_core_libcproc.h"     // VG_(libdir)
+#include "pub_core_mallocfree.h"
+#include "pub_core_xarray.h"
+#include "pub_core_hashtable.h"
+#include "pub_core_clientstate.h"  // VG_(args_for_valgrind)
+#include "pub_core_machine.h"      // VG_(machine_get_VexArchInfo)
+#include "pub_core_options.h"
+#include "pub_core_tooliface.h"    // VG_(needs).cacheable_translations
+#include "pub_core_transcache.h"
+
+
+/*------------------------------------------------------------*/
+/*--- File format                                          ---*/
+/*------------------------------------------------------------*/
+
+/* The file is a TCFileHdr, followed by ctx_szB bytes of context
+   string, followed by any number of records.  Each record is a
+   TCRecHdr, then guest_szB bytes of guest code (the extents, in
+   order), then code_len bytes of host code, then padding up to
+   rec_szB.  All sizes are multiples of 8 so that headers stay
+   aligned when the file is read into memory.
+
+   The context string describes everything that the translations
+   depend on apart from the guest code itself: the Valgrind version,
+   the tool executable, the host CPU and all the Valgrind options.
+   If it differs from the current one, the whole file is discarded
+   and started afresh.
+
+   Records are only ever appended, so that several runs can share
+   a file.  A record that is found to be damaged or truncated on
+   loading terminates the load; anything after it is ignored. */
+
+#define TC_MAGIC    0x43544756  /* "VGTC" */
+#define TC_VERSION  1
+
+/* Refuse to load, and stop appending to, files larger than this. */
+#define TC_MAX_FILE_SZB  (256 * 1024 * 1024)
+
+/* Don't append more than this many records for one guest address.
+   Reaching this means the code at that address keeps changing, so
+   caching it is pointless. */
+#define TC_MAX_PER_KEY  4
+
+typedef
+   struct {
+      UInt magic;
+      UInt version;
+      UInt ctx_szB;   /* including padding */
+      UInt ctx_hash;
+   }
+   TCFileHdr;
+
+typedef
+   struct {
+      UInt  magic;
+      UInt  rec_szB;  /* total, including this header and padding */
+      ULong nraddr;
+      ULong addr;
+      ULong vge_base[3];
+      UInt  vge_len[3];
+      UInt  vge_n_used;
+      UInt  kind;
+      UInt  abi_hash;
+      UInt  sc_bitset;
+      UInt  pxControl;
+      UInt  n_guest_instrs;
+      UInt  code_len;
+      UInt  guest_szB;
+      UInt  checksum; /* adler32 of guest bytes then host code */
+   }
+   TCRecHdr;
+
+
+/*------------------------------------------------------------*/
+/*--- In-memory state                                      ---*/
+/*------------------------------------------------------------*/
+
+/* All records for one nraddr, most recently added first. */
+typedef
+   struct _TCRec {
+      struct _TCRec*  older;
+      const TCRecHdr* hdr;
+      Bool            verified; /* checksum already checked */
+   }
+   TCRec;
+
+typedef
+   struct _TCNode {
+      struct _TCNode* next;
+      UWord           key;      /* nraddr */
+      TCRec*          newest;
+      UInt            n_recs;
+   }
+   TCNode;
+
+static Bool         tc_enabled  = False;
+static Int          tc_fd       = -1;   /* for appending; -1 if read-only */
+static Long         tc_file_szB = 0;    /* current size of the file */
+static VgHashTable* tc_index    = NULL;
+
+/* Stats */
+static ULong n_tc_loaded   = 0;
+static ULong n_tc_lookups  = 0;
+static ULong n_tc_hits     = 0;
+static ULong n_tc_rejected = 0;  /* candidates failing a check */
+static ULong n_tc_added    = 0;
+
+
+static UInt round8 ( UInt n )
+{
+   return VG_ROUNDUP(n, 8);
+}
+
+static UInt guest_szB_of ( const VexGuestExtents* vge )
+{
+   UInt i, szB = 0;
+   for (i = 0; i < vge->n_used; i++)
+      szB += vge->len[i];
+   return szB;
+}
+
+static const UChar* guest_bytes_of ( const TCRecHdr* hdr )
+{
+   return (const UChar*)(hdr + 1);
+}
+
+static const UChar* code_of ( const TCRecHdr* hdr )
+{
+   return guest_bytes_of(hdr) + hdr->guest_szB;
+}
+
+static UInt checksum_of ( const TCRecHdr* hdr )
+{
+   UInt ck = VG_(adler32)(0, NULL, 0);
+   ck = VG_(adler32)(ck, guest_bytes_of(hdr), hdr->guest_szB);
+   ck = VG_(adler32)(ck, code_of(hdr), hdr->code_len);
+   return ck;
+}
+
+static void index_record ( const TCRecHdr* hdr )
+{
+   TCNode* node = VG_(HT_lookup)(tc_index, (UWord)hdr->nraddr);
+   TCRec*  rec  = VG_(malloc)("transcache.rec", sizeof(TCRec));
+   if (node == NULL) {
+      node = VG_(malloc)("transcache.node", sizeof(TCNode));
+      node->key    = (UWord)hdr->nraddr;
+      node->newest = NULL;
+      node->n_recs = 0;
+      VG_(HT_add_node)(tc_index, node);
+   }
+   rec->hdr      = hdr;
+   rec->verified = False;
+   rec->older    = node->newest;
+   node->newest  = rec;
+   node->n_recs++;
+}
+
+/* Structural checks on a record found in a file.  |avail| is the
+   number of bytes from the start of the record to the end of the
+   file.  The checksum is checked lazily, when the record is first
+   a candidate for a lookup. */
+static Bool record_looks_sane ( const TCRecHdr* hdr, Long avail )
+{
+   UInt i, szB;
+   if (avail < sizeof(TCRecHdr))
+      return False;
+   if (hdr->magic != TC_MAGIC)
+      return False;
+   if (hdr->vge_n_used < 1 || hdr->vge_n_used > 3)
+      return False;
+   if (hdr->code_len == 0 || hdr->code_len >= 65536)
+      return False;
+   szB = 0;
+   for (i = 0; i < hdr->vge_n_used; i++) {
+      if (hdr->vge_len[i] > 65535)
+         return False;
+      szB += hdr->vge_len[i];
+   }
+   if (szB != hdr->guest_szB)
+      return False;
+   if (hdr->rec_szB
+       != round8(sizeof(TCRecHdr) + hdr->guest_szB + hdr->code_len))
+      return False;
+   return hdr->rec_szB <= avail;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Setting up                                           ---*/
+/*------------------------------------------------------------*/
+
+/* Build the context string.  Returns NULL if the context cannot be
+   established, in which case the cache can't be used. */
+static HChar* make_context ( const HChar* toolname )
+{
+   VexArch        vex_arch;
+   VexArchInfo    vex_archinfo;
+   struct vg_stat st;
+   SysRes         sres;
+   Int            i;
+   XArray*        xa;
+   HChar*         res;
+   HChar          tool_path[VG_(strlen)(VG_(libdir)) + VG_(strlen)(toolname)
+                            + sizeof(VG_PLATFORM) + 3];
+
+   /* Host code contains absolute addresses of the tool's helper
+      functions, so the exact tool executable matters. */
+   VG_(sprintf)(tool_path, "%s/%s-%s", VG_(libdir), toolname, VG_PLATFORM);
+   sres = VG_(stat)(tool_path, &st);
+   if (sr_isError(sres))
+      return NULL;
+
+   VG_(machine_get_VexArchInfo)( &vex_arch, &vex_archinfo );
+
+   xa = VG_(newXA)(VG_(malloc), "transcache.ctx", VG_(free), sizeof(HChar));
+   VG_(xaprintf)(xa, "valgrind %s %s\n", VERSION, VG_PLATFORM);
+   VG_(xaprintf)(xa, "tool %s %llu %llu %lld %llu.%llu\n",
+                 tool_path, st.dev, st.ino, st.size, st.mtime, st.mtime_nsec);
+   VG_(xaprintf)(xa, "host %u 0x%x %u\n",
+                 (UInt)vex_arch, vex_archinfo.hwcaps,
+                 (UInt)vex_archinfo.endness);
+   for (i = 0; i < VG_(sizeXA)(VG_(args_for_valgrind)); i++) {
+      HChar* arg = *(HChar**)VG_(indexXA)(VG_(args_for_valgrind), i);
+      VG_(xaprintf)(xa, "arg %s\n", arg);
+   }
+   VG_(xaprintf)(xa, "%c", 0);
+   res = VG_(strdup)("transcache.ctx", (HChar*)VG_(indexXA)(xa, 0));
+   VG_(deleteXA)(xa);
+   return res;
+}
+
+/* Read all of fd into a freshly allocated buffer.  Returns NULL on
+   failure. */
+static UChar* read_whole_file ( Int fd, Long szB )
+{
+   UChar* buf = VG_(malloc)("transcache.file", szB > 0 ? szB : 1);
+   Long   done = 0;
+   while (done < szB) {
+      Int chunk = szB - done > 1024*1024 ? 1024*1024 : (Int)(szB - done);
+      Int n     = VG_(read)(fd, buf + done, chunk);
+      if (n <= 0) {
+         VG_(free)(buf);
+         return NULL;
+      }
+      done += n;
+   }
+   return buf;
+}
+
+/* Try to load an existing file.  Returns True if it exists and
+   belongs to this context, in which case its records are indexed
+   and tc_file_szB is set to the length of its valid prefix. */
+static Bool load_file ( const HChar* path, const HChar* ctx, UInt ctx_szB )
+{
+   struct vg_stat   st;
+   const TCFileHdr* fhdr;
+   UChar*           buf;
+   Long             off;
+   SysRes           sres = VG_(open)(path, VKI_O_RDONLY, 0);
+
+   if (sr_isError(sres))
+      return False;
+   if (VG_(fstat)(sr_Res(sres), &st) != 0
+       || st.size < sizeof(TCFileHdr) + ctx_szB
+       || st.size > TC_MAX_FILE_SZB) {
+      VG_(close)(sr_Res(sres));
+      return False;
+   }
+   buf = read_whole_file(sr_Res(sres), st.size);
+   VG_(close)(sr_Res(sres));
+   if (buf == NULL)
+      return False;
+
+   fhdr = (const TCFileHdr*)buf;
+   if (fhdr->magic != TC_MAGIC || fhdr->version != TC_VERSION
+       || fhdr->ctx_szB != ctx_szB
+       || fhdr->ctx_hash != VG_(adler32)(0, (const UChar*)ctx, ctx_szB)
+       || VG_(memcmp)(fhdr + 1, ctx, VG_(strlen)(ctx) + 1) != 0) {
+      VG_(free)(buf);
+      return False;
+   }
+
+   /* The buffer is never freed: records in it are referenced by the
+      index for the rest of the run. */
+   off = sizeof(TCFileHdr) + ctx_szB;
+   while (off < st.size) {
+      const TCRecHdr* hdr = (const TCRecHdr*)(buf + off);
+      if (!record_looks_sane(hdr, st.size - off))
+         break;
+      index_record(hdr);
+      n_tc_loaded++;
+      off += hdr->rec_szB;
+   }
+   tc_file_szB = off;
+   return True;
+}
+
+/* Create a new file containing just the header and context. */
+static Bool create_file ( const HChar* path, const HChar* ctx, UInt ctx_szB )
+{
+   TCFileHdr fhdr;
+   HChar     ctx_padded[ctx_szB];
+   SysRes    sres;
+   Int       fd;
+   Bool      ok;
+
+   VG_(unlink)(path);
+   sres = VG_(open)(path, VKI_O_CREAT|VKI_O_EXCL|VKI_O_WRONLY,
+                    VKI_S_IRUSR|VKI_S_IWUSR);
+   if (sr_isError(sres))
+      return False;
+   fd = sr_Res(sres);
+
+   VG_(memset)(ctx_padded, 0, ctx_szB);
+   VG_(strcpy)(ctx_padded, ctx);
+   fhdr.magic    = TC_MAGIC;
+   fhdr.version  = TC_VERSION;
+   fhdr.ctx_szB  = ctx_szB;
+   fhdr.ctx_hash = VG_(adler32)(0, (const UChar*)ctx_padded, ctx_szB);
+   ok = VG_(write)(fd, &fhdr, sizeof(fhdr)) == sizeof(fhdr)
+        && VG_(write)(fd, ctx_padded, ctx_szB) == ctx_szB;
+   VG_(close)(fd);
+   tc_file_szB = sizeof(fhdr) + ctx_szB;
+   return ok;
+}
+
+void VG_(init_transcache) ( const HChar* toolname )
+{
+   const HChar* path;
+   HChar*       ctx;
+   UInt         ctx_szB;
+   SysRes       sres;
+
+   vg_assert(!tc_enabled);
+   if (VG_(clo_trans_cache_file) == NULL)
+      return;
+
+   if (!VG_(needs).cacheable_translations) {
+      VG_(umsg)("Warning: tool '%s' does not support --trans-cache-file; "
+                "option ignored\n", toolname);
+      return;
+   }
+
+   path = VG_(expand_file_name)("--trans-cache-file",
+                                VG_(clo_trans_cache_file));
+   ctx  = make_context(toolname);
+   if (ctx == NULL) {
+      VG_(umsg)("Warning: cannot identify the tool executable; "
+                "--trans-cache-file ignored\n");
+      return;
+   }
+   ctx_szB  = round8(VG_(strlen)(ctx) + 1);
+   tc_index = VG_(HT_construct)("transcache.index");
+
+   /* load_file compares against the padded context, which is what
+      create_file writes out. */
+   { HChar ctx_padded[ctx_szB];
+     VG_(memset)(ctx_padded, 0, ctx_szB);
+     VG_(strcpy)(ctx_padded, ctx);
+     if (!load_file(path, ctx_padded, ctx_szB)
+         && !create_file(path, ctx_padded, ctx_szB)
+         /* Maybe another process created it in the meantime. */
+         && !load_file(path, ctx_padded, ctx_szB)) {
+        VG_(umsg)("Warning: cannot use translation cache file '%s'\n",
+                  path);
+        VG_(free)(ctx);
+        return;
+     }
+   }
+   VG_(free)(ctx);
+
+   /* If some other run has appended a damaged record, or the file is
+      full, don't make things worse: just use what we have. */
+   {  struct vg_stat st;
+      sres = VG_(open)(path, VKI_O_WRONLY|VKI_O_APPEND, 0);
+      if (!sr_isError(sres)) {
+         tc_fd = VG_(safe_fd)(sr_Res(sres));
+         if (VG_(fstat)(tc_fd, &st) != 0 || st.size != tc_file_szB
+             || st.size >= TC_MAX_FILE_SZB) {
+            VG_(close)(tc_fd);
+            tc_fd = -1;
+         }
+      }
+   }
+
+   tc_enabled = True;
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg,
+                   "translation cache: %s, %llu translations loaded%s\n",
+                   path, n_tc_loaded, tc_fd == -1 ? " (read-only)" : "");
+}
+
+Bool VG_(transcache_enabled) ( void )
+{
+   return tc_enabled;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Lookup and insertion                                 ---*/
+/*------------------------------------------------------------*/
+
+static void entry_from_hdr ( /*OUT*/TransCacheEntry* e, const TCRecHdr* hdr )
+{
+   UInt i;
+   e->nraddr     = (Addr)hdr->nraddr;
+   e->addr       = (Addr)hdr->addr;
+   e->vge.n_used = hdr->vge_n_used;
+   for (i = 0; i < 3; i++) {
+      e->vge.base[i] = (Addr)hdr->vge_base[i];
+      e->vge.len[i]  = (UShort)hdr->vge_len[i];
+   }
+   e->kind           = hdr->kind;
+   e->abi_hash       = hdr->abi_hash;
+   e->sc_bitset      = hdr->sc_bitset;
+   e->pxControl      = hdr->pxControl;
+   e->n_guest_instrs = hdr->n_guest_instrs;
+   e->code_len       = hdr->code_len;
+   e->code           = code_of(hdr);
+}
+
+static Bool guest_bytes_match ( const TCRecHdr* hdr )
+{
+   const UChar* saved = guest_bytes_of(hdr);
+   UInt i;
+   for (i = 0; i < hdr->vge_n_used; i++) {
+      if (VG_(memcmp)(saved, (const void*)(Addr)hdr->vge_base[i],
+                      hdr->vge_len[i]) != 0)
+         return False;
+      saved += hdr->vge_len[i];
+   }
+   return True;
+}
+
+Bool VG_(search_transcache) ( /*OUT*/TransCacheEntry* res,
+                              Addr nraddr, Addr addr,
+                              Bool (*acceptable)( const TransCacheEntry*,
+                                                  void* ),
+                              void* opaque )
+{
+   TCNode* node;
+   TCRec*  rec;
+
+   vg_assert(tc_enabled);
+   n_tc_lookups++;
+   node = VG_(HT_lookup)(tc_index, nraddr);
+   if (node == NULL)
+      return False;
+
+   for (rec = node->newest; rec != NULL; rec = rec->older) {
+      const TCRecHdr* hdr = rec->hdr;
+      if ((Addr)hdr->addr != addr)
+         continue;
+      if (!rec->verified) {
+         if (checksum_of(hdr) != hdr->checksum) {
+            n_tc_rejected++;
+            continue;
+         }
+         rec->verified = True;
+      }
+      entry_from_hdr(res, hdr);
+      /* |acceptable| checks the extents are mapped, so it must come
+         before looking at guest memory. */
+      if (!acceptable(res, opaque) || !guest_bytes_match(hdr)) {
+         n_tc_rejected++;
+         continue;
+      }
+      n_tc_hits++;
+      return True;
+   }
+   return False;
+}
+
+void VG_(add_to_transcache) ( const TransCacheEntry* e )
+{
+   UInt      guest_szB, rec_szB, i;
+   TCRecHdr* hdr;
+   UChar*    p;
+   TCNode*   node;
+
+   vg_assert(tc_enabled);
+   if (tc_fd == -1)
+      return;
+
+   node = VG_(HT_lookup)(tc_index, e->nraddr);
+   if (node != NULL && node->n_recs >= TC_MAX_PER_KEY)
+      return;
+
+   guest_szB = guest_szB_of(&e->vge);
+   rec_szB   = round8(sizeof(TCRecHdr) + guest_szB + e->code_len);
+   if (tc_file_szB + rec_szB > TC_MAX_FILE_SZB)
+      return;
+
+   /* The record is kept, so that a later retranslation of the same
+      code in this run can use it too. */
+   hdr = VG_(malloc)("transcache.newrec", rec_szB);
+   VG_(memset)(hdr, 0, rec_szB);
+   hdr->magic      = TC_MAGIC;
+   hdr->rec_szB    = rec_szB;
+   hdr->nraddr     = e->nraddr;
+   hdr->addr       = e->addr;
+   hdr->vge_n_used = e->vge.n_used;
+   for (i = 0; i < e->vge.n_used; i++) {
+      hdr->vge_base[i] = e->vge.base[i];
+      hdr->vge_len[i]  = e->vge.len[i];
+   }
+   hdr->kind           = e->kind;
+   hdr->abi_hash       = e->abi_hash;
+   hdr->sc_bitset      = e->sc_bitset;
+   hdr->pxControl      = e->pxControl;
+   hdr->n_guest_instrs = e->n_guest_instrs;
+   hdr->code_len       = e->code_len;
+   hdr->guest_szB      = guest_szB;
+
+   p = (UChar*)(hdr + 1);
+   for (i = 0; i < e->vge.n_used; i++) {
+      VG_(memcpy)(p, (const void*)e->vge.base[i], e->vge.len[i]);
+      p += e->vge.len[i];
+   }
+   VG_(memcpy)(p, e->code, e->code_len);
+   hdr->checksum = checksum_of(hdr);
+
+   /* One write per record, so that concurrent appenders using
+      O_APPEND don't interleave.  If anything goes wrong, stop
+      writing: a short record at the end just stops the next load
+      there. */
+   if (VG_(write)(tc_fd, hdr, rec_szB) != rec_szB) {
+      VG_(close)(tc_fd);
+      tc_fd = -1;
+      VG_(free)(hdr);
+      return;
+   }
+   tc_file_szB += rec_szB;
+
+   index_record(hdr);
+   n_tc_added++;
+}
+
+void VG_(print_transcache_stats) ( void )
+{
+   if (!tc_enabled)
+      return;
+   VG_(message)(Vg_DebugMsg,
+                "transcache: %'llu loaded, %'llu added%s\n",
+                n_tc_loaded, n_tc_added,
+                tc_fd == -1 ? " (not writing)" : "");
+   VG_(message)(Vg_DebugMsg,
+                "transcache: %'llu lookups, %'llu hits, %'llu rejected\n",
+                n_tc_lookups, n_tc_hits, n_tc_rejected);
+}
+
+/*--------------------------------------------------------------------*/
+/*--- end                                           m_transcache.c ---*/
+/*--------------------------------------------------------------------*/
@@ -39,7 +39,12 @@
 #include "pub_core_libcbase.h"
 #include "pub_core_libcassert.h"
 #include "pub_core_libcprint.h"
+#include "pub_core_libcproc.h"     // VG_(read_millisecond_timer)
+#include "pub_core_mallocfree.h"
 #include "pub_core_options.h"
+#include "pub_core_oset.h"
+#include "pub_core_xarray.h"
+#include "pub_core_scheduler.h"    // VG_(in_generated_code)
 
 #include "pub_core_debuginfo.h"  // VG_(get_fnname_w_offset)
 #include "pub_core_redir.h"      // VG_(redir_do_lookup)
@@ -50,6 +55,7 @@
 
 #include "pub_core_translate.h"
 #include "pub_core_transtab.h"
+#include "pub_core_transcache.h"
 #include "pub_core_dispatch.h" // VG_(run_innerloop__dispatch_{un}profiled)
                                // VG_(run_a_noredir_translation__return_point)
 
@@ -67,6 +73,7 @@
 /*------------------------------------------------------------*/
 
 static ULong n_SP_updates_fast            = 0;
+static ULong n_SP_updates_known_len       = 0;
 static ULong n_SP_updates_generic_known   = 0;
 static ULong n_SP_updates_generic_unknown = 0;
 
@@ -75,9 +82,22 @@ static ULong n_PX_VexRegUpdUnwindregsAtMemAccess = 0;
 static ULong n_PX_VexRegUpdAllregsAtMemAccess    = 0;
 static ULong n_PX_VexRegUpdAllregsAtEachInsn     = 0;
 
+static ULong n_smc_wp_extents  = 0;
+static ULong n_smc_wp_faults   = 0;
+static ULong n_smc_wp_deferred = 0;  /* faults from core code */
+static ULong n_smc_wp_syscall  = 0;
+static ULong n_smc_wp_hot      = 0;
+static ULong n_smc_wp_args     = 0;  /* VG_(smc_wp_unprotect_args) */
+
+static ULong n_ahead_noted   = 0;
+static ULong n_ahead_done    = 0;
+static ULong n_ahead_skipped = 0;
+static ULong n_ahead_busy    = 0;  /* calls skipped, others ready */
+
 void VG_(print_translation_stats) ( void )
 {
-   UInt n_SP_updates = n_SP_updates_fast + n_SP_updates_generic_known
+   UInt n_SP_updates = n_SP_updates_fast + n_SP_updates_known_len
+                                         + n_SP_updates_generic_known
                                          + n_SP_updates_generic_unknown;
    if (n_SP_updates == 0) {
       VG_(message)(Vg_DebugMsg, "translate: no SP updates identified\n");
@@ -86,6 +106,11 @@ void VG_(print_translation_stats) ( void )
          "translate:            fast SP updates identified: %'llu (%3.1f%%)\n",
          n_SP_updates_fast, n_SP_updates_fast * 100.0 / n_SP_updates );
 
+      VG_(message)(Vg_DebugMsg,
+         "translate:       known_len SP updates identified: %'llu (%3.1f%%)\n",
+         n_SP_updates_known_len,
+         n_SP_updates_known_len * 100.0 / n_SP_updates );
+
       VG_(message)(Vg_DebugMsg,
          "translate:   generic_known SP updates identified: %'llu (%3.1f%%)\n",
          n_SP_updates_generic_known,
@@ -99,6 +124,23 @@ void VG_(print_translation_stats) ( void )
 
    VG_(message)(Vg_DebugMsg,
                 "translate: PX: SPonly %'llu,  UnwRegs %'llu,  AllRegs %'llu,  AllRegsAllInsns %'llu\n", n_PX_VexRegUpdSpAtMemAccess, n_PX_VexRegUpdUnwindregsAtMemAccess, n_PX_VexRegUpdAllregsAtMemAccess, n_PX_VexRegUpdAllregsAtEachInsn);
+
+   if (VG_(clo_smc_write_protect))
+      VG_(message)(Vg_DebugMsg,
+                   "translate: smc-wp: %'llu extents protected, "
+                   "%'llu write faults (%'llu deferred), "
+                   "%'llu syscall unprotects (%'llu by arg), "
+                   "%'llu hot pages\n",
+                   n_smc_wp_extents, n_smc_wp_faults, n_smc_wp_deferred,
+                   n_smc_wp_syscall, n_smc_wp_args, n_smc_wp_hot);
+
+   if (VG_(clo_translate_ahead) > 0)
+      VG_(message)(Vg_DebugMsg,
+                   "translate: ahead: %'llu successors noted, "
+                   "%'llu translated, %'llu skipped, "
+                   "%'llu calls while busy\n",
+                   n_ahead_noted, n_ahead_done, n_ahead_skipped,
+                   n_ahead_busy);
 }
 
 /*------------------------------------------------------------*/
@@ -249,6 +291,146 @@ IRSB* tool_instrument_then_gdbserver_if_needed ( VgCallbackClosure* closureV,
        hWordTy);                                   
 }
 
+/*------------------------------------------------------------*/
+/*--- Translating ahead                                    ---*/
+/*------------------------------------------------------------*/
+
+/* With --translate-ahead=N, the constant successors (branch targets
+   and fall-through) of each superblock translated on demand are
+   remembered, and up to N of them are translated when a thread is
+   about to block in a syscall.  Only the most recent N_AHEAD
+   successors are kept; older ones are less likely to be wanted soon.
+
+   This happens with the BigLock held, so it is only done when no
+   other thread is ready to run -- the process would otherwise be
+   idle -- and it stops after AHEAD_BUDGET_MS, so that a thread whose
+   syscall completes meanwhile isn't kept waiting for the lock for
+   long. */
+
+#define N_AHEAD 64
+
+static Addr ahead_queue[N_AHEAD];
+static UInt ahead_used = 0;  /* number of valid entries */
+static UInt ahead_next = 0;  /* slot to write the next entry into */
+
+/* True while VG_(translate_ahead) is running, so as not to note the
+   successors of speculative translations. */
+static Bool translating_ahead = False;
+
+/* Don't translate ahead within this many bytes of the end of a
+   segment.  Vex would read past the end of the segment if the block
+   runs into it, and unlike a demand translation, nothing guarantees
+   that the code is really there. */
+#define AHEAD_SEG_SLACK_SZB 1024
+
+/* How long one call to VG_(translate_ahead) may take. */
+#define AHEAD_BUDGET_MS 2
+
+/* The instrumentation function note_successors_then_instrument
+   hands on to. */
+static IRSB* (*instrument_after_noting) ( VgCallbackClosure*,
+                                          IRSB*,
+                                          const VexGuestLayout*,
+                                          const VexGuestExtents*,
+                                          const VexArchInfo*,
+                                          IRType, IRType ) = NULL;
+
+static void note_successor ( const IRConst* dst )
+{
+   Addr a;
+   switch (dst->tag) {
+      case Ico_U32: a = (Addr)dst->Ico.U32; break;
+      case Ico_U64: a = (Addr)dst->Ico.U64; break;
+      default:      return;
+   }
+   ahead_queue[ahead_next] = a;
+   ahead_next = (ahead_next + 1) % N_AHEAD;
+   if (ahead_used < N_AHEAD)
+      ahead_used++;
+   n_ahead_noted++;
+}
+
+static
+IRSB* note_successors_then_instrument ( VgCallbackClosure* closureV,
+                                        IRSB*              sb_in,
+                                        const VexGuestLayout*  layout,
+                                        const VexGuestExtents* vge,
+                                        const VexArchInfo*     vai,
+                                        IRType             gWordTy,
+                                        IRType             hWordTy )
+{
+   Int i;
+   if (!translating_ahead) {
+      for (i = 0; i < sb_in->stmts_used; i++) {
+         const IRStmt* st = sb_in->stmts[i];
+         if (st->tag == Ist_Exit && st->Ist.Exit.jk == Ijk_Boring)
+            note_successor(st->Ist.Exit.dst);
+      }
+      if (sb_in->next->tag == Iex_Const
+          && (sb_in->jumpkind == Ijk_Boring || sb_in->jumpkind == Ijk_Call))
+         note_successor(sb_in->next->Iex.Const.con);
+   }
+   return instrument_after_noting(closureV, sb_in, layout, vge, vai,
+                                  gWordTy, hWordTy);
+}
+
+/* Is any thread other than |tid| waiting to run? */
+static Bool other_threads_ready ( ThreadId tid )
+{
+   ThreadId i;
+   for (i = 1; i < VG_N_THREADS; i++) {
+      if (i != tid && (VG_(threads)[i].status == VgTs_Runnable
+                       || VG_(threads)[i].status == VgTs_Yielding))
+         return True;
+   }
+   return False;
+}
+
+void VG_(translate_ahead) ( ThreadId tid )
+{
+   UInt n_done = 0;
+   UInt start_ms;
+
+   if (VG_(clo_translate_ahead) == 0 || ahead_used == 0)
+      return;
+   if (other_threads_ready(tid)) {
+      n_ahead_busy++;
+      return;
+   }
+
+   start_ms = VG_(read_millisecond_timer)();
+   translating_ahead = True;
+   while (ahead_used > 0 && n_done < VG_(clo_translate_ahead)) {
+      Addr            a;
+      NSegment const* seg;
+
+      /* Most recent first. */
+      ahead_next = (ahead_next + N_AHEAD - 1) % N_AHEAD;
+      ahead_used--;
+      a   = ahead_queue[ahead_next];
+      seg = VG_(am_find_nsegment)(a);
+
+      /* Only ever look at code in mapped, executable files: that is
+         where most code lives, and reading it can't fault. */
+      if (seg == NULL || seg->kind != SkFileC || !seg->hasX
+          || a + AHEAD_SEG_SLACK_SZB > seg->end
+          || a == TRANSTAB_BOGUS_GUEST_ADDR
+          || VG_(search_transtab)(NULL, NULL, NULL, a, False)) {
+         n_ahead_skipped++;
+         continue;
+      }
+
+      /* bbs_done is only used for tracing. */
+      if (VG_(translate)(tid, a, /*debug*/False, 0/*not verbose*/,
+                         0/*bbs_done*/, True/*allow redirection*/))
+         n_done++;
+      if (VG_(read_millisecond_timer)() - start_ms >= AHEAD_BUDGET_MS)
+         break;
+   }
+   translating_ahead = False;
+   n_ahead_done += n_done;
+}
+
 /* For tools that want to know about SP changes, this pass adds
    in the appropriate hooks.  We have to do it after the tool's
    instrumentation, so the tool doesn't have to worry about the C calls
@@ -267,6 +449,86 @@ IRSB* tool_instrument_then_gdbserver_if_needed ( VgCallbackClosure* closureV,
    There is some extra complexity to deal correctly with updates to
    only parts of SP.  Bizarre, but it has been known to happen.
 */
+
+/* For a change of SP by a known constant, to new_SP, that there is no
+   specialised handler for: call the tool's new_mem_stack or
+   die_mem_stack directly, with the length as a constant.  This avoids
+   the checks VG_(unknown_SP_update) does to detect stack switches,
+   which no change of at most --max-stackframe bytes can be.  Returns
+   False if the tool doesn't track such changes or the change is too
+   big, in which case the caller falls back to the generic case. */
+static Bool known_SP_update ( IRSB* bb, const VexGuestLayout* layout,
+                              IRTemp new_SP, Long delta,
+                              Bool curr_IP_known, Addr curr_IP )
+{
+   IRType   typeof_SP = layout->sizeof_SP == 4 ? Ity_I32 : Ity_I64;
+   IRDirty* dcall;
+
+   if (delta < -VG_(clo_max_stackframe) || VG_(clo_max_stackframe) < delta)
+      return False;
+
+   if (delta < 0) {
+      /* new_mem_stack(new_SP, -delta) */
+      vg_assert(curr_IP_known);
+      if (NULL != VG_(tdict).track_new_mem_stack_w_ECU)
+         dcall = unsafeIRDirty_0_N(
+                    0/*regparms*/,
+                    "track_new_mem_stack_w_ECU",
+                    VG_(fnptr_to_fnentry)(
+                       VG_(tdict).track_new_mem_stack_w_ECU ),
+                    mkIRExprVec_3( IRExpr_RdTmp(new_SP),
+                                   mkIRExpr_HWord( (HWord)(-delta) ),
+                                   mk_ecu_Expr(curr_IP) )
+                 );
+      else if (NULL != VG_(tdict).track_new_mem_stack)
+         dcall = unsafeIRDirty_0_N(
+                    0/*regparms*/,
+                    "track_new_mem_stack",
+                    VG_(fnptr_to_fnentry)( VG_(tdict).track_new_mem_stack ),
+                    mkIRExprVec_2( IRExpr_RdTmp(new_SP),
+                                   mkIRExpr_HWord( (HWord)(-delta) ) )
+                 );
+      else
+         return False;
+   } else {
+      /* die_mem_stack(old_SP, delta), where old_SP = new_SP - delta */
+      IRTemp old_SP;
+      vg_assert(delta > 0);
+      if (NULL == VG_(tdict).track_die_mem_stack)
+         return False;
+      old_SP = newIRTemp(bb->tyenv, typeof_SP);
+      addStmtToIRSB(
+         bb,
+         IRStmt_WrTmp( old_SP,
+                       typeof_SP == Ity_I32
+                          ? IRExpr_Binop( Iop_Sub32, IRExpr_RdTmp(new_SP),
+                                          IRExpr_Const(IRConst_U32(delta)) )
+                          : IRExpr_Binop( Iop_Sub64, IRExpr_RdTmp(new_SP),
+                                          IRExpr_Const(IRConst_U64(delta)) ))
+      );
+      dcall = unsafeIRDirty_0_N(
+                 0/*regparms*/,
+                 "track_die_mem_stack",
+                 VG_(fnptr_to_fnentry)( VG_(tdict).track_die_mem_stack ),
+                 mkIRExprVec_2( IRExpr_RdTmp(old_SP),
+                                mkIRExpr_HWord( (HWord)delta ) )
+              );
+   }
+
+   /* As with the specialised handlers, say that the call reads SP. */
+   dcall->nFxState = 1;
+   dcall->fxState[0].fx        = Ifx_Read;
+   dcall->fxState[0].offset    = layout->offset_SP;
+   dcall->fxState[0].size      = layout->sizeof_SP;
+   dcall->fxState[0].nRepeats  = 0;
+   dcall->fxState[0].repeatLen = 0;
+
+   addStmtToIRSB( bb, IRStmt_Dirty(dcall) );
+   update_SP_aliases(-delta);
+   n_SP_updates_known_len++;
+   return True;
+}
+
 static
 IRSB* vg_SP_update_pass ( void*             closureV,
                           IRSB*             sb_in, 
@@ -499,6 +761,11 @@ IRSB* vg_SP_update_pass ( void*             closureV,
             case -160: DO_NEW( 160, tttmp); addStmtToIRSB(bb,st); continue;
             default:  
                /* common values for ppc64: 144 128 160 112 176 */
+               if (known_SP_update(bb, layout, tttmp, delta,
+                                   curr_IP_known, curr_IP)) {
+                  addStmtToIRSB(bb,st);
+                  continue;
+               }
                n_SP_updates_generic_known++;
                goto generic;
          }
@@ -780,14 +1047,322 @@ static Bool translations_allowable_from_seg ( NSegment const* seg, Addr addr )
 }
 
 
+/* --smc-write-protect=yes: instead of giving an extent a self-check,
+   take write access to its pages away from the client (see
+   VG_(am_set_client_WP)).  Unmodified code then runs with no checking
+   at all.  A write to one of the pages faults, and
+   VG_(smc_wp_handle_write_fault) discards the page's translations,
+   gives write access back, and restarts the write.
+
+   Only private anonymous memory is protected.  Writes to a shared
+   mapping can come through some other mapping, possibly in another
+   process, and never fault here; such code keeps its self-checks.
+
+   Code that gets written often, in particular code on the stack,
+   would fault all the time.  So a page which has faulted
+   SMC_WP_MAX_FAULTS times is considered hot and is not protected
+   again; its code gets self-checks as usual.  The fault counts are
+   kept in a small direct-mapped table; losing one just means a page
+   takes a few more faults before it is recognised as hot.
+
+   The kernel's writes don't fault, they fail, so pages the kernel
+   may write are left alone:
+
+   - Syscall buffers declared with PRE_MEM_WRITE are unprotected
+     before the call, and stay unprotected until it is done (it may
+     block, and other threads may translate code meanwhile).  These
+     ranges are kept in smc_wp_busy.
+
+   - Words the kernel writes at some later time, and whose failure
+     it ignores (the CLONE_CHILD_CLEARTID word, robust futexes), are
+     never protected.  Their pages are kept in smc_wp_never.
+
+   - Other writes, those the syscall wrappers don't declare, can
+     only be guessed at: a syscall argument pointing into a protected
+     page (VG_(smc_wp_unprotect_args)).  VG_(client_syscall)
+     unprotects such pages before the call, or, for a few syscalls
+     that can safely be done twice, only if the call fails with
+     EFAULT, and then restarts it.  A write through a pointer the
+     wrapper doesn't know about still fails. */
+
+#define SMC_WP_MAX_FAULTS  4
+#define N_SMC_WP_PAGES     4096   /* must be a power of 2 */
+
+typedef
+   struct {
+      Addr page;
+      UInt n_faults;
+   }
+   SmcWpPage;
+
+static SmcWpPage smc_wp_pages[N_SMC_WP_PAGES];
+
+typedef
+   struct {
+      ThreadId tid;
+      Addr     lo;   /* first page */
+      Addr     hi;   /* last page */
+   }
+   SmcWpBusy;
+
+static XArray* smc_wp_busy  = NULL;   /* of SmcWpBusy */
+static OSet*   smc_wp_never = NULL;   /* of page addresses */
+
+static SmcWpPage* smc_wp_page_info ( Addr page )
+{
+   return &smc_wp_pages[(page / VKI_PAGE_SIZE) & (N_SMC_WP_PAGES-1)];
+}
+
+/* Must PAGE be left unprotected? */
+static Bool smc_wp_page_excluded ( Addr page )
+{
+   SmcWpPage* pg = smc_wp_page_info(page);
+   Word       i, n;
+
+   if (pg->page == page && pg->n_faults >= SMC_WP_MAX_FAULTS)
+      return True;
+   if (smc_wp_never != NULL && VG_(OSetWord_Contains)(smc_wp_never, page))
+      return True;
+   n = smc_wp_busy == NULL ? 0 : VG_(sizeXA)(smc_wp_busy);
+   for (i = 0; i < n; i++) {
+      SmcWpBusy* b = VG_(indexXA)(smc_wp_busy, i);
+      if (page >= b->lo && page <= b->hi)
+         return True;
+   }
+   return False;
+}
+
+/* Could START .. START+LEN-1 be write-protected?  Only looks at the
+   segments, so VG_(am_set_client_WP) may still fail. */
+static Bool smc_wp_range_eligible ( Addr start, SizeT len )
+{
+   Addr            a = start;
+   NSegment const* seg;
+
+   while (a <= start + len - 1) {
+      seg = VG_(am_find_nsegment)(a);
+      if (seg == NULL || seg->kind != SkAnonC || seg->isShared)
+         return False;
+      if (seg->end >= start + len - 1)
+         return True;
+      a = seg->end + 1;
+   }
+   return True;
+}
+
+/* Clear the bits in |bitset| (as computed by compute_self_check) for
+   extents that can be write-protected instead.  If |doit| is False,
+   nothing is protected, and the result is what it would be if all the
+   protecting that was tried succeeded. */
+static UInt smc_wp_protect_extents ( const VexGuestExtents* vge,
+                                     UInt bitset, Bool doit )
+{
+   UInt i;
+   Addr lo, hi, a;
+
+   if (!VG_(clo_smc_write_protect))
+      return bitset;
+
+   for (i = 0; i < vge->n_used; i++) {
+      if (!(bitset & (1 << i)))
+         continue;
+      lo = VG_PGROUNDDN(vge->base[i]);
+      hi = VG_PGROUNDDN(vge->base[i] + (vge->len[i] > 0 ? vge->len[i] - 1
+                                                        : 0));
+      for (a = lo; a <= hi; a += VKI_PAGE_SIZE)
+         if (smc_wp_page_excluded(a))
+            break;
+      if (a <= hi)
+         continue;
+      if (!doit) {
+         if (smc_wp_range_eligible(lo, hi - lo + VKI_PAGE_SIZE))
+            bitset &= ~(1 << i);
+      } else if (VG_(am_set_client_WP)(lo, hi - lo + VKI_PAGE_SIZE)) {
+         bitset &= ~(1 << i);
+         n_smc_wp_extents++;
+      }
+   }
+   return bitset;
+}
+
+/* Pages written by the core itself, whose code is still to be
+   discarded.  If there are too many, everything from
+   smc_wp_pending_lo to smc_wp_pending_hi is discarded instead. */
+#define N_SMC_WP_PENDING  32
+
+static Addr smc_wp_pending[N_SMC_WP_PENDING];
+static Int  n_smc_wp_pending  = 0;
+static Addr smc_wp_pending_lo = ~(Addr)0;
+static Addr smc_wp_pending_hi = 0;
+
+void VG_(smc_wp_flush_pending) ( void )
+{
+   Int i;
+
+   if (n_smc_wp_pending == 0)
+      return;
+   if (n_smc_wp_pending > N_SMC_WP_PENDING) {
+      VG_(discard_translations)(smc_wp_pending_lo,
+                                (ULong)smc_wp_pending_hi
+                                - (ULong)smc_wp_pending_lo + VKI_PAGE_SIZE,
+                                "smc_wp_flush_pending");
+   } else {
+      for (i = 0; i < n_smc_wp_pending; i++)
+         VG_(discard_translations)(smc_wp_pending[i], VKI_PAGE_SIZE,
+                                   "smc_wp_flush_pending");
+   }
+   n_smc_wp_pending  = 0;
+   smc_wp_pending_lo = ~(Addr)0;
+   smc_wp_pending_hi = 0;
+}
+
+Bool VG_(smc_wp_handle_write_fault) ( Addr fault_addr )
+{
+   Addr            page = VG_PGROUNDDN(fault_addr);
+   NSegment const* seg;
+   SmcWpPage*      pg;
+
+   if (!VG_(clo_smc_write_protect))
+      return False;
+
+   seg = VG_(am_find_nsegment)(page);
+   if (seg == NULL || seg->kind != SkAnonC || !seg->isWP || !seg->hasW)
+      return False;
+
+   n_smc_wp_faults++;
+   pg = smc_wp_page_info(page);
+   if (pg->page != page) {
+      pg->page     = page;
+      pg->n_faults = 0;
+   }
+   pg->n_faults++;
+   if (pg->n_faults == SMC_WP_MAX_FAULTS)
+      n_smc_wp_hot++;
+
+   if (VG_(clo_verbosity) > 2 || VG_(clo_trace_signals))
+      VG_(dmsg)("smc-wp: write to translated code at %#lx\n", fault_addr);
+
+   Bool wasWP = VG_(am_clear_client_WP)(page, VKI_PAGE_SIZE);
+   vg_assert(wasWP);
+
+   if (VG_(in_generated_code)) {
+      /* A client store (or a VEX helper doing one), so no core or
+         tool state is half updated and the code can go now.  The
+         rest of the translation doing the store still runs (sector
+         memory is never freed), just as a self-checking translation
+         which modifies itself runs to its end. */
+      VG_(discard_translations)(page, VKI_PAGE_SIZE,
+                                "smc_wp_handle_write_fault");
+   } else {
+      /* The core writing for the client, eg. building a signal frame.
+         It may be in the middle of anything, so leave the discarding
+         until before generated code next runs. */
+      n_smc_wp_deferred++;
+      if (n_smc_wp_pending < N_SMC_WP_PENDING)
+         smc_wp_pending[n_smc_wp_pending++] = page;
+      else
+         n_smc_wp_pending = N_SMC_WP_PENDING + 1;   /* overflowed */
+      if (page < smc_wp_pending_lo) smc_wp_pending_lo = page;
+      if (page > smc_wp_pending_hi) smc_wp_pending_hi = page;
+   }
+   return True;
+}
+
+/* Remove any protection from the pages LO .. HI, discarding their
+   code.  Returns True if there was any. */
+static Bool smc_wp_unprotect ( Addr lo, Addr hi, const HChar* who )
+{
+   if (!VG_(am_clear_client_WP)(lo, hi - lo + VKI_PAGE_SIZE))
+      return False;
+   VG_(discard_translations)(lo, (ULong)hi - (ULong)lo + VKI_PAGE_SIZE,
+                             who);
+   return True;
+}
+
+void VG_(smc_wp_unprotect_for_syscall) ( ThreadId tid, Addr a, SizeT len )
+{
+   SmcWpBusy b;
+
+   if (!VG_(clo_smc_write_protect) || len == 0 || a + len - 1 < a)
+      return;
+
+   b.tid = tid;
+   b.lo  = VG_PGROUNDDN(a);
+   b.hi  = VG_PGROUNDDN(a + len - 1);
+   if (smc_wp_busy == NULL)
+      smc_wp_busy = VG_(newXA)(VG_(malloc), "translate.smc_wp_busy.1",
+                               VG_(free), sizeof(SmcWpBusy));
+   VG_(addToXA)(smc_wp_busy, &b);
+
+   if (smc_wp_unprotect(b.lo, b.hi, "smc_wp_unprotect_for_syscall"))
+      n_smc_wp_syscall++;
+}
+
+void VG_(smc_wp_syscall_done) ( ThreadId tid )
+{
+   Word i;
+
+   if (smc_wp_busy == NULL)
+      return;
+   for (i = VG_(sizeXA)(smc_wp_busy) - 1; i >= 0; i--) {
+      SmcWpBusy* b = VG_(indexXA)(smc_wp_busy, i);
+      if (b->tid == tid)
+         VG_(removeIndexXA)(smc_wp_busy, i);
+   }
+}
+
+void VG_(smc_wp_never_protect) ( Addr a, SizeT len )
+{
+   Addr lo, hi, page;
+
+   if (!VG_(clo_smc_write_protect) || len == 0 || a + len - 1 < a)
+      return;
+
+   lo = VG_PGROUNDDN(a);
+   hi = VG_PGROUNDDN(a + len - 1);
+   if (smc_wp_never == NULL)
+      smc_wp_never = VG_(OSetWord_Create)(VG_(malloc),
+                                          "translate.smc_wp_never.1",
+                                          VG_(free));
+   for (page = lo; page <= hi; page += VKI_PAGE_SIZE)
+      if (!VG_(OSetWord_Contains)(smc_wp_never, page))
+         VG_(OSetWord_Insert)(smc_wp_never, page);
+
+   (void)smc_wp_unprotect(lo, hi, "smc_wp_never_protect");
+}
+
+Bool VG_(smc_wp_unprotect_args) ( ThreadId tid,
+                                  const UWord* args, Int n_args )
+{
+   Int   i;
+   Addr  page, start;
+   SizeT len;
+   Bool  any = False;
+
+   if (!VG_(clo_smc_write_protect) || n_smc_wp_extents == 0)
+      return False;
+
+   for (i = 0; i < n_args; i++) {
+      page = VG_PGROUNDDN(args[i]);
+      if (!VG_(am_next_client_WP)(page, &start, &len) || start > page)
+         continue;
+      /* The kernel may write any amount from the argument onwards. */
+      VG_(smc_wp_unprotect_for_syscall)(tid, page, start + len - page);
+      n_smc_wp_args++;
+      any = True;
+   }
+   return any;
+}
+
+
 /* Produce a bitmask stating which of the supplied extents needs a
    self-check.  See documentation of
    VexTranslateArgs::needs_self_check for more details about the
    return convention. */
 
-static UInt needs_self_check ( void* closureV,
-                               /*MAYBE_MOD*/VexRegisterUpdates* pxControl,
-                               const VexGuestExtents* vge )
+static UInt compute_self_check ( void* closureV,
+                                 /*MAYBE_MOD*/VexRegisterUpdates* pxControl,
+                                 const VexGuestExtents* vge )
 {
    VgCallbackClosure* closure = (VgCallbackClosure*)closureV;
    UInt i, bitset;
@@ -909,6 +1484,24 @@ static UInt needs_self_check ( void* closureV,
 
    }
 
+   return bitset;
+}
+
+/* The values most recently returned by needs_self_check, so that they
+   can be recorded in the persistent translation cache. */
+static UInt               last_sc_bitset = 0;
+static VexRegisterUpdates last_pxControl = VexRegUpd_INVALID;
+
+/* The callback given to Vex: compute_self_check, with extents
+   write-protected instead of checked where possible, plus stats. */
+static UInt needs_self_check ( void* closureV,
+                               /*MAYBE_MOD*/VexRegisterUpdates* pxControl,
+                               const VexGuestExtents* vge )
+{
+   UInt bitset = compute_self_check(closureV, pxControl, vge);
+
+   bitset = smc_wp_protect_extents(vge, bitset, True);
+
    /* Update running PX stats, as it is difficult without these to
       check that the system is behaving as expected. */
    switch (*pxControl) {
@@ -924,6 +1517,8 @@ static UInt needs_self_check ( void* closureV,
          vg_assert(0);
    }
 
+   last_sc_bitset = bitset;
+   last_pxControl = *pxControl;
    return bitset;
 }
 
@@ -1457,6 +2052,76 @@ typedef
    }
    T_Kind;
 
+/* What a translation found in the persistent translation cache must
+   agree with, in order to be used in place of a new translation. */
+typedef
+   struct {
+      VgCallbackClosure* closure;
+      T_Kind             kind;
+      UInt               abi_hash;
+   }
+   TransCacheCtx;
+
+/* A hash of the fields of |abi|, for telling whether a cached
+   translation was made with the same settings.  Fields are hashed one
+   by one, rather than the struct as a whole, so that padding and
+   pointer values don't come into it. */
+static UInt hash_VexAbiInfo ( const VexAbiInfo* abi )
+{
+   UInt vals[7];
+   UInt n = 0;
+   vals[n++] = (UInt)abi->guest_stack_redzone_size;
+   vals[n++] = abi->guest_amd64_assume_fs_is_const;
+   vals[n++] = abi->guest_amd64_assume_gs_is_const;
+   vals[n++] = abi->guest_ppc_zap_RZ_at_blr;
+   /* guest_ppc_zap_RZ_at_bl is a function; all that can be compared
+      from one run to the next is which one it is. */
+   vals[n++] = abi->guest_ppc_zap_RZ_at_bl == NULL ? 0
+               : abi->guest_ppc_zap_RZ_at_bl == const_True ? 1 : 2;
+   vals[n++] = abi->guest_mips_fp_mode64;
+   vals[n++] = abi->host_ppc_calls_use_fndescrs;
+   vg_assert(n <= sizeof(vals)/sizeof(vals[0]));
+   return VG_(adler32)(0, (const UChar*)vals, n * sizeof(UInt));
+}
+
+/* Would Vex, asked to translate now, make the same decisions as it
+   did when it made |tce|?  The guest bytes themselves are compared
+   by m_transcache. */
+static Bool transcache_acceptable ( const TransCacheEntry* tce,
+                                    void* opaque )
+{
+   TransCacheCtx*     ctx = (TransCacheCtx*)opaque;
+   VexRegisterUpdates px;
+   UInt               i;
+
+   if (tce->kind != ctx->kind || tce->abi_hash != ctx->abi_hash)
+      return False;
+
+   for (i = 0; i < tce->vge.n_used; i++) {
+      Addr            a   = tce->vge.base[i];
+      NSegment const* seg = VG_(am_find_nsegment)(a);
+      if (!translations_allowable_from_seg(seg, a))
+         return False;
+      if (tce->vge.len[i] > 0 && a + tce->vge.len[i] - 1 > seg->end)
+         return False;
+      /* Extents after the first one start where Vex chased to. */
+      if (i > 0 && !chase_into_ok(ctx->closure, a))
+         return False;
+   }
+
+   /* No pages get protected here: that happens only once the entry
+      has been installed, and VG_(translate) backs out if it turns
+      out differently from what was predicted. */
+   px = VG_(clo_vex_control).iropt_register_updates_default;
+   if (smc_wp_protect_extents(&tce->vge,
+          compute_self_check(ctx->closure, &px, &tce->vge), False)
+          != tce->sc_bitset
+       || px != tce->pxControl)
+      return False;
+
+   return True;
+}
+
 /* Translate the basic block beginning at NRADDR, and add it to the
    translation cache & translation table.  Unless
    DEBUGGING_TRANSLATION is true, in which case the call is being done
@@ -1487,6 +2152,8 @@ Bool VG_(translate) ( ThreadId tid,
    VexTranslateArgs   vta;
    VexTranslateResult tres;
    VgCallbackClosure  closure;
+   Bool               use_transcache;
+   UInt               abi_hash = 0;
 
    /* Make sure Vex is initialised right. */
 
@@ -1694,6 +2361,51 @@ Bool VG_(translate) ( ThreadId tid,
    closure.nraddr = nraddr;
    closure.readdr = addr;
 
+   /* Translations depending on anything that isn't the same from one
+      run to the next can't go in the persistent cache.  If possible,
+      reuse one found there. */
+   use_transcache = VG_(transcache_enabled)()
+                    && !debugging_translation
+                    && verbosity == 0
+                    && kind != T_NoRedir
+                    && !VG_(clo_profyle_sbs)
+                    && VG_(clo_vgdb) != Vg_VgdbFull
+                    && !VG_(gdbserver_init_done)();
+   if (use_transcache) {
+      TransCacheEntry tce;
+      TransCacheCtx   tcc;
+      tcc.closure  = &closure;
+      tcc.kind     = kind;
+      tcc.abi_hash = hash_VexAbiInfo(&vex_abiinfo);
+      abi_hash     = tcc.abi_hash;
+      if (VG_(search_transcache)(&tce, nraddr, addr,
+                                 transcache_acceptable, &tcc)) {
+         VexRegisterUpdates px
+            = VG_(clo_vex_control).iropt_register_updates_default;
+         for (i = 0; i < tce.vge.n_used; i++) {
+            VG_(am_set_segment_hasT)( tce.vge.base[i] );
+         }
+         VG_(add_to_transtab)( &tce.vge,
+                               nraddr,
+                               (Addr)tce.code,
+                               tce.code_len,
+                               tce.sc_bitset != 0,
+                               -1,
+                               tce.n_guest_instrs );
+         /* Now write-protect what the entry expects to be protected.
+            If some of that can't be done, the entry lacks self-checks
+            it needs: throw it away and translate afresh. */
+         if (smc_wp_protect_extents(&tce.vge,
+                compute_self_check(&closure, &px, &tce.vge), True)
+             == tce.sc_bitset)
+            return True;
+         for (i = 0; i < tce.vge.n_used; i++) {
+            VG_(discard_translations)( tce.vge.base[i], tce.vge.len[i],
+                                       "translate(transcache)" );
+         }
+      }
+   }
+
    /* Set up args for LibVEX_Translate. */
    vta.arch_guest       = vex_arch;
    vta.archinfo_guest   = vex_archinfo;
@@ -1720,6 +2432,10 @@ Bool VG_(translate) ( ThreadId tid,
         = VG_(clo_vgdb) != Vg_VgdbNo
              ? tool_instrument_then_gdbserver_if_needed
              : VG_(tdict).tool_instrument;
+     if (VG_(clo_translate_ahead) > 0 && !debugging_translation) {
+        instrument_after_noting = f;
+        f = note_successors_then_instrument;
+     }
      IRSB*(*g)(void*,
                IRSB*,const VexGuestLayout*,const VexGuestExtents*,
                const VexArchInfo*,IRType,IRType) = (__typeof__(g)) f;
@@ -1801,6 +2517,22 @@ Bool VG_(translate) ( ThreadId tid,
                                 tres.n_sc_extents > 0,
                                 tres.offs_profInc,
                                 tres.n_guest_instrs );
+
+          if (use_transcache) {
+             TransCacheEntry tce;
+             vg_assert(tres.offs_profInc == -1);
+             tce.nraddr         = nraddr;
+             tce.addr           = addr;
+             tce.vge            = vge;
+             tce.kind           = kind;
+             tce.abi_hash       = abi_hash;
+             tce.sc_bitset      = last_sc_bitset;
+             tce.pxControl      = last_pxControl;
+             tce.n_guest_instrs = tres.n_guest_instrs;
+             tce.code_len       = tmpbuf_used;
+             tce.code           = &tmpbuf[0];
+             VG_(add_to_transcache)( &tce );
+          }
       } else {
           vg_assert(tres.offs_profInc == -1); /* -1 == unset */
           VG_(add_to_unredir_transtab)( &vge,
@@ -424,6 +424,24 @@ typedef
          in strictly non-overlapping order, so we can binary search
          them at any time. */
       XArray* host_extents; /* XArray* of HostExtent */
+
+      /* How much the translations in this sector have been used
+         lately: the number of times a thread's timeslice ended just
+         as it was about to run one of them (see
+         VG_(sample_transtab_use)), halved every time a sector is
+         recycled.  Used to choose which sector to recycle. */
+      ULong n_uses;
+
+      /* When this sector was last (re)initialised, counted in sector
+         initialisations.  Larger is younger. */
+      ULong fill_seq;
+
+      /* Lowest and highest guest address covered by any translation
+         added since the sector was (re)initialised.  Not updated when
+         translations are deleted, so they are only bounds.  If the
+         sector is empty, guest_lo > guest_hi. */
+      Addr guest_lo;
+      Addr guest_hi;
    }
    Sector;
 
@@ -433,10 +451,12 @@ typedef
 /* The root data structure is an array of sectors.  The index of the
    youngest sector is recorded, and new translations are put into that
    sector.  When it fills up, we move along to the next sector and
-   start to fill that up, wrapping around at the end of the array.
-   That way, once all N_TC_SECTORS have been bought into use for the
-   first time, and are full, we then re-use the oldest sector,
-   endlessly. 
+   start to fill that up.  Once all N_TC_SECTORS have been bought into
+   use for the first time, and are full, we then re-use the sector
+   whose translations have been used least lately (see
+   choose_sector_to_recycle), endlessly.  Purely recycling the oldest
+   one would throw away hot code as readily as cold, which for large
+   programs causes storms of retranslation.
 
    When running, youngest sector should be between >= 0 and <
    N_TC_SECTORS.  The initial  value indicates the TT/TC system is
@@ -445,6 +465,27 @@ typedef
 static Sector sectors[MAX_N_SECTORS];
 static Int    youngest_sector = INV_SNO;
 
+/* The sector that was youngest before youngest_sector, or INV_SNO. */
+static Int    prev_youngest_sector = INV_SNO;
+
+/* Number of sector initialisations so far; see Sector.fill_seq. */
+static ULong  n_sector_fills = 0;
+
+/* Guest entry addresses of translations thrown out by sector
+   recycling, so as to count how many of them get translated again.
+   Direct mapped, so the count is a lower bound.  Allocated at the
+   first recycling. */
+#define N_DUMPED_ENTRIES_BITS 16
+#define N_DUMPED_ENTRIES      (1 << N_DUMPED_ENTRIES_BITS)
+static Addr*  dumped_entries = NULL;
+
+static inline UInt DUMPED_HASH ( Addr entry )
+{
+   UWord k = (UWord)entry;
+   return (UInt)((k ^ (k >> N_DUMPED_ENTRIES_BITS)) 
+                 & (N_DUMPED_ENTRIES - 1));
+}
+
 /* The number of ULongs in each TCEntry area.  This is computed once
    at startup and does not change. */
 static Int    tc_sector_szQ = 0;
@@ -482,15 +523,44 @@ typedef
 /*global*/ __attribute__((aligned(16)))
            FastCacheEntry VG_(tt_fast)[VG_TT_FAST_SIZE];
 
+/* A second level behind VG_(tt_fast), only used from C.  When an
+   entry is evicted from VG_(tt_fast) by a colliding one, it is moved
+   here, so that a later miss on it can be satisfied without probing
+   the hash table of every sector.  This matters when several threads
+   (or several hot loops) keep evicting each other's entries.  It is
+   TT_FAST2_WAYS-way set associative, each set kept in most recently
+   used first order.  Unused entries have .guest ==
+   TRANSTAB_BOGUS_GUEST_ADDR, as in VG_(tt_fast). */
+#define TT_FAST2_BITS  10
+#define TT_FAST2_SETS  (1 << TT_FAST2_BITS)
+#define TT_FAST2_WAYS  4
+
+static FastCacheEntry tt_fast2[TT_FAST2_SETS][TT_FAST2_WAYS];
+
+static inline UInt TT_FAST2_HASH ( Addr key )
+{
+   /* Use the bits just above those VG_(tt_fast) indexes on, so that
+      entries colliding there are spread over different sets. */
+   UWord k = (UWord)key;
+   return (UInt)((k ^ (k >> VG_TT_FAST_BITS)) & (TT_FAST2_SETS - 1));
+}
+
 /* Make sure we're not used before initialisation. */
 static Bool init_done = False;
 
 
 /*------------------ STATS DECLS ------------------*/
 
-/* Number of fast-cache updates and flushes done. */
+/* Number of fast-cache updates and flushes done, and of entries
+   invalidated individually. */
 static ULong n_fast_flushes = 0;
 static ULong n_fast_updates = 0;
+static ULong n_fast_inval   = 0;
+
+/* Number of VG_(tt_fast) misses looked up, and how many of them
+   were found in tt_fast2. */
+static ULong n_fast_misses = 0;
+static ULong n_fast2_hits  = 0;
 
 /* Number of full lookups done. */
 static ULong n_full_lookups = 0;
@@ -508,10 +578,21 @@ static ULong n_dump_count = 0;
 static ULong n_dump_osize = 0;
 static ULong n_sectors_recycled = 0;
 
+/* Number of new translations of an entry that had been dumped. */
+static ULong n_retrans_count = 0;
+
 /* Number/osize of translations discarded due to requests to do so. */
 static ULong n_disc_count = 0;
 static ULong n_disc_osize = 0;
 
+/* Number of discard requests handled by each scheme, and the number
+   of sectors which could be skipped, since they have nothing in the
+   requested range. */
+static ULong n_disc_fast   = 0;
+static ULong n_disc_medium = 0;
+static ULong n_disc_slow   = 0;
+static ULong n_disc_sectors_skipped = 0;
+
 
 /*-------------------------------------------------------------*/
 /*--- Misc                                                  ---*/
@@ -1455,9 +1536,41 @@ static inline HTTno HASH_TT ( Addr key )
    return (HTTno)(k32 % N_HTTES_PER_SECTOR);
 }
 
+/* Put an entry evicted from VG_(tt_fast) at the front of its
+   tt_fast2 set, dropping the least recently used one. */
+static void fast2_insert ( Addr key, Addr host )
+{
+   FastCacheEntry* set = tt_fast2[TT_FAST2_HASH(key)];
+   UInt w;
+   for (w = TT_FAST2_WAYS-1; w > 0; w--)
+      set[w] = set[w-1];
+   set[0].guest = key;
+   set[0].host  = host;
+}
+
+/* Look up key in tt_fast2, removing it if found. */
+static Bool fast2_remove ( Addr key, /*OUT*/Addr* host )
+{
+   FastCacheEntry* set = tt_fast2[TT_FAST2_HASH(key)];
+   UInt w;
+   for (w = 0; w < TT_FAST2_WAYS; w++) {
+      if (set[w].guest == key) {
+         *host = set[w].host;
+         for (; w < TT_FAST2_WAYS-1; w++)
+            set[w] = set[w+1];
+         set[TT_FAST2_WAYS-1].guest = TRANSTAB_BOGUS_GUEST_ADDR;
+         return True;
+      }
+   }
+   return False;
+}
+
 static void setFastCacheEntry ( Addr key, ULong* tcptr )
 {
    UInt cno = (UInt)VG_TT_FAST_HASH(key);
+   if (VG_(tt_fast)[cno].guest != TRANSTAB_BOGUS_GUEST_ADDR
+       && VG_(tt_fast)[cno].guest != key)
+      fast2_insert(VG_(tt_fast)[cno].guest, VG_(tt_fast)[cno].host);
    VG_(tt_fast)[cno].guest = key;
    VG_(tt_fast)[cno].host  = (Addr)tcptr;
    n_fast_updates++;
@@ -1482,9 +1595,31 @@ static void invalidateFastCache ( void )
    }
 
    vg_assert(j == VG_TT_FAST_SIZE);
+
+   for (j = 0; j < TT_FAST2_SETS; j++) {
+      UInt w;
+      for (w = 0; w < TT_FAST2_WAYS; w++)
+         tt_fast2[j][w].guest = TRANSTAB_BOGUS_GUEST_ADDR;
+   }
+
    n_fast_flushes++;
 }
 
+/* Remove any fast-cache entry for key, at either level.  Used when the
+   translation for key is deleted, instead of invalidating the whole
+   cache. */
+static void invalidateFastCacheEntry ( Addr key )
+{
+   UInt cno = (UInt)VG_TT_FAST_HASH(key);
+   Addr dummy;
+   if (VG_(tt_fast)[cno].guest == key) {
+      VG_(tt_fast)[cno].guest = TRANSTAB_BOGUS_GUEST_ADDR;
+      n_fast_inval++;
+   }
+   if (fast2_remove(key, &dummy))
+      n_fast_inval++;
+}
+
 
 static TTEno get_empty_tt_slot(SECno sNo)
 {
@@ -1599,9 +1734,17 @@ static void initialiseSector ( SECno sno )
 
       /* Sector has been used before.  Dump the old contents. */
       if (VG_(clo_stats) || VG_(debugLog_getLevel)() >= 1)
-         VG_(dmsg)("transtab: " "recycle  sector %d\n", sno);
+         VG_(dmsg)("transtab: " "recycle  sector %d (uses %llu)\n",
+                   sno, sec->n_uses);
       n_sectors_recycled++;
 
+      if (dumped_entries == NULL) {
+         dumped_entries = ttaux_malloc("transtab.dumped_entries",
+                                       N_DUMPED_ENTRIES * sizeof(Addr));
+         for (i = 0; i < N_DUMPED_ENTRIES; i++)
+            dumped_entries[i] = TRANSTAB_BOGUS_GUEST_ADDR;
+      }
+
       vg_assert(sec->ttC != NULL);
       vg_assert(sec->ttH != NULL);
       vg_assert(sec->tc_next != NULL);
@@ -1622,6 +1765,8 @@ static void initialiseSector ( SECno sno )
             vg_assert(sec->ttC[ei].n_tte2ec >= 1);
             vg_assert(sec->ttC[ei].n_tte2ec <= 3);
             n_dump_osize += TTEntryH__osize(&sec->ttH[ei]);
+            dumped_entries[DUMPED_HASH(sec->ttC[ei].entry)]
+               = sec->ttC[ei].entry;
             /* Tell the tool too. */
             if (VG_(needs).superblock_discards) {
                VexGuestExtents vge_tmp;
@@ -1678,6 +1823,10 @@ static void initialiseSector ( SECno sno )
 
    sec->tc_next = sec->tc;
    sec->tt_n_inuse = 0;
+   sec->n_uses = 0;
+   sec->fill_seq = ++n_sector_fills;
+   sec->guest_lo = ~(Addr)0;
+   sec->guest_hi = 0;
 
    invalidateFastCache();
 
@@ -1686,6 +1835,40 @@ static void initialiseSector ( SECno sno )
    }
 }
 
+/* Choose the sector to move on to when the youngest one, y, is full.
+   Sectors not yet in use are taken first, in order.  After that, the
+   least used sector, excluding the two youngest, which haven't had
+   time to show whether they are hot.  Ties go to the oldest.  All
+   use counts are then halved, so that they reflect recent use. */
+static SECno choose_sector_to_recycle ( SECno y )
+{
+   SECno sno, best = INV_SNO;
+
+   for (sno = 0; sno < n_sectors; sno++) {
+      if (sectors[sno].tc == NULL)
+         return sno;
+   }
+
+   for (sno = 0; sno < n_sectors; sno++) {
+      if (sno == y || sno == prev_youngest_sector)
+         continue;
+      if (best == INV_SNO
+          || sectors[sno].n_uses < sectors[best].n_uses
+          || (sectors[sno].n_uses == sectors[best].n_uses
+              && sectors[sno].fill_seq < sectors[best].fill_seq))
+         best = sno;
+   }
+   if (best == INV_SNO) {
+      /* Only two sectors: no choice. */
+      best = y == 0 ? 1 : 0;
+   }
+
+   for (sno = 0; sno < n_sectors; sno++)
+      sectors[sno].n_uses >>= 1;
+
+   return best;
+}
+
 /* Add a translation of vge to TT/TC.  The translation is temporarily
    in code[0 .. code_len-1].
 
@@ -1723,6 +1906,11 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
    n_in_osize += vge_osize(vge);
    if (is_self_checking)
       n_in_sc_count++;
+   if (dumped_entries != NULL
+       && dumped_entries[DUMPED_HASH(entry)] == entry) {
+      n_retrans_count++;
+      dumped_entries[DUMPED_HASH(entry)] = TRANSTAB_BOGUS_GUEST_ADDR;
+   }
 
    y = youngest_sector;
    vg_assert(isValidSector(y));
@@ -1757,9 +1945,8 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
                    y, tt_loading_pct, tc_loading_pct,
                    8 * (tc_sector_szQ - tcAvailQ)/sectors[y].tt_n_inuse);
       }
-      youngest_sector++;
-      if (youngest_sector >= n_sectors)
-         youngest_sector = 0;
+      prev_youngest_sector = youngest_sector;
+      youngest_sector = choose_sector_to_recycle(y);
       y = youngest_sector;
       initialiseSector(y);
    }
@@ -1852,6 +2039,18 @@ void VG_(add_to_transtab)( const VexGuestExtents* vge,
                     hx.start, hx.len, y, tteix);
    }
 
+   /* Update the sector's guest address bounds. */
+   { UInt i;
+     for (i = 0; i < vge->n_used; i++) {
+        if (vge->len[i] == 0)
+           continue;
+        if (vge->base[i] < sectors[y].guest_lo)
+           sectors[y].guest_lo = vge->base[i];
+        if (vge->base[i] + vge->len[i] - 1 > sectors[y].guest_hi)
+           sectors[y].guest_hi = vge->base[i] + vge->len[i] - 1;
+     }
+   }
+
    /* Update the fast-cache. */
    setFastCacheEntry( entry, tcptr );
 
@@ -1875,6 +2074,25 @@ Bool VG_(search_transtab) ( /*OUT*/Addr*  res_hcode,
    TTEno tti;
 
    vg_assert(init_done);
+
+   /* A lookup which updates the fast cache is (nearly always) a
+      VG_(tt_fast) miss in the dispatcher.  Try the second level
+      before searching all the sectors.  tt_fast2 doesn't know which
+      sector an entry is in, so this only works if the caller doesn't
+      want to know either. */
+   if (upd_cache) {
+      Addr host;
+      n_fast_misses++;
+      if (res_sNo == NULL && res_tteNo == NULL
+          && fast2_remove(guest_addr, &host)) {
+         n_fast2_hits++;
+         setFastCacheEntry(guest_addr, (ULong*)host);
+         if (res_hcode)
+            *res_hcode = host;
+         return True;
+      }
+   }
+
    /* Find the initial probe point just once.  It will be the same in
       all sectors and avoids multiple expensive % operations. */
    n_full_lookups++;
@@ -1932,6 +2150,19 @@ Bool VG_(search_transtab) ( /*OUT*/Addr*  res_hcode,
    return False;
 }
 
+/* Record that a thread's timeslice ended just as it was about to run
+   the translation for GUEST_ADDR.  Timeslices end after a fixed number
+   of blocks, wherever the thread is, so these are samples of where
+   time goes.  Lookups (fast cache misses) would not do: they happen
+   when code is new or has just been unchained, rather than when it is
+   used, and hot chained code never causes any. */
+void VG_(sample_transtab_use) ( Addr guest_addr )
+{
+   SECno sno;
+   if (VG_(search_transtab)(NULL, &sno, NULL, guest_addr, False))
+      sectors[sno].n_uses++;
+}
+
 
 /*-------------------------------------------------------------*/
 /*--- Delete translations.                                  ---*/
@@ -2024,6 +2255,9 @@ static void delete_tte ( /*MOD*/Sector* sec, SECno secNo, TTEno tteno,
    tteC->n_tte2ec = 0;
    add_to_empty_tt_list(secNo, tteno);
 
+   /* Make sure the dispatcher can't find it any more. */
+   invalidateFastCacheEntry(tteC->entry);
+
    /* Stats .. */
    sec->tt_n_inuse--;
    n_disc_count++;
@@ -2038,6 +2272,18 @@ static void delete_tte ( /*MOD*/Sector* sec, SECno secNo, TTEno tteno,
 }
 
 
+/* Could sec hold any translations intersecting the specified range? */
+
+static inline
+Bool sector_may_overlap ( const Sector* sec, Addr guest_start, ULong range )
+{
+   if (sec->tc == NULL || sec->guest_lo > sec->guest_hi)
+      return False;
+   return overlap1(guest_start, range,
+                   sec->guest_lo, (ULong)(sec->guest_hi - sec->guest_lo) + 1);
+}
+
+
 /* Delete translations from sec which intersect specified range, but
    only consider translations in the specified eclass. */
 
@@ -2112,7 +2358,6 @@ void VG_(discard_translations) ( Addr guest_start, ULong range,
    Sector* sec;
    SECno   sno;
    EClassNo ec;
-   Bool    anyDeleted = False;
 
    vg_assert(init_done);
 
@@ -2135,7 +2380,7 @@ void VG_(discard_translations) ( Addr guest_start, ULong range,
    VG_(machine_get_VexArchInfo)( &arch_host, &archinfo_host );
    VexEndness endness_host = archinfo_host.endness;
 
-   /* There are two different ways to do this.
+   /* There are three different ways to do this.
 
       If the range fits within a single address-range equivalence
       class, as will be the case for a cache line sized invalidation,
@@ -2143,11 +2388,21 @@ void VG_(discard_translations) ( Addr guest_start, ULong range,
       that equivalence class, and also in the "sin-bin" equivalence
       class ECLASS_MISC.
 
+      If the range spans several classes, but not all of them, as is
+      typical for JITs discarding a page or a few of code, then we
+      only have to inspect the lists of those classes, and
+      ECLASS_MISC.  Any translation intersecting the range has its
+      extents each within one class (else it is in ECLASS_MISC), and
+      one of them must be a class the range touches.
+
       Otherwise, the invalidation is of a larger range and probably
       results from munmap.  In this case it's (probably!) faster just
       to inspect all translations, dump those we don't want, and
       regenerate the equivalence class information (since modifying it
       in-situ is even more expensive).
+
+      In all cases, sectors whose bounds don't intersect the range are
+      skipped.
    */
 
    /* First off, figure out if the range falls within a single class, 
@@ -2157,44 +2412,88 @@ void VG_(discard_translations) ( Addr guest_start, ULong range,
    if (range <= (1ULL << ECLASS_SHIFT))
       ec = range_to_eclass( guest_start, (UInt)range );
 
+   /* And how many classes it spans, if not. */
+   ULong n_ecs = ((guest_start + range - 1) >> ECLASS_SHIFT)
+                 - (guest_start >> ECLASS_SHIFT) + 1;
+   if (guest_start + range - 1 < guest_start)
+      n_ecs = ECLASS_MISC; /* wraps around the address space */
+
    /* if ec is ECLASS_MISC then we aren't looking at just a single
-      class, so use the slow scheme.  Else use the fast scheme,
-      examining 'ec' and ECLASS_MISC. */
+      class, so use the medium or slow scheme.  Else use the fast
+      scheme, examining 'ec' and ECLASS_MISC. */
 
    if (ec != ECLASS_MISC) {
 
       VG_(debugLog)(2, "transtab",
                        "                    FAST, ec = %d\n", ec);
+      n_disc_fast++;
 
       /* Fast scheme */
       vg_assert(ec >= 0 && ec < ECLASS_MISC);
 
       for (sno = 0; sno < n_sectors; sno++) {
          sec = &sectors[sno];
-         if (sec->tc == NULL)
+         if (!sector_may_overlap(sec, guest_start, range)) {
+            n_disc_sectors_skipped++;
             continue;
-         anyDeleted |= delete_translations_in_sector_eclass( 
+         }
+         delete_translations_in_sector_eclass( 
                           sec, sno, guest_start, range, ec, 
                           arch_host, endness_host
                        );
-         anyDeleted |= delete_translations_in_sector_eclass( 
+         delete_translations_in_sector_eclass( 
                           sec, sno, guest_start, range, ECLASS_MISC,
                           arch_host, endness_host
                        );
       }
 
+   } else if (n_ecs < ECLASS_MISC) {
+
+      /* medium scheme */
+
+      EClassNo ec0 = (EClassNo)((guest_start >> ECLASS_SHIFT)
+                                & (ECLASS_MISC - 1));
+      ULong    k;
+
+      VG_(debugLog)(2, "transtab",
+                       "                    MEDIUM, ec = %d .. +%llu\n",
+                       ec0, n_ecs);
+      n_disc_medium++;
+
+      for (sno = 0; sno < n_sectors; sno++) {
+         sec = &sectors[sno];
+         if (!sector_may_overlap(sec, guest_start, range)) {
+            n_disc_sectors_skipped++;
+            continue;
+         }
+         for (k = 0; k < n_ecs; k++) {
+            delete_translations_in_sector_eclass(
+               sec, sno, guest_start, range,
+               (EClassNo)((ec0 + k) & (ECLASS_MISC - 1)),
+               arch_host, endness_host
+            );
+         }
+         delete_translations_in_sector_eclass(
+            sec, sno, guest_start, range, ECLASS_MISC,
+            arch_host, endness_host
+         );
+      }
+
    } else {
 
       /* slow scheme */
 
       VG_(debugLog)(2, "transtab",
                        "                    SLOW, ec = %d\n", ec);
+      n_disc_slow++;
 
       for (sno = 0; sno < n_sectors; sno++) {
          sec = &sectors[sno];
-         if (sec->tc == NULL)
+         if (!sector_may_overlap(sec, guest_start, range)) {
+            n_disc_sectors_skipped++;
             continue;
-         anyDeleted |= delete_translations_in_sector( 
+         }
+         delete_translations_in_sector( 
                           sec, sno, guest_start, range,
                           arch_host, endness_host
                        );
@@ -2202,8 +2501,8 @@ void VG_(discard_translations) ( Addr guest_start, ULong range,
 
    }
 
-   if (anyDeleted)
-      invalidateFastCache();
+   /* delete_tte has removed the fast-cache entries of the deleted
+      translations, so there is no need to flush the whole cache. */
 
    /* don't forget the no-redir cache */
    unredir_discard_translations( guest_start, range );
@@ -2571,8 +2870,13 @@ void VG_(print_tt_tc_stats) ( void )
       "    tt/tc: %'llu tt lookups requiring %'llu probes\n",
       n_full_lookups, n_lookup_probes );
    VG_(message)(Vg_DebugMsg,
-      "    tt/tc: %'llu fast-cache updates, %'llu flushes\n",
-      n_fast_updates, n_fast_flushes );
+      "    tt/tc: %'llu fast-cache updates, %'llu flushes, "
+      "%'llu entries invalidated\n",
+      n_fast_updates, n_fast_flushes, n_fast_inval );
+   VG_(message)(Vg_DebugMsg,
+      "    tt/tc: %'llu fast-cache misses, %'llu hits in 2nd level (%3.1f%%)\n",
+      n_fast_misses, n_fast2_hits,
+      safe_idiv(100 * n_fast2_hits, n_fast_misses) );
 
    VG_(message)(Vg_DebugMsg,
                 " transtab: new        %'llu "
@@ -2586,9 +2890,19 @@ void VG_(print_tt_tc_stats) ( void )
                 " transtab: dumped     %'llu (%'llu -> ?" "?) "
                 "(sectors recycled %'llu)\n",
                 n_dump_count, n_dump_osize, n_sectors_recycled );
+   VG_(message)(Vg_DebugMsg,
+                " transtab: retranslated %'llu dumped "
+                "(%3.1f%% of new, at least)\n",
+                n_retrans_count,
+                safe_idiv(100 * n_retrans_count, n_in_count) );
    VG_(message)(Vg_DebugMsg,
                 " transtab: discarded  %'llu (%'llu -> ?" "?)\n",
                 n_disc_count, n_disc_osize );
+   VG_(message)(Vg_DebugMsg,
+                " transtab: discard requests: %'llu fast, %'llu medium, "
+                "%'llu slow; %'llu sector scans avoided\n",
+                n_disc_fast, n_disc_medium, n_disc_slow,
+                n_disc_sectors_skipped );
 
    if (DEBUG_TRANSTAB) {
       VG_(printf)("\n");
@@ -277,6 +277,24 @@ extern Bool VG_(am_change_ownership_v_to_c)( Addr start, SizeT len );
    expected to belong to a client segment. */
 extern void VG_(am_set_segment_hasT)( Addr addr );
 
+/* Take write access to the client range START .. START+LEN-1 away
+   (from the kernel's point of view only; hasW is unchanged and isWP is
+   set), so that writes to it fault.  START and LEN must be page
+   aligned and the range must lie in SkAnonC segments.  Returns False,
+   having changed nothing, if that is not possible. */
+extern Bool VG_(am_set_client_WP)( Addr start, SizeT len );
+
+/* Give back write access taken away by VG_(am_set_client_WP) to any
+   part of START .. START+LEN-1 (rounded out to whole pages).  Returns
+   True if any part of the range had been protected. */
+extern Bool VG_(am_clear_client_WP)( Addr start, SizeT len );
+
+/* Find the lowest range at or above FROM that VG_(am_set_client_WP)
+   has protected, and return it in *START and *LEN.  Returns False if
+   there is none. */
+extern Bool VG_(am_next_client_WP)( Addr from, /*OUT*/Addr* start,
+                                               /*OUT*/SizeT* len );
+
 /* --- --- --- reservations --- --- --- */
 
 /* Create a reservation from START .. START+LENGTH-1, with the given
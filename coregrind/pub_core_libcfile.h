@@ -39,8 +39,6 @@
 
 #include "pub_tool_libcfile.h"
 
-/* Move an fd into the Valgrind-safe range */
-extern Int VG_(safe_fd) ( Int oldfd );
 extern Int VG_(fcntl)   ( Int fd, Int cmd, Addr arg );
 
 /* Convert an fd into a filename */
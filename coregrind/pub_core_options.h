@@ -314,6 +314,14 @@ extern Int VG_(clo_merge_recursive_frames);
 /* Max number of sectors that will be used by the translation code cache. */
 extern UInt VG_(clo_num_transtab_sectors);
 
+/* Max number of predicted successor blocks to translate each time a
+   thread is about to block in a syscall.  0 disables this. */
+extern UInt VG_(clo_translate_ahead);
+
+/* File in which to keep translations across runs, or NULL.  See
+   pub_core_transcache.h. */
+extern const HChar* VG_(clo_trans_cache_file);
+
 /* Average size of a transtab code entry. 0 means to use the tool
    provided default. */
 extern UInt VG_(clo_avg_transtab_entry_size);
@@ -347,6 +355,10 @@ typedef
    auto-detected. */
 extern VgSmc VG_(clo_smc_check);
 
+/* Write-protect code which --smc-check says should be checked, where
+   possible, instead of giving it self-checks. */
+extern Bool VG_(clo_smc_write_protect);
+
 /* A set of minor kernel variants,
    so they can be properly handled by m_syswrap. */
 typedef
@@ -133,7 +133,12 @@ typedef
       Word exitcode; // in the case of exitgroup, set by someone else
       Int  fatalsig; // fatal signal
 
-#     if defined(VGO_darwin)
+#     if defined(VGO_linux)
+      // Robust futex list head, as given to set_robust_list.  The
+      // kernel writes to the futexes on it when the thread exits.
+      Addr robust_list;
+
+#     elif defined(VGO_darwin)
       // Mach trap POST handler as chosen by PRE
       void (*post_mach_trap_fn)(ThreadId tid,
                                 struct SyscallArgs *, struct SyscallStatus *);
@@ -0,0 +1,100 @@
+/*--------------------------------------------------------------------*/
+/*--- Persistent translation cache.          pub_core_transcache.h ---*/
+/*--------------------------------------------------------------------*/
+
+/*
+   This file is part of Valgrind, a dynamic binary instrumentation
+   framework.
+
+   Copyright (C) 2000-2015 Julian Seward
+      jseward@acm.org
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2 of the
+   License, or (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA
+   02111-1307, USA.
+
+   The GNU General Public License is contained in the file COPYING.
+*/
+
+#ifndef __PUB_CORE_TRANSCACHE_H
+#define __PUB_CORE_TRANSCACHE_H
+
+#include "pub_core_basics.h"   // VG_ macro
+#include "libvex.h"            // VexGuestExtents
+
+//--------------------------------------------------------------------
+// PURPOSE: This module keeps instrumented host code in a file, so
+// that later runs of the same tool, with the same options, on the
+// same guest code can skip translating it.  It is enabled with
+// --trans-cache-file= and only for tools that have declared their
+// translations cacheable (VG_(needs_cacheable_translations)).
+//
+// Host code cannot be relocated (Vex does not tell us where it has
+// embedded guest addresses), so an entry is only ever reused for
+// exactly the guest address it was made for.  Every entry also
+// carries a copy of the guest bytes it was made from, and is
+// rejected unless they are identical to what is in memory now.
+//--------------------------------------------------------------------
+
+/* One cached translation.  |kind|, |abi_hash|, |sc_bitset| and
+   |pxControl| are not interpreted by this module; they record the
+   conditions the translation was made under, and it is up to the
+   caller to check that they still hold. */
+typedef
+   struct {
+      Addr            nraddr;  /* key, as given to VG_(add_to_transtab) */
+      Addr            addr;    /* guest address actually translated */
+      VexGuestExtents vge;
+      UInt            kind;
+      UInt            abi_hash;
+      UInt            sc_bitset;
+      UInt            pxControl;
+      UInt            n_guest_instrs;
+      UInt            code_len;
+      const UChar*    code;    /* code_len bytes of host code */
+   }
+   TransCacheEntry;
+
+/* Open (or create) the file named by VG_(clo_trans_cache_file) and
+   load its contents.  Does nothing if the option is not given.
+   Must be called after the tool's post_clo_init. */
+extern void VG_(init_transcache) ( const HChar* toolname );
+
+/* Is the cache in use? */
+extern Bool VG_(transcache_enabled) ( void );
+
+/* Look for a cached translation of nraddr/addr.  For each candidate,
+   |acceptable| is called first; it must check that all of the
+   candidate's extents are mapped and translatable, as well as any
+   other conditions it cares about.  Only then are the candidate's
+   guest bytes compared against memory.  Returns True and fills in
+   *res for the first candidate passing both tests. */
+extern Bool VG_(search_transcache) ( /*OUT*/TransCacheEntry* res,
+                                     Addr nraddr, Addr addr,
+                                     Bool (*acceptable)
+                                        ( const TransCacheEntry*, void* ),
+                                     void* opaque );
+
+/* Append a newly made translation to the cache file.  The guest bytes
+   are read from the extents in e->vge, so this must be called before
+   the client gets a chance to run again. */
+extern void VG_(add_to_transcache) ( const TransCacheEntry* e );
+
+extern void VG_(print_transcache_stats) ( void );
+
+#endif   // __PUB_CORE_TRANSCACHE_H
+
+/*--------------------------------------------------------------------*/
+/*--- end                                    pub_core_transcache.h ---*/
+/*--------------------------------------------------------------------*/
@@ -46,6 +46,42 @@ Bool VG_(translate) ( ThreadId tid,
                       ULong    bbs_done,
                       Bool     allow_redirection );
 
+/* Translate some of the likely successors of recently translated
+   superblocks, if --translate-ahead is in effect.  Called when thread
+   tid is about to block. */
+extern void VG_(translate_ahead) ( ThreadId tid );
+
+/* With --smc-write-protect=yes: if FAULT_ADDR is in a page that was
+   write-protected because code was translated from it, make the page
+   writable again and return True, so that the faulting write can be
+   restarted.  Otherwise return False.  The page's code is discarded
+   at once if the write came from generated code, otherwise by the
+   next call to VG_(smc_wp_flush_pending). */
+extern Bool VG_(smc_wp_handle_write_fault) ( Addr fault_addr );
+
+/* Discard the code from pages which the core itself wrote to.  Called
+   by the scheduler before running generated code. */
+extern void VG_(smc_wp_flush_pending) ( void );
+
+/* The kernel is about to write to the client range A .. A+LEN-1 on
+   behalf of thread TID's current syscall.  Remove any write protection
+   the range has, since such writes don't fault but fail, and don't
+   protect it again until VG_(smc_wp_syscall_done)(TID). */
+extern void VG_(smc_wp_unprotect_for_syscall) ( ThreadId tid,
+                                                Addr a, SizeT len );
+extern void VG_(smc_wp_syscall_done) ( ThreadId tid );
+
+/* The kernel may write to A .. A+LEN-1 at some later time, ignoring
+   failure (eg. the CLONE_CHILD_CLEARTID word).  Never protect it. */
+extern void VG_(smc_wp_never_protect) ( Addr a, SizeT len );
+
+/* For those of the N_ARGS syscall arguments ARGS which point into a
+   write-protected page, treat the rest of the protected range as
+   VG_(smc_wp_unprotect_for_syscall) does.  Returns True if there was
+   any. */
+extern Bool VG_(smc_wp_unprotect_args) ( ThreadId tid,
+                                         const UWord* args, Int n_args );
+
 extern void VG_(print_translation_stats) ( void );
 
 #endif   // __PUB_CORE_TRANSLATE_H
@@ -110,6 +110,10 @@ extern Bool VG_(search_transtab) ( /*OUT*/Addr*  res_hcode,
                                    Addr          guest_addr, 
                                    Bool          upd_cache );
 
+/* Note that a thread is about to run the translation for GUEST_ADDR,
+   as a sample of which sectors hold the code being run. */
+extern void VG_(sample_transtab_use) ( Addr guest_addr );
+
 extern void VG_(discard_translations) ( Addr  start, ULong range,
                                         const HChar* who );
 
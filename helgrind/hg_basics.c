@@ -77,6 +77,8 @@ UWord HG_(clo_history_level) = 2;
 
 UWord HG_(clo_conflict_cache_size) = 2000000;
 
+const HChar* HG_(clo_history_spill_file) = NULL;
+
 UWord HG_(clo_sanity_flags) = 0;
 
 Bool  HG_(clo_free_is_write) = False;
@@ -85,6 +87,8 @@ UWord HG_(clo_vts_pruning) = 1;
 
 Bool  HG_(clo_check_stack_refs) = True;
 
+UWord HG_(clo_race_sampling) = 1;
+
 /*--------------------------------------------------------------------*/
 /*--- end                                              hg_basics.c ---*/
 /*--------------------------------------------------------------------*/
@@ -99,6 +99,11 @@ extern UWord HG_(clo_history_level);
    amd 10 million.  Default is 1 million. */
 extern UWord HG_(clo_conflict_cache_size);
 
+/* At --history-level=full, the file to which accesses dropped from
+   the conflict cache are written, so that they can still be shown.
+   NULL (the default) means they are just forgotten. */
+extern const HChar* HG_(clo_history_spill_file);
+
 /* Sanity check level.  This is an or-ing of
    SCE_{THREADS,LOCKS,BIGRANGE,ACCESS,LAOG}. */
 extern UWord HG_(clo_sanity_flags);
@@ -126,6 +131,12 @@ extern UWord HG_(clo_vts_pruning);
    the stack, which speeds things up a bit.  Default: True. */
 extern Bool HG_(clo_check_stack_refs); 
 
+/* When greater than 1, race checking is only done for a rotating
+   subset of the program's code: about one in this many code regions
+   at any one time, for each thread.  See "Race sampling" in
+   hg_main.c.  Default: 1 (check everything). */
+extern UWord HG_(clo_race_sampling);
+
 #endif /* ! __HG_BASICS_H */
 
 /*--------------------------------------------------------------------*/
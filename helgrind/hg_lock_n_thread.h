@@ -114,6 +114,11 @@ typedef
          --ignore-thread-creation. */
       Int synchr_nesting;
 
+      /* Number of times this thread has been scheduled, used to
+         rotate the code regions it race-checks when
+         --race-sampling is in use. */
+      UInt sample_phase;
+
 #if defined(VGO_solaris)
       Int      bind_guard_flag; /* Bind flag from the runtime linker. */
 #endif /* VGO_solaris */
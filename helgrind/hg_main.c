@@ -185,6 +185,7 @@ static Thread* mk_Thread ( Thr* hbthr ) {
    thread->admin        = admin_threads;
    thread->synchr_nesting = 0;
    thread->pthread_create_nesting_level = 0;
+   thread->sample_phase = 0;
 #if defined(VGO_solaris)
    thread->bind_guard_flag = 0;
 #endif /* VGO_solaris */
@@ -1424,6 +1425,11 @@ void evhH__pre_thread_releases_lock ( Thread* thr,
 static Thread *current_Thread      = NULL,
               *current_Thread_prev = NULL;
 
+/* With --race-sampling=N, the slot (0 .. N-1) of the code regions
+   whose memory accesses are currently being checked.  Read directly
+   by the generated code; see "Race sampling" below. */
+static UInt hg_sample_slot = 0;
+
 static void evh__start_client_code ( ThreadId tid, ULong nDisp ) {
    if (0) VG_(printf)("start %d %llu\n", (Int)tid, nDisp);
    tl_assert(current_Thread == NULL);
@@ -1433,6 +1439,15 @@ static void evh__start_client_code ( ThreadId tid, ULong nDisp ) {
       libhb_Thr_resumes( current_Thread->hbthr );
       current_Thread_prev = current_Thread;
    }
+   if (HG_(clo_race_sampling) > 1) {
+      /* Move on to the next slot each timeslice.  Threads start at
+         different slots, so that between them they cover more of the
+         code at any one time. */
+      hg_sample_slot
+         = (UInt)((current_Thread->errmsg_index
+                   + current_Thread->sample_phase++)
+                  % HG_(clo_race_sampling));
+   }
 }
 static void evh__stop_client_code ( ThreadId tid, ULong nDisp ) {
    if (0) VG_(printf)(" stop %d %llu\n", (Int)tid, nDisp);
@@ -3473,18 +3488,59 @@ void evh__HG_RTLD_BIND_CLEAR(ThreadId tid, Int flags)
    (2) Cache these add-edge requests and ignore them if said edges
        have already been added to laog.  Invalidate the cache any time
        any edges are deleted from laog.
+
+   (1) is now done differently: as long as laog has no cycle, we
+   maintain a topological order of its nodes (each node has an 'ord',
+   and src->dst implies src.ord < dst.ord), updated incrementally on
+   each edge addition as described in "A Dynamic Topological Sort
+   Algorithm for Directed Acyclic Graphs" (Pearce and Kelly, 2006).
+   Then a path lk --*--> L can only exist if lk.ord < L.ord, so in the
+   common case the search is answered by comparing orders, and
+   otherwise it only has to visit nodes ordered between lk and the
+   highest held lock.  Deleting edges never invalidates the order.
+   An edge that would close a cycle (that is, one added after a lock
+   order error) is kept in the graph but left out of the order: it is
+   recorded in its source's 'backs', and searches also bound
+   themselves by the order of those sources, which still leaves them
+   visiting the same nodes as a plain search would that can lead
+   anywhere.  When locks are deleted, and so maybe the cycle with
+   them, the edges left out are tried again.
 */
 
 typedef
    struct {
       WordSetID inns; /* in univ_laog */
       WordSetID outs; /* in univ_laog */
+      WordSetID backs; /* in univ_laog: the 'outs' not in the order */
+      Word      ord;  /* position in the topological order */
+      UWord     mark; /* == laog_mark if seen by the current search */
    }
    LAOGLinks;
 
 /* lock order acquisition graph */
 static WordFM* laog = NULL; /* WordFM Lock* LAOGLinks* */
 
+/* Nodes with nonempty 'backs', and the total size of those. */
+static XArray* laog_back_srcs = NULL; /* of Lock* */
+static UWord   laog_n_backs   = 0;
+/* Lowest and highest 'ord' given out so far. */
+static Word laog_ord_min = 0;
+static Word laog_ord_max = 0;
+/* Incremented to start a new search, so as to clear all the marks. */
+static UWord laog_mark = 0;
+
+/* Scratch space for the searches. */
+static XArray* laog_stack  = NULL; /* of Lock* */
+static XArray* laog_deltaF = NULL; /* of LAOGLinks* */
+static XArray* laog_deltaB = NULL; /* of LAOGLinks* */
+static XArray* laog_ords   = NULL; /* of Word */
+
+static ULong stats__laog_checks  = 0; /* acquisitions checked */
+static ULong stats__laog_trivial = 0; /* ... answered by 'ord' alone */
+static ULong stats__laog_reorder = 0; /* edges that needed a reorder */
+static ULong stats__laog_visited = 0; /* nodes visited by reorders */
+static ULong stats__laog_backs   = 0; /* edges left out of the order */
+
 /* EXPOSITION ONLY: for each edge in 'laog', record the two places
    where that edge was created, so that we can show the user later if
    we need to. */
@@ -3524,6 +3580,28 @@ static void laog__init ( void )
 
    laog_exposition = VG_(newFM)( HG_(zalloc), "hg.laog__init.2", HG_(free), 
                                  cmp_LAOGLinkExposition );
+
+   laog_stack  = VG_(newXA)( HG_(zalloc), "hg.laog__init.3",
+                             HG_(free), sizeof(Lock*) );
+   laog_deltaF = VG_(newXA)( HG_(zalloc), "hg.laog__init.4",
+                             HG_(free), sizeof(LAOGLinks*) );
+   laog_deltaB = VG_(newXA)( HG_(zalloc), "hg.laog__init.5",
+                             HG_(free), sizeof(LAOGLinks*) );
+   laog_ords   = VG_(newXA)( HG_(zalloc), "hg.laog__init.6",
+                             HG_(free), sizeof(Word) );
+   laog_back_srcs = VG_(newXA)( HG_(zalloc), "hg.laog__init.7",
+                                HG_(free), sizeof(Lock*) );
+}
+
+static LAOGLinks* laog__links ( Lock* lk ) {
+   UWord      keyW  = 0;
+   LAOGLinks* links = NULL;
+   if (VG_(lookupFM)( laog, &keyW, (UWord*)&links, (UWord)lk )) {
+      tl_assert(links);
+      tl_assert(keyW == (UWord)lk);
+      return links;
+   }
+   return NULL;
 }
 
 static void laog__show ( const HChar* who ) {
@@ -3539,7 +3617,7 @@ static void laog__show ( const HChar* who ) {
                                  (UWord*)&links )) {
       tl_assert(me);
       tl_assert(links);
-      VG_(printf)("   node %p:\n", me);
+      VG_(printf)("   node %p: ord %ld\n", me, links->ord);
       HG_(getPayloadWS)( &ws_words, &ws_size, univ_laog, links->inns );
       for (i = 0; i < ws_size; i++)
          VG_(printf)("      inn %#lx\n", ws_words[i] );
@@ -3573,6 +3651,8 @@ static void univ_laog_do_GC ( void ) {
       univ_laog_seen[links->inns] = True;
       tl_assert(links->outs >= 0 && links->outs < univ_laog_cardinality);
       univ_laog_seen[links->outs] = True;
+      tl_assert(links->backs >= 0 && links->backs < univ_laog_cardinality);
+      univ_laog_seen[links->backs] = True;
       links = NULL;
    }
    VG_(doneIterFM)( laog );
@@ -3627,10 +3707,208 @@ static void univ_laog_do_GC ( void ) {
 }
 
 
+static Int cmp_LAOGLinks_by_ord ( const void* v1, const void* v2 ) {
+   const LAOGLinks* l1 = *(LAOGLinks* const*)v1;
+   const LAOGLinks* l2 = *(LAOGLinks* const*)v2;
+   if (l1->ord < l2->ord) return -1;
+   if (l1->ord > l2->ord) return  1;
+   return 0;
+}
+
+static Int cmp_Word ( const void* v1, const void* v2 ) {
+   Word w1 = *(const Word*)v1;
+   Word w2 = *(const Word*)v2;
+   if (w1 < w2) return -1;
+   if (w1 > w2) return  1;
+   return 0;
+}
+
+/* Collect in 'res' the nodes reachable from 'start' (forwards if
+   'fwd', else backwards) through nodes whose ord is at most (if
+   'fwd'; at least if not) 'bound'.  Returns True, and stops early, if
+   'stop' is reached.  Nodes are marked with the current laog_mark. */
+static Bool laog__order_search ( Lock* start, LAOGLinks* startL, Bool fwd,
+                                 Word bound, Lock* stop, XArray* res )
+{
+   UWord  i, nbrs_size;
+   UWord* nbrs_words;
+
+   VG_(dropTailXA)( laog_stack, VG_(sizeXA)( laog_stack ) );
+   startL->mark = laog_mark;
+   (void) VG_(addToXA)( laog_stack, &start );
+   (void) VG_(addToXA)( res, &startL );
+
+   while (VG_(sizeXA)( laog_stack ) > 0) {
+      Word       ssz  = VG_(sizeXA)( laog_stack );
+      Lock*      here = *(Lock**) VG_(indexXA)( laog_stack, ssz-1 );
+      LAOGLinks* hereL;
+      VG_(dropTailXA)( laog_stack, 1 );
+      hereL = laog__links( here );
+      tl_assert(hereL);
+      stats__laog_visited++;
+      HG_(getPayloadWS)( &nbrs_words, &nbrs_size, univ_laog,
+                         fwd ? hereL->outs : hereL->inns );
+      for (i = 0; i < nbrs_size; i++) {
+         Lock*      nbr  = (Lock*)nbrs_words[i];
+         LAOGLinks* nbrL = laog__links( nbr );
+         tl_assert(nbrL);
+         /* Only follow the edges the order is kept for. */
+         if (laog_n_backs > 0
+             && (fwd ? HG_(elemWS)( univ_laog, hereL->backs, (UWord)nbr )
+                     : HG_(elemWS)( univ_laog, nbrL->backs, (UWord)here )))
+            continue;
+         if (nbr == stop)
+            return True;
+         if (nbrL->mark == laog_mark)
+            continue;
+         if (fwd ? nbrL->ord > bound : nbrL->ord < bound)
+            continue;
+         nbrL->mark = laog_mark;
+         (void) VG_(addToXA)( laog_stack, &nbr );
+         (void) VG_(addToXA)( res, &nbrL );
+      }
+   }
+   return False;
+}
+
+/* The edge src->dst has just been added.  Update the topological
+   order, or if the edge closes a cycle, leave it out of the order. */
+static void laog__order_add_edge ( Lock* src, LAOGLinks* srcL,
+                                   Lock* dst, LAOGLinks* dstL )
+{
+   Word i, nB, nF;
+
+   if (srcL->ord < dstL->ord)
+      return;
+
+   stats__laog_reorder++;
+   laog_mark++;
+   VG_(dropTailXA)( laog_deltaF, VG_(sizeXA)( laog_deltaF ) );
+   VG_(dropTailXA)( laog_deltaB, VG_(sizeXA)( laog_deltaB ) );
+   VG_(dropTailXA)( laog_ords,   VG_(sizeXA)( laog_ords ) );
+
+   /* Nodes reachable from dst that are not after src.  If src is
+      among them, the edge closes a cycle. */
+   if (dst == src
+       || laog__order_search( dst, dstL, True, srcL->ord, src,
+                              laog_deltaF )) {
+      if (HG_(isEmptyWS)( univ_laog, srcL->backs ))
+         (void) VG_(addToXA)( laog_back_srcs, &src );
+      srcL->backs = HG_(addToWS)( univ_laog, srcL->backs, (UWord)dst );
+      laog_n_backs++;
+      stats__laog_backs++;
+      return;
+   }
+   /* Nodes reaching src that are not before dst. */
+   laog__order_search( src, srcL, False, dstL->ord, NULL, laog_deltaB );
+
+   /* Give the orders of all these nodes back to them, first to those
+      reaching src and then to those reachable from dst, keeping the
+      relative order within each set. */
+   VG_(setCmpFnXA)( laog_deltaF, cmp_LAOGLinks_by_ord );
+   VG_(setCmpFnXA)( laog_deltaB, cmp_LAOGLinks_by_ord );
+   VG_(setCmpFnXA)( laog_ords,   cmp_Word );
+   VG_(sortXA)( laog_deltaF );
+   VG_(sortXA)( laog_deltaB );
+   nB = VG_(sizeXA)( laog_deltaB );
+   nF = VG_(sizeXA)( laog_deltaF );
+   for (i = 0; i < nB; i++)
+      (void) VG_(addToXA)( laog_ords,
+                           &(*(LAOGLinks**)VG_(indexXA)( laog_deltaB, i ))->ord );
+   for (i = 0; i < nF; i++)
+      (void) VG_(addToXA)( laog_ords,
+                           &(*(LAOGLinks**)VG_(indexXA)( laog_deltaF, i ))->ord );
+   VG_(sortXA)( laog_ords );
+   for (i = 0; i < nB; i++)
+      (*(LAOGLinks**)VG_(indexXA)( laog_deltaB, i ))->ord
+         = *(Word*)VG_(indexXA)( laog_ords, i );
+   for (i = 0; i < nF; i++)
+      (*(LAOGLinks**)VG_(indexXA)( laog_deltaF, i ))->ord
+         = *(Word*)VG_(indexXA)( laog_ords, nB + i );
+   tl_assert(srcL->ord < dstL->ord);
+}
+
+/* The edge src->dst is about to be deleted.  If it was left out of
+   the order, forget that. */
+static void laog__order_del_edge ( Lock* src, LAOGLinks* srcL, Lock* dst )
+{
+   Word i, n;
+
+   if (laog_n_backs == 0
+       || !HG_(elemWS)( univ_laog, srcL->backs, (UWord)dst ))
+      return;
+   srcL->backs = HG_(delFromWS)( univ_laog, srcL->backs, (UWord)dst );
+   laog_n_backs--;
+   if (!HG_(isEmptyWS)( univ_laog, srcL->backs ))
+      return;
+   n = VG_(sizeXA)( laog_back_srcs );
+   for (i = 0; i < n; i++) {
+      if (*(Lock**)VG_(indexXA)( laog_back_srcs, i ) == src) {
+         VG_(removeIndexXA)( laog_back_srcs, i );
+         return;
+      }
+   }
+   tl_assert(0);
+}
+
+/* Allocates a duplicate of words. Caller must HG_(free) the result. */
+static UWord* UWordV_dup(UWord* words, Word words_size)
+{
+   UInt i;
+
+   if (words_size == 0)
+      return NULL;
+
+   UWord *dup = HG_(zalloc) ("hg.dup.1", (SizeT) words_size * sizeof(UWord));
+
+   for (i = 0; i < words_size; i++)
+      dup[i] = words[i];
+
+   return dup;
+}
+
+/* Edges have been deleted, which may have broken the cycles that kept
+   some edges out of the order.  Try to put those back in. */
+static void laog__order_retry_backs ( void )
+{
+   Word   i, n;
+   UWord  j, nbacks;
+   UWord* backs_words;
+   Lock** srcs;
+
+   if (laog_n_backs == 0)
+      return;
+   /* laog__order_add_edge changes laog_back_srcs and the 'backs'. */
+   n    = VG_(sizeXA)( laog_back_srcs );
+   srcs = HG_(zalloc)( "hg.laog_retry.1", n * sizeof(Lock*) );
+   for (i = 0; i < n; i++)
+      srcs[i] = *(Lock**)VG_(indexXA)( laog_back_srcs, i );
+   VG_(dropTailXA)( laog_back_srcs, n );
+   for (i = 0; i < n; i++) {
+      LAOGLinks* srcL = laog__links( srcs[i] );
+      tl_assert(srcL);
+      HG_(getPayloadWS)( &backs_words, &nbacks, univ_laog, srcL->backs );
+      backs_words = UWordV_dup( backs_words, nbacks );
+      srcL->backs  = HG_(emptyWS)( univ_laog );
+      laog_n_backs -= nbacks;
+      for (j = 0; j < nbacks; j++) {
+         LAOGLinks* dstL = laog__links( (Lock*)backs_words[j] );
+         tl_assert(dstL);
+         laog__order_add_edge( srcs[i], srcL,
+                               (Lock*)backs_words[j], dstL );
+      }
+      if (backs_words)
+         HG_(free)( backs_words );
+   }
+   HG_(free)( srcs );
+}
+
 __attribute__((noinline))
 static void laog__add_edge ( Lock* src, Lock* dst ) {
    UWord      keyW;
    LAOGLinks* links;
+   LAOGLinks* srcL;
+   LAOGLinks* dstL;
    Bool       presentF, presentR;
    if (0) VG_(printf)("laog__add_edge %p %p\n", src, dst);
 
@@ -3658,8 +3936,12 @@ static void laog__add_edge ( Lock* src, Lock* dst ) {
       links = HG_(zalloc)("hg.lae.1", sizeof(LAOGLinks));
       links->inns = HG_(emptyWS)( univ_laog );
       links->outs = HG_(singletonWS)( univ_laog, (UWord)dst );
+      links->backs = HG_(emptyWS)( univ_laog );
+      /* No predecessors, so it can go first. */
+      links->ord  = --laog_ord_min;
       VG_(addToFM)( laog, (UWord)src, (UWord)links );
    }
+   srcL = links;
    /* Update the in edges for dst */
    keyW  = 0;
    links = NULL;
@@ -3674,11 +3956,18 @@ static void laog__add_edge ( Lock* src, Lock* dst ) {
       links = HG_(zalloc)("hg.lae.2", sizeof(LAOGLinks));
       links->inns = HG_(singletonWS)( univ_laog, (UWord)src );
       links->outs = HG_(emptyWS)( univ_laog );
+      links->backs = HG_(emptyWS)( univ_laog );
+      /* No successors, so it can go last. */
+      links->ord  = ++laog_ord_max;
       VG_(addToFM)( laog, (UWord)dst, (UWord)links );
    }
+   dstL = links;
 
    tl_assert( (presentF && presentR) || (!presentF && !presentR) );
 
+   if (!presentF)
+      laog__order_add_edge( src, srcL, dst, dstL );
+
    if (!presentF && src->acquired_at && dst->acquired_at) {
       LAOGLinkExposition expo;
       /* If this edge is entering the graph, and we have acquired_at
@@ -3721,6 +4010,7 @@ static void laog__del_edge ( Lock* src, Lock* dst ) {
    if (VG_(lookupFM)( laog, &keyW, (UWord*)&links, (UWord)src )) {
       tl_assert(links);
       tl_assert(keyW == (UWord)src);
+      laog__order_del_edge( src, links, dst );
       links->outs = HG_(delFromWS)( univ_laog, links->outs, (UWord)dst );
    }
    /* Update the in edges for dst */
@@ -3811,7 +4101,12 @@ static void laog__sanity_check ( const HChar* who ) {
                              laog__preds( (Lock*)ws_words[i] ), 
                              (UWord)me ))
             goto bad;
+         if (links->ord >= laog__links( (Lock*)ws_words[i] )->ord
+             && !HG_(elemWS)( univ_laog, links->backs, ws_words[i] ))
+            goto bad;
       }
+      if (!HG_(isSubsetOf)( univ_laog, links->backs, links->outs ))
+         goto bad;
       me = NULL;
       links = NULL;
    }
@@ -3832,14 +4127,15 @@ __attribute__((noinline))
 static
 Lock* laog__do_dfs_from_to ( Lock* src, WordSetID dsts /* univ_lsets */ )
 {
-   Lock*     ret;
-   Word      ssz;
-   XArray*   stack;   /* of Lock* */
-   WordFM*   visited; /* Lock* -> void, iow, Set(Lock*) */
-   Lock*     here;
-   WordSetID succs;
-   UWord     succs_size, i;
-   UWord*    succs_words;
+   Lock*      ret;
+   Word       ssz;
+   Lock*      here;
+   LAOGLinks* srcL;
+   LAOGLinks* hereL;
+   Word       bound;
+   UWord      dsts_size, succs_size, i;
+   UWord*     dsts_words;
+   UWord*     succs_words;
    //laog__sanity_check();
 
    /* If the destination set is empty, we can never get there from
@@ -3847,36 +4143,76 @@ Lock* laog__do_dfs_from_to ( Lock* src, WordSetID dsts /* univ_lsets */ )
    if (HG_(isEmptyWS)( univ_lsets, dsts ))
       return NULL;
 
-   ret     = NULL;
-   stack   = VG_(newXA)( HG_(zalloc), "hg.lddft.1", HG_(free), sizeof(Lock*) );
-   visited = VG_(newFM)( HG_(zalloc), "hg.lddft.2", HG_(free), NULL/*unboxedcmp*/ );
+   /* Nor if 'src' has no successors. */
+   srcL = laog__links( src );
+   if (srcL == NULL)
+      return NULL;
+
+   stats__laog_checks++;
 
-   (void) VG_(addToXA)( stack, &src );
+   /* With a topological order, only nodes ordered after 'src' and not
+      after the last of 'dsts' can be on a path from one to the other,
+      unless the path takes an edge left out of the order.  The first
+      such edge on it leaves a node ordered after 'src', so there is
+      no need to go beyond the last of those either. */
+   bound = 0;
+   {
+      Bool any = False;
+      HG_(getPayloadWS)( &dsts_words, &dsts_size, univ_lsets, dsts );
+      for (i = 0; i < dsts_size; i++) {
+         LAOGLinks* dL = laog__links( (Lock*)dsts_words[i] );
+         if (dL && dL->ord > srcL->ord && (!any || dL->ord > bound)) {
+            bound = dL->ord;
+            any   = True;
+         }
+      }
+      for (i = 0; i < (UWord)VG_(sizeXA)( laog_back_srcs ); i++) {
+         LAOGLinks* bL
+            = laog__links( *(Lock**)VG_(indexXA)( laog_back_srcs, i ) );
+         tl_assert(bL);
+         if (bL->ord >= srcL->ord && (!any || bL->ord > bound)) {
+            bound = bL->ord;
+            any   = True;
+         }
+      }
+      if (!any) {
+         stats__laog_trivial++;
+         return NULL;
+      }
+   }
+
+   ret = NULL;
+   laog_mark++;
+   VG_(dropTailXA)( laog_stack, VG_(sizeXA)( laog_stack ) );
+   srcL->mark = laog_mark;
+   (void) VG_(addToXA)( laog_stack, &src );
 
    while (True) {
 
-      ssz = VG_(sizeXA)( stack );
+      ssz = VG_(sizeXA)( laog_stack );
 
       if (ssz == 0) { ret = NULL; break; }
 
-      here = *(Lock**) VG_(indexXA)( stack, ssz-1 );
-      VG_(dropTailXA)( stack, 1 );
+      here = *(Lock**) VG_(indexXA)( laog_stack, ssz-1 );
+      VG_(dropTailXA)( laog_stack, 1 );
 
       if (HG_(elemWS)( univ_lsets, dsts, (UWord)here )) { ret = here; break; }
 
-      if (VG_(lookupFM)( visited, NULL, NULL, (UWord)here ))
-         continue;
-
-      VG_(addToFM)( visited, (UWord)here, 0 );
-
-      succs = laog__succs( here );
-      HG_(getPayloadWS)( &succs_words, &succs_size, univ_laog, succs );
-      for (i = 0; i < succs_size; i++)
-         (void) VG_(addToXA)( stack, &succs_words[i] );
+      hereL = laog__links( here );
+      tl_assert(hereL);
+      HG_(getPayloadWS)( &succs_words, &succs_size, univ_laog, hereL->outs );
+      for (i = 0; i < succs_size; i++) {
+         LAOGLinks* succL = laog__links( (Lock*)succs_words[i] );
+         tl_assert(succL);
+         if (succL->mark == laog_mark)
+            continue;
+         if (succL->ord > bound)
+            continue;
+         succL->mark = laog_mark;
+         (void) VG_(addToXA)( laog_stack, &succs_words[i] );
+      }
    }
 
-   VG_(deleteFM)( visited, NULL, NULL );
-   VG_(deleteXA)( stack );
    return ret;
 }
 
@@ -4007,22 +4343,6 @@ static void laog__pre_thread_acquires_lock (
       all_except_Locks__sanity_check("laog__pre_thread_acquires_lock-post");
 }
 
-/* Allocates a duplicate of words. Caller must HG_(free) the result. */
-static UWord* UWordV_dup(UWord* words, Word words_size)
-{
-   UInt i;
-
-   if (words_size == 0)
-      return NULL;
-
-   UWord *dup = HG_(zalloc) ("hg.dup.1", (SizeT) words_size * sizeof(UWord));
-
-   for (i = 0; i < words_size; i++)
-      dup[i] = words[i];
-
-   return dup;
-}
-
 /* Delete from 'laog' any pair mentioning a lock in locksToDelete */
 
 __attribute__((noinline))
@@ -4077,6 +4397,8 @@ static void laog__handle_one_lock_deletion ( Lock* lk )
       }
    }
    /* FIXME ??? What about removing lock lk data from EXPOSITION ??? */
+
+   laog__order_retry_backs();
 }
 
 //__attribute__((noinline))
@@ -4416,13 +4738,47 @@ static IRExpr* mk_And1 ( IRSB* sbOut, IRExpr* arg1, IRExpr* arg2 )
    return mkexpr(res);
 }
 
+/* Per-superblock state for --race-sampling (see gen_sample_guard). */
+typedef
+   struct {
+      IRExpr* sampled; /* Ity_I1 atom: are this superblock's accesses
+                          to be checked?  NULL if sampling is off */
+      Int     nFixed;  /* number of accesses always checkable */
+      IRTemp  nVar;    /* Ity_I64: number of the others which turned
+                          out to be checkable, or IRTemp_INVALID */
+   }
+   SampleInfo;
+
+/* Count an access that would be checked, were it not for sampling,
+   if |cond| holds (NULL => True). */
+static void count_checkable_access ( IRSB* sbOut, SampleInfo* si,
+                                     IRExpr* cond )
+{
+   IRTemp n, sum;
+
+   if (!cond) {
+      si->nFixed++;
+      return;
+   }
+   n = newIRTemp(sbOut->tyenv, Ity_I64);
+   addStmtToIRSB(sbOut, assign(n, unop(Iop_1Uto64, cond)));
+   if (si->nVar != IRTemp_INVALID) {
+      sum = newIRTemp(sbOut->tyenv, Ity_I64);
+      addStmtToIRSB(sbOut, assign(sum, binop(Iop_Add64, mkexpr(si->nVar),
+                                                        mkexpr(n))));
+      n = sum;
+   }
+   si->nVar = n;
+}
+
 static void instrument_mem_access ( IRSB*   sbOut, 
                                     IRExpr* addr,
                                     Int     szB,
                                     Bool    isStore,
                                     Int     hWordTy_szB,
                                     Int     goff_sp,
-                                    IRExpr* guard ) /* NULL => True */
+                                    IRExpr* guard, /* NULL => True */
+                                    SampleInfo* si )
 {
    IRType   tyAddr   = Ity_INVALID;
    const HChar* hName    = NULL;
@@ -4577,11 +4933,159 @@ static void instrument_mem_access ( IRSB*   sbOut,
       di->guard = mk_And1(sbOut, di->guard, guard);
    }
 
+   /* With --race-sampling, count the access if it is to be checked at
+      all, then only check it if the superblock is sampled. */
+   if (si->sampled) {
+      count_checkable_access(
+         sbOut, si,
+         guard || !HG_(clo_check_stack_refs) ? di->guard : NULL );
+      di->guard = mk_And1(sbOut, di->guard, si->sampled);
+   }
+
    /* Add the helper. */
    addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
 }
 
 
+/* Race sampling.  With --race-sampling=N, N > 1, each superblock is
+   assigned to one of N slots by a hash of the 4K page holding its
+   first instruction, so that code which is close together, such as
+   one function, usually lands in the same slot.  The superblock
+   starts by comparing its slot with hg_sample_slot, and its memory
+   accesses are only passed to libhb when they are equal.  An
+   unsampled access therefore costs no more than a guarded-off helper
+   call.  Each thread moves to the next slot every time it is
+   scheduled.
+
+   Skipping accesses can only lose races, not invent them: the shadow
+   state just keeps the previous checked access, and anything which
+   happens-after a skipped access also happens-after everything that
+   preceded it in that thread.
+
+   The generated code also counts, at the end of each superblock, how
+   many of its memory accesses would have been checked without
+   sampling (so not those in the dynamic linker, nor stack references
+   with --check-stack-refs=no), and how many of them were.  hg_fini
+   reports this as the coverage achieved.  Superblocks left by a side
+   exit are not counted, which makes little difference to the ratio. */
+
+static ULong stats__sample_accesses = 0;
+static ULong stats__sample_checked  = 0;
+
+static UInt sample_slot_for ( Addr ga )
+{
+   ULong h = (ULong)(ga >> 12) * 0x9E3779B97F4A7C15ULL;
+   return (UInt)((h >> 32) % HG_(clo_race_sampling));
+}
+
+/* Does bbIn contain anything hg_instrument might instrument? */
+static Bool has_mem_accesses ( const IRSB* bbIn )
+{
+   Int i;
+   for (i = 0; i < bbIn->stmts_used; i++) {
+      const IRStmt* st = bbIn->stmts[i];
+      switch (st->tag) {
+         case Ist_Store: case Ist_StoreG: case Ist_LoadG: case Ist_CAS:
+         case Ist_LLSC:
+            return True;
+         case Ist_WrTmp:
+            if (st->Ist.WrTmp.data->tag == Iex_Load)
+               return True;
+            break;
+         case Ist_Dirty:
+            if (st->Ist.Dirty.details->mFx != Ifx_None)
+               return True;
+            break;
+         default:
+            break;
+      }
+   }
+   return False;
+}
+
+static void add_sample_counter ( IRSB* sbOut, ULong* counter, IRExpr* e )
+{
+#  if defined(VG_BIGENDIAN)
+   const IREndness end = Iend_BE;
+#  else
+   const IREndness end = Iend_LE;
+#  endif
+   IRExpr* caddr = mkIRExpr_HWord( (HWord)counter );
+   IRTemp  t1    = newIRTemp(sbOut->tyenv, Ity_I64);
+   IRTemp  t2    = newIRTemp(sbOut->tyenv, Ity_I64);
+   addStmtToIRSB( sbOut, assign(t1, IRExpr_Load(end, Ity_I64, caddr)) );
+   addStmtToIRSB( sbOut, assign(t2, binop(Iop_Add64, mkexpr(t1), e)) );
+   addStmtToIRSB( sbOut, IRStmt_Store(end, caddr, mkexpr(t2)) );
+}
+
+/* Generate the sampling test at the start of a superblock whose first
+   instruction is at ga, and set si->sampled to the guard to put on
+   its accesses, or NULL if every access is to be checked. */
+static void gen_sample_guard ( IRSB* sbOut, const IRSB* bbIn, Addr ga,
+                               /*OUT*/SampleInfo* si )
+{
+#  if defined(VG_BIGENDIAN)
+   const IREndness end = Iend_BE;
+#  else
+   const IREndness end = Iend_LE;
+#  endif
+   IRTemp slot, sampled;
+
+   si->sampled = NULL;
+   si->nFixed  = 0;
+   si->nVar    = IRTemp_INVALID;
+   if (HG_(clo_race_sampling) <= 1 || !has_mem_accesses(bbIn))
+      return;
+
+   slot    = newIRTemp(sbOut->tyenv, Ity_I32);
+   sampled = newIRTemp(sbOut->tyenv, Ity_I1);
+   addStmtToIRSB( sbOut,
+                  assign(slot, IRExpr_Load(end, Ity_I32,
+                                           mkIRExpr_HWord(
+                                              (HWord)&hg_sample_slot ))) );
+   addStmtToIRSB( sbOut,
+                  assign(sampled, binop(Iop_CmpEQ32, mkexpr(slot),
+                                        mkU32(sample_slot_for(ga)))) );
+   si->sampled = mkexpr(sampled);
+}
+
+/* At the end of the superblock, add up what was counted by
+   count_checkable_access. */
+static void gen_sample_counts ( IRSB* sbOut, const SampleInfo* si )
+{
+   IRExpr* n;
+   IRTemp  nAll, nChecked;
+
+   if (!si->sampled || (si->nFixed == 0 && si->nVar == IRTemp_INVALID))
+      return;
+
+   n = mkU64(si->nFixed);
+   if (si->nVar != IRTemp_INVALID) {
+      nAll = newIRTemp(sbOut->tyenv, Ity_I64);
+      addStmtToIRSB( sbOut, assign(nAll, binop(Iop_Add64, mkexpr(si->nVar),
+                                                          n)) );
+      n = mkexpr(nAll);
+   }
+   nChecked = newIRTemp(sbOut->tyenv, Ity_I64);
+   addStmtToIRSB( sbOut,
+                  assign(nChecked, IRExpr_ITE(si->sampled, n, mkU64(0))) );
+   add_sample_counter( sbOut, &stats__sample_accesses, n );
+   add_sample_counter( sbOut, &stats__sample_checked, mkexpr(nChecked) );
+}
+
+static void print_sample_coverage ( void )
+{
+   if (HG_(clo_race_sampling) <= 1)
+      return;
+   VG_(umsg)("race sampling: checked %'llu of %'llu memory accesses "
+             "(%llu%%)\n",
+             stats__sample_checked, stats__sample_accesses,
+             stats__sample_accesses == 0
+                ? 0ULL
+                : (stats__sample_checked * 100) / stats__sample_accesses);
+}
+
+
 /* Figure out if GA is a guest code address in the dynamic linker, and
    if so return True.  Otherwise (and in case of any doubt) return
    False.  (sidedly safe w/ False as the safe value) */
@@ -4614,6 +5118,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
    IRStmt* st;
    Bool    inLDSO = False;
    Addr    inLDSOmask4K = 1; /* mismatches on first check */
+   SampleInfo si;
 
    const Int goff_sp = layout->offset_SP;
 
@@ -4648,6 +5153,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
    cia = st->Ist.IMark.addr;
    st = NULL;
 
+   gen_sample_guard(bbOut, bbIn, cia, &si);
+
    for (/*use current i*/; i < bbIn->stmts_used; i++) {
       st = bbIn->stmts[i];
       tl_assert(st);
@@ -4711,7 +5218,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      * sizeofIRType(typeOfIRExpr(bbIn->tyenv, cas->dataLo)),
                   False/*!isStore*/,
                   sizeofIRType(hWordTy), goff_sp,
-                  NULL/*no-guard*/
+                  NULL, &si
                );
             }
             break;
@@ -4732,7 +5239,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      sizeofIRType(dataTy),
                      False/*!isStore*/,
                      sizeofIRType(hWordTy), goff_sp,
-                     NULL/*no-guard*/
+                     NULL, &si
                   );
                }
             } else {
@@ -4750,7 +5257,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   sizeofIRType(typeOfIRExpr(bbIn->tyenv, st->Ist.Store.data)),
                   True/*isStore*/,
                   sizeofIRType(hWordTy), goff_sp,
-                  NULL/*no-guard*/
+                  NULL, &si
                );
             }
             break;
@@ -4764,7 +5271,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             instrument_mem_access( bbOut, addr, sizeofIRType(type),
                                    True/*isStore*/,
                                    sizeofIRType(hWordTy),
-                                   goff_sp, sg->guard );
+                                   goff_sp,
+                                   sg->guard, &si );
             break;
          }
 
@@ -4778,7 +5286,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
             instrument_mem_access( bbOut, addr, sizeofIRType(type),
                                    False/*!isStore*/,
                                    sizeofIRType(hWordTy),
-                                   goff_sp, lg->guard );
+                                   goff_sp,
+                                   lg->guard, &si );
             break;
          }
 
@@ -4792,7 +5301,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                      sizeofIRType(data->Iex.Load.ty),
                      False/*!isStore*/,
                      sizeofIRType(hWordTy), goff_sp,
-                     NULL/*no-guard*/
+                     NULL, &si
                   );
                }
             }
@@ -4812,7 +5321,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   if (!inLDSO) {
                      instrument_mem_access( 
                         bbOut, d->mAddr, dataSize, False/*!isStore*/,
-                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/
+                        sizeofIRType(hWordTy), goff_sp, NULL, &si
                      );
                   }
                }
@@ -4820,7 +5329,7 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
                   if (!inLDSO) {
                      instrument_mem_access( 
                         bbOut, d->mAddr, dataSize, True/*isStore*/,
-                        sizeofIRType(hWordTy), goff_sp, NULL/*no-guard*/
+                        sizeofIRType(hWordTy), goff_sp, NULL, &si
                      );
                   }
                }
@@ -4841,6 +5350,8 @@ IRSB* hg_instrument ( VgCallbackClosure* closure,
       addStmtToIRSB( bbOut, st );
    } /* iterate over bbIn->stmts */
 
+   gen_sample_counts(bbOut, &si);
+
    return bbOut;
 }
 
@@ -5519,6 +6030,8 @@ static Bool hg_process_cmd_line_option ( const HChar* arg )
 
    else if VG_BINT_CLO(arg, "--conflict-cache-size",
                        HG_(clo_conflict_cache_size), 10*1000, 150*1000*1000) {}
+   else if VG_STR_CLO(arg, "--history-spill-file",
+                      HG_(clo_history_spill_file)) {}
 
    /* "stuvwx" --> stuvwx (binary) */
    else if VG_STR_CLO(arg, "--hg-sanity-flags", tmp_str) {
@@ -5553,6 +6066,8 @@ static Bool hg_process_cmd_line_option ( const HChar* arg )
 
    else if VG_BOOL_CLO(arg, "--check-stack-refs",
                             HG_(clo_check_stack_refs)) {}
+   else if VG_BINT_CLO(arg, "--race-sampling",
+                       HG_(clo_race_sampling), 1, 1024) {}
    else if VG_BOOL_CLO(arg, "--ignore-thread-creation",
                             HG_(clo_ignore_thread_creation)) {}
 
@@ -5572,8 +6087,12 @@ static void hg_print_usage ( void )
 "       approx: full trace for one thread, approx for the other (faster)\n"
 "       none:   only show trace for one thread in a race (fastest)\n"
 "    --conflict-cache-size=N   size of 'full' history cache [2000000]\n"
+"    --history-spill-file=<file> keep 'full' history dropped from the\n"
+"                              cache in <file> [none]\n"
 "    --check-stack-refs=no|yes race-check reads and writes on the\n"
 "                              main stack and thread stacks? [yes]\n"
+"    --race-sampling=N         race-check only about 1 in N code regions\n"
+"                              at a time, rotating, for speed [1]\n"
 "    --ignore-thread-creation=yes|no Ignore activities during thread\n"
 "                              creation [%s]\n",
 HG_(clo_ignore_thread_creation) ? "yes" : "no"
@@ -5653,6 +6172,12 @@ static void hg_print_stats (void)
                   (Int)(laog ? VG_(sizeFM)( laog ) : 0));
       VG_(printf)(" LAOG exposition: %'8d map size\n",
                   (Int)(laog_exposition ? VG_(sizeFM)( laog_exposition ) : 0));
+      VG_(printf)("      LAOG order: %'8llu checks (%'llu trivial), "
+                  "%'llu reorders (%'llu nodes), "
+                  "%'llu edges left out (%'lu now)\n",
+                  stats__laog_checks, stats__laog_trivial,
+                  stats__laog_reorder, stats__laog_visited,
+                  stats__laog_backs, laog_n_backs);
    }
 
    VG_(printf)("           locks: %'8lu acquires, "
@@ -5687,6 +6212,9 @@ static void hg_fini ( Int exitcode )
    if (HG_(clo_sanity_flags))
       all__sanity_check("SK_(fini)");
 
+   if (VG_(clo_verbosity) > 1 || VG_(clo_stats))
+      print_sample_coverage();
+
    if (VG_(clo_stats))
       hg_print_stats();
 }
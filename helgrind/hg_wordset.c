@@ -39,7 +39,6 @@
 #include "pub_tool_libcbase.h"
 #include "pub_tool_libcprint.h"
 #include "pub_tool_threadstate.h"
-#include "pub_tool_wordfm.h"
 
 #include "hg_basics.h"
 #include "hg_wordset.h"     /* self */
@@ -52,77 +51,65 @@
 //------------------------------------------------------------------//
 
 typedef
-   struct { UWord arg1; UWord arg2; UWord res; }
+   struct { UWord arg1; UWord arg2; WordSet res; UInt epoch; }
    WCacheEnt;
 
-/* Each cache is a fixed sized array of N_WCACHE_STAT_MAX entries.
-   However only the first .dynMax are used.  This is because at some
-   point, expanding the cache further overall gives a slowdown because
-   searching more entries more than negates any performance advantage
-   from caching those entries in the first place.  Hence use .dynMax
-   to allow the size of the cache(s) to be set differently for each
-   different WordSetU. */
-#define N_WCACHE_STAT_MAX 32
+/* Each cache is a two-way set-associative table of 2 * (mask+1)
+   entries, indexed by a hash of the operation's arguments.  An entry
+   is only valid if its .epoch is the cache's current .epoch, so the
+   whole cache can be invalidated in constant time by bumping the
+   latter (see HG_(dieWS)). */
 typedef
    struct {
-      WCacheEnt ent[N_WCACHE_STAT_MAX];
-      UWord     dynMax; /* 1 .. N_WCACHE_STAT_MAX inclusive */
-      UWord     inUse;  /* 0 .. dynMax inclusive */
+      WCacheEnt* ent;
+      UWord      mask;  /* number of sets - 1 */
+      UInt       epoch; /* never 0, which marks never-used entries */
    }
    WCache;
 
-#define WCache_INIT(_zzcache,_zzdynmax)                              \
-   do {                                                              \
-      tl_assert((_zzdynmax) >= 1);                                   \
-      tl_assert((_zzdynmax) <= N_WCACHE_STAT_MAX);                   \
-      (_zzcache).dynMax = (_zzdynmax);                               \
-      (_zzcache).inUse = 0;                                          \
-   } while (0)
+#if VG_WORDSIZE == 8
+#  define WS_HASH_K ((UWord)0x9E3779B97F4A7C15ULL)
+#  define WS_WORD_BITS_LOG2 6
+#else
+#  define WS_HASH_K ((UWord)0x9E3779B9UL)
+#  define WS_WORD_BITS_LOG2 5
+#endif
+
+#define WCache_SET(_cache,_arg1,_arg2)                               \
+   (((((_arg1) * WS_HASH_K) ^ (_arg2)) * WS_HASH_K                   \
+     >> (VG_WORDSIZE * 4)) & (_cache)->mask)
 
 #define WCache_LOOKUP_AND_RETURN(_retty,_zzcache,_zzarg1,_zzarg2)    \
    do {                                                              \
-      UWord   _i;                                                    \
-      UWord   _arg1  = (UWord)(_zzarg1);                             \
-      UWord   _arg2  = (UWord)(_zzarg2);                             \
-      WCache* _cache = &(_zzcache);                                  \
-      tl_assert(_cache->dynMax >= 1);                                \
-      tl_assert(_cache->dynMax <= N_WCACHE_STAT_MAX);                \
-      tl_assert(_cache->inUse >= 0);                                 \
-      tl_assert(_cache->inUse <= _cache->dynMax);                    \
-      if (_cache->inUse > 0) {                                       \
-         if (_cache->ent[0].arg1 == _arg1                            \
-             && _cache->ent[0].arg2 == _arg2)                        \
-            return (_retty)_cache->ent[0].res;                       \
-         for (_i = 1; _i < _cache->inUse; _i++) {                    \
-            if (_cache->ent[_i].arg1 == _arg1                        \
-                && _cache->ent[_i].arg2 == _arg2) {                  \
-               WCacheEnt tmp     = _cache->ent[_i-1];                \
-               _cache->ent[_i-1] = _cache->ent[_i];                  \
-               _cache->ent[_i]   = tmp;                              \
-               return (_retty)_cache->ent[_i-1].res;                 \
-            }                                                        \
-         }                                                           \
+      UWord      _arg1  = (UWord)(_zzarg1);                          \
+      UWord      _arg2  = (UWord)(_zzarg2);                          \
+      WCache*    _cache = &(_zzcache);                               \
+      WCacheEnt* _e                                                  \
+         = &_cache->ent[2 * WCache_SET(_cache, _arg1, _arg2)];       \
+      if (_e[0].arg1 == _arg1 && _e[0].arg2 == _arg2                 \
+          && _e[0].epoch == _cache->epoch)                           \
+         return (_retty)_e[0].res;                                   \
+      if (_e[1].arg1 == _arg1 && _e[1].arg2 == _arg2                 \
+          && _e[1].epoch == _cache->epoch) {                         \
+         WCacheEnt _tmp = _e[0];                                     \
+         _e[0] = _e[1];                                              \
+         _e[1] = _tmp;                                               \
+         return (_retty)_e[0].res;                                   \
       }                                                              \
    } while (0)
 
 #define WCache_UPDATE(_zzcache,_zzarg1,_zzarg2,_zzresult)            \
    do {                                                              \
-      Word    _i;                                                    \
-      UWord   _arg1  = (UWord)(_zzarg1);                             \
-      UWord   _arg2  = (UWord)(_zzarg2);                             \
-      UWord   _res   = (UWord)(_zzresult);                           \
-      WCache* _cache = &(_zzcache);                                  \
-      tl_assert(_cache->dynMax >= 1);                                \
-      tl_assert(_cache->dynMax <= N_WCACHE_STAT_MAX);                \
-      tl_assert(_cache->inUse >= 0);                                 \
-      tl_assert(_cache->inUse <= _cache->dynMax);                    \
-      if (_cache->inUse < _cache->dynMax)                            \
-         _cache->inUse++;                                            \
-      for (_i = _cache->inUse-1; _i >= 1; _i--)                      \
-         _cache->ent[_i] = _cache->ent[_i-1];                        \
-      _cache->ent[0].arg1 = _arg1;                                   \
-      _cache->ent[0].arg2 = _arg2;                                   \
-      _cache->ent[0].res  = _res;                                    \
+      UWord      _arg1  = (UWord)(_zzarg1);                          \
+      UWord      _arg2  = (UWord)(_zzarg2);                          \
+      WCache*    _cache = &(_zzcache);                               \
+      WCacheEnt* _e                                                  \
+         = &_cache->ent[2 * WCache_SET(_cache, _arg1, _arg2)];       \
+      _e[1]       = _e[0];                                           \
+      _e[0].arg1  = _arg1;                                           \
+      _e[0].arg2  = _arg2;                                           \
+      _e[0].res   = (WordSet)(_zzresult);                            \
+      _e[0].epoch = _cache->epoch;                                   \
    } while (0)
 
 
@@ -131,35 +118,50 @@ typedef
 //---                       Implementation                       ---//
 //------------------------------------------------------------------//
 
+/* The words of a WordVec are allocated along with it, just after it.
+   'sig' has a bit set for each word (see word_sig), which allows
+   many membership and disjointness questions to be answered without
+   looking at the words. */
 typedef
    struct {
       WordSetU* owner; /* for sanity checking */
       UWord*    words;
       UWord     size; /* Really this should be SizeT */
+      UWord     hash; /* of size and words */
+      UWord     sig;  /* OR of word_sig of the words */
    }
    WordVec;
 
+#define WS_HT_EMPTY   ((WordSet)0xFFFFFFFF)
+#define WS_HT_DELETED ((WordSet)0xFFFFFFFE)
+
 /* ix2vec[0 .. ix2vec_used-1] are pointers to the lock sets (WordVecs)
-   really.  vec2ix is the inverse mapping, mapping WordVec* to the
-   corresponding ix2vec entry number.  The two mappings are mutually
-   redundant. 
+   really.  htab is the inverse mapping, an open addressing hash table
+   (with linear probing) of the live WordSets, keyed by their WordVec
+   contents.  The two mappings are mutually redundant.
 
    If a WordVec WV is marked as dead by HG(dieWS), WV is removed from
-   vec2ix. The entry of the dead WVs in ix2vec are used to maintain a
+   htab. The entry of the dead WVs in ix2vec are used to maintain a
    linked list of free (to be re-used) ix2vec entries. */
 struct _WordSetU {
       void*     (*alloc)(const HChar*,SizeT);
       const HChar* cc;
       void      (*dealloc)(void*);
-      WordFM*   vec2ix; /* WordVec-to-WordSet mapping tree */
+      WordSet*  htab; /* WordVec-to-WordSet hash table */
+      UWord     htab_size; /* a power of 2 */
+      UWord     htab_live; /* nr of entries holding a WordSet */
+      UWord     htab_tomb; /* nr of WS_HT_DELETED entries */
       WordVec** ix2vec; /* WordSet-to-WordVec mapping array */
       UWord     ix2vec_size;
       UWord     ix2vec_used;
       WordVec** ix2vec_free;
+      UWord*    scratch; /* where operations build their result */
+      UWord     scratch_size;
       WordSet   empty; /* cached, for speed */
       /* Caches for some operations */
       WCache    cache_addTo;
       WCache    cache_delFrom;
+      WCache    cache_union;
       WCache    cache_intersect;
       WCache    cache_minus;
       /* Stats */
@@ -169,6 +171,7 @@ struct _WordSetU {
       UWord     n_del_uncached;
       UWord     n_die;
       UWord     n_union;
+      UWord     n_union_uncached;
       UWord     n_intersect;
       UWord     n_intersect_uncached;
       UWord     n_minus;
@@ -179,61 +182,83 @@ struct _WordSetU {
       UWord     n_isSingleton;
       UWord     n_anyElementOf;
       UWord     n_isSubsetOf;
+      UWord     n_intern;
+      UWord     n_intern_new;
    };
 
+static void WCache_init ( WordSetU* wsu, WCache* cache, Word cacheSize )
+{
+   UWord nSets = 1;
+   tl_assert(cacheSize >= 1);
+   while (nSets < 32 * (UWord)cacheSize)
+      nSets *= 2;
+   cache->ent   = wsu->alloc( wsu->cc, 2 * nSets * sizeof(WCacheEnt) );
+   VG_(memset)( cache->ent, 0, 2 * nSets * sizeof(WCacheEnt) );
+   cache->mask  = nSets - 1;
+   cache->epoch = 1;
+}
+
+static void WCache_invalidate ( WCache* cache )
+{
+   cache->epoch++;
+   if (cache->epoch == 0) {
+      VG_(memset)( cache->ent, 0, 2 * (cache->mask + 1) * sizeof(WCacheEnt) );
+      cache->epoch = 1;
+   }
+}
+
+static inline UWord word_sig ( UWord w )
+{
+   return (UWord)1 << ((w * WS_HASH_K) >> (8 * VG_WORDSIZE
+                                           - WS_WORD_BITS_LOG2));
+}
+
+static UWord hash_words ( const UWord* words, UWord size )
+{
+   UWord i;
+   UWord h = size;
+   for (i = 0; i < size; i++) {
+      h ^= words[i];
+      h *= WS_HASH_K;
+      h ^= h >> (VG_WORDSIZE * 4 - 3);
+   }
+   return h;
+}
+
 /* Create a new WordVec of the given size. */
 
 static WordVec* new_WV_of_size ( WordSetU* wsu, UWord sz )
 {
    WordVec* wv;
    tl_assert(sz >= 0);
-   wv = wsu->alloc( wsu->cc, sizeof(WordVec) );
+   wv = wsu->alloc( wsu->cc, sizeof(WordVec) + (SizeT)sz * sizeof(UWord) );
    wv->owner = wsu;
-   wv->words = NULL;
-   wv->size = sz;
-   if (sz > 0) {
-     wv->words = wsu->alloc( wsu->cc, (SizeT)sz * sizeof(UWord) );
-   }
+   wv->words = sz > 0 ? (UWord*)(wv + 1) : NULL;
+   wv->size  = sz;
+   wv->hash  = 0;
+   wv->sig   = 0;
    return wv;
 }
 
 static void delete_WV ( WordVec* wv )
 {
-   void (*dealloc)(void*) = wv->owner->dealloc;
-   if (wv->words) {
-      dealloc(wv->words);
-   }
-   dealloc(wv);
-}
-static void delete_WV_for_FM ( UWord wv ) {
-   delete_WV( (WordVec*)wv );
+   wv->owner->dealloc(wv);
 }
 
-static Word cmp_WordVecs_for_FM ( UWord wv1W, UWord wv2W )
+/* Make sure wsu->scratch can hold at least sz words. */
+static UWord* ensure_scratch ( WordSetU* wsu, UWord sz )
 {
-   UWord    i;
-   WordVec* wv1    = (WordVec*)wv1W;
-   WordVec* wv2    = (WordVec*)wv2W;
-
-   // WordVecs with smaller size are smaller.
-   if (wv1->size < wv2->size) {
-      return -1;
-   }
-   if (wv1->size > wv2->size) {
-      return 1;
-   }
-
-   // Sizes are equal => order based on content.
-   for (i = 0; i < wv1->size; i++) {
-      if (wv1->words[i] == wv2->words[i])
-         continue;
-      if (wv1->words[i] < wv2->words[i])
-         return -1;
-      if (wv1->words[i] > wv2->words[i])
-         return 1;
-      tl_assert(0);
-   }
-   return 0; /* identical */
+   UWord new_sz;
+   if (sz <= wsu->scratch_size)
+      return wsu->scratch;
+   new_sz = 2 * wsu->scratch_size;
+   if (new_sz < 16) new_sz = 16;
+   if (new_sz < sz) new_sz = sz;
+   if (wsu->scratch)
+      wsu->dealloc(wsu->scratch);
+   wsu->scratch = wsu->alloc( wsu->cc, new_sz * sizeof(UWord) );
+   wsu->scratch_size = new_sz;
+   return wsu->scratch;
 }
 
 static void ensure_ix2vec_space ( WordSetU* wsu )
@@ -305,51 +330,116 @@ static WordVec* do_ix2vec_with_dead ( WordSetU* wsu, WordSet ws )
    return wv;
 }
 
-/* See if wv is contained within wsu.  If so, deallocate wv and return
-   the index of the already-present copy.  If not, add wv to both the
-   vec2ix and ix2vec mappings and return its index. 
-*/
-static WordSet add_or_dealloc_WordVec( WordSetU* wsu, WordVec* wv_new )
-{
-   Bool     have;
-   WordVec* wv_old;
-   UWord/*Set*/ ix_old = -1;
-   /* Really WordSet, but need something that can safely be casted to
-      a Word* in the lookupFM.  Making it WordSet (which is 32 bits)
-      causes failures on a 64-bit platform. */
-   tl_assert(wv_new->owner == wsu);
-   have = VG_(lookupFM)( wsu->vec2ix, 
-                         (UWord*)&wv_old, (UWord*)&ix_old,
-                         (UWord)wv_new );
-   if (have) {
-      tl_assert(wv_old != wv_new);
-      tl_assert(wv_old);
-      tl_assert(wv_old->owner == wsu);
-      tl_assert(ix_old < wsu->ix2vec_used);
-      tl_assert(wsu->ix2vec[ix_old] == wv_old);
-      delete_WV( wv_new );
-      return (WordSet)ix_old;
-   } else if (wsu->ix2vec_free) {
-      WordSet ws;
+/* Return the index in htab of the WordSet whose words are the 'size'
+   words 'words', of hash 'h', or if there is none, of the entry in
+   which it should be added. */
+static UWord htab_find ( WordSetU* wsu,
+                         const UWord* words, UWord size, UWord h )
+{
+   UWord mask     = wsu->htab_size - 1;
+   UWord i        = h & mask;
+   UWord free_ix  = wsu->htab_size; /* none yet */
+   while (True) {
+      WordSet ws = wsu->htab[i];
+      if (ws == WS_HT_EMPTY)
+         return free_ix < wsu->htab_size ? free_ix : i;
+      if (ws == WS_HT_DELETED) {
+         if (free_ix == wsu->htab_size)
+            free_ix = i;
+      } else {
+         WordVec* wv = wsu->ix2vec[ws];
+         if (wv->hash == h && wv->size == size
+             && (size == 0
+                 || 0 == VG_(memcmp)( wv->words, words,
+                                      size * sizeof(UWord) )))
+            return i;
+      }
+      i = (i + 1) & mask;
+   }
+}
+
+/* Rebuild htab, with enough room for the live WordSets and then
+   some. */
+static void htab_resize ( WordSetU* wsu )
+{
+   UWord   ws, i, mask;
+   UWord   new_sz = 64;
+   while (new_sz < 4 * (wsu->htab_live + 1))
+      new_sz *= 2;
+   if (wsu->htab)
+      wsu->dealloc(wsu->htab);
+   wsu->htab = wsu->alloc( wsu->cc, new_sz * sizeof(WordSet) );
+   VG_(memset)( wsu->htab, 0xFF, new_sz * sizeof(WordSet) );
+   tl_assert(wsu->htab[0] == WS_HT_EMPTY);
+   wsu->htab_size = new_sz;
+   wsu->htab_tomb = 0;
+   mask = new_sz - 1;
+   for (ws = 0; ws < wsu->ix2vec_used; ws++) {
+      WordVec* wv = wsu->ix2vec[ws];
+      if (is_dead(wsu,wv))
+         continue;
+      i = wv->hash & mask;
+      while (wsu->htab[i] != WS_HT_EMPTY)
+         i = (i + 1) & mask;
+      wsu->htab[i] = (WordSet)ws;
+   }
+}
+
+/* Return the WordSet made of the 'size' sorted words 'words', making
+   a new one if there is none yet.  'words' is copied if needed, so
+   it can be (and usually is) wsu->scratch. */
+static WordSet intern_words ( WordSetU* wsu, const UWord* words, UWord size )
+{
+   UWord    h = hash_words( words, size );
+   UWord    i = htab_find( wsu, words, size, h );
+   UWord    k;
+   WordVec* wv_new;
+   WordSet  ws;
+
+   wsu->n_intern++;
+   ws = wsu->htab[i];
+   if (ws != WS_HT_EMPTY && ws != WS_HT_DELETED)
+      return ws;
+
+   /* Not present.  Keep the load factor (tombstones included) of
+      htab at most 3/4 after the insertion. */
+   wsu->n_intern_new++;
+   if (4 * (wsu->htab_live + wsu->htab_tomb + 1) > 3 * wsu->htab_size) {
+      htab_resize( wsu );
+      i = htab_find( wsu, words, size, h );
+   }
+
+   wv_new = new_WV_of_size( wsu, size );
+   wv_new->hash = h;
+   for (k = 0; k < size; k++) {
+      wv_new->words[k] = words[k];
+      wv_new->sig |= word_sig(words[k]);
+   }
+
+   if (wsu->ix2vec_free) {
       tl_assert(is_dead(wsu,(WordVec*)wsu->ix2vec_free));
       ws = wsu->ix2vec_free - &(wsu->ix2vec[0]);
       tl_assert(wsu->ix2vec[ws] == NULL || is_dead(wsu,wsu->ix2vec[ws]));
       wsu->ix2vec_free = (WordVec **) wsu->ix2vec[ws];
       wsu->ix2vec[ws] = wv_new;
-      VG_(addToFM)( wsu->vec2ix, (UWord)wv_new, ws );
       if (HG_DEBUG) VG_(printf)("aodW %s re-use free %d %p\n", wsu->cc, (Int)ws, wv_new );
-      return ws;
    } else {
       ensure_ix2vec_space( wsu );
       tl_assert(wsu->ix2vec);
       tl_assert(wsu->ix2vec_used < wsu->ix2vec_size);
-      wsu->ix2vec[wsu->ix2vec_used] = wv_new;
-      VG_(addToFM)( wsu->vec2ix, (Word)wv_new, (Word)wsu->ix2vec_used );
-      if (HG_DEBUG) VG_(printf)("aodW %s %d %p\n", wsu->cc, (Int)wsu->ix2vec_used, wv_new  );
+      ws = (WordSet)wsu->ix2vec_used;
+      tl_assert(ws < WS_HT_DELETED);
+      wsu->ix2vec[ws] = wv_new;
+      if (HG_DEBUG) VG_(printf)("aodW %s %d %p\n", wsu->cc, (Int)ws, wv_new );
       wsu->ix2vec_used++;
       tl_assert(wsu->ix2vec_used <= wsu->ix2vec_size);
-      return (WordSet)(wsu->ix2vec_used - 1);
    }
+
+   if (wsu->htab[i] == WS_HT_DELETED)
+      wsu->htab_tomb--;
+   wsu->htab[i] = ws;
+   wsu->htab_live++;
+   return ws;
 }
 
 
@@ -359,25 +449,26 @@ WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
                              Word  cacheSize )
 {
    WordSetU* wsu;
-   WordVec*  empty;
 
    wsu          = alloc_nofail( cc, sizeof(WordSetU) );
    VG_(memset)( wsu, 0, sizeof(WordSetU) );
    wsu->alloc   = alloc_nofail;
    wsu->cc      = cc;
    wsu->dealloc = dealloc;
-   wsu->vec2ix  = VG_(newFM)( alloc_nofail, cc,
-                              dealloc, cmp_WordVecs_for_FM );
+   wsu->htab    = NULL;
+   wsu->htab_live = 0;
+   htab_resize( wsu );
    wsu->ix2vec_used = 0;
    wsu->ix2vec_size = 0;
    wsu->ix2vec      = NULL;
    wsu->ix2vec_free = NULL;
-   WCache_INIT(wsu->cache_addTo,     cacheSize);
-   WCache_INIT(wsu->cache_delFrom,   cacheSize);
-   WCache_INIT(wsu->cache_intersect, cacheSize);
-   WCache_INIT(wsu->cache_minus,     cacheSize);
-   empty = new_WV_of_size( wsu, 0 );
-   wsu->empty = add_or_dealloc_WordVec( wsu, empty );
+   WCache_init( wsu, &wsu->cache_addTo,     cacheSize );
+   WCache_init( wsu, &wsu->cache_delFrom,   cacheSize );
+   WCache_init( wsu, &wsu->cache_union,     cacheSize );
+   WCache_init( wsu, &wsu->cache_intersect, cacheSize );
+   WCache_init( wsu, &wsu->cache_minus,     cacheSize );
+   wsu->empty = intern_words( wsu, NULL, 0 );
+   tl_assert(wsu->empty == 0);
 
    return wsu;
 }
@@ -385,10 +476,21 @@ WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
 void HG_(deleteWordSetU) ( WordSetU* wsu )
 {
    void (*dealloc)(void*) = wsu->dealloc;
-   tl_assert(wsu->vec2ix);
-   VG_(deleteFM)( wsu->vec2ix, delete_WV_for_FM, NULL/*val-finalizer*/ );
+   UWord ws;
+   for (ws = 0; ws < wsu->ix2vec_used; ws++) {
+      if (!is_dead(wsu, wsu->ix2vec[ws]))
+         delete_WV( wsu->ix2vec[ws] );
+   }
+   dealloc(wsu->htab);
    if (wsu->ix2vec)
       dealloc(wsu->ix2vec);
+   if (wsu->scratch)
+      dealloc(wsu->scratch);
+   dealloc(wsu->cache_addTo.ent);
+   dealloc(wsu->cache_delFrom.ent);
+   dealloc(wsu->cache_union.ent);
+   dealloc(wsu->cache_intersect.ent);
+   dealloc(wsu->cache_minus.ent);
    dealloc(wsu);
 }
 
@@ -459,8 +561,7 @@ void HG_(getPayloadWS) ( /*OUT*/UWord** words, /*OUT*/UWord* nWords,
 void HG_(dieWS) ( WordSetU* wsu, WordSet ws )
 {
    WordVec* wv = do_ix2vec_with_dead( wsu, ws );
-   WordVec* wv_in_vec2ix;
-   UWord/*Set*/ wv_ix = -1;
+   UWord    i, mask;
 
    if (HG_DEBUG) VG_(printf)("dieWS %s %d %p\n", wsu->cc, (Int)ws, wv);
 
@@ -473,23 +574,28 @@ void HG_(dieWS) ( WordSetU* wsu, WordSet ws )
    wsu->n_die++;
    
    
+   /* Remove ws from htab, leaving a tombstone so that the probe
+      sequences going through its entry are not cut short. */
+   mask = wsu->htab_size - 1;
+   i = wv->hash & mask;
+   while (wsu->htab[i] != ws) {
+      tl_assert(wsu->htab[i] != WS_HT_EMPTY);
+      i = (i + 1) & mask;
+   }
+   wsu->htab[i] = WS_HT_DELETED;
+   wsu->htab_live--;
+   wsu->htab_tomb++;
+
    wsu->ix2vec[ws] = (WordVec*) wsu->ix2vec_free;
    wsu->ix2vec_free = &wsu->ix2vec[ws];
 
-   VG_(delFromFM) ( wsu->vec2ix, 
-                    (UWord*)&wv_in_vec2ix, (UWord*)&wv_ix,
-                    (UWord)wv );
-
-   if (HG_DEBUG) VG_(printf)("dieWS wv_ix %d\n", (Int)wv_ix);
-   tl_assert (wv_ix);
-   tl_assert (wv_ix == ws);
-
    delete_WV( wv );
 
-   wsu->cache_addTo.inUse = 0;
-   wsu->cache_delFrom.inUse = 0;
-   wsu->cache_intersect.inUse = 0;
-   wsu->cache_minus.inUse = 0;
+   WCache_invalidate( &wsu->cache_addTo );
+   WCache_invalidate( &wsu->cache_delFrom );
+   WCache_invalidate( &wsu->cache_union );
+   WCache_invalidate( &wsu->cache_intersect );
+   WCache_invalidate( &wsu->cache_minus );
 }
 
 Bool HG_(plausibleWS) ( WordSetU* wsu, WordSet ws )
@@ -525,6 +631,8 @@ Bool HG_(elemWS) ( WordSetU* wsu, WordSet ws, UWord w )
    UWord    i;
    WordVec* wv = do_ix2vec( wsu, ws );
    wsu->n_elem++;
+   if (!(wv->sig & word_sig(w)))
+      return False;
    for (i = 0; i < wv->size; i++) {
       if (wv->words[i] == w)
          return True;
@@ -534,24 +642,22 @@ Bool HG_(elemWS) ( WordSetU* wsu, WordSet ws, UWord w )
 
 WordSet HG_(doubletonWS) ( WordSetU* wsu, UWord w1, UWord w2 )
 {
-   WordVec* wv;
+   UWord words[2];
    wsu->n_doubleton++;
    if (w1 == w2) {
-      wv = new_WV_of_size(wsu, 1);
-      wv->words[0] = w1;
+      words[0] = w1;
+      return intern_words( wsu, words, 1 );
    }
    else if (w1 < w2) {
-      wv = new_WV_of_size(wsu, 2);
-      wv->words[0] = w1;
-      wv->words[1] = w2;
+      words[0] = w1;
+      words[1] = w2;
    }
    else {
       tl_assert(w1 > w2);
-      wv = new_WV_of_size(wsu, 2);
-      wv->words[0] = w2;
-      wv->words[1] = w1;
+      words[0] = w2;
+      words[1] = w1;
    }
-   return add_or_dealloc_WordVec( wsu, wv );
+   return intern_words( wsu, words, 2 );
 }
 
 WordSet HG_(singletonWS) ( WordSetU* wsu, UWord w )
@@ -562,6 +668,11 @@ WordSet HG_(singletonWS) ( WordSetU* wsu, UWord w )
 WordSet HG_(isSubsetOf) ( WordSetU* wsu, WordSet small, WordSet big )
 {
    wsu->n_isSubsetOf++;
+   if (small == big)
+      return True;
+   /* Some word of 'small' is certainly not in 'big'. */
+   if (do_ix2vec( wsu, small )->sig & ~do_ix2vec( wsu, big )->sig)
+      return False;
    return small == HG_(intersectWS)( wsu, small, big );
 }
 
@@ -587,7 +698,8 @@ void HG_(ppWSUstats) ( WordSetU* wsu, const HChar* name )
                wsu->n_add, wsu->n_add_uncached);
    VG_(printf)("      delFrom      %10lu (%lu uncached)\n", 
                wsu->n_del, wsu->n_del_uncached);
-   VG_(printf)("      union        %10lu\n", wsu->n_union);
+   VG_(printf)("      union        %10lu (%lu uncached)\n",
+               wsu->n_union, wsu->n_union_uncached);
    VG_(printf)("      intersect    %10lu (%lu uncached) "
                "[nb. incl isSubsetOf]\n", 
                wsu->n_intersect, wsu->n_intersect_uncached);
@@ -600,12 +712,15 @@ void HG_(ppWSUstats) ( WordSetU* wsu, const HChar* name )
    VG_(printf)("      anyElementOf %10lu\n",   wsu->n_anyElementOf);
    VG_(printf)("      isSubsetOf   %10lu\n",   wsu->n_isSubsetOf);
    VG_(printf)("      dieWS        %10lu\n",   wsu->n_die);
+   VG_(printf)("      intern       %10lu (%lu new), table %lu/%lu\n",
+               wsu->n_intern, wsu->n_intern_new,
+               wsu->htab_live, wsu->htab_size);
 }
 
 WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
 {
    UWord    k, j;
-   WordVec* wv_new;
+   UWord*   words;
    WordVec* wv;
    WordSet  result = (WordSet)(-1); /* bogus */
 
@@ -615,27 +730,29 @@ WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
 
    /* If already present, this is a no-op. */
    wv = do_ix2vec( wsu, ws );
-   for (k = 0; k < wv->size; k++) {
-      if (wv->words[k] == w) {
-         result = ws;
-         goto out;
+   if (wv->sig & word_sig(w)) {
+      for (k = 0; k < wv->size; k++) {
+         if (wv->words[k] == w) {
+            result = ws;
+            goto out;
+         }
       }
    }
-   /* Ok, not present.  Build a new one ... */
-   wv_new = new_WV_of_size( wsu, wv->size + 1 );
+   /* Ok, not present.  Build the new one in scratch ... */
+   words = ensure_scratch( wsu, wv->size + 1 );
    k = j = 0;
    for (; k < wv->size && wv->words[k] < w; k++) {
-      wv_new->words[j++] = wv->words[k];
+      words[j++] = wv->words[k];
    }
-   wv_new->words[j++] = w;
+   words[j++] = w;
    for (; k < wv->size; k++) {
       tl_assert(wv->words[k] > w);
-      wv_new->words[j++] = wv->words[k];
+      words[j++] = wv->words[k];
    }
-   tl_assert(j == wv_new->size);
+   tl_assert(j == wv->size + 1);
 
    /* Find any existing copy, or add the new one. */
-   result = add_or_dealloc_WordVec( wsu, wv_new );
+   result = intern_words( wsu, words, j );
    tl_assert(result != (WordSet)(-1));
 
   out:
@@ -646,7 +763,7 @@ WordSet HG_(addToWS) ( WordSetU* wsu, WordSet ws, UWord w )
 WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
 {
    UWord    i, j, k;
-   WordVec* wv_new;
+   UWord*   words;
    WordSet  result = (WordSet)(-1); /* bogus */
    WordVec* wv = do_ix2vec( wsu, ws );
 
@@ -658,6 +775,10 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
       return ws;
    }
 
+   /* and sets that certainly don't have w */
+   if (!(wv->sig & word_sig(w)))
+      return ws;
+
    WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_delFrom, ws, w);
    wsu->n_del_uncached++;
 
@@ -675,16 +796,16 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
    tl_assert(i >= 0 && i < wv->size);
    tl_assert(wv->size > 0);
 
-   wv_new = new_WV_of_size( wsu, wv->size - 1 );
+   words = ensure_scratch( wsu, wv->size - 1 );
    j = k = 0;
    for (; j < wv->size; j++) {
       if (j == i)
          continue;
-      wv_new->words[k++] = wv->words[j];
+      words[k++] = wv->words[j];
    }
-   tl_assert(k == wv_new->size);
+   tl_assert(k == wv->size - 1);
 
-   result = add_or_dealloc_WordVec( wsu, wv_new );
+   result = intern_words( wsu, words, k );
    if (wv->size == 1) {
       tl_assert(result == wsu->empty);
    }
@@ -696,38 +817,31 @@ WordSet HG_(delFromWS) ( WordSetU* wsu, WordSet ws, UWord w )
 
 WordSet HG_(unionWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 {
-   UWord    i1, i2, k, sz;
-   WordVec* wv_new;
-   WordVec* wv1 = do_ix2vec( wsu, ws1 );
-   WordVec* wv2 = do_ix2vec( wsu, ws2 );
+   UWord    i1, i2, k;
+   UWord*   words;
+   WordSet  ws_new = (WordSet)(-1); /* bogus */
+   WordVec* wv1;
+   WordVec* wv2;
+
    wsu->n_union++;
-   sz = 0;
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      sz++;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         i2++;
-      } else {
-         i1++;
-         i2++;
-      }
-   }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
-   if (i1 == wv1->size && i2 < wv2->size) {
-      sz += (wv2->size - i2);
-   }
-   if (i2 == wv2->size && i1 < wv1->size) {
-      sz += (wv1->size - i1);
+
+   /* Deal with some obvious cases fast. */
+   if (ws1 == ws2 || ws2 == wsu->empty)
+      return ws1;
+   if (ws1 == wsu->empty)
+      return ws2;
+
+   /* As for intersectWS, union(x,y) == union(y,x). */
+   if (ws1 > ws2) {
+      WordSet wst = ws1; ws1 = ws2; ws2 = wst;
    }
 
-   wv_new = new_WV_of_size( wsu, sz );
+   WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_union, ws1, ws2);
+   wsu->n_union_uncached++;
+
+   wv1 = do_ix2vec( wsu, ws1 );
+   wv2 = do_ix2vec( wsu, ws2 );
+   words = ensure_scratch( wsu, wv1->size + wv2->size );
    k = 0;
 
    i1 = i2 = 0;
@@ -735,14 +849,14 @@ WordSet HG_(unionWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
       if (i1 >= wv1->size || i2 >= wv2->size)
          break;
       if (wv1->words[i1] < wv2->words[i2]) {
-         wv_new->words[k++] = wv1->words[i1];
+         words[k++] = wv1->words[i1];
          i1++;
       } else 
       if (wv1->words[i1] > wv2->words[i2]) {
-         wv_new->words[k++] = wv2->words[i2];
+         words[k++] = wv2->words[i2];
          i2++;
       } else {
-         wv_new->words[k++] = wv1->words[i1];
+         words[k++] = wv1->words[i1];
          i1++;
          i2++;
       }
@@ -750,25 +864,25 @@ WordSet HG_(unionWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
    tl_assert(i1 <= wv1->size);
    tl_assert(i2 <= wv2->size);
    tl_assert(i1 == wv1->size || i2 == wv2->size);
-   if (i1 == wv1->size && i2 < wv2->size) {
-      while (i2 < wv2->size)
-         wv_new->words[k++] = wv2->words[i2++];
-   }
-   if (i2 == wv2->size && i1 < wv1->size) {
-      while (i1 < wv1->size)
-         wv_new->words[k++] = wv1->words[i1++];
-   }
+   while (i2 < wv2->size)
+      words[k++] = wv2->words[i2++];
+   while (i1 < wv1->size)
+      words[k++] = wv1->words[i1++];
+
+   tl_assert(k <= wv1->size + wv2->size);
 
-   tl_assert(k == sz);
+   ws_new = intern_words( wsu, words, k );
+   tl_assert(ws_new != (WordSet)(-1));
+   WCache_UPDATE(wsu->cache_union, ws1, ws2, ws_new);
 
-   return add_or_dealloc_WordVec( wsu, wv_new );
+   return ws_new;
 }
 
 WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 {
-   UWord    i1, i2, k, sz;
+   UWord    i1, i2, k;
+   UWord*   words;
    WordSet  ws_new = (WordSet)(-1); /* bogus */
-   WordVec* wv_new;
    WordVec* wv1; 
    WordVec* wv2; 
 
@@ -785,32 +899,18 @@ WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
       WordSet wst = ws1; ws1 = ws2; ws2 = wst;
    }
 
-   WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_intersect, ws1, ws2);
-   wsu->n_intersect_uncached++;
-
    wv1 = do_ix2vec( wsu, ws1 );
    wv2 = do_ix2vec( wsu, ws2 );
-   sz = 0;
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         i2++;
-      } else {
-         sz++;
-         i1++;
-         i2++;
-      }
-   }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
 
-   wv_new = new_WV_of_size( wsu, sz );
+   /* Sets with no common signature bit are certainly disjoint. */
+   if (!(wv1->sig & wv2->sig))
+      return wsu->empty;
+
+   WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_intersect, ws1, ws2);
+   wsu->n_intersect_uncached++;
+
+   words = ensure_scratch( wsu, wv1->size < wv2->size
+                                ? wv1->size : wv2->size );
    k = 0;
 
    i1 = i2 = 0;
@@ -823,7 +923,7 @@ WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
       if (wv1->words[i1] > wv2->words[i2]) {
          i2++;
       } else {
-         wv_new->words[k++] = wv1->words[i1];
+         words[k++] = wv1->words[i1];
          i1++;
          i2++;
       }
@@ -832,10 +932,8 @@ WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
    tl_assert(i2 <= wv2->size);
    tl_assert(i1 == wv1->size || i2 == wv2->size);
 
-   tl_assert(k == sz);
-
-   ws_new = add_or_dealloc_WordVec( wsu, wv_new );
-   if (sz == 0) {
+   ws_new = intern_words( wsu, words, k );
+   if (k == 0) {
       tl_assert(ws_new == wsu->empty);
    }
 
@@ -847,42 +945,27 @@ WordSet HG_(intersectWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 
 WordSet HG_(minusWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
 {
-   UWord    i1, i2, k, sz;
+   UWord    i1, i2, k;
+   UWord*   words;
    WordSet  ws_new = (WordSet)(-1); /* bogus */
-   WordVec* wv_new;
    WordVec* wv1;
    WordVec* wv2;
    
    wsu->n_minus++;
-   WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_minus, ws1, ws2);
-   wsu->n_minus_uncached++;
+
+   /* Deal with some obvious cases fast. */
+   if (ws1 == ws2)
+      return wsu->empty;
 
    wv1 = do_ix2vec( wsu, ws1 );
    wv2 = do_ix2vec( wsu, ws2 );
-   sz = 0;
-   i1 = i2 = 0;
-   while (1) {
-      if (i1 >= wv1->size || i2 >= wv2->size)
-         break;
-      if (wv1->words[i1] < wv2->words[i2]) {
-         sz++;
-         i1++;
-      } else 
-      if (wv1->words[i1] > wv2->words[i2]) {
-         i2++;
-      } else {
-         i1++;
-         i2++;
-      }
-   }
-   tl_assert(i1 <= wv1->size);
-   tl_assert(i2 <= wv2->size);
-   tl_assert(i1 == wv1->size || i2 == wv2->size);
-   if (i2 == wv2->size && i1 < wv1->size) {
-      sz += (wv1->size - i1);
-   }
+   if (!(wv1->sig & wv2->sig))
+      return ws1;
 
-   wv_new = new_WV_of_size( wsu, sz );
+   WCache_LOOKUP_AND_RETURN(WordSet, wsu->cache_minus, ws1, ws2);
+   wsu->n_minus_uncached++;
+
+   words = ensure_scratch( wsu, wv1->size );
    k = 0;
 
    i1 = i2 = 0;
@@ -890,7 +973,7 @@ WordSet HG_(minusWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
       if (i1 >= wv1->size || i2 >= wv2->size)
          break;
       if (wv1->words[i1] < wv2->words[i2]) {
-         wv_new->words[k++] = wv1->words[i1];
+         words[k++] = wv1->words[i1];
          i1++;
       } else 
       if (wv1->words[i1] > wv2->words[i2]) {
@@ -903,15 +986,13 @@ WordSet HG_(minusWS) ( WordSetU* wsu, WordSet ws1, WordSet ws2 )
    tl_assert(i1 <= wv1->size);
    tl_assert(i2 <= wv2->size);
    tl_assert(i1 == wv1->size || i2 == wv2->size);
-   if (i2 == wv2->size && i1 < wv1->size) {
-      while (i1 < wv1->size)
-         wv_new->words[k++] = wv1->words[i1++];
-   }
+   while (i1 < wv1->size)
+      words[k++] = wv1->words[i1++];
 
-   tl_assert(k == sz);
+   tl_assert(k <= wv1->size);
 
-   ws_new = add_or_dealloc_WordVec( wsu, wv_new );
-   if (sz == 0) {
+   ws_new = intern_words( wsu, words, k );
+   if (k == 0) {
       tl_assert(ws_new == wsu->empty);
    }
 
@@ -46,7 +46,8 @@ typedef  struct _WordSetU  WordSetU;  /* opaque */
 
 typedef  UInt              WordSet;   /* opaque, small int index */
 
-/* Allocate and initialise a WordSetU */
+/* Allocate and initialise a WordSetU.  Each of its operation caches
+   has about 64 * cacheSize entries. */
 WordSetU* HG_(newWordSetU) ( void* (*alloc_nofail)( const HChar*, SizeT ),
                              const HChar* cc,
                              void  (*dealloc)(void*),
@@ -46,6 +46,9 @@
 #include "pub_tool_execontext.h"
 #include "pub_tool_errormgr.h"
 #include "pub_tool_options.h"        // VG_(clo_stats)
+#include "pub_tool_vki.h"            // VKI_O_*, VKI_SEEK_SET
+#include "pub_tool_libcfile.h"       // VG_(open), VG_(read), VG_(write)
+#include "pub_tool_libcproc.h"       // VG_(atfork)
 #include "hg_basics.h"
 #include "hg_wordset.h"
 #include "hg_lock_n_thread.h"
@@ -632,6 +635,8 @@ static UWord stats__cline_16to8pulldown  = 0; // # calls to pulldown_to_8
 static UWord stats__vts__tick            = 0; // # calls to VTS__tick
 static UWord stats__vts__join            = 0; // # calls to VTS__join
 static UWord stats__vts__cmpLEQ          = 0; // # calls to VTS__cmpLEQ
+static UWord stats__vts__join_dense      = 0; // # VTS__join dense fast paths
+static UWord stats__vts__cmpLEQ_dense    = 0; // # VTS__cmpLEQ dense fast paths
 static UWord stats__vts__cmp_structural  = 0; // # calls to VTS__cmp_structural
 static UWord stats__vts_tab_GC           = 0; // # nr of vts_tab GC
 static UWord stats__vts_pruning          = 0; // # nr of vts pruning
@@ -2306,14 +2311,17 @@ static void VTS__tick ( /*OUT*/VTS* out, Thr* me, VTS* vts )
    tl_assert(is_sane_VTS(vts));
    n = vts->usedTS;
 
-   /* Copy all entries which precede 'me'. */
-   for (i = 0; i < n; i++) {
-      ScalarTS* here = &vts->ts[i];
-      if (UNLIKELY(here->thrid >= me_thrid))
-         break;
-      UInt hi = out->usedTS++;
-      out->ts[hi] = *here;
+   /* Find the first entry not preceding 'me', and copy all those
+      before it in one go. */
+   { UInt lo = 0, hi = n;
+     while (lo < hi) {
+        UInt mid = (lo + hi) / 2;
+        if (vts->ts[mid].thrid < me_thrid) lo = mid + 1; else hi = mid;
+     }
+     i = lo;
    }
+   VG_(memcpy)(&out->ts[0], &vts->ts[0], i * sizeof(ScalarTS));
+   out->usedTS = i;
 
    /* 'i' now indicates the next entry to copy, if any.
        There are 3 possibilities:
@@ -2349,11 +2357,9 @@ static void VTS__tick ( /*OUT*/VTS* out, Thr* me, VTS* vts )
          out->ts[hi].tym   = 1;
       }
       /* And copy any remaining entries. */
-      for (/*keepgoing*/; i < n; i++) {
-         ScalarTS* here2 = &vts->ts[i];
-         UInt hi = out->usedTS++;
-         out->ts[hi] = *here2;
-      }
+      VG_(memcpy)(&out->ts[out->usedTS], &vts->ts[i],
+                  (n - i) * sizeof(ScalarTS));
+      out->usedTS += n - i;
    }
 
    tl_assert(is_sane_VTS(out));
@@ -2362,6 +2368,92 @@ static void VTS__tick ( /*OUT*/VTS* out, Thr* me, VTS* vts )
 }
 
 
+/* Dense fast paths for VTS__join and VTS__cmpLEQ.
+
+   When a program's population of threads is fairly stable, most of
+   the VTSs in existence mention exactly the same ThrIDs, so their ts
+   arrays are in effect dense vectors indexed the same way, and
+   joining or comparing two of them needs no merging at all, just an
+   element-wise max or compare.  Also, when the thrid bits of two
+   ScalarTSs are equal, comparing them as 64-bit words gives the same
+   answer as comparing their tym fields, whichever way the compiler
+   lays out the bitfields.  So these treat the ts arrays as arrays of
+   ULong, in single passes with no data-dependent branches, while
+   accumulating the XOR of the two sides.  (They are not vectorised:
+   baseline x86 has no 64-bit unsigned vector compare, and tools are
+   built without a target ISA baseline.)  If that has any
+   thrid bits set, the VTSs were not aligned after all; the result is
+   then thrown away and the caller does the general merge. */
+
+/* The thrid bits of a ScalarTS, seen as a ULong. */
+static ULong scalarts_thrid_mask = 0;
+
+static void scalarts_thrid_mask_init ( void )
+{
+   ScalarTS st;
+   STATIC_ASSERT(sizeof(ScalarTS) == sizeof(ULong));
+   VG_(memset)(&st, 0, sizeof(st));
+   st.thrid = ThrID_MAX_VALID;
+   VG_(memcpy)(&scalarts_thrid_mask, &st, sizeof(ULong));
+   tl_assert(scalarts_thrid_mask != 0);
+}
+
+/* Join 'a' and 'b', which have the same number of entries, into
+   'out', if they mention the same ThrIDs.  Returns False, leaving
+   out->usedTS at zero, if they don't. */
+static Bool VTS__join_dense ( /*OUT*/VTS* out, const VTS* a, const VTS* b )
+{
+   UInt         i, n = a->usedTS;
+   const ULong* wa   = (const ULong*)&a->ts[0];
+   const ULong* wb   = (const ULong*)&b->ts[0];
+   ULong*       wo   = (ULong*)&out->ts[0];
+   ULong        diff = 0;
+
+   tl_assert(b->usedTS == n);
+   for (i = 0; i < n; i++) {
+      ULong x = wa[i], y = wb[i];
+      diff |= x ^ y;
+      wo[i] = x > y ? x : y;
+   }
+   if (diff & scalarts_thrid_mask)
+      return False;
+   out->usedTS = n;
+   return True;
+}
+
+/* Likewise for VTS__cmpLEQ: if 'a' and 'b' mention the same ThrIDs,
+   set *res as VTS__cmpLEQ would and return True. */
+static Bool VTS__cmpLEQ_dense ( /*OUT*/UInt* res, const VTS* a, const VTS* b )
+{
+   UInt         i, n = a->usedTS;
+   const ULong* wa   = (const ULong*)&a->ts[0];
+   const ULong* wb   = (const ULong*)&b->ts[0];
+   ULong        diff = 0, gt = 0;
+
+   tl_assert(b->usedTS == n);
+   for (i = 0; i < n; i++) {
+      ULong x = wa[i], y = wb[i];
+      diff |= x ^ y;
+      gt   |= (ULong)(x > y);
+   }
+   if (diff & scalarts_thrid_mask)
+      return False;
+   if (gt == 0) {
+      *res = 0;
+      return True;
+   }
+   for (i = 0; i < n; i++) {
+      if (wa[i] > wb[i]) {
+         tl_assert(a->ts[i].thrid >= 1024);
+         *res = a->ts[i].thrid;
+         return True;
+      }
+   }
+   /*NOTREACHED*/
+   tl_assert(0);
+}
+
+
 /* Return a new VTS constructed as the join (max) of the 2 args.
    Neither arg is modified.
 */
@@ -2387,6 +2479,12 @@ static void VTS__join ( /*OUT*/VTS* out, VTS* a, VTS* b )
       scalarts_limitations_fail_NORETURN( True/*due_to_nThrs*/ );
    tl_assert(out->sizeTS >= useda + usedb);
 
+   if (useda == usedb && VTS__join_dense(out, a, b)) {
+      stats__vts__join_dense++;
+      tl_assert(is_sane_VTS(out));
+      return;
+   }
+
    ia = ib = 0;
 
    while (1) {
@@ -2480,6 +2578,14 @@ static UInt/*ThrID*/ VTS__cmpLEQ ( VTS* a, VTS* b )
    useda = a->usedTS;
    usedb = b->usedTS;
 
+   if (useda == usedb) {
+      UInt diffthrid;
+      if (VTS__cmpLEQ_dense(&diffthrid, a, b)) {
+         stats__vts__cmpLEQ_dense++;
+         return diffthrid;
+      }
+   }
+
    ia = ib = 0;
 
    while (1) {
@@ -3373,33 +3479,100 @@ static inline UInt ROL32 ( UInt w, Int n ) {
    w = (w << n) | (w >> (32-n));
    return w;
 }
-static inline UInt hash_VtsIDs ( VtsID vi1, VtsID vi2, UInt nTab ) {
-   UInt hash = ROL32(vi1,19) ^ ROL32(vi2,13);
-   return hash % nTab;
+static inline UInt hash_VtsIDs ( VtsID vi1, VtsID vi2, UInt mask ) {
+   UInt hash = (ROL32(vi1,19) ^ ROL32(vi2,13)) * 0x9E3779B1;
+   return (hash ^ (hash >> 16)) & mask;
 }
 
-#define N_CMPLEQ_CACHE 1023
-static
-   struct { VtsID vi1; VtsID vi2; Bool leq; }
-   cmpLEQ_cache[N_CMPLEQ_CACHE];
+/* The cmpLEQ and join2 caches are direct mapped and start with
+   VTSID_CACHE_MIN entries.  Programs with hundreds of threads have
+   far more live VTSs than that covers, so whenever more than 1 in
+   VTSID_CACHE_GROW_RATIO of the last VTSID_CACHE_WINDOW queries to a
+   cache missed, it is doubled, up to VTSID_CACHE_MAX entries.
+   Growing a cache empties it, as does VtsID__invalidate_caches. */
+#define VTSID_CACHE_MIN        1024
+#define VTSID_CACHE_MAX        (1 << 18)
+#define VTSID_CACHE_WINDOW     65536
+#define VTSID_CACHE_GROW_RATIO 8
 
-#define N_JOIN2_CACHE 1023
-static
-   struct { VtsID vi1; VtsID vi2; VtsID res; }
-   join2_cache[N_JOIN2_CACHE];
+typedef struct { VtsID vi1; VtsID vi2; Bool leq; } CmpLEQCacheEnt;
+typedef struct { VtsID vi1; VtsID vi2; VtsID res; } Join2CacheEnt;
 
-static void VtsID__invalidate_caches ( void ) {
-   Int i;
-   for (i = 0; i < N_CMPLEQ_CACHE; i++) {
+/* Sizing state for one cache.  win_queries/win_misses are the
+   query/miss totals when the current window started. */
+typedef
+   struct {
+      UInt  mask;   /* number of entries - 1 */
+      ULong win_queries;
+      ULong win_misses;
+   }
+   VtsIDCacheCtl;
+
+static CmpLEQCacheEnt* cmpLEQ_cache = NULL;
+static VtsIDCacheCtl   cmpLEQ_ctl;
+static Join2CacheEnt*  join2_cache  = NULL;
+static VtsIDCacheCtl   join2_ctl;
+
+static void cmpLEQ_cache_clear ( void ) {
+   UInt i;
+   for (i = 0; i <= cmpLEQ_ctl.mask; i++) {
       cmpLEQ_cache[i].vi1 = VtsID_INVALID;
       cmpLEQ_cache[i].vi2 = VtsID_INVALID;
       cmpLEQ_cache[i].leq = False;
    }
-   for (i = 0; i < N_JOIN2_CACHE; i++) {
-     join2_cache[i].vi1 = VtsID_INVALID;
-     join2_cache[i].vi2 = VtsID_INVALID;
-     join2_cache[i].res = VtsID_INVALID;
+}
+
+static void join2_cache_clear ( void ) {
+   UInt i;
+   for (i = 0; i <= join2_ctl.mask; i++) {
+      join2_cache[i].vi1 = VtsID_INVALID;
+      join2_cache[i].vi2 = VtsID_INVALID;
+      join2_cache[i].res = VtsID_INVALID;
+   }
+}
+
+/* Called on each miss.  Returns True if the window has just ended
+   with too many misses and the cache is allowed to grow. */
+static Bool VtsID_cache_should_grow ( VtsIDCacheCtl* ctl,
+                                      ULong queries, ULong misses )
+{
+   Bool grow;
+   if (queries - ctl->win_queries < VTSID_CACHE_WINDOW)
+      return False;
+   grow = (misses - ctl->win_misses) * VTSID_CACHE_GROW_RATIO
+             > queries - ctl->win_queries
+          && ctl->mask + 1 < VTSID_CACHE_MAX;
+   ctl->win_queries = queries;
+   ctl->win_misses  = misses;
+   return grow;
+}
+
+static void cmpLEQ_cache_resize ( UInt nEnts ) {
+   if (cmpLEQ_cache)
+      HG_(free)(cmpLEQ_cache);
+   cmpLEQ_cache = HG_(zalloc)( "libhb.cmpLEQ_cache.1",
+                               nEnts * sizeof(CmpLEQCacheEnt) );
+   cmpLEQ_ctl.mask = nEnts - 1;
+   cmpLEQ_cache_clear();
+}
+
+static void join2_cache_resize ( UInt nEnts ) {
+   if (join2_cache)
+      HG_(free)(join2_cache);
+   join2_cache = HG_(zalloc)( "libhb.join2_cache.1",
+                              nEnts * sizeof(Join2CacheEnt) );
+   join2_ctl.mask = nEnts - 1;
+   join2_cache_clear();
+}
+
+static void VtsID__invalidate_caches ( void ) {
+   if (cmpLEQ_cache == NULL) {
+      cmpLEQ_cache_resize(VTSID_CACHE_MIN);
+      join2_cache_resize(VTSID_CACHE_MIN);
+      return;
    }
+   cmpLEQ_cache_clear();
+   join2_cache_clear();
 }
 //////////////////////////
 
@@ -3435,11 +3608,16 @@ static Bool VtsID__cmpLEQ_WRK ( VtsID vi1, VtsID vi2 ) {
    tl_assert(vi1 != vi2);
    ////++
    stats__cmpLEQ_queries++;
-   hash = hash_VtsIDs(vi1, vi2, N_CMPLEQ_CACHE);
+   hash = hash_VtsIDs(vi1, vi2, cmpLEQ_ctl.mask);
    if (cmpLEQ_cache[hash].vi1 == vi1
        && cmpLEQ_cache[hash].vi2 == vi2)
       return cmpLEQ_cache[hash].leq;
    stats__cmpLEQ_misses++;
+   if (UNLIKELY(VtsID_cache_should_grow(&cmpLEQ_ctl, stats__cmpLEQ_queries,
+                                        stats__cmpLEQ_misses))) {
+      cmpLEQ_cache_resize(2 * (cmpLEQ_ctl.mask + 1));
+      hash = hash_VtsIDs(vi1, vi2, cmpLEQ_ctl.mask);
+   }
    ////--
    v1  = VtsID__to_VTS(vi1);
    v2  = VtsID__to_VTS(vi2);
@@ -3465,11 +3643,16 @@ static VtsID VtsID__join2_WRK ( VtsID vi1, VtsID vi2 ) {
    tl_assert(vi1 != vi2);
    ////++
    stats__join2_queries++;
-   hash = hash_VtsIDs(vi1, vi2, N_JOIN2_CACHE);
+   hash = hash_VtsIDs(vi1, vi2, join2_ctl.mask);
    if (join2_cache[hash].vi1 == vi1
        && join2_cache[hash].vi2 == vi2)
       return join2_cache[hash].res;
    stats__join2_misses++;
+   if (UNLIKELY(VtsID_cache_should_grow(&join2_ctl, stats__join2_queries,
+                                        stats__join2_misses))) {
+      join2_cache_resize(2 * (join2_ctl.mask + 1));
+      hash = hash_VtsIDs(vi1, vi2, join2_ctl.mask);
+   }
    ////--
    vts1 = VtsID__to_VTS(vi1);
    vts2 = VtsID__to_VTS(vi2);
@@ -4212,6 +4395,12 @@ static inline SVal Ptr2SVal (void* ptr)
       of course decrement the reference count on the RCEC it
       refers to, in order that entries from (1) eventually get
       discarded too.
+
+   3. Optionally (--history-spill-file=), a file to which each OldRef
+      discarded from (2) is appended, stack trace and all, so that
+      libhb_event_map_lookup can still find it when (2) has nothing.
+      Only a small summary of each segment of the file is kept in
+      memory, so memory use does not grow with the history kept.
 */
 
 static UWord stats__evm__lookup_found = 0;
@@ -4534,6 +4723,420 @@ static UWord     oldrefHTN    = 0;    /* # elems in oldrefHT */
    as we never free an OldRef : we just re-use them. */
 
 
+/* Compare the intervals [a1,a1+n1) and [a2,a2+n2).  Return -1 if the
+   first interval is lower, 1 if the first interval is higher, and 0
+   if there is any overlap.  Redundant paranoia with casting is there
+   following what looked distinctly like a bug in gcc-4.1.2, in which
+   some of the comparisons were done signedly instead of
+   unsignedly. */
+/* Copied from exp-ptrcheck/sg_main.c */
+static inline Word cmp_nonempty_intervals ( Addr a1, SizeT n1,
+                                            Addr a2, SizeT n2 ) {
+   UWord a1w = (UWord)a1;
+   UWord n1w = (UWord)n1;
+   UWord a2w = (UWord)a2;
+   UWord n2w = (UWord)n2;
+   tl_assert(n1w > 0 && n2w > 0);
+   if (a1w + n1w <= a2w) return -1L;
+   if (a2w + n2w <= a1w) return 1L;
+   return 0;
+}
+
+///////////////////////////////////////////////////////
+//// Part (3): spilling discarded OldRefs to a file
+///
+/// Records are appended in the order they are discarded from the LRU
+/// list, hence roughly oldest first.  The file is divided into
+/// segments of SPILL_SEG_RECS records, and for each segment we keep
+/// in memory only the range of addresses it covers and a Bloom filter
+/// of the 8-byte granules touched, with SPILL_FILTER_K bits set per
+/// granule.  At 8 filter bits per record, a segment is read on behalf
+/// of an address it does not hold only about 1 time in 40.  A lookup
+/// reads, newest first, only the segments whose summary says they
+/// might hold the address.
+///
+/// Only the SPILL_MAX_SEGS newest segments are kept.  After that, the
+/// oldest one is forgotten, and its part of the file overwritten, for
+/// each new one, so that neither the file nor the memory needed for
+/// the summaries grows any further.  spill_segs is then a ring, with
+/// spill_seg_oldest the index of the oldest segment.
+///
+/// The file descriptor is kept out of the client's reach and closed on
+/// exec.  A forked child shares it, and its offset, with the parent,
+/// so the child stops using it, and starts a file of its own if the
+/// file name expands differently there (as with %p).
+
+#define SPILL_SEG_RECS     1024
+#define SPILL_BUF_RECS     256
+#define SPILL_FILTER_BITS  (8 * SPILL_SEG_RECS)
+#define SPILL_FILTER_K     4
+#define SPILL_MAX_SEGS     2048
+
+typedef
+   struct {
+      Addr  ga;
+      UInt  tsw;        /* a TSW, as an UInt */
+      UInt  locksHeldW;
+      UWord frames[N_FRAMES];
+   }
+   SpillRec;
+
+typedef
+   struct {
+      Off64T offset;    /* in the file, of the segment's first record */
+      UInt   nRecs;
+      Addr   min_ga, max_ga;
+      UChar  filter[SPILL_FILTER_BITS / 8];
+   }
+   SpillSeg;
+
+static Int      spill_fd       = -1;
+static HChar*   spill_path     = NULL; /* expanded file name */
+static XArray*  spill_segs     = NULL; /* of SpillSeg, see above */
+static Word     spill_seg_oldest = 0;
+static Off64T   spill_wr_off   = 0;    /* where spill_wbuf goes */
+static SpillRec spill_wbuf[SPILL_BUF_RECS]; /* not yet written */
+static UInt     spill_wbuf_used = 0;
+static SpillRec spill_rbuf[SPILL_BUF_RECS]; /* for reading back */
+
+static ULong stats__spill_recs   = 0;
+static ULong stats__spill_found  = 0;
+static ULong stats__spill_segs_read = 0;
+static ULong stats__spill_segs_reused = 0;
+
+/* The i'th newest segment, 0 being the one currently filling. */
+static inline SpillSeg* spill_seg_newest ( Word i )
+{
+   Word n = VG_(sizeXA)(spill_segs);
+   return VG_(indexXA)(spill_segs, (spill_seg_oldest + n - 1 - i) % n);
+}
+
+/* The filter bits of the granule containing 'ga' are successive
+   slices of one multiplicative hash of the granule number. */
+static inline ULong spill_filter_hash ( Addr ga )
+{
+   return (ULong)(ga >> 3) * 0x9E3779B97F4A7C15ULL;
+}
+
+static inline Bool spill_filter_test ( const SpillSeg* seg, Addr ga )
+{
+   ULong h = spill_filter_hash(ga);
+   Int   k;
+   for (k = 0; k < SPILL_FILTER_K; k++) {
+      UInt b = (UInt)(h >> (64 - 16 * (k + 1))) & (SPILL_FILTER_BITS - 1);
+      if (!((seg->filter[b >> 3] >> (b & 7)) & 1))
+         return False;
+   }
+   return True;
+}
+
+static inline void spill_filter_set ( SpillSeg* seg, Addr ga )
+{
+   ULong h = spill_filter_hash(ga);
+   Int   k;
+   for (k = 0; k < SPILL_FILTER_K; k++) {
+      UInt b = (UInt)(h >> (64 - 16 * (k + 1))) & (SPILL_FILTER_BITS - 1);
+      seg->filter[b >> 3] |= 1 << (b & 7);
+   }
+}
+
+/* Create the spill file 'path', which is taken over.  Returns False,
+   with a warning, if it cannot be created. */
+static Bool history_spill_open ( HChar* path )
+{
+   SysRes sres = VG_(open)(path, VKI_O_CREAT|VKI_O_TRUNC|VKI_O_RDWR,
+                           VKI_S_IRUSR|VKI_S_IWUSR);
+   if (sr_isError(sres)) {
+      VG_(umsg)("Warning: cannot create history spill file '%s'; "
+                "--history-spill-file ignored\n", path);
+      VG_(free)(path);
+      return False;
+   }
+   spill_fd         = VG_(safe_fd)(sr_Res(sres));
+   spill_path       = path;
+   spill_seg_oldest = 0;
+   spill_wr_off     = 0;
+   spill_wbuf_used  = 0;
+   spill_segs = VG_(newXA)( HG_(zalloc), "libhb.history_spill_open.1",
+                            HG_(free), sizeof(SpillSeg) );
+   return True;
+}
+
+/* Stop spilling, forgetting what has been spilled. */
+static void history_spill_close ( void )
+{
+   if (spill_fd < 0)
+      return;
+   VG_(close)(spill_fd);
+   spill_fd = -1;
+   VG_(free)(spill_path);
+   spill_path = NULL;
+   VG_(deleteXA)(spill_segs);
+   spill_segs = NULL;
+}
+
+static void history_spill_atfork_child ( ThreadId tid )
+{
+   HChar* path;
+
+   if (spill_fd < 0)
+      return;
+   /* The parent carries on writing the file, and would move the
+      offset we share with it under our feet, so it stays the parent's.
+      Unwritten records go too: the parent will write them. */
+   path = VG_(expand_file_name)("--history-spill-file",
+                                HG_(clo_history_spill_file));
+   if (VG_(strcmp)(path, spill_path) == 0) {
+      VG_(free)(path);
+      path = NULL;
+   }
+   history_spill_close();
+   if (path)
+      history_spill_open(path);
+}
+
+static void history_spill_init ( void )
+{
+   if (HG_(clo_history_spill_file) == NULL || HG_(clo_history_level) != 2)
+      return;
+   if (history_spill_open(VG_(expand_file_name)("--history-spill-file",
+                                                HG_(clo_history_spill_file))))
+      VG_(atfork)(NULL/*pre*/, NULL/*parent*/,
+                  history_spill_atfork_child/*child*/);
+}
+
+static void history_spill_fail ( void )
+{
+   VG_(umsg)("Warning: cannot write history spill file; "
+             "no more accesses will be spilled\n");
+   history_spill_close();
+}
+
+static void history_spill_flush ( void )
+{
+   Int nB = spill_wbuf_used * sizeof(SpillRec);
+   if (spill_fd < 0 || nB == 0)
+      return;
+   if (VG_(lseek)(spill_fd, spill_wr_off, VKI_SEEK_SET) != spill_wr_off
+       || VG_(write)(spill_fd, spill_wbuf, nB) != nB) {
+      history_spill_fail();
+      return;
+   }
+   spill_wr_off += nB;
+   spill_wbuf_used = 0;
+}
+
+/* Append 'ref', which is about to be discarded, to the spill file. */
+static void history_spill ( const OldRef* ref )
+{
+   SpillSeg* seg;
+   SpillRec* rec;
+   Word      nSegs;
+
+   if (spill_fd < 0)
+      return;
+
+   nSegs = VG_(sizeXA)(spill_segs);
+   seg   = nSegs > 0 ? spill_seg_newest(0) : NULL;
+   if (seg == NULL || seg->nRecs == SPILL_SEG_RECS) {
+      /* A segment's records are contiguous in the file, so write out
+         the previous one's before deciding where this one goes. */
+      history_spill_flush();
+      if (spill_fd < 0)
+         return;
+      if (nSegs < SPILL_MAX_SEGS) {
+         SpillSeg fresh;
+         VG_(memset)(&fresh, 0, sizeof(fresh));
+         fresh.offset = spill_wr_off;
+         VG_(addToXA)(spill_segs, &fresh);
+         seg = VG_(indexXA)(spill_segs, nSegs);
+      } else {
+         Off64T offset;
+         seg    = VG_(indexXA)(spill_segs, spill_seg_oldest);
+         offset = seg->offset;
+         VG_(memset)(seg, 0, sizeof(*seg));
+         seg->offset      = offset;
+         spill_wr_off     = offset;
+         spill_seg_oldest = (spill_seg_oldest + 1) % nSegs;
+         stats__spill_segs_reused++;
+      }
+      seg->min_ga = ref->ga;
+      seg->max_ga = ref->ga;
+   }
+
+   rec = &spill_wbuf[spill_wbuf_used++];
+   rec->ga         = ref->ga;
+   rec->tsw        = oldref_tsw(ref);
+   rec->locksHeldW = ref->acc.locksHeldW;
+   VG_(memcpy)(rec->frames, ref->acc.rcec->frames, sizeof(rec->frames));
+
+   if (ref->ga < seg->min_ga) seg->min_ga = ref->ga;
+   if (ref->ga > seg->max_ga) seg->max_ga = ref->ga;
+   spill_filter_set(seg, ref->ga);
+   if ((ref->ga >> 3) != ((ref->ga + ref->acc.tsw.szB - 1) >> 3))
+      spill_filter_set(seg, ref->ga + ref->acc.tsw.szB - 1);
+   seg->nRecs++;
+   stats__spill_recs++;
+
+   if (spill_wbuf_used == SPILL_BUF_RECS)
+      history_spill_flush();
+}
+
+/* The lowest address a record overlapping 'a' can start at: records
+   are at most 8 bytes long. */
+static inline Addr spill_lo ( Addr a )
+{
+   return a >= 7 ? a - 7 : 0;
+}
+
+/* Could 'seg' hold a record overlapping [lo, hi] ? */
+static Bool spill_seg_may_have ( const SpillSeg* seg, Addr lo, Addr hi )
+{
+   Addr g;
+   if (seg->max_ga < lo || seg->min_ga > hi)
+      return False;
+   for (g = lo & ~(Addr)7; g <= hi; g += 8) {
+      if (spill_filter_test(seg, g))
+         return True;
+   }
+   return False;
+}
+
+/* Call fn on each record of 'seg', in the order written, until it
+   returns False.  Returns False if the file could not be read. */
+static Bool spill_seg_scan ( const SpillSeg* seg,
+                             Bool (*fn)( const SpillRec*, void* ),
+                             void* opaque )
+{
+   UInt done = 0;
+   stats__spill_segs_read++;
+   while (done < seg->nRecs) {
+      UInt   n   = seg->nRecs - done;
+      Off64T off = seg->offset + (Off64T)done * sizeof(SpillRec);
+      UInt   i;
+      if (n > SPILL_BUF_RECS)
+         n = SPILL_BUF_RECS;
+      if (VG_(lseek)(spill_fd, off, VKI_SEEK_SET) != off
+          || VG_(read)(spill_fd, spill_rbuf, n * sizeof(SpillRec))
+             != (Int)(n * sizeof(SpillRec)))
+         return False;
+      for (i = 0; i < n; i++) {
+         if (!fn(&spill_rbuf[i], opaque))
+            return True;
+      }
+      done += n;
+   }
+   return True;
+}
+
+typedef
+   struct {
+      ThrID     thrid;
+      Addr      a;
+      SizeT     szB;
+      Bool      isW;
+      Bool      found;
+      SpillRec  best;
+   }
+   SpillLookup;
+
+static Bool spill_lookup_rec ( const SpillRec* rec, void* opaque )
+{
+   SpillLookup* q = opaque;
+   TSW          tsw;
+   VG_(memcpy)(&tsw, &rec->tsw, sizeof(TSW));
+   /* Same criteria as libhb_event_map_lookup uses for OldRefs. */
+   if (tsw.thrid == q->thrid)
+      return True;
+   if (!tsw.isW && !q->isW)
+      return True;
+   if (cmp_nonempty_intervals(q->a, q->szB, rec->ga, tsw.szB) != 0)
+      return True;
+   /* Records are written in LRU order, so a later one is more recent. */
+   q->best  = *rec;
+   q->found = True;
+   return True;
+}
+
+/* Find the most recent spilled access conflicting with thr/[a, a+szB[/isW,
+   looking at the newest segment that has any. */
+static Bool history_spill_lookup ( /*OUT*/SpillRec* res,
+                                   ThrID thrid, Addr a, SizeT szB, Bool isW )
+{
+   Word        s;
+   SpillLookup q;
+
+   history_spill_flush();
+   if (spill_fd < 0)
+      return False;
+
+   q.thrid = thrid;
+   q.a     = a;
+   q.szB   = szB;
+   q.isW   = isW;
+   q.found = False;
+   for (s = 0; s < VG_(sizeXA)(spill_segs); s++) {
+      const SpillSeg* seg = spill_seg_newest(s);
+      if (!spill_seg_may_have(seg, spill_lo(a), a + szB - 1))
+         continue;
+      if (!spill_seg_scan(seg, spill_lookup_rec, &q))
+         return False;
+      if (q.found) {
+         *res = q.best;
+         stats__spill_found++;
+         return True;
+      }
+   }
+   return False;
+}
+
+typedef
+   struct {
+      Addr     a;
+      SizeT    szB;
+      Access_t fn;
+   }
+   SpillHistory;
+
+static Bool spill_history_rec ( const SpillRec* rec, void* opaque )
+{
+   SpillHistory* h = opaque;
+   TSW           tsw;
+   Int           n;
+   VG_(memcpy)(&tsw, &rec->tsw, sizeof(TSW));
+   if (cmp_nonempty_intervals(h->a, h->szB, rec->ga, tsw.szB) == 0) {
+      for (n = 0; n < N_FRAMES; n++) {
+         if (0 == rec->frames[n])
+            break;
+      }
+      (*h->fn)((UWord*)rec->frames, n, Thr__from_ThrID(tsw.thrid),
+               rec->ga, tsw.szB, tsw.isW, rec->locksHeldW);
+   }
+   return True;
+}
+
+/* Report the spilled accesses overlapping [a, a+szB[, oldest first. */
+static void history_spill_access_history ( Addr a, SizeT szB, Access_t fn )
+{
+   Word         s;
+   SpillHistory h;
+
+   history_spill_flush();
+   if (spill_fd < 0)
+      return;
+
+   h.a   = a;
+   h.szB = szB;
+   h.fn  = fn;
+   for (s = VG_(sizeXA)(spill_segs) - 1; s >= 0; s--) {
+      const SpillSeg* seg = spill_seg_newest(s);
+      if (spill_seg_may_have(seg, spill_lo(a), a + szB - 1)
+          && !spill_seg_scan(seg, spill_history_rec, &h))
+         return;
+   }
+}
+
+
 /* allocates a new OldRef or re-use the lru one if all allowed OldRef
    have already been allocated. */
 static OldRef* alloc_or_reuse_OldRef ( void )
@@ -4548,6 +5151,7 @@ static OldRef* alloc_or_reuse_OldRef ( void )
       OldRef_unchain(oldref);
       oldref_ht = VG_(HT_gen_remove) (oldrefHT, oldref, cmp_oldref_tsw);
       tl_assert (oldref == oldref_ht);
+      history_spill( oldref );
       ctxt__rcdec( oldref->acc.rcec );
       return oldref;
    }
@@ -4558,25 +5162,6 @@ inline static UInt min_UInt ( UInt a, UInt b ) {
    return a < b ? a : b;
 }
 
-/* Compare the intervals [a1,a1+n1) and [a2,a2+n2).  Return -1 if the
-   first interval is lower, 1 if the first interval is higher, and 0
-   if there is any overlap.  Redundant paranoia with casting is there
-   following what looked distinctly like a bug in gcc-4.1.2, in which
-   some of the comparisons were done signedly instead of
-   unsignedly. */
-/* Copied from exp-ptrcheck/sg_main.c */
-static inline Word cmp_nonempty_intervals ( Addr a1, SizeT n1,
-                                            Addr a2, SizeT n2 ) {
-   UWord a1w = (UWord)a1;
-   UWord n1w = (UWord)n1;
-   UWord a2w = (UWord)a2;
-   UWord n2w = (UWord)n2;
-   tl_assert(n1w > 0 && n2w > 0);
-   if (a1w + n1w <= a2w) return -1L;
-   if (a2w + n2w <= a1w) return 1L;
-   return 0;
-}
-
 static UWord event_map_stamp = 0; // Used to stamp each OldRef when touched.
 
 static void event_map_bind ( Addr a, SizeT szB, Bool isW, Thr* thr )
@@ -4750,6 +5335,27 @@ Bool libhb_event_map_lookup ( /*OUT*/ExeContext** resEC,
       /* consider next address in toCheck[] */
    } /* for (j = 0; j < nToCheck; j++) */
 
+   /* Nothing in memory; maybe it has been spilled. */
+   {
+      SpillRec rec;
+      if (history_spill_lookup(&rec, thrid, a, szB, isW)) {
+         TSW tsw;
+         Int n, maxNFrames;
+         VG_(memcpy)(&tsw, &rec.tsw, sizeof(TSW));
+         maxNFrames = min_UInt(N_FRAMES, VG_(clo_backtrace_size));
+         for (n = 0; n < maxNFrames; n++) {
+            if (0 == rec.frames[n]) break;
+         }
+         *resEC      = VG_(make_ExeContext_from_StackTrace)(rec.frames, n);
+         *resThr     = Thr__from_ThrID(tsw.thrid);
+         *resSzB     = tsw.szB;
+         *resIsW     = tsw.isW;
+         *locksHeldW = rec.locksHeldW;
+         stats__evm__lookup_found++;
+         return True;
+      }
+   }
+
    /* really didn't find anything. */
    stats__evm__lookup_notfound++;
    return False;
@@ -4761,7 +5367,10 @@ void libhb_event_map_access_history ( Addr a, SizeT szB, Access_t fn )
    OldRef *ref = lru.next;
    SizeT ref_szB;
    Int n;
-      
+
+   /* Spilled accesses are all older than those still in memory. */
+   history_spill_access_history(a, szB, fn);
+
    while (ref != &mru) {
       ref_szB = ref->acc.tsw.szB;
       if (cmp_nonempty_intervals(a, szB, ref->ga, ref_szB) == 0) {
@@ -4829,6 +5438,8 @@ static void event_map_init ( void )
                            .locksHeldW = 0, 
                            .rcec = NULL};
    lru.acc = mru.acc;
+
+   history_spill_init();
 }
 
 static void event_map__check_reference_counts ( void )
@@ -6256,6 +6867,7 @@ Thr* libhb_init (
       VTS singleton, tick and join operations. */
    temp_max_sized_VTS = VTS__new( "libhb.libhb_init.1", ThrID_MAX_VALID );
    temp_max_sized_VTS->id = VtsID_INVALID;
+   scalarts_thrid_mask_init();
    verydead_thread_tables_init();
    vts_set_init();
    vts_tab_init();
@@ -6401,10 +7013,14 @@ void libhb_shutdown ( Bool show_stats )
                   stats__cmpLEQ_queries, stats__cmpLEQ_misses);
       VG_(printf)("   libhb: %'13llu join2  queries (%'llu misses)\n",
                   stats__join2_queries, stats__join2_misses);
+      VG_(printf)("   libhb: cmpLEQ cache %'u entries, join2 cache %'u entries\n",
+                  cmpLEQ_ctl.mask + 1, join2_ctl.mask + 1);
 
       VG_(printf)("%s","\n");
       VG_(printf)("   libhb: VTSops: tick %'lu,  join %'lu,  cmpLEQ %'lu\n",
                   stats__vts__tick, stats__vts__join,  stats__vts__cmpLEQ );
+      VG_(printf)("   libhb: VTSops: dense join %'lu,  dense cmpLEQ %'lu\n",
+                  stats__vts__join_dense, stats__vts__cmpLEQ_dense );
       VG_(printf)("   libhb: VTSops: cmp_structural %'lu (%'lu slow)\n",
                   stats__vts__cmp_structural, stats__vts__cmp_structural_slow);
       VG_(printf)("   libhb: VTSset: find__or__clone_and_add %'lu"
@@ -6464,6 +7080,12 @@ void libhb_shutdown ( Bool show_stats )
       tl_assert (oldrefHTN == VG_(HT_count_nodes) (oldrefHT));
       VG_(printf)( "   libhb: oldref lookup found=%lu notfound=%lu\n",
                    stats__evm__lookup_found, stats__evm__lookup_notfound);
+      if (spill_segs)
+         VG_(printf)( "   libhb: history spill: %'llu records in %'lu segments"
+                      " (%'llu reused, %'llu found, %'llu segments read)\n",
+                      stats__spill_recs, VG_(sizeXA)(spill_segs),
+                      stats__spill_segs_reused,
+                      stats__spill_found, stats__spill_segs_read);
       if (VG_(clo_verbosity) > 1)
          VG_(HT_print_stats) (oldrefHT, cmp_oldref_tsw);
       VG_(printf)( "   libhb: oldref bind tsw/rcec "
@@ -6541,6 +7163,8 @@ void libhb_shutdown ( Bool show_stats )
       VG_(printf)("%s","\n");
 
    }
+
+   history_spill_close();
 }
 
 /* Receive notification that a thread has low level exited.  The
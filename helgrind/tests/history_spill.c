@@ -0,0 +1,96 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+/* Race on x, with enough unrelated accesses in between that the
+   first access is only to be found in the --history-spill-file file.
+   Then fork, spill some more in the child, and exec, and check that
+   the spill file did not leak into the exec'd program. */
+
+#define N_FILLER (200 * 1000)
+
+int x = 0;
+int fds[2];
+
+static void fill ( void )
+{
+   int* filler = malloc(N_FILLER * sizeof(int));
+   int  i;
+   for (i = 0; i < N_FILLER; i++)
+      filler[i] = i;
+   free(filler);
+}
+
+static void* child_fn ( void* arg )
+{
+   x = 1;
+   /* A pipe creates no happens-before edge, but fixes the order. */
+   write(fds[1], "x", 1);
+   return NULL;
+}
+
+/* Runs natively, after exec: report any open spill file. */
+static int check_fds ( void )
+{
+   DIR*           d = opendir("/proc/self/fd");
+   struct dirent* e;
+   char           path[300], target[256];
+   ssize_t        n;
+   int            stray = 0;
+   if (d == NULL) {
+      printf("exec: no stray spill fds\n");
+      return 0;
+   }
+   while ((e = readdir(d)) != NULL) {
+      snprintf(path, sizeof(path), "/proc/self/fd/%s", e->d_name);
+      n = readlink(path, target, sizeof(target) - 1);
+      if (n < 0)
+         continue;
+      target[n] = 0;
+      if (strstr(target, "history_spill.") && strstr(target, ".spill")) {
+         printf("exec: fd %s is %s\n", e->d_name, target);
+         stray++;
+      }
+   }
+   closedir(d);
+   if (stray == 0)
+      printf("exec: no stray spill fds\n");
+   return 0;
+}
+
+int main ( int argc, char** argv )
+{
+   pthread_t child;
+   pid_t     pid;
+   char      c;
+
+   if (argc > 1 && strcmp(argv[1], "exec") == 0)
+      return check_fds();
+
+   if (pipe(fds) || pthread_create(&child, NULL, child_fn, NULL)) {
+      perror("pipe/pthread_create");
+      exit(1);
+   }
+   read(fds[0], &c, 1);
+   fill();
+   /* Unprotected relative to child */
+   x = 2;
+   pthread_join(child, NULL);
+
+   fflush(stdout);
+   pid = fork();
+   if (pid == 0) {
+      fill();
+      execl(argv[0], argv[0], "exec", (char*)NULL);
+      perror("execl");
+      _exit(1);
+   }
+   waitpid(pid, NULL, 0);
+   printf("done\n");
+   return 0;
+}
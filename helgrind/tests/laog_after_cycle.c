@@ -0,0 +1,63 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/* A lock order error puts a cycle in the lock order graph.  Check
+   that errors found after that, and after many more locks have been
+   ordered, still name the right locks, including one found only
+   through the edge that closed the cycle. */
+
+#define N_CHAIN 200
+
+pthread_mutex_t mxA, mxB, mxC, mxD;
+pthread_mutex_t chain[N_CHAIN];
+
+static void lock_pair ( pthread_mutex_t* first, pthread_mutex_t* second )
+{
+   int r;
+   r = pthread_mutex_lock( first ); assert(r==0);
+   r = pthread_mutex_lock( second ); assert(r==0);
+   r = pthread_mutex_unlock( second ); assert(r==0);
+   r = pthread_mutex_unlock( first ); assert(r==0);
+}
+
+int main ( void )
+{
+   int r, i;
+   r = pthread_mutex_init( &mxA, NULL ); assert(r==0);
+   r = pthread_mutex_init( &mxB, NULL ); assert(r==0);
+   r = pthread_mutex_init( &mxC, NULL ); assert(r==0);
+   r = pthread_mutex_init( &mxD, NULL ); assert(r==0);
+   for (i = 0; i < N_CHAIN; i++) {
+      r = pthread_mutex_init( &chain[i], NULL ); assert(r==0);
+   }
+
+   /* mxA before mxB, then mxB before mxA. */
+   lock_pair( &mxA, &mxB );
+   r = pthread_mutex_lock( &mxB ); assert(r==0);
+   r = pthread_mutex_lock( &mxA ); assert(r==0); /* error */
+   r = pthread_mutex_unlock( &mxA ); assert(r==0);
+   r = pthread_mutex_unlock( &mxB ); assert(r==0);
+
+   /* mxC, chain[0 .. N_CHAIN-1], mxD, mxB, in that order. */
+   lock_pair( &mxC, &chain[0] );
+   for (i = 0; i + 1 < N_CHAIN; i++)
+      lock_pair( &chain[i], &chain[i+1] );
+   lock_pair( &chain[N_CHAIN-1], &mxD );
+   lock_pair( &mxD, &mxB );
+
+   /* mxC comes before mxA only through mxB before mxA. */
+   r = pthread_mutex_lock( &mxA ); assert(r==0);
+   r = pthread_mutex_lock( &mxC ); assert(r==0); /* error */
+   r = pthread_mutex_unlock( &mxC ); assert(r==0);
+   r = pthread_mutex_unlock( &mxA ); assert(r==0);
+
+   r = pthread_mutex_lock( &mxB ); assert(r==0);
+   r = pthread_mutex_lock( &mxD ); assert(r==0); /* error */
+   r = pthread_mutex_unlock( &mxD ); assert(r==0);
+   r = pthread_mutex_unlock( &mxB ); assert(r==0);
+
+   printf("done\n");
+   return 0;
+}
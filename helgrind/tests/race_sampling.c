@@ -0,0 +1,43 @@
+/* With --race-sampling=N, each thread checks the memory accesses of
+   only some of the code at a time, moving on every time it is
+   scheduled.  Run two threads for long enough to be scheduled many
+   times, so that some, but not all, of their accesses get checked.
+   They race on 'shared' all the time, so the race must be found
+   anyway, once each thread has had its turn at checking the loop. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_WORDS  1000
+#define N_PASSES 2000
+
+static volatile int shared = 0;
+
+static void* worker ( void* v )
+{
+   int* a = malloc(N_WORDS * sizeof(int));
+   long sum = 0;
+   int i, j;
+   for (i = 0; i < N_WORDS; i++)
+      a[i] = i;
+   for (j = 0; j < N_PASSES; j++)
+      for (i = 0; i < N_WORDS; i++) {
+         sum += a[i]++;
+         shared++;              /* unprotected */
+      }
+   free(a);
+   return (void*)sum;
+}
+
+int main ( void )
+{
+   pthread_t t1, t2;
+   void *r1, *r2;
+   pthread_create(&t1, NULL, worker, NULL);
+   pthread_create(&t2, NULL, worker, NULL);
+   pthread_join(t1, &r1);
+   pthread_join(t2, &r2);
+   printf("%s\n", r1 == r2 ? "done" : "mismatch");
+   return 0;
+}
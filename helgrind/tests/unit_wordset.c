@@ -0,0 +1,160 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pub_tool_basics.h"
+#include "pub_tool_libcbase.h"
+#include "pub_tool_libcassert.h"
+#include "pub_tool_libcprint.h"
+
+// Crudely redirect various VG_(foo)() functions to their libc equivalents.
+#undef tl_assert
+#define tl_assert(e)                   assert(e)
+
+#define vgPlain_printf                 printf
+#define vgPlain_memset                 memset
+#define vgPlain_memcmp                 memcmp
+
+#include "helgrind/hg_wordset.c"
+
+// Randomised test of the word set operations: every result is checked
+// against a bitmask over a small universe of words, including that
+// equal sets always get the same WordSet number, also once some sets
+// have died and their numbers are being reused.
+
+#define N_ITERS  20000     // Operations to do
+#define N_UNIV   40        // Size of the universe of words
+#define N_LIVE   200       // Most sets to keep around
+#define N_SPARE  50        // Fewest sets to keep before killing any
+
+typedef  unsigned long long  Mask;
+
+
+/* Consistent random number generator, so it produces the
+   same results on all platforms. */
+
+#define random error_do_not_use_libc_random
+
+static UInt seed = 0;
+static UInt myrandom( void )
+{
+  seed = (1103515245 * seed + 12345);
+  return seed >> 8;
+}
+
+static void* allocate_node(const HChar* cc, SizeT szB)
+{ return malloc(szB); }
+
+static void free_node(void* p)
+{ return free(p); }
+
+// Universe element i, spaced out so it looks like a pointer.
+static UWord elt ( UInt i )
+{
+   return 0x1000 + i * 56;
+}
+
+// The contents of 'ws' as a bitmask, checking they are sorted.
+static Mask contents ( WordSetU* wsu, WordSet ws )
+{
+   UWord* words;
+   UWord  nWords, i;
+   Mask   m = 0;
+   HG_(getPayloadWS)( &words, &nWords, wsu, ws );
+   for (i = 0; i < nWords; i++) {
+      assert( i == 0 || words[i] > words[i-1] );
+      assert( (words[i] - 0x1000) % 56 == 0 );
+      m |= 1ULL << ((words[i] - 0x1000) / 56);
+   }
+   return m;
+}
+
+int main(void)
+{
+   WordSetU* wsu = HG_(newWordSetU)( allocate_node, "unit_wordset",
+                                     free_node, 8 );
+   WordSet   live[N_LIVE];
+   Int       nLive = 1;
+   Int       it, j, nDied = 0;
+
+   live[0] = HG_(emptyWS)( wsu );
+   assert( contents(wsu, live[0]) == 0 );
+
+   for (it = 0; it < N_ITERS; it++) {
+      WordSet a  = live[myrandom() % nLive];
+      WordSet b  = live[myrandom() % nLive];
+      Mask    ma = contents(wsu, a);
+      Mask    mb = contents(wsu, b);
+      UInt    x  = myrandom() % N_UNIV;
+      UInt    y  = myrandom() % N_UNIV;
+      WordSet res;
+      Mask    expected;
+
+      switch (myrandom() % 8) {
+         case 0:
+            res = HG_(addToWS)( wsu, a, elt(x) );
+            expected = ma | (1ULL << x);
+            break;
+         case 1:
+            res = HG_(delFromWS)( wsu, a, elt(x) );
+            expected = ma & ~(1ULL << x);
+            break;
+         case 2:
+            res = HG_(unionWS)( wsu, a, b );
+            expected = ma | mb;
+            break;
+         case 3:
+            res = HG_(intersectWS)( wsu, a, b );
+            expected = ma & mb;
+            break;
+         case 4:
+            res = HG_(minusWS)( wsu, a, b );
+            expected = ma & ~mb;
+            break;
+         case 5:
+            res = HG_(doubletonWS)( wsu, elt(x), elt(y) );
+            expected = (1ULL << x) | (1ULL << y);
+            break;
+         case 6:
+            assert( !HG_(isSubsetOf)( wsu, a, b ) == !((ma & ~mb) == 0) );
+            assert( HG_(elemWS)( wsu, a, elt(x) ) == ((ma >> x) & 1) );
+            assert( HG_(isEmptyWS)( wsu, a ) == (ma == 0) );
+            assert( HG_(cardinalityWS)( wsu, a )
+                    == (UWord)__builtin_popcountll(ma) );
+            continue;
+         default: {
+            // Kill a set that nothing refers to any more.
+            WordSet dead;
+            Int     k;
+            if (nLive <= N_SPARE)
+               continue;
+            k = 1 + myrandom() % (nLive - 1);
+            dead = live[k];
+            live[k] = live[--nLive];
+            for (j = 0; j < nLive; j++) {
+               if (live[j] == dead)
+                  break;
+            }
+            if (j == nLive) {
+               HG_(dieWS)( wsu, dead );
+               nDied++;
+            }
+            continue;
+         }
+      }
+
+      assert( contents(wsu, res) == expected );
+      // Equal sets are the same set.
+      for (j = 0; j < nLive; j++) {
+         assert( (live[j] == res) == (contents(wsu, live[j]) == expected) );
+      }
+      if (nLive < N_LIVE)
+         live[nLive++] = res;
+   }
+
+   printf("%d operations, some sets died: %s\n", N_ITERS,
+          nDied > 0 ? "yes" : "no");
+   HG_(deleteWordSetU)( wsu );
+   return 0;
+}
@@ -112,6 +112,12 @@ typedef
       Bool    hasT;     // True --> translations have (or MAY have)
                         // been taken from this segment
       Bool    isCH;     // True --> is client heap (SkAnonC ONLY)
+      Bool    isWP;     // True --> write access has been taken away
+                        // by the core, to notice writes to code that
+                        // has been translated (SkAnonC ONLY); the
+                        // client still sees hasW
+      Bool    isShared; // True --> mapped MAP_SHARED, so may be written
+                        // through other mappings (SkAnonC, SkFileC ONLY)
    }
    NSegment;
 
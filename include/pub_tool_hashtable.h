@@ -33,14 +33,17 @@
 
 #include "pub_tool_basics.h"   // VG_ macro
 
-/* Generic type for a separately-chained hash table.  Via a kind of dodgy
+/* Generic type for a hash table of nodes.  Via a kind of dodgy
    C-as-C++ style inheritance, tools can extend the VgHashNode type, so long
    as the first two fields match the sizes of these two fields.  Requires
-   a bit of casting by the tool. */
+   a bit of casting by the tool.
 
-// Problems with this data structure:
-// - Separate chaining gives bad cache behaviour.  Hash tables with linear
-//   probing give better cache behaviour.
+   The table uses linear probing over an array holding each key next to
+   its node, so lookups of absent keys and of the first node with a key
+   don't touch other nodes.  The 'next' field links nodes with the same
+   key; it is owned by the table while the node is in it.  The table is
+   grown incrementally: the cost of moving the nodes to a bigger array
+   is spread over the following insertions and removals. */
 
 typedef
    struct _VgHashNode {
@@ -51,10 +54,9 @@ typedef
 
 typedef struct _VgHashTable VgHashTable;
 
-/* Make a new table.  Allocates the memory with VG_(calloc)(), so can
-   be freed with VG_(free)().  The table starts small but will
-   periodically be expanded.  This is transparent to the users of this
-   module. The function never returns NULL. */
+/* Make a new table.  The table starts small but will periodically be
+   expanded.  This is transparent to the users of this module.  The
+   function never returns NULL.  Free it with VG_(HT_destruct). */
 extern VgHashTable *VG_(HT_construct) ( const HChar* name );
 
 /* Count the number of nodes in a table. */
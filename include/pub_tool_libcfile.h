@@ -86,6 +86,11 @@ extern SysRes VG_(stat)   ( const HChar* file_name, struct vg_stat* buf );
 extern Int    VG_(fstat)  ( Int   fd,        struct vg_stat* buf );
 extern SysRes VG_(dup)    ( Int oldfd );
 extern SysRes VG_(dup2)   ( Int oldfd, Int newfd );
+
+/* Move an fd into the Valgrind-safe range, above the fds the client
+   can use, and mark it close-on-exec.  Tools should do this with any
+   fd they keep open while the client runs.  Asserts on failure. */
+extern Int    VG_(safe_fd) ( Int oldfd );
 extern Int    VG_(rename) ( const HChar* old_name, const HChar* new_name );
 extern Int    VG_(unlink) ( const HChar* file_name );
 
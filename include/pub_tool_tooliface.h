@@ -497,6 +497,21 @@ extern void VG_(needs_xml_output) ( void );
    function here. */
 extern void VG_(needs_final_IR_tidy_pass) ( IRSB*(*final_tidy)(IRSB*) );
 
+/* Can the tool's translations be kept in a file and reused by a later
+   run (--trans-cache-file)?  Only say so if the instrumentation is a
+   pure function of the guest code and the command line options: it
+   must not embed pointers to data allocated at run time, ExeContexts,
+   or anything else that differs from one run to the next.  Should be
+   called from post_clo_init, since it usually depends on options. */
+extern void VG_(needs_cacheable_translations) ( void );
+
+/* Could the tool's instrumented code run in several threads at once?
+   Only say so if its helpers and the state they update need no lock:
+   counters updated atomically, or no run-time state at all.  The core
+   does not run threads in parallel yet, see
+   docs/internals/parallel-execution.txt. */
+extern void VG_(needs_thread_safe_instrumentation) ( void );
+
 
 /* ------------------------------------------------------------------ */
 /* Core events to track */
@@ -1023,7 +1023,8 @@ static Bool mempool_block_maybe_describe( Addr a, AddrInfo* ai );
    putting the result in ai. */
 static void describe_addr ( Addr a, /*OUT*/AddrInfo* ai )
 {
-   MC_Chunk*  mc;
+   MC_Chunk*         mc;
+   MC_FreedBlockInfo fb;
 
    tl_assert(Addr_Undescribed == ai->tag);
 
@@ -1049,7 +1050,7 @@ static void describe_addr ( Addr a, /*OUT*/AddrInfo* ai )
       if (addr_is_in_MC_Chunk_default_REDZONE_SZB(mc, a)) {
          ai->tag = Addr_Block;
          ai->Addr.Block.block_kind = Block_Mallocd;
-         if (MC_(get_freed_block_bracketting)( a ))
+         if (MC_(get_freed_block_bracketting)( a, NULL ))
             ai->Addr.Block.block_desc = "recently re-allocated block";
          else
             ai->Addr.Block.block_desc = "block";
@@ -1062,16 +1063,15 @@ static void describe_addr ( Addr a, /*OUT*/AddrInfo* ai )
       }
    }
    /* -- Search for a recently freed block which might bracket it. -- */
-   mc = MC_(get_freed_block_bracketting)( a );
-   if (mc) {
+   if (MC_(get_freed_block_bracketting)( a, &fb )) {
       ai->tag = Addr_Block;
       ai->Addr.Block.block_kind = Block_Freed;
       ai->Addr.Block.block_desc = "block";
-      ai->Addr.Block.block_szB  = mc->szB;
-      ai->Addr.Block.rwoffset   = (Word)a - (Word)mc->data;
-      ai->Addr.Block.allocated_at = MC_(allocated_at)(mc);
+      ai->Addr.Block.block_szB  = fb.szB;
+      ai->Addr.Block.rwoffset   = (Word)a - (Word)fb.data;
+      ai->Addr.Block.allocated_at = fb.allocated_at;
       VG_(initThreadInfo) (&ai->Addr.Block.alloc_tinfo);
-      ai->Addr.Block.freed_at = MC_(freed_at)(mc);
+      ai->Addr.Block.freed_at = fb.freed_at;
       return;
    }
 
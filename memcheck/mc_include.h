@@ -115,10 +115,21 @@ void MC_(move_mempool)    ( Addr poolA, Addr poolB );
 void MC_(mempool_change)  ( Addr pool, Addr addrA, Addr addrB, SizeT size );
 Bool MC_(mempool_exists)  ( Addr pool );
 
+/* What is remembered about a recently freed block. */
+typedef
+   struct {
+      Addr        data;
+      SizeT       szB;
+      ExeContext* allocated_at;  // VG_(null_ExeContext)() if not recorded
+      ExeContext* freed_at;      // ditto
+   }
+   MC_FreedBlockInfo;
+
 /* Searches for a recently freed block which might bracket Addr a.
-   Return the MC_Chunk* for this block or NULL if no bracketting block
-   is found. */
-MC_Chunk* MC_(get_freed_block_bracketting)( Addr a );
+   Returns True and, if res is not NULL, fills in *res for this block;
+   returns False if no bracketting block is found. */
+Bool MC_(get_freed_block_bracketting)( Addr a,
+                                       /*OUT*/MC_FreedBlockInfo* res );
 
 /* For efficient pooled alloc/free of the MC_Chunk. */
 extern PoolAlloc* MC_(chunk_poolalloc);
@@ -138,6 +149,7 @@ void MC_(make_mem_noaccess)        ( Addr a, SizeT len );
 void MC_(make_mem_undefined_w_otag)( Addr a, SizeT len, UInt otag );
 void MC_(make_mem_defined)         ( Addr a, SizeT len );
 void MC_(copy_address_range_state) ( Addr src, Addr dst, SizeT len );
+void MC_(maybe_compress_secmaps)   ( void );
 
 void MC_(print_malloc_stats) ( void );
 /* nr of free operations done */
@@ -230,6 +242,9 @@ enum {
    MCPE_LOADV_128_OR_256_SLOW2,
    MCPE_LOADVN_SLOW,
    MCPE_LOADVN_SLOW_LOOP,
+   MCPE_LOADV_RANGE,
+   MCPE_LOADV_RANGE_SLOW1,
+   MCPE_LOADV_RANGE_SLOW2,
    MCPE_STOREV8,
    MCPE_STOREV8_SLOW1,
    MCPE_STOREV8_SLOW2,
@@ -269,12 +284,14 @@ enum {
    MCPE_COPY_ADDRESS_RANGE_STATE,
    MCPE_COPY_ADDRESS_RANGE_STATE_LOOP1,
    MCPE_COPY_ADDRESS_RANGE_STATE_LOOP2,
+   MCPE_COPY_ADDRESS_RANGE_STATE_BULK,
    MCPE_CHECK_MEM_IS_NOACCESS,
    MCPE_CHECK_MEM_IS_NOACCESS_LOOP,
    MCPE_IS_MEM_ADDRESSABLE,
    MCPE_IS_MEM_ADDRESSABLE_LOOP,
    MCPE_IS_MEM_DEFINED,
    MCPE_IS_MEM_DEFINED_LOOP,
+   MCPE_IS_MEM_DEFINED_BULK,
    MCPE_IS_MEM_DEFINED_COMPREHENSIVE,
    MCPE_IS_MEM_DEFINED_COMPREHENSIVE_LOOP,
    MCPE_IS_DEFINED_ASCIIZ,
@@ -489,8 +506,20 @@ extern HChar * MC_(snprintf_delta) (HChar * buf, Int size,
 
 
 Bool MC_(is_valid_aligned_word)     ( Addr a );
+SizeT MC_(count_valid_aligned_words) ( Addr a, SizeT nwords );
 Bool MC_(is_within_valid_secondary) ( Addr a );
 
+/* Change tracking for --incremental-leak-check=yes.  MC_(dirty_secmaps)
+   is NULL unless it is in use.  Otherwise its entry [a >> 16] (or
+   [MC_(n_dirty_secmaps)] if that is larger) is nonzero if the 64KB chunk
+   containing a may have changed since MC_(clean_secmap) was last called
+   for it.  MC_(clean_secmap) returns False, and does nothing, for the
+   shared entry. */
+extern UChar* MC_(dirty_secmaps);
+extern UWord  MC_(n_dirty_secmaps);
+Bool MC_(is_secmap_dirty) ( Addr a );
+Bool MC_(clean_secmap)    ( Addr a );
+
 // Prints as user msg a description of the given loss record.
 void MC_(pp_LossRecord)(UInt n_this_record, UInt n_total_records,
                         LossRecord* l);
@@ -710,6 +739,19 @@ extern Bool MC_(clo_show_mismatched_frees);
    operations? Default: NO */
 extern Bool MC_(clo_expensive_definedness_checks);
 
+/* Should shadow memory for uniform areas be compressed?  Default: NO */
+extern Bool MC_(clo_shadow_compression);
+
+/* Geometry of the origin cache (rounded down to powers of 2), and
+   whether it may grow.  Default: 2^20 sets, 2 ways, NO */
+extern Int  MC_(clo_origin_cache_sets);
+extern Int  MC_(clo_origin_cache_ways);
+extern Bool MC_(clo_origin_cache_grow);
+
+/* Should a leak search reuse what earlier ones found in memory that
+   has not changed since?  Default: NO */
+extern Bool MC_(clo_incremental_leak_check);
+
 /*------------------------------------------------------------*/
 /*--- Instrumentation                                      ---*/
 /*------------------------------------------------------------*/
@@ -755,6 +797,8 @@ VG_REGPARM(1) UWord MC_(helperc_LOADV16be)  ( Addr );
 VG_REGPARM(1) UWord MC_(helperc_LOADV16le)  ( Addr );
 VG_REGPARM(1) UWord MC_(helperc_LOADV8)     ( Addr );
 
+VG_REGPARM(2) UWord MC_(helperc_LOADV_RANGE_DEFINED) ( Addr, UWord );
+
 VG_REGPARM(3)
 void MC_(helperc_MAKE_STACK_UNINIT_w_o) ( Addr base, UWord len, Addr nia );
 
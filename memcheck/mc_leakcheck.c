@@ -492,6 +492,36 @@ static Int* lc_markstack;
 // the stack has one element, 1 if it has two, etc.
 static Int  lc_markstack_top;    
 
+// Every chunk lies within [lc_min_chunk_addr, lc_max_chunk_addr).  Most
+// words scanned are not pointers into the heap at all, and this rejects
+// them before any expensive lookup.
+static Addr lc_min_chunk_addr;
+static Addr lc_max_chunk_addr;
+
+// An index over lc_chunks, built with it, so that finding the chunk a
+// word points into doesn't take a binary search over all of them.  For
+// each 4KB page that some chunk overlaps, lc_page_index holds the range
+// of chunks overlapping it.  It is a hash table (open addressing,
+// linear probing, at most half full), so that a word pointing nowhere
+// near a chunk usually costs one probe.  Chunks spanning more than
+// LC_BIG_PAGES pages are left out of it and listed, in order, in
+// lc_big_chunks instead: there are few of them.
+#define LC_PAGE_SHIFT 12
+#define LC_BIG_PAGES  16
+
+typedef
+   struct {
+      UWord page;    // page number + 1, or 0 if the slot is free
+      Int   first;   // lc_chunks[first .. last-1] overlap the page
+      Int   last;
+   }
+   LC_PageEntry;
+
+static LC_PageEntry* lc_page_index;
+static UWord         lc_page_index_mask;
+static Int*          lc_big_chunks;
+static Int           lc_n_big_chunks;
+
 // Keeps track of how many bytes of memory we've scanned, for printing.
 // (Nb: We don't keep track of how many register bytes we've scanned.)
 static SizeT lc_scanned_szB;
@@ -519,6 +549,118 @@ static SizeT MC_(bytes_heuristically_reachable)[N_LEAK_CHECK_HEURISTICS]
 static SizeT MC_(blocks_heuristically_reachable)[N_LEAK_CHECK_HEURISTICS]
                                                 = {0,0,0,0};
 
+static inline UWord lc_page_hash ( UWord page )
+{
+#  if VG_WORDSIZE == 8
+   return (page * 0x9E3779B97F4A7C15ULL) >> 32;
+#  else
+   return page * 0x9E3779B9U;
+#  endif
+}
+
+static void lc_free_chunk_index ( void )
+{
+   if (lc_page_index) {
+      VG_(free)(lc_page_index);
+      lc_page_index = NULL;
+   }
+   if (lc_big_chunks) {
+      VG_(free)(lc_big_chunks);
+      lc_big_chunks = NULL;
+   }
+   lc_n_big_chunks = 0;
+}
+
+static inline void lc_chunk_pages ( const MC_Chunk* ch,
+                                    UWord* first, UWord* last )
+{
+   *first = ch->data >> LC_PAGE_SHIFT;
+   *last  = (ch->data + (ch->szB == 0 ? 0 : ch->szB - 1)) >> LC_PAGE_SHIFT;
+}
+
+// Builds lc_page_index and lc_big_chunks for the (sorted, non
+// overlapping) lc_chunks.
+static void lc_build_chunk_index ( void )
+{
+   UWord n_pages = 0, n_slots = 16, first, last, page;
+   Int   i;
+
+   lc_free_chunk_index();
+   for (i = 0; i < lc_n_chunks; i++) {
+      lc_chunk_pages(lc_chunks[i], &first, &last);
+      if (last - first >= LC_BIG_PAGES)
+         lc_n_big_chunks++;
+      else
+         n_pages += last - first + 1;
+   }
+   while (n_slots < 2 * n_pages)
+      n_slots *= 2;
+   lc_page_index      = VG_(calloc)("mc.lbci.1", n_slots, sizeof(LC_PageEntry));
+   lc_page_index_mask = n_slots - 1;
+   if (lc_n_big_chunks > 0)
+      lc_big_chunks = VG_(malloc)("mc.lbci.2", lc_n_big_chunks * sizeof(Int));
+
+   lc_n_big_chunks = 0;
+   for (i = 0; i < lc_n_chunks; i++) {
+      lc_chunk_pages(lc_chunks[i], &first, &last);
+      if (last - first >= LC_BIG_PAGES) {
+         lc_big_chunks[lc_n_big_chunks++] = i;
+         continue;
+      }
+      for (page = first + 1; page <= last + 1; page++) {
+         UWord         h = lc_page_hash(page) & lc_page_index_mask;
+         LC_PageEntry* e = &lc_page_index[h];
+         while (e->page != 0 && e->page != page) {
+            h = (h + 1) & lc_page_index_mask;
+            e = &lc_page_index[h];
+         }
+         if (e->page == 0) {
+            e->page  = page;
+            e->first = i;
+         }
+         e->last = i + 1;
+      }
+   }
+}
+
+// The lc_chunks index of the chunk ptr points at or inside, or -1.
+// Gives the same answer as find_chunk_for on lc_chunks.
+static Int lc_find_chunk ( Addr ptr )
+{
+   UWord page = (ptr >> LC_PAGE_SHIFT) + 1;
+   UWord h;
+   Int   lo, hi;
+
+   if (lc_page_index == NULL)
+      return -1;
+   h = lc_page_hash(page) & lc_page_index_mask;
+   while (lc_page_index[h].page != 0) {
+      const LC_PageEntry* e = &lc_page_index[h];
+      if (e->page == page) {
+         Int ch_no = find_chunk_for(ptr, &lc_chunks[e->first],
+                                    e->last - e->first);
+         if (ch_no != -1)
+            return e->first + ch_no;
+         break;
+      }
+      h = (h + 1) & lc_page_index_mask;
+   }
+
+   lo = 0;
+   hi = lc_n_big_chunks - 1;
+   while (lo <= hi) {
+      Int       mid = (lo + hi) / 2;
+      MC_Chunk* ch  = lc_chunks[lc_big_chunks[mid]];
+      if (ptr < ch->data)
+         hi = mid - 1;
+      else if (ptr >= ch->data + ch->szB)
+         lo = mid + 1;
+      else
+         return lc_big_chunks[mid];
+   }
+   return -1;
+}
+
 // Determines if a pointer is to a chunk.  Returns the chunk number et al
 // via call-by-reference.
 static Bool
@@ -528,6 +670,9 @@ lc_is_a_chunk_ptr(Addr ptr, Int* pch_no, MC_Chunk** pch, LC_Extra** pex)
    MC_Chunk* ch;
    LC_Extra* ex;
 
+   if (ptr < lc_min_chunk_addr || ptr >= lc_max_chunk_addr)
+      return False;
+
    // Quick filter. Note: implemented with am, not with get_vabits2
    // as ptr might be random data pointing anywhere. On 64 bit
    // platforms, getting va bits for random data can be quite costly
@@ -535,7 +680,10 @@ lc_is_a_chunk_ptr(Addr ptr, Int* pch_no, MC_Chunk** pch, LC_Extra** pex)
    if (!VG_(am_is_valid_for_client)(ptr, 1, VKI_PROT_READ)) {
       return False;
    } else {
-      ch_no = find_chunk_for(ptr, lc_chunks, lc_n_chunks);
+      ch_no = lc_find_chunk(ptr);
+#     if VG_DEBUG_FIND_CHUNK
+      tl_assert(ch_no == find_chunk_for(ptr, lc_chunks, lc_n_chunks));
+#     endif
       tl_assert(ch_no >= -1 && ch_no < lc_n_chunks);
 
       if (ch_no == -1) {
@@ -1010,7 +1158,296 @@ void lc_scan_memory_fault_catcher ( Int sigNo, Addr addr )
                               lc_scan_memory_jmpbuf);
 }
 
-// lc_scan_memory has 2 modes:
+
+/*------------------------------------------------------------*/
+/*--- Incremental leak search.                             ---*/
+/*------------------------------------------------------------*/
+
+/* With --incremental-leak-check=yes, where the valid words pointing
+   into blocks are in each 64KB chunk of memory (the span of one
+   secondary map) is kept in a summary.  Later searches use the summary
+   instead of scanning the chunk again, for as long as the chunk is not
+   marked in MC_(dirty_secmaps): that is, as long as neither its
+   contents, nor its V+A bits, nor its protection have changed.
+
+   Which words point into blocks also depends on which blocks there
+   are, though.  The words that did are looked up again each time the
+   summary is used, so blocks freed since are handled.  Of the other
+   valid words, a summary only keeps a Bloom filter of the pages they
+   point into.  Before each search, the blocks allocated since the
+   previous one are looked up in it, and summaries in which such a
+   block might be pointed to are thrown away.
+
+   A chunk that cannot be summarised (it has no valid words at all, it
+   is the last one in the address space, or reading it faulted) gets a summary marked 'unusable', so that it is
+   just scanned until it changes, without trying again each time. */
+
+#define LC_BLOOM_BITS_LOG2  12
+#define LC_BLOOM_BITS       (1 << LC_BLOOM_BITS_LOG2)
+#define LC_BLOOM_WORDS      (LC_BLOOM_BITS / (8 * sizeof(UWord)))
+#define LC_BLOOM_PAGE_SHIFT 12
+
+typedef
+   struct _LC_SMSummary {
+      struct _LC_SMSummary* next;
+      Addr    base;        // key: SM_SIZE-aligned start of the chunk
+      Bool    unusable;
+      UInt    n_valid;     // how many valid words the chunk has
+      UInt    n_ptrs;      // how many of these pointed into a block,
+      UShort* offs;        // and their offsets in the chunk, ascending
+      UWord   bloom[LC_BLOOM_WORDS];
+   }
+   LC_SMSummary;
+
+static VgHashTable *lc_summaries = NULL;
+
+// The blocks that every summary in lc_summaries is up to date with,
+// sorted by address.
+typedef
+   struct {
+      Addr  data;
+      SizeT szB;
+   }
+   LC_Block;
+
+static LC_Block* lc_summarised_blocks   = NULL;
+static Int       lc_n_summarised_blocks = 0;
+
+// How many bytes of lc_scanned_szB come from summaries.
+static SizeT lc_reused_szB;
+
+static inline UWord lc_bloom_bit ( Addr a )
+{
+   UWord page = a >> LC_BLOOM_PAGE_SHIFT;
+#  if VG_WORDSIZE == 8
+   return (page * 0x9E3779B97F4A7C15ULL) >> (64 - LC_BLOOM_BITS_LOG2);
+#  else
+   return (page * 0x9E3779B9U) >> (32 - LC_BLOOM_BITS_LOG2);
+#  endif
+}
+
+static inline void lc_bloom_set ( UWord* bloom, UWord bit )
+{
+   bloom[bit / (8 * sizeof(UWord))] |= (UWord)1 << (bit % (8 * sizeof(UWord)));
+}
+
+static void lc_free_summary ( LC_SMSummary* s )
+{
+   if (s->offs)
+      VG_(free)(s->offs);
+   VG_(free)(s);
+}
+
+// How many bytes lc_scan_words would count as scanned in [a, lim).
+static SizeT lc_valid_szB ( Addr a, Addr lim )
+{
+   SizeT szB = 0;
+   while (a < lim) {
+      Addr  page_end = VG_PGROUNDDN(a) + VKI_PAGE_SIZE;
+      Addr  end      = page_end == 0 || page_end > lim ? lim : page_end;
+      if (VG_(am_is_valid_for_client)(a, sizeof(Addr), VKI_PROT_READ)) {
+         while (a < end) {
+            SizeT n = MC_(count_valid_aligned_words)(a,
+                                                     (end - a) / sizeof(Addr));
+            szB += n * sizeof(Addr);
+            a   += (n == 0 ? 1 : n) * sizeof(Addr);
+         }
+      }
+      a = end;
+   }
+   return szB;
+}
+
+// Make a summary of the chunk starting at base, against the current
+// lc_chunks.
+static LC_SMSummary* lc_summarise ( Addr base )
+{
+   static UShort*  offs = NULL;  // room for the whole chunk
+   LC_SMSummary*     s;
+   fault_catcher_t prev_catcher;
+   Addr            a;
+
+   if (offs == NULL)
+      offs = VG_(malloc)("mc.lcs.1", SM_SIZE / sizeof(Addr) * sizeof(UShort));
+
+   s = VG_(calloc)("mc.lcs.2", 1, sizeof(LC_SMSummary));
+   s->base = base;
+   if (base + SM_SIZE == 0 || !MC_(is_within_valid_secondary)(base)) {
+      s->unusable = True;
+      return s;
+   }
+
+   prev_catcher = VG_(set_fault_catcher)(lc_scan_memory_fault_catcher);
+   if (VG_MINIMAL_SETJMP(lc_scan_memory_jmpbuf) != 0) {
+      // Leave it to lc_scan_words to deal with.
+      VG_(set_fault_catcher)(prev_catcher);
+      VG_(memset)(s->bloom, 0, sizeof(s->bloom));
+      s->unusable = True;
+      s->n_valid  = s->n_ptrs = 0;
+      return s;
+   }
+   // The same checks as lc_scan_words, page by page.
+   for (a = base; a < base + SM_SIZE; a += VKI_PAGE_SIZE) {
+      Addr p   = a;
+      Addr end = a + VKI_PAGE_SIZE;
+      if (!VG_(am_is_valid_for_client)(a, sizeof(Addr), VKI_PROT_READ))
+         continue;
+      while (p < end) {
+         SizeT n = MC_(count_valid_aligned_words)(p, (end - p) / sizeof(Addr));
+         if (n == 0) {
+            p += sizeof(Addr);
+            continue;
+         }
+         s->n_valid += n;
+         for (; n > 0; n--, p += sizeof(Addr)) {
+            Addr w = *(Addr *)p;
+            if (w >= lc_min_chunk_addr && w < lc_max_chunk_addr
+                && lc_find_chunk(w) != -1) {
+               offs[s->n_ptrs++] = p - base;
+            } else if (w >= VKI_PAGE_SIZE) {
+               lc_bloom_set(s->bloom, lc_bloom_bit(w));
+            }
+         }
+      }
+   }
+   VG_(set_fault_catcher)(prev_catcher);
+
+   if (s->n_ptrs > 0) {
+      s->offs = VG_(malloc)("mc.lcs.3", s->n_ptrs * sizeof(UShort));
+      VG_(memcpy)(s->offs, offs, s->n_ptrs * sizeof(UShort));
+   }
+   return s;
+}
+
+// Returns an up to date summary of the chunk starting at base, or NULL
+// if it has to be scanned.  *reused says whether the summary was made
+// by an earlier search.
+static LC_SMSummary* lc_get_summary ( Addr base, /*OUT*/Bool* reused )
+{
+   LC_SMSummary* s = VG_(HT_lookup)(lc_summaries, base);
+
+   *reused = s != NULL && !MC_(is_secmap_dirty)(base);
+   if (*reused)
+      return s->unusable ? NULL : s;
+   if (s != NULL) {
+      VG_(HT_remove)(lc_summaries, base);
+      lc_free_summary(s);
+   }
+   if (!MC_(clean_secmap)(base))
+      return NULL;
+   s = lc_summarise(base);
+   VG_(HT_add_node)(lc_summaries, s);
+   return s->unusable ? NULL : s;
+}
+
+// Does for [a, lim) what lc_scan_words would, using summary s.
+static void lc_replay_summary ( const LC_SMSummary* s, Addr a, Addr lim,
+                                Bool is_prior_definite,
+                                Int clique, Int cur_clique, Bool reused )
+{
+   volatile UInt   i;
+   UInt            lo = 0, hi = s->n_ptrs;
+   fault_catcher_t prev_catcher;
+   SizeT           szB;
+
+   // Find the first word at or after a.
+   while (lo < hi) {
+      UInt mid = (lo + hi) / 2;
+      if (s->base + s->offs[mid] < a)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   i = lo;
+
+   // Nothing should have changed, but see leak_search_fault_catcher.
+   prev_catcher = VG_(set_fault_catcher)(lc_scan_memory_fault_catcher);
+   if (VG_MINIMAL_SETJMP(lc_scan_memory_jmpbuf) != 0) {
+      lc_sig_skipped_szB += sizeof(Addr);
+      i++;
+   }
+   for (; i < s->n_ptrs && s->base + s->offs[i] < lim; i++) {
+      Addr addr = *(Addr *)(s->base + s->offs[i]);
+      lc_push_if_a_chunk_ptr(addr, clique, cur_clique, is_prior_definite);
+   }
+   VG_(set_fault_catcher)(prev_catcher);
+
+   if (a == s->base && lim - a == SM_SIZE)
+      szB = s->n_valid * sizeof(Addr);
+   else
+      szB = lc_valid_szB(a, lim);
+   lc_scanned_szB += szB;
+   if (reused)
+      lc_reused_szB += szB;
+}
+
+// Called at the start of each search, once lc_chunks is set up.  Drops
+// the summaries that may be missing pointers to blocks allocated since
+// the previous search.
+static void lc_prepare_summaries ( void )
+{
+   UWord new_bloom[LC_BLOOM_WORDS];
+   Bool  any_new = False;
+   Int   i, j;
+
+   if (lc_summaries == NULL)
+      lc_summaries = VG_(HT_construct)("mc.lps.1");
+
+   // Which blocks are new?  Both lists are sorted by address.  For
+   // each new one, add all the pages it covers to new_bloom.
+   VG_(memset)(new_bloom, 0, sizeof(new_bloom));
+   j = 0;
+   for (i = 0; i < lc_n_chunks; i++) {
+      MC_Chunk* ch = lc_chunks[i];
+      Addr      first, last, page;
+      while (j < lc_n_summarised_blocks
+             && lc_summarised_blocks[j].data < ch->data)
+         j++;
+      if (j < lc_n_summarised_blocks
+          && lc_summarised_blocks[j].data == ch->data
+          && lc_summarised_blocks[j].szB  == ch->szB)
+         continue;
+      any_new = True;
+      first = ch->data >> LC_BLOOM_PAGE_SHIFT;
+      last  = (ch->data + (ch->szB == 0 ? 0 : ch->szB - 1))
+              >> LC_BLOOM_PAGE_SHIFT;
+      if (last - first >= LC_BLOOM_BITS) {
+         VG_(memset)(new_bloom, 0xFF, sizeof(new_bloom));
+         continue;
+      }
+      for (page = first; page <= last; page++)
+         lc_bloom_set(new_bloom, lc_bloom_bit(page << LC_BLOOM_PAGE_SHIFT));
+   }
+
+   if (any_new) {
+      UInt         n, k, w;
+      VgHashNode** all = VG_(HT_to_array)(lc_summaries, &n);
+      for (k = 0; k < n; k++) {
+         LC_SMSummary* s = (LC_SMSummary*)all[k];
+         for (w = 0; w < LC_BLOOM_WORDS; w++)
+            if (s->bloom[w] & new_bloom[w])
+               break;
+         if (w < LC_BLOOM_WORDS) {
+            VG_(HT_remove)(lc_summaries, s->base);
+            lc_free_summary(s);
+         }
+      }
+      VG_(free)(all);
+   }
+
+   // From here on, summaries are made against the current blocks.
+   if (lc_summarised_blocks)
+      VG_(free)(lc_summarised_blocks);
+   lc_summarised_blocks = VG_(malloc)("mc.lps.2",
+                                      lc_n_chunks * sizeof(LC_Block));
+   for (i = 0; i < lc_n_chunks; i++) {
+      lc_summarised_blocks[i].data = lc_chunks[i]->data;
+      lc_summarised_blocks[i].szB  = lc_chunks[i]->szB;
+   }
+   lc_n_summarised_blocks = lc_n_chunks;
+}
+
+// lc_scan_memory (and lc_scan_words, which does the scanning) has 2 modes:
 //
 // 1. Leak check mode (searched == 0).
 // -----------------------------------
@@ -1040,9 +1477,9 @@ void lc_scan_memory_fault_catcher ( Int sigNo, Addr addr )
 // to searched and outputs the places where searched is found.
 // It does not recursively scans the found memory.
 static void
-lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
-               Int clique, Int cur_clique,
-               Addr searched, SizeT szB)
+lc_scan_words(Addr start, SizeT len, Bool is_prior_definite,
+              Int clique, Int cur_clique,
+              Addr searched, SizeT szB)
 {
    /* memory scan is based on the assumption that valid pointers are aligned
       on a multiple of sizeof(Addr). So, we can (and must) skip the begin and
@@ -1057,6 +1494,9 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
    Addr ptr = VG_ROUNDUP(start, sizeof(Addr));
    const Addr end = VG_ROUNDDN(start+len, sizeof(Addr));
    fault_catcher_t prev_catcher;
+   // How many words from ptr on are known to be valid.  Asking about
+   // a run of words at once is much cheaper than asking about each.
+   SizeT n_valid = 0;
 
    if (VG_DEBUG_LEAKCHECK)
       VG_(printf)("scan %#lx-%#lx (%lu)\n", start, end, len);
@@ -1107,6 +1547,7 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
       tl_assert(bad_scanned_addr < VG_ROUNDDN(start+len, sizeof(Addr)));
       ptr = bad_scanned_addr + sizeof(Addr); // Unaddressable, - skip it.
 #endif
+      n_valid = 0;
    }
    while (ptr < end) {
       Addr addr;
@@ -1115,6 +1556,7 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
       if (UNLIKELY((ptr % SM_SIZE) == 0)) {
          if (! MC_(is_within_valid_secondary)(ptr) ) {
             ptr = VG_ROUNDUP(ptr+1, SM_SIZE);
+            n_valid = 0;
             continue;
          }
       }
@@ -1123,11 +1565,16 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
       if (UNLIKELY((ptr % VKI_PAGE_SIZE) == 0)) {
          if (!VG_(am_is_valid_for_client)(ptr, sizeof(Addr), VKI_PROT_READ)) {
             ptr += VKI_PAGE_SIZE;      // Bad page - skip it.
+            n_valid = 0;
             continue;
          }
       }
 
-      if ( MC_(is_valid_aligned_word)(ptr) ) {
+      if (n_valid == 0)
+         n_valid = MC_(count_valid_aligned_words)(ptr,
+                                                  (end - ptr) / sizeof(Addr));
+      if ( n_valid > 0 ) {
+         n_valid--;
          lc_scanned_szB += sizeof(Addr);
          // If the below read fails, we will longjmp to the loop begin.
          addr = *(Addr *)ptr;
@@ -1174,6 +1621,39 @@ lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
    VG_(set_fault_catcher)(prev_catcher);
 }
 
+// With --incremental-leak-check=yes, uses the summaries of the chunks
+// that haven't changed instead of scanning them.
+static void
+lc_scan_memory(Addr start, SizeT len, Bool is_prior_definite,
+               Int clique, Int cur_clique,
+               Addr searched, SizeT szB)
+{
+   Addr       a   = VG_ROUNDUP(start, sizeof(Addr));
+   const Addr end = VG_ROUNDDN(start+len, sizeof(Addr));
+
+   if (lc_summaries == NULL || searched != 0) {
+      lc_scan_words(start, len, is_prior_definite, clique, cur_clique,
+                    searched, szB);
+      return;
+   }
+   while (a < end) {
+      Addr        base = VG_ROUNDDN(a, SM_SIZE);
+      Addr        lim  = base + SM_SIZE;
+      LC_SMSummary* s;
+      Bool          reused;
+      if (lim == 0 || lim > end)
+         lim = end;
+      s = lc_get_summary(base, &reused);
+      if (s != NULL)
+         lc_replay_summary(s, a, lim, is_prior_definite, clique, cur_clique,
+                           reused);
+      else
+         lc_scan_words(a, lim - a, is_prior_definite, clique, cur_clique,
+                       0, 0);
+      a = lim;
+   }
+}
+
 
 // Process the mark stack until empty.
 static void lc_process_markstack(Int clique)
@@ -1715,6 +2195,7 @@ static void scan_memory_root_set(Addr searched, SizeT szB)
    tl_assert(seg_starts && n_seg_starts > 0);
 
    lc_scanned_szB = 0;
+   lc_reused_szB = 0;
    lc_sig_skipped_szB = 0;
 
    // VG_(am_show_nsegments)( 0, "leakcheck");
@@ -1788,8 +2269,10 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
       VG_(free)(lc_chunks);
       lc_chunks = NULL;
    }
+   lc_free_chunk_index();
    lc_chunks = find_active_chunks(&lc_n_chunks);
    lc_chunks_n_frees_marker = MC_(get_cmalloc_n_frees)();
+   lc_min_chunk_addr = lc_max_chunk_addr = 0;
    if (lc_n_chunks == 0) {
       tl_assert(lc_chunks == NULL);
       if (lr_table != NULL) {
@@ -1885,6 +2368,19 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
       lc_extras = NULL;
    }
    lc_extras = VG_(malloc)( "mc.dml.2", lc_n_chunks * sizeof(LC_Extra) );
+   lc_min_chunk_addr = lc_chunks[0]->data;
+   lc_max_chunk_addr = 0;
+   for (i = 0; i < lc_n_chunks; i++) {
+      MC_Chunk* ch  = lc_chunks[i];
+      Addr      end = ch->data + ch->szB + (ch->szB == 0 ? 1 : 0);
+      if (end > lc_max_chunk_addr)
+         lc_max_chunk_addr = end;
+   }
+   lc_build_chunk_index();
+
+   if (MC_(clo_incremental_leak_check))
+      lc_prepare_summaries();
+
    for (i = 0; i < lc_n_chunks; i++) {
       lc_extras[i].state        = Unreached;
       lc_extras[i].pending      = False;
@@ -1918,6 +2414,8 @@ void MC_(detect_memory_leaks) ( ThreadId tid, LeakCheckParams* lcp)
 
    if (VG_(clo_verbosity) > 1 && !VG_(clo_xml)) {
       VG_(umsg)("Checked %'lu bytes\n", lc_scanned_szB);
+      if (lc_summaries != NULL)
+         VG_(umsg)("Reused the results for %'lu bytes\n", lc_reused_szB);
       if (lc_sig_skipped_szB > 0)
          VG_(umsg)("Skipped %'lu bytes due to read errors\n",
                    lc_sig_skipped_szB);
@@ -42,7 +42,6 @@
 #include "pub_tool_machine.h"
 #include "pub_tool_mallocfree.h"
 #include "pub_tool_options.h"
-#include "pub_tool_oset.h"
 #include "pub_tool_rangemap.h"
 #include "pub_tool_replacemalloc.h"
 #include "pub_tool_tooliface.h"
@@ -76,6 +75,8 @@ static void ocache_sarp_Clear_Origins ( Addr, UWord ); /* fwds */
 
 #define PERF_FAST_SARP     1
 
+#define PERF_FAST_BULK     1
+
 #define PERF_FAST_STACK    1
 #define PERF_FAST_STACK2   1
 
@@ -282,39 +283,199 @@ typedef
 
 // 3 distinguished secondary maps, one for no-access, one for
 // accessible but undefined, and one for accessible and defined.
-// Distinguished secondaries may never be modified.
+// Distinguished secondaries may never be modified.  A fourth one stands
+// in for all compressed secondaries; see below.
 #define SM_DIST_NOACCESS   0
 #define SM_DIST_UNDEFINED  1
 #define SM_DIST_DEFINED    2
+#define SM_DIST_COMPRESSED 3
+
+static SecMap sm_distinguished[4];
 
-static SecMap sm_distinguished[3];
+#define SM_COMPRESSED (&sm_distinguished[SM_DIST_COMPRESSED])
 
 static INLINE Bool is_distinguished_sm ( SecMap* sm ) {
-   return sm >= &sm_distinguished[0] && sm <= &sm_distinguished[2];
+   return sm >= &sm_distinguished[0] && sm <= &sm_distinguished[3];
 }
 
 // Forward declaration
 static void update_SM_counts(SecMap* oldSM, SecMap* newSM);
 
-/* dist_sm points to one of our three distinguished secondaries.  Make
-   a copy of it so that we can write to it.
+/* A note on concurrency.  Today only the thread holding the BigLock
+   ever touches shadow memory.  But the maps are arranged so that
+   readers need no locks, should several threads ever run at once
+   (see docs/internals/parallel-execution.txt):
+
+   - A SecMap never changes between being distinguished and not,
+     other than by having a pointer to it replaced.  A
+     non-distinguished SecMap is fully initialised before a pointer to
+     it is published (install_copy_for_writing), so a reader that sees
+     the pointer sees the contents.  Readers depend only on the
+     address dependency from the pointer to the contents, which every
+     supported CPU respects, so reads need no barriers.
+
+   - The one exception is set_address_range_perms, which unmaps a
+     SecMap that it replaces by a distinguished one.  With concurrent
+     readers, that would have to be deferred until no thread can still
+     be using it.  The same goes for compress_secmaps, and for the
+     table of compressed secondaries, which is not safe for concurrent
+     readers at all: --shadow-compression=yes would have to be refused.
+
+   - Copy-on-write of a distinguished SecMap publishes the copy with a
+     compare-and-swap.  Two threads racing to write to the same
+     distinguished SecMap both make copies; one wins, and the other
+     uses the winner's copy and abandons its own.
+
+   - The auxiliary primary map (auxmap_L2, below) is an insert-only
+     hash table, whose entries are published, like SecMaps, fully
+     initialised.  When it grows, the old table is left in place for
+     readers that may still be looking at it.  Inserting must still be
+     serialised, which it is, by the BigLock.
+
+   - The front cache of the auxiliary map (auxmap_L1) is reorganised
+     by readers, so it can be torn by concurrent updates.  It is only
+     a hint: every hit is checked against the (immutable) base of the
+     entry it points at.
+
+   None of this costs anything on the fast paths: the barriers are
+   all on the paths that allocate. */
+
+/* --------------- Compressed secondaries --------------- */
+
+/* Most of a big heap is in very few states: large blocks are wholly
+   defined or wholly undefined, and the rest is mostly unaddressable
+   gaps.  Giving each 64k of that its own 16k SecMap is a waste.  So,
+   with --shadow-compression=yes, compress_secmaps now and again
+   replaces every SecMap made of at most CSM_MAX_RUNS runs of equal
+   vabits8 by a list of those runs (a CSecMap), kept in csm_table,
+   keyed by the base address of the 64k it covers.  If there is only
+   one run, the SecMap becomes one of the ordinary distinguished
+   secondaries instead.
+
+   The primary map then points at SM_COMPRESSED.  It is distinguished,
+   so none of the fast paths write to it, and it is full of
+   VA_BITS2_PARTDEFINED, so none of the fast paths read from it either:
+   they all fall into their slow cases, which decode the runs
+   (get_vabits2 and friends).  Writing to a compressed secondary turns
+   it back into a normal one, just as for the other distinguished
+   secondaries.  So does reading it more than CSM_HOT_READS times in
+   the slow path, so that memory that is in use does not stay there. */
+
+#define CSM_MAX_RUNS   32
+#define CSM_HOT_READS  64
+
+typedef
+   struct _CSecMap {
+      struct _CSecMap* next;
+      UWord            base;      /* key */
+      UInt             n_runs;
+      UInt             n_reads;
+      /* Run i is vabits8[i], for chunks end[i-1] .. end[i]-1 of the
+         SecMap (with end[-1] being 0).  end[n_runs-1] == SM_CHUNKS. */
+      UShort           end[CSM_MAX_RUNS];
+      UChar            vabits8[CSM_MAX_RUNS];
+   }
+   CSecMap;
+
+static VgHashTable* csm_table = NULL;
+
+static ULong n_csm_compressions = 0;
+static ULong n_csm_expansions   = 0;
+static ULong n_csm_sweeps       = 0;
+
+/* The CSecMap for a, which must be covered by SM_COMPRESSED. */
+static INLINE CSecMap* find_csm ( Addr a )
+{
+   CSecMap* csm = VG_(HT_lookup)(csm_table, start_of_this_sm(a));
+   tl_assert(csm != NULL);
+   return csm;
+}
+
+/* Index of the run holding chunk sm_off. */
+static INLINE UInt csm_run_for ( const CSecMap* csm, UWord sm_off )
+{
+   UInt lo = 0, hi = csm->n_runs - 1;
+   while (lo < hi) {
+      UInt mid = (lo + hi) / 2;
+      if (csm->end[mid] <= sm_off)
+         lo = mid + 1;
+      else
+         hi = mid;
+   }
+   return lo;
+}
+
+static UChar get_compressed_vabits8 ( Addr a )
+{
+   const CSecMap* csm = find_csm(a);
+   return csm->vabits8[ csm_run_for(csm, SM_OFF(a)) ];
+}
+
+/* dist_sm points to one of our distinguished secondaries.  Make a
+   copy of it, or if it is SM_COMPRESSED, of the compressed secondary
+   for a, so that we can write to it.
 */
-static SecMap* copy_for_writing ( SecMap* dist_sm )
+static SecMap* copy_for_writing ( SecMap* dist_sm, Addr a )
 {
    SecMap* new_sm;
-   tl_assert(dist_sm == &sm_distinguished[0]
-          || dist_sm == &sm_distinguished[1]
-          || dist_sm == &sm_distinguished[2]);
+   tl_assert(is_distinguished_sm(dist_sm));
 
    new_sm = VG_(am_shadow_alloc)(sizeof(SecMap));
    if (new_sm == NULL)
       VG_(out_of_memory_NORETURN)( "memcheck:allocate new SecMap", 
                                    sizeof(SecMap) );
-   VG_(memcpy)(new_sm, dist_sm, sizeof(SecMap));
-   update_SM_counts(dist_sm, new_sm);
+   if (dist_sm == SM_COMPRESSED) {
+      const CSecMap* csm = find_csm(a);
+      UInt  i;
+      UWord off = 0;
+      for (i = 0; i < csm->n_runs; i++) {
+         VG_(memset)(&new_sm->vabits8[off], csm->vabits8[i],
+                     csm->end[i] - off);
+         off = csm->end[i];
+      }
+      tl_assert(off == SM_CHUNKS);
+   } else {
+      VG_(memcpy)(new_sm, dist_sm, sizeof(SecMap));
+   }
    return new_sm;
 }
 
+/* Forget the compressed secondary for a, which is being replaced. */
+static void free_csm ( Addr a )
+{
+   CSecMap* csm = VG_(HT_remove)(csm_table, start_of_this_sm(a));
+   tl_assert(csm != NULL);
+   VG_(free)(csm);
+}
+
+/* *p points to a distinguished secondary, the one for a.  Replace it
+   with a writable copy, and return the secondary that *p then points
+   to.  That is the copy, unless some other thread got there first. */
+static SecMap* install_copy_for_writing ( SecMap** p, Addr a )
+{
+   SecMap* dist_sm = *p;
+   SecMap* new_sm;
+
+   if (!is_distinguished_sm(dist_sm))
+      return dist_sm;
+
+   new_sm = copy_for_writing(dist_sm, a);
+   /* This is a full barrier, so the copy's contents are visible to
+      other threads before the pointer to it is. */
+   if (__sync_bool_compare_and_swap(p, dist_sm, new_sm)) {
+      if (dist_sm == SM_COMPRESSED) {
+         free_csm(a);
+         n_csm_expansions++;
+      }
+      update_SM_counts(dist_sm, new_sm);
+      return new_sm;
+   }
+   /* Lost the race.  Nobody else has seen new_sm, so it can go. */
+   SysRes sres = VG_(am_munmap_valgrind)((Addr)new_sm, sizeof(SecMap));
+   tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+   return *p;
+}
+
 /* --------------- Stats --------------- */
 
 static Int   n_issued_SMs      = 0;
@@ -327,6 +488,8 @@ static Int   max_noaccess_SMs  = 0;
 static Int   max_undefined_SMs = 0;
 static Int   max_defined_SMs   = 0;
 static Int   max_non_DSM_SMs   = 0;
+static Int   n_compressed_SMs  = 0;
+static Int   max_compressed_SMs = 0;
 
 /* # searches initiated in auxmap_L1, and # base cmps required */
 static ULong n_auxmap_L1_searches  = 0;
@@ -347,12 +510,14 @@ static void update_SM_counts(SecMap* oldSM, SecMap* newSM)
    if      (oldSM == &sm_distinguished[SM_DIST_NOACCESS ]) n_noaccess_SMs --;
    else if (oldSM == &sm_distinguished[SM_DIST_UNDEFINED]) n_undefined_SMs--;
    else if (oldSM == &sm_distinguished[SM_DIST_DEFINED  ]) n_defined_SMs  --;
+   else if (oldSM == SM_COMPRESSED)                        n_compressed_SMs--;
    else                                                  { n_non_DSM_SMs  --;
                                                            n_deissued_SMs ++; }
 
    if      (newSM == &sm_distinguished[SM_DIST_NOACCESS ]) n_noaccess_SMs ++;
    else if (newSM == &sm_distinguished[SM_DIST_UNDEFINED]) n_undefined_SMs++;
    else if (newSM == &sm_distinguished[SM_DIST_DEFINED  ]) n_defined_SMs  ++;
+   else if (newSM == SM_COMPRESSED)                        n_compressed_SMs++;
    else                                                  { n_non_DSM_SMs  ++;
                                                            n_issued_SMs   ++; }
 
@@ -360,6 +525,8 @@ static void update_SM_counts(SecMap* oldSM, SecMap* newSM)
    if (n_undefined_SMs > max_undefined_SMs) max_undefined_SMs = n_undefined_SMs;
    if (n_defined_SMs   > max_defined_SMs  ) max_defined_SMs   = n_defined_SMs;
    if (n_non_DSM_SMs   > max_non_DSM_SMs  ) max_non_DSM_SMs   = n_non_DSM_SMs;   
+   if (n_compressed_SMs > max_compressed_SMs)
+      max_compressed_SMs = n_compressed_SMs;
 }
 
 /* --------------- Primary maps --------------- */
@@ -374,8 +541,8 @@ static SecMap* primary_map[N_PRIMARY_MAP];
 /* An entry in the auxiliary primary map.  base must be a 64k-aligned
    value, and sm points at the relevant secondary map.  As with the
    main primary map, the secondary may be either a real secondary, or
-   one of the three distinguished secondaries.  DO NOT CHANGE THIS
-   LAYOUT: the first word has to be the key for OSet fast lookups.
+   one of the three distinguished secondaries.  Once an entry is in
+   the map, its base never changes, and it is never removed.
 */
 typedef
    struct { 
@@ -397,7 +564,36 @@ static struct {
        } 
        auxmap_L1[N_AUXMAP_L1];
 
-static OSet* auxmap_L2 = NULL;
+/* The auxiliary map proper is an open-addressing hash table of
+   pointers to AuxMapEnts, with linear probing.  It is never more than
+   half full.  Entries are never removed, so a lookup can stop at the
+   first empty slot. */
+typedef
+   struct {
+      UWord       n_slots;   /* a power of 2 */
+      UWord       n_used;
+      AuxMapEnt** slots;     /* NULL means empty */
+   }
+   AuxMapL2;
+
+#define N_AUXMAP_L2_INIT 1024
+
+static AuxMapL2* auxmap_L2 = NULL;
+
+static AuxMapL2* new_auxmap_L2 ( UWord n_slots )
+{
+   AuxMapL2* tab = VG_(malloc)("mc.iaLL.1", sizeof(AuxMapL2));
+   tab->n_slots  = n_slots;
+   tab->n_used   = 0;
+   tab->slots    = VG_(calloc)("mc.iaLL.2", n_slots, sizeof(AuxMapEnt*));
+   return tab;
+}
+
+static INLINE UWord auxmap_L2_hash ( Addr base )
+{
+   UWord k = base >> 16;
+   return k ^ (k >> 11) ^ (k >> 23);
+}
 
 static void init_auxmap_L1_L2 ( void )
 {
@@ -407,11 +603,57 @@ static void init_auxmap_L1_L2 ( void )
       auxmap_L1[i].ent  = NULL;
    }
 
-   tl_assert(0 == offsetof(AuxMapEnt,base));
    tl_assert(sizeof(Addr) == sizeof(void*));
-   auxmap_L2 = VG_(OSetGen_Create)( /*keyOff*/  offsetof(AuxMapEnt,base),
-                                    /*fastCmp*/ NULL,
-                                    VG_(malloc), "mc.iaLL.1", VG_(free) );
+   auxmap_L2 = new_auxmap_L2(N_AUXMAP_L2_INIT);
+}
+
+static AuxMapEnt* lookup_in_auxmap_L2 ( Addr a )
+{
+   const AuxMapL2* tab  = auxmap_L2;
+   UWord           mask = tab->n_slots - 1;
+   UWord           i    = auxmap_L2_hash(a) & mask;
+   AuxMapEnt*      ent;
+
+   while (True) {
+      ent = tab->slots[i];
+      if (ent == NULL || ent->base == a)
+         return ent;
+      i = (i + 1) & mask;
+   }
+}
+
+/* Put ent, which is not already present, in slot-table |slots|. */
+static void add_to_auxmap_L2_slots ( AuxMapEnt** slots, UWord n_slots,
+                                     AuxMapEnt* ent )
+{
+   UWord mask = n_slots - 1;
+   UWord i    = auxmap_L2_hash(ent->base) & mask;
+   while (slots[i] != NULL)
+      i = (i + 1) & mask;
+   /* Make ent's contents visible before ent itself. */
+   __sync_synchronize();
+   slots[i] = ent;
+}
+
+static void insert_into_auxmap_L2 ( AuxMapEnt* ent )
+{
+   AuxMapL2* tab = auxmap_L2;
+
+   if (2 * (tab->n_used + 1) > tab->n_slots) {
+      /* Double the table.  The new one is filled in before being
+         published; the old one is left for any reader still in it. */
+      AuxMapL2* nyu = new_auxmap_L2(2 * tab->n_slots);
+      UWord     i;
+      for (i = 0; i < tab->n_slots; i++)
+         if (tab->slots[i] != NULL)
+            add_to_auxmap_L2_slots(nyu->slots, nyu->n_slots, tab->slots[i]);
+      nyu->n_used = tab->n_used;
+      __sync_synchronize();
+      auxmap_L2 = tab = nyu;
+   }
+
+   add_to_auxmap_L2_slots(tab->slots, tab->n_slots, ent);
+   tab->n_used++;
 }
 
 /* Check representation invariants; if OK return NULL; else a
@@ -440,7 +682,7 @@ static const HChar* check_auxmap_L1_L2_sanity ( Word* n_secmaps_found )
    *n_secmaps_found = 0;
    if (sizeof(void*) == 4) {
       /* 32-bit platform */
-      if (VG_(OSetGen_Size)(auxmap_L2) != 0)
+      if (auxmap_L2->n_used != 0)
          return "32-bit: auxmap_L2 is non-empty";
       for (i = 0; i < N_AUXMAP_L1; i++) 
         if (auxmap_L1[i].base != 0 || auxmap_L1[i].ent != NULL)
@@ -449,11 +691,14 @@ static const HChar* check_auxmap_L1_L2_sanity ( Word* n_secmaps_found )
       /* 64-bit platform */
       UWord elems_seen = 0;
       AuxMapEnt *elem, *res;
-      AuxMapEnt key;
       /* L2 table */
-      VG_(OSetGen_ResetIter)(auxmap_L2);
-      while ( (elem = VG_(OSetGen_Next)(auxmap_L2)) ) {
+      for (i = 0; i < auxmap_L2->n_slots; i++) {
+         elem = auxmap_L2->slots[i];
+         if (elem == NULL)
+            continue;
          elems_seen++;
+         if (lookup_in_auxmap_L2(elem->base) != elem)
+            return "64-bit: _L2 entry not found by lookup";
          if (0 != (elem->base & (Addr)0xFFFF))
             return "64-bit: nonzero .base & 0xFFFF in auxmap_L2";
          if (elem->base <= MAX_PRIMARY_ADDRESS)
@@ -463,8 +708,11 @@ static const HChar* check_auxmap_L1_L2_sanity ( Word* n_secmaps_found )
          if (!is_distinguished_sm(elem->sm))
             (*n_secmaps_found)++;
       }
-      if (elems_seen != n_auxmap_L2_nodes)
+      if (elems_seen != n_auxmap_L2_nodes
+          || elems_seen != auxmap_L2->n_used)
          return "64-bit: disagreement on number of elems in _L2";
+      if (2 * auxmap_L2->n_used > auxmap_L2->n_slots)
+         return "64-bit: _L2 is more than half full";
       /* Check L1-L2 correspondence */
       for (i = 0; i < N_AUXMAP_L1; i++) {
          if (auxmap_L1[i].base == 0 && auxmap_L1[i].ent == NULL)
@@ -478,9 +726,7 @@ static const HChar* check_auxmap_L1_L2_sanity ( Word* n_secmaps_found )
          if (auxmap_L1[i].ent->base != auxmap_L1[i].base)
             return "64-bit: _L1 and _L2 bases are inconsistent";
          /* Look it up in auxmap_L2. */
-         key.base = auxmap_L1[i].base;
-         key.sm   = 0;
-         res = VG_(OSetGen_Lookup)(auxmap_L2, &key);
+         res = lookup_in_auxmap_L2(auxmap_L1[i].base);
          if (res == NULL)
             return "64-bit: _L1 .base not found in _L2";
          if (res != auxmap_L1[i].ent)
@@ -512,9 +758,20 @@ static void insert_into_auxmap_L1_at ( Word rank, AuxMapEnt* ent )
    auxmap_L1[rank].ent  = ent;
 }
 
+/* Does auxmap_L1[i] hold the entry for a?  The .ent->base test is
+   the one that counts; see "A note on concurrency" above. */
+static INLINE AuxMapEnt* auxmap_L1_match ( Word i, Addr a )
+{
+   if (auxmap_L1[i].base == a) {
+      AuxMapEnt* ent = auxmap_L1[i].ent;
+      if (LIKELY(ent != NULL && ent->base == a))
+         return ent;
+   }
+   return NULL;
+}
+
 static INLINE AuxMapEnt* maybe_find_in_auxmap ( Addr a )
 {
-   AuxMapEnt  key;
    AuxMapEnt* res;
    Word       i;
 
@@ -524,22 +781,25 @@ static INLINE AuxMapEnt* maybe_find_in_auxmap ( Addr a )
    /* First search the front-cache, which is a self-organising
       list containing the most popular entries. */
 
-   if (LIKELY(auxmap_L1[0].base == a))
-      return auxmap_L1[0].ent;
-   if (LIKELY(auxmap_L1[1].base == a)) {
+   res = auxmap_L1_match(0, a);
+   if (LIKELY(res != NULL))
+      return res;
+   res = auxmap_L1_match(1, a);
+   if (LIKELY(res != NULL)) {
       Addr       t_base = auxmap_L1[0].base;
       AuxMapEnt* t_ent  = auxmap_L1[0].ent;
       auxmap_L1[0].base = auxmap_L1[1].base;
       auxmap_L1[0].ent  = auxmap_L1[1].ent;
       auxmap_L1[1].base = t_base;
       auxmap_L1[1].ent  = t_ent;
-      return auxmap_L1[0].ent;
+      return res;
    }
 
    n_auxmap_L1_searches++;
 
    for (i = 0; i < N_AUXMAP_L1; i++) {
-      if (auxmap_L1[i].base == a) {
+      res = auxmap_L1_match(i, a);
+      if (res != NULL) {
          break;
       }
    }
@@ -555,18 +815,14 @@ static INLINE AuxMapEnt* maybe_find_in_auxmap ( Addr a )
          auxmap_L1[i-1].ent  = auxmap_L1[i-0].ent;
          auxmap_L1[i-0].base = t_base;
          auxmap_L1[i-0].ent  = t_ent;
-         i--;
       }
-      return auxmap_L1[i].ent;
+      return res;
    }
 
    n_auxmap_L2_searches++;
 
    /* First see if we already have it. */
-   key.base = a;
-   key.sm   = 0;
-
-   res = VG_(OSetGen_Lookup)(auxmap_L2, &key);
+   res = lookup_in_auxmap_L2(a);
    if (res)
       insert_into_auxmap_L1_at( AUXMAP_L1_INSERT_IX, res );
    return res;
@@ -585,10 +841,10 @@ static AuxMapEnt* find_or_alloc_in_auxmap ( Addr a )
       to allocate one. */
    a &= ~(Addr)0xFFFF;
 
-   nyu = (AuxMapEnt*) VG_(OSetGen_AllocNode)( auxmap_L2, sizeof(AuxMapEnt) );
+   nyu = VG_(malloc)( "mc.faiia.1", sizeof(AuxMapEnt) );
    nyu->base = a;
    nyu->sm   = &sm_distinguished[SM_DIST_NOACCESS];
-   VG_(OSetGen_Insert)( auxmap_L2, nyu );
+   insert_into_auxmap_L2( nyu );
    insert_into_auxmap_L1_at( AUXMAP_L1_INSERT_IX, nyu );
    n_auxmap_L2_nodes++;
    return nyu;
@@ -641,7 +897,7 @@ static INLINE SecMap* get_secmap_for_writing_low(Addr a)
 {
    SecMap** p = get_secmap_low_ptr(a);
    if (UNLIKELY(is_distinguished_sm(*p)))
-      *p = copy_for_writing(*p);
+      return install_copy_for_writing(p, a);
    return *p;
 }
 
@@ -649,7 +905,7 @@ static INLINE SecMap* get_secmap_for_writing_high ( Addr a )
 {
    SecMap** p = get_secmap_high_ptr(a);
    if (UNLIKELY(is_distinguished_sm(*p)))
-      *p = copy_for_writing(*p);
+      return install_copy_for_writing(p, a);
    return *p;
 }
 
@@ -731,6 +987,63 @@ UChar extract_vabits4_from_vabits8 ( Addr a, UChar vabits8 )
    return 0xf & vabits8;               // mask out the rest
 }
 
+/* --------------- Change tracking for the leak checker --------------- */
+
+/* With --incremental-leak-check=yes, the leak checker reuses what it
+   found in a 64KB chunk of memory last time, for as long as neither
+   the chunk's contents nor its V+A bits change (see mc_leakcheck.c).
+   MC_(dirty_secmaps) has one byte per primary map entry, set whenever
+   the corresponding chunk may have changed, and one more, at index
+   MC_(n_dirty_secmaps), shared by everything above MAX_PRIMARY_ADDRESS.
+   Stores done by the client are noted by the instrumented code itself
+   (see mc_translate.c); all other changes come through mark_dirty. */
+
+UChar* MC_(dirty_secmaps)   = NULL;
+UWord  MC_(n_dirty_secmaps) = N_PRIMARY_MAP;
+
+static INLINE UWord dirty_secmap_index ( Addr a )
+{
+   UWord i = a >> 16;
+   return i < N_PRIMARY_MAP ? i : N_PRIMARY_MAP;
+}
+
+static void mark_dirty_slow ( Addr a, SizeT len )
+{
+   Addr  end  = a + len - 1;
+   UWord i    = dirty_secmap_index(a);
+   UWord last = end >= a ? dirty_secmap_index(end) : N_PRIMARY_MAP;
+   for (; i <= last; i++)
+      MC_(dirty_secmaps)[i] = 1;
+}
+
+static INLINE void mark_dirty ( Addr a, SizeT len )
+{
+   if (UNLIKELY(MC_(dirty_secmaps) != NULL) && len > 0)
+      mark_dirty_slow(a, len);
+}
+
+Bool MC_(is_secmap_dirty) ( Addr a )
+{
+   tl_assert(MC_(dirty_secmaps) != NULL);
+   return MC_(dirty_secmaps)[dirty_secmap_index(a)] != 0;
+}
+
+Bool MC_(clean_secmap) ( Addr a )
+{
+   UWord i = dirty_secmap_index(a);
+   tl_assert(MC_(dirty_secmaps) != NULL);
+   if (i == N_PRIMARY_MAP)
+      return False;
+   MC_(dirty_secmaps)[i] = 0;
+   return True;
+}
+
+static void init_dirty_secmaps ( void )
+{
+   MC_(dirty_secmaps) = VG_(malloc)("mc.ids.1", N_PRIMARY_MAP + 1);
+   VG_(memset)(MC_(dirty_secmaps), 1, N_PRIMARY_MAP + 1);
+}
+
 // Note that these four are only used in slow cases.  The fast cases do
 // clever things like combine the auxmap check (in
 // get_secmap_{read,writ}able) with alignment checks.
@@ -744,6 +1057,7 @@ void set_vabits2 ( Addr a, UChar vabits2 )
 {
    SecMap* sm       = get_secmap_for_writing(a);
    UWord   sm_off   = SM_OFF(a);
+   mark_dirty(a, 1);
    insert_vabits2_into_vabits8( a, vabits2, &(sm->vabits8[sm_off]) );
 }
 
@@ -752,7 +1066,8 @@ UChar get_vabits2 ( Addr a )
 {
    SecMap* sm       = get_secmap_for_reading(a);
    UWord   sm_off   = SM_OFF(a);
-   UChar   vabits8  = sm->vabits8[sm_off];
+   UChar   vabits8  = UNLIKELY(sm == SM_COMPRESSED)
+                         ? get_compressed_vabits8(a) : sm->vabits8[sm_off];
    return extract_vabits2_from_vabits8(a, vabits8);
 }
 
@@ -765,7 +1080,8 @@ UChar get_vabits8_for_aligned_word32 ( Addr a )
 {
    SecMap* sm       = get_secmap_for_reading(a);
    UWord   sm_off   = SM_OFF(a);
-   UChar   vabits8  = sm->vabits8[sm_off];
+   UChar   vabits8  = UNLIKELY(sm == SM_COMPRESSED)
+                         ? get_compressed_vabits8(a) : sm->vabits8[sm_off];
    return vabits8;
 }
 
@@ -777,10 +1093,225 @@ void set_vabits8_for_aligned_word32 ( Addr a, UChar vabits8 )
    sm->vabits8[sm_off] = vabits8;
 }
 
+/* --------------- Bulk vabits8 operations --------------- */
+
+// These work on runs of vabits8 within one SecMap, 16 at a time (so 64
+// bytes of memory at a time).  They use the compiler's generic vector
+// types, which become SSE2 code on x86 and amd64, NEON on arm64 and
+// AltiVec/VSX on ppc64, and plain word-at-a-time code where there is
+// no vector unit.  So there's no need to choose an implementation at
+// startup.  The operations are simple enough that wider (AVX2) vectors
+// gain nothing measurable: they are limited by memory bandwidth.
+//
+// Comment out PERF_FAST_BULK to use the original byte/word-at-a-time
+// code instead; with VG_DEBUG_MEMORY >= 1, the results are checked
+// against it.
+
+typedef ULong VA16 __attribute__((vector_size(16)));
+
+#define VA16_BYTES(b)   (0x0101010101010101ULL * (UChar)(b))
+
+static INLINE VA16 load_VA16 ( const UChar* p )
+{
+   VA16 v;
+   __builtin_memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static INLINE void store_VA16 ( UChar* p, VA16 v )
+{
+   __builtin_memcpy(p, &v, sizeof(v));
+}
+
+static INLINE Bool is_zero_VA16 ( VA16 v )
+{
+   return (v[0] | v[1]) == 0;
+}
+
+/* Does vabits8 contain a VA_BITS2_PARTDEFINED field? */
+static INLINE Bool vabits8_has_pdb ( UChar vabits8 )
+{
+   return ((vabits8 & (vabits8 >> 1)) & 0x55) != 0;
+}
+
+/* Set p[0 .. n-1] to vabits8. */
+static void fill_vabits8 ( UChar* p, UChar vabits8, SizeT n )
+{
+   SizeT i = 0;
+   VA16  v = { VA16_BYTES(vabits8), VA16_BYTES(vabits8) };
+   for (; i + 16 <= n; i += 16)
+      store_VA16(&p[i], v);
+   for (; i < n; i++)
+      p[i] = vabits8;
+}
+
+/* Index of the first of p[0 .. n-1] not equal to vabits8, or n. */
+static SizeT find_vabits8_not ( const UChar* p, UChar vabits8, SizeT n )
+{
+   SizeT i = 0;
+   VA16  v = { VA16_BYTES(vabits8), VA16_BYTES(vabits8) };
+   for (; i + 16 <= n; i += 16)
+      if (!is_zero_VA16(load_VA16(&p[i]) ^ v))
+         break;
+   for (; i < n; i++)
+      if (p[i] != vabits8)
+         break;
+#  if VG_DEBUG_MEMORY >= 1
+   { SizeT j;
+     for (j = 0; j < i; j++) tl_assert(p[j] == vabits8);
+     tl_assert(i == n || p[i] != vabits8); }
+#  endif
+   return i;
+}
+
+/* Copy src[0 .. n-1] to dst[0 .. n-1], which must not overlap.  Returns
+   True if any of them contains a VA_BITS2_PARTDEFINED field, in which
+   case the caller has to copy the sec-V-bits too. */
+static Bool copy_vabits8 ( UChar* dst, const UChar* src, SizeT n )
+{
+   SizeT i = 0;
+   VA16  pdb = { 0, 0 };
+   VA16  m55 = { VA16_BYTES(0x55), VA16_BYTES(0x55) };
+   Bool  any;
+   for (; i + 16 <= n; i += 16) {
+      VA16 v = load_VA16(&src[i]);
+      store_VA16(&dst[i], v);
+      pdb |= v & (v >> 1) & m55;
+   }
+   any = !is_zero_VA16(pdb);
+   for (; i < n; i++) {
+      dst[i] = src[i];
+      any |= vabits8_has_pdb(src[i]);
+   }
+#  if VG_DEBUG_MEMORY >= 1
+   { SizeT j; Bool any2 = False;
+     for (j = 0; j < n; j++) {
+        tl_assert(dst[j] == src[j]);
+        any2 |= vabits8_has_pdb(src[j]);
+     }
+     tl_assert(any == any2); }
+#  endif
+   return any;
+}
+
+/* How many of the first nwords aligned 32-bit words starting at a
+   have V+A bits vabits8?  Stops at the end of a's SecMap. */
+static INLINE SizeT count_vabits8_run ( Addr a, SizeT nwords, UChar vabits8 )
+{
+   SecMap* sm = get_secmap_for_reading(a);
+   SizeT   n  = (start_of_this_sm(a) + SM_SIZE - a) / 4;
+   tl_assert(VG_IS_4_ALIGNED(a));
+   if (n > nwords)
+      n = nwords;
+   if (UNLIKELY(sm == SM_COMPRESSED)) {
+      /* Adjacent runs differ, so this is as far as it goes. */
+      const CSecMap* csm = find_csm(a);
+      UInt           r   = csm_run_for(csm, SM_OFF(a));
+      if (csm->vabits8[r] != vabits8)
+         return 0;
+      return csm->end[r] - SM_OFF(a) < n ? csm->end[r] - SM_OFF(a) : n;
+   }
+   if (is_distinguished_sm(sm))
+      return sm->vabits8[0] == vabits8 ? n : 0;
+   return find_vabits8_not(&sm->vabits8[SM_OFF(a)], vabits8, n);
+}
+
+/* Replace *p, the normal secondary for base .. base+SM_SIZE-1, by a
+   distinguished or a compressed one, if it has few enough runs. */
+static void compress_sm ( SecMap** p, Addr base )
+{
+   SecMap*  sm = *p;
+   SecMap*  new_sm;
+   CSecMap  tmp;
+   UWord    off = 0;
+
+   tl_assert(!is_distinguished_sm(sm));
+   tmp.n_runs = 0;
+   while (off < SM_CHUNKS) {
+      UChar vabits8 = sm->vabits8[off];
+      if (tmp.n_runs == CSM_MAX_RUNS)
+         return;   /* too fragmented */
+      off += find_vabits8_not(&sm->vabits8[off], vabits8, SM_CHUNKS - off);
+      tmp.end    [tmp.n_runs] = off;
+      tmp.vabits8[tmp.n_runs] = vabits8;
+      tmp.n_runs++;
+   }
+
+   if (tmp.n_runs == 1 && tmp.vabits8[0] == VA_BITS8_NOACCESS) {
+      new_sm = &sm_distinguished[SM_DIST_NOACCESS];
+   } else if (tmp.n_runs == 1 && tmp.vabits8[0] == VA_BITS8_UNDEFINED) {
+      new_sm = &sm_distinguished[SM_DIST_UNDEFINED];
+   } else if (tmp.n_runs == 1 && tmp.vabits8[0] == VA_BITS8_DEFINED) {
+      new_sm = &sm_distinguished[SM_DIST_DEFINED];
+   } else {
+      CSecMap* csm = VG_(malloc)("mc.csm.1", sizeof(CSecMap));
+      *csm         = tmp;
+      csm->base    = base;
+      csm->n_reads = 0;
+      VG_(HT_add_node)(csm_table, csm);
+      n_csm_compressions++;
+      new_sm = SM_COMPRESSED;
+   }
+
+   *p = new_sm;
+   update_SM_counts(sm, new_sm);
+   SysRes sres = VG_(am_munmap_valgrind)((Addr)sm, sizeof(SecMap));
+   tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+}
+
+/* Don't sweep until there are this many normal secondaries (16MB of
+   shadow, covering 64MB of memory), and after that, not until their
+   number has doubled, so that the cost of sweeping stays proportional
+   to the number of secondaries made. */
+#define CSM_MIN_SWEEP 1024
+
+static Int csm_sweep_at = CSM_MIN_SWEEP;
+
+static void compress_secmaps ( void )
+{
+   UWord i;
+
+   n_csm_sweeps++;
+   for (i = 0; i < N_PRIMARY_MAP; i++) {
+      if (!is_distinguished_sm(primary_map[i]))
+         compress_sm(&primary_map[i], (Addr)i << 16);
+   }
+   for (i = 0; i < auxmap_L2->n_slots; i++) {
+      AuxMapEnt* ent = auxmap_L2->slots[i];
+      if (ent != NULL && !is_distinguished_sm(ent->sm))
+         compress_sm(&ent->sm, ent->base);
+   }
+
+   csm_sweep_at = 2 * n_non_DSM_SMs;
+   if (csm_sweep_at < CSM_MIN_SWEEP)
+      csm_sweep_at = CSM_MIN_SWEEP;
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg,
+                   "memcheck: compressed shadow memory: %d normal, "
+                   "%d compressed SMs\n", n_non_DSM_SMs, n_compressed_SMs);
+}
+
+/* Called at points where nobody is holding on to a SecMap pointer. */
+void MC_(maybe_compress_secmaps) ( void )
+{
+   if (UNLIKELY(MC_(clo_shadow_compression)
+                && n_non_DSM_SMs >= csm_sweep_at))
+      compress_secmaps();
+}
+
+/* A compressed secondary that is read often is better off normal. */
+static void expand_csm_if_hot ( Addr a )
+{
+   SecMap** p = get_secmap_ptr(a);
+   if (*p == SM_COMPRESSED && ++find_csm(a)->n_reads > CSM_HOT_READS)
+      (void)install_copy_for_writing(p, a);
+}
+
 
 // Forward declarations
 static UWord get_sec_vbits8(Addr a);
 static void  set_sec_vbits8(Addr a, UWord vbits8);
+static void  clear_sec_vbits8(Addr a);
 
 // Returns False if there was an addressability error.
 static INLINE
@@ -792,10 +1323,13 @@ Bool set_vbits8 ( Addr a, UChar vbits8 )
       // Addressable.  Convert in-register format to in-memory format.
       // Also remove any existing sec V bit entry for the byte if no
       // longer necessary.
+      Bool was_pdb = VA_BITS2_PARTDEFINED == vabits2;
       if      ( V_BITS8_DEFINED   == vbits8 ) { vabits2 = VA_BITS2_DEFINED;   }
       else if ( V_BITS8_UNDEFINED == vbits8 ) { vabits2 = VA_BITS2_UNDEFINED; }
       else                                    { vabits2 = VA_BITS2_PARTDEFINED;
                                                 set_sec_vbits8(a, vbits8);  }
+      if (was_pdb && VA_BITS2_PARTDEFINED != vabits2)
+         clear_sec_vbits8(a);
       set_vabits2(a, vabits2);
 
    } else {
@@ -833,93 +1367,49 @@ Bool get_vbits8 ( Addr a, UChar* vbits8 )
 
 // This table holds the full V bit pattern for partially-defined bytes
 // (PDBs) that are represented by VA_BITS2_PARTDEFINED in the main shadow
-// memory.
+// memory.  It is a hash table of nodes, each covering an aligned
+// BYTES_PER_SEC_VBIT_NODE bytes, stored in the slots of one array and
+// looked up by linear probing.
+//
+// The home slot of a node is a hash of its 4KB page plus the node's
+// index within that page, so that the nodes of a page -- PDBs are often
+// clustered, eg. perf/bz2 repeatedly writes then reads more than 20,000
+// in a contiguous row -- end up in neighbouring slots.
 //
 // Note: the nodes in this table can become stale.  Eg. if you write a PDB,
 // then overwrite the same address with a fully defined byte, the sec-V-bit
 // node will not necessarily be removed.  This is because checking for
-// whether removal is necessary would slow down the fast paths.  
-//
-// To avoid the stale nodes building up too much, we periodically (once the
-// table reaches a certain size) garbage collect (GC) the table by
-// traversing it and evicting any nodes not having PDB.
-// If more than a certain proportion of nodes survived, we increase the
-// table size so that GCs occur less often.  
+// whether removal is necessary would slow down the fast paths.
+// set_vbits8, which is already slow, does tell us when it overwrites a
+// PDB; we then mark the byte V_BITS8_UNDEFINED in its node, and remove
+// the node once all its bytes are so marked.
 //
-// This policy is designed to avoid bad table bloat in the worst case where
-// a program creates huge numbers of stale PDBs -- we would get this bloat
-// if we had no GC -- while handling well the case where a node becomes
-// stale but shortly afterwards is rewritten with a PDB and so becomes
-// non-stale again (which happens quite often, eg. in perf/bz2).  If we just
-// remove all stale nodes as soon as possible, we just end up re-adding a
-// lot of them in later again.  The "sufficiently stale" approach avoids
-// this.  (If a program has many live PDBs, performance will just suck,
-// there's no way around that.)
+// For the rest, rather than stopping now and then to garbage collect
+// the whole table, each time a node is added we look at the next
+// SEC_VBIT_SWEEP_STEP slots after a sweep cursor, and evict any nodes
+// there with no PDB left.  Stale nodes are thus reclaimed within one
+// pass over the table, which takes a fraction of the number of
+// insertions needed to fill it, so the table only grows when there are
+// really many PDBs.  (If a program has many live PDBs, performance will
+// just suck, there's no way around that.)
 //
-// Further comments, JRS 14 Feb 2012.  It turns out that the policy of
-// holding on to stale entries for 2 GCs before discarding them can lead
-// to massive space leaks.  So we're changing to an arrangement where
-// lines are evicted as soon as they are observed to be stale during a
-// GC.  This also has a side benefit of allowing the sufficiently_stale
-// field to be removed from the SecVBitNode struct, reducing its size by
-// 8 bytes, which is a substantial space saving considering that the
-// struct was previously 32 or so bytes, on a 64 bit target.
-//
-// In order to try and mitigate the problem that the "sufficiently stale"
-// heuristic was designed to avoid, the table size is allowed to drift
-// up ("DRIFTUP") slowly to 80000, even if the residency is low.  This
-// means that nodes will exist in the table longer on average, and hopefully
-// will be deleted and re-added less frequently.
-//
-// The previous scaling up mechanism (now called STEPUP) is retained:
-// if residency exceeds 50%, the table is scaled up, although by a 
-// factor sqrt(2) rather than 2 as before.  This effectively doubles the
-// frequency of GCs when there are many PDBs at reduces the tendency of
-// stale PDBs to reside for long periods in the table.
-
-static OSet* secVBitTable;
-
-// Stats
-static ULong sec_vbits_new_nodes = 0;
-static ULong sec_vbits_updates   = 0;
+// Removal shifts later nodes of the same probe run back, rather than
+// leaving tombstones, so lookups never get slower as nodes come and go.
 
 // This must be a power of two;  this is checked in mc_pre_clo_init().
 // The size chosen here is a trade-off:  if the nodes are bigger (ie. cover
 // a larger address range) they take more space but we can get multiple
 // partially-defined bytes in one if they are close to each other, reducing
-// the number of total nodes.  In practice sometimes they are clustered (eg.
-// perf/bz2 repeatedly writes then reads more than 20,000 in a contiguous
-// row), but often not.  So we choose something intermediate.
+// the number of total nodes.  In practice sometimes they are clustered, but
+// often not.  So we choose something intermediate.
 #define BYTES_PER_SEC_VBIT_NODE     16
 
-// We make the table bigger by a factor of STEPUP_GROWTH_FACTOR if
-// more than this many nodes survive a GC.
-#define STEPUP_SURVIVOR_PROPORTION  0.5
-#define STEPUP_GROWTH_FACTOR        1.414213562
-
-// If the above heuristic doesn't apply, then we may make the table
-// slightly bigger, by a factor of DRIFTUP_GROWTH_FACTOR, if more than
-// this many nodes survive a GC, _and_ the total table size does
-// not exceed a fixed limit.  The numbers are somewhat arbitrary, but
-// work tolerably well on long Firefox runs.  The scaleup ratio of 1.5%
-// effectively although gradually reduces residency and increases time
-// between GCs for programs with small numbers of PDBs.  The 80000 limit
-// effectively limits the table size to around 2MB for programs with
-// small numbers of PDBs, whilst giving a reasonably long lifetime to
-// entries, to try and reduce the costs resulting from deleting and
-// re-adding of entries.
-#define DRIFTUP_SURVIVOR_PROPORTION 0.15
-#define DRIFTUP_GROWTH_FACTOR       1.015
-#define DRIFTUP_MAX_SIZE            80000
-
-// We GC the table when it gets this many nodes in it, ie. it's effectively
-// the table size.  It can change.
-static Int  secVBitLimit = 1000;
-
-// The number of GCs done, used to age sec-V-bit nodes for eviction.
-// Because it's unsigned, wrapping doesn't matter -- the right answer will
-// come out anyway.
-static UInt GCs_done = 0;
+#define SEC_VBIT_PAGE_SHIFT         12
+#define SEC_VBIT_MIN_SLOTS          1024
+#define SEC_VBIT_SWEEP_STEP         4
+
+// Marks a free slot.  Never a node address, as those are aligned.
+#define SEC_VBIT_FREE               ((Addr)1)
 
 typedef 
    struct {
@@ -928,80 +1418,128 @@ typedef
    } 
    SecVBitNode;
 
-static OSet* createSecVBitTable(void)
+static SecVBitNode* secVBitTable;
+static UWord        secVBit_mask;      // number of slots - 1
+static UWord        secVBit_sweep;     // next slot to be swept
+
+// Stats
+static ULong sec_vbits_new_nodes = 0;
+static ULong sec_vbits_updates   = 0;
+static ULong sec_vbits_cleared   = 0;  // nodes removed by set_vbits8
+static ULong sec_vbits_swept     = 0;  // nodes removed by the sweep
+static ULong sec_vbits_resizes   = 0;
+static UWord max_secVBit_slots   = 0;
+
+static INLINE UWord secVBit_home ( Addr aAligned )
 {
-   OSet* newSecVBitTable;
-   newSecVBitTable = VG_(OSetGen_Create_With_Pool)
-      ( offsetof(SecVBitNode, a), 
-        NULL, // use fast comparisons
-        VG_(malloc), "mc.cSVT.1 (sec VBit table)", 
-        VG_(free),
-        1000,
-        sizeof(SecVBitNode));
-   return newSecVBitTable;
+   UWord page = aAligned >> SEC_VBIT_PAGE_SHIFT;
+   UWord h;
+#  if VG_WORDSIZE == 8
+   h = (UWord)((page * 0x9E3779B97F4A7C15ULL) >> 32);
+#  else
+   h = page * 0x9E3779B9U;
+#  endif
+   return (h + aAligned / BYTES_PER_SEC_VBIT_NODE)
+          & secVBit_mask;
 }
 
-static void gcSecVBitTable(void)
+static void alloc_secVBitTable ( UWord n_slots )
 {
-   OSet*        secVBitTable2;
-   SecVBitNode* n;
-   Int          i, n_nodes = 0, n_survivors = 0;
+   UWord i;
+   secVBitTable  = VG_(malloc)("mc.cSVT.1 (sec VBit table)",
+                               n_slots * sizeof(SecVBitNode));
+   secVBit_mask  = n_slots - 1;
+   secVBit_sweep = 0;
+   for (i = 0; i < n_slots; i++)
+      secVBitTable[i].a = SEC_VBIT_FREE;
+   if (n_slots > max_secVBit_slots)
+      max_secVBit_slots = n_slots;
+}
 
-   GCs_done++;
+static INLINE SecVBitNode* lookup_secVBitNode ( Addr aAligned )
+{
+   UWord i = secVBit_home(aAligned);
+   while (secVBitTable[i].a != SEC_VBIT_FREE) {
+      if (secVBitTable[i].a == aAligned)
+         return &secVBitTable[i];
+      i = (i + 1) & secVBit_mask;
+   }
+   return NULL;
+}
 
-   // Create the new table.
-   secVBitTable2 = createSecVBitTable();
+// Returns the free slot in which a node for aAligned, known not to be
+// in the table, should go.
+static SecVBitNode* free_secVBitNode_for ( Addr aAligned )
+{
+   UWord i = secVBit_home(aAligned);
+   while (secVBitTable[i].a != SEC_VBIT_FREE)
+      i = (i + 1) & secVBit_mask;
+   return &secVBitTable[i];
+}
 
-   // Traverse the table, moving fresh nodes into the new table.
-   VG_(OSetGen_ResetIter)(secVBitTable);
-   while ( (n = VG_(OSetGen_Next)(secVBitTable)) ) {
-      // Keep node if any of its bytes are non-stale.  Using
-      // get_vabits2() for the lookup is not very efficient, but I don't
-      // think it matters.
-      for (i = 0; i < BYTES_PER_SEC_VBIT_NODE; i++) {
-         if (VA_BITS2_PARTDEFINED == get_vabits2(n->a + i)) {
-            // Found a non-stale byte, so keep =>
-            // Insert a copy of the node into the new table.
-            SecVBitNode* n2 = 
-               VG_(OSetGen_AllocNode)(secVBitTable2, sizeof(SecVBitNode));
-            *n2 = *n;
-            VG_(OSetGen_Insert)(secVBitTable2, n2);
-            break;
-         }
+static void remove_secVBitNode ( UWord i )
+{
+   UWord j = i;
+   tl_assert(n_secVBit_nodes > 0);
+   n_secVBit_nodes--;
+   // Move back any later node of the probe run that would otherwise no
+   // longer be reachable from its home slot.
+   while (True) {
+      UWord home;
+      j = (j + 1) & secVBit_mask;
+      if (secVBitTable[j].a == SEC_VBIT_FREE)
+         break;
+      home = secVBit_home(secVBitTable[j].a);
+      if (((j - home) & secVBit_mask) >= ((j - i) & secVBit_mask)) {
+         secVBitTable[i] = secVBitTable[j];
+         i = j;
       }
    }
+   secVBitTable[i].a = SEC_VBIT_FREE;
+}
 
-   // Get the before and after sizes.
-   n_nodes     = VG_(OSetGen_Size)(secVBitTable);
-   n_survivors = VG_(OSetGen_Size)(secVBitTable2);
-
-   // Destroy the old table, and put the new one in its place.
-   VG_(OSetGen_Destroy)(secVBitTable);
-   secVBitTable = secVBitTable2;
-
-   if (VG_(clo_verbosity) > 1 && n_nodes != 0) {
-      VG_(message)(Vg_DebugMsg, "memcheck GC: %d nodes, %d survivors (%.1f%%)\n",
-                   n_nodes, n_survivors, n_survivors * 100.0 / n_nodes);
-   }
+static void grow_secVBitTable ( void )
+{
+   SecVBitNode* old      = secVBitTable;
+   UWord        old_size = secVBit_mask + 1;
+   UWord        i;
 
-   // Increase table size if necessary.
-   if ((Double)n_survivors 
-       > ((Double)secVBitLimit * STEPUP_SURVIVOR_PROPORTION)) {
-      secVBitLimit = (Int)((Double)secVBitLimit * (Double)STEPUP_GROWTH_FACTOR);
-      if (VG_(clo_verbosity) > 1)
-         VG_(message)(Vg_DebugMsg,
-                      "memcheck GC: %d new table size (stepup)\n",
-                      secVBitLimit);
+   alloc_secVBitTable(2 * old_size);
+   for (i = 0; i < old_size; i++) {
+      if (old[i].a != SEC_VBIT_FREE)
+         *free_secVBitNode_for(old[i].a) = old[i];
    }
-   else
-   if (secVBitLimit < DRIFTUP_MAX_SIZE
-       && (Double)n_survivors 
-          > ((Double)secVBitLimit * DRIFTUP_SURVIVOR_PROPORTION)) {
-      secVBitLimit = (Int)((Double)secVBitLimit * (Double)DRIFTUP_GROWTH_FACTOR);
-      if (VG_(clo_verbosity) > 1)
-         VG_(message)(Vg_DebugMsg,
-                      "memcheck GC: %d new table size (driftup)\n",
-                      secVBitLimit);
+   VG_(free)(old);
+   sec_vbits_resizes++;
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg,
+                   "memcheck: sec V bit table now %lu slots, %d nodes\n",
+                   secVBit_mask + 1, n_secVBit_nodes);
+}
+
+// Evicts stale nodes from the next SEC_VBIT_SWEEP_STEP slots.
+static void sweep_secVBitTable ( void )
+{
+   Int n;
+   for (n = 0; n < SEC_VBIT_SWEEP_STEP; n++) {
+      SecVBitNode* node = &secVBitTable[secVBit_sweep];
+      Int          i;
+      if (node->a != SEC_VBIT_FREE) {
+         // Using get_vabits2() for the lookup is not very efficient, but
+         // I don't think it matters.
+         for (i = 0; i < BYTES_PER_SEC_VBIT_NODE; i++) {
+            if (VA_BITS2_PARTDEFINED == get_vabits2(node->a + i))
+               break;
+         }
+         if (i == BYTES_PER_SEC_VBIT_NODE) {
+            // Stale.  Another node may be moved into this slot, so look
+            // at it again.
+            remove_secVBitNode(secVBit_sweep);
+            sec_vbits_swept++;
+            continue;
+         }
+      }
+      secVBit_sweep = (secVBit_sweep + 1) & secVBit_mask;
    }
 }
 
@@ -1009,7 +1547,7 @@ static UWord get_sec_vbits8(Addr a)
 {
    Addr         aAligned = VG_ROUNDDN(a, BYTES_PER_SEC_VBIT_NODE);
    Int          amod     = a % BYTES_PER_SEC_VBIT_NODE;
-   SecVBitNode* n        = VG_(OSetGen_Lookup)(secVBitTable, &aAligned);
+   SecVBitNode* n        = lookup_secVBitNode(aAligned);
    UChar        vbits8;
    tl_assert2(n, "get_sec_vbits8: no node for address %p (%p)\n", aAligned, a);
    // Shouldn't be fully defined or fully undefined -- those cases shouldn't
@@ -1023,7 +1561,7 @@ static void set_sec_vbits8(Addr a, UWord vbits8)
 {
    Addr         aAligned = VG_ROUNDDN(a, BYTES_PER_SEC_VBIT_NODE);
    Int          i, amod  = a % BYTES_PER_SEC_VBIT_NODE;
-   SecVBitNode* n        = VG_(OSetGen_Lookup)(secVBitTable, &aAligned);
+   SecVBitNode* n        = lookup_secVBitNode(aAligned);
    // Shouldn't be fully defined or fully undefined -- those cases shouldn't
    // make it to the secondary V bits table.
    tl_assert(V_BITS8_DEFINED != vbits8 && V_BITS8_UNDEFINED != vbits8);
@@ -1031,31 +1569,48 @@ static void set_sec_vbits8(Addr a, UWord vbits8)
       n->vbits8[amod] = vbits8;     // update
       sec_vbits_updates++;
    } else {
-      // Do a table GC if necessary.  Nb: do this before creating and
-      // inserting the new node, to avoid erroneously GC'ing the new node.
-      if (secVBitLimit == VG_(OSetGen_Size)(secVBitTable)) {
-         gcSecVBitTable();
-      }
+      // Reclaim some stale nodes, and make room if necessary.  Nb: do
+      // this before finding a slot for the new node, as both can move
+      // nodes around.
+      sweep_secVBitTable();
+      if (2 * (n_secVBit_nodes + 1) > secVBit_mask + 1)
+         grow_secVBitTable();
 
       // New node:  assign the specific byte, make the rest invalid (they
       // should never be read as-is, but be cautious).
-      n = VG_(OSetGen_AllocNode)(secVBitTable, sizeof(SecVBitNode));
+      n = free_secVBitNode_for(aAligned);
       n->a            = aAligned;
       for (i = 0; i < BYTES_PER_SEC_VBIT_NODE; i++) {
          n->vbits8[i] = V_BITS8_UNDEFINED;
       }
       n->vbits8[amod] = vbits8;
-
-      // Insert the new node.
-      VG_(OSetGen_Insert)(secVBitTable, n);
       sec_vbits_new_nodes++;
 
-      n_secVBit_nodes = VG_(OSetGen_Size)(secVBitTable);
+      n_secVBit_nodes++;
       if (n_secVBit_nodes > max_secVBit_nodes)
          max_secVBit_nodes = n_secVBit_nodes;
    }
 }
 
+// The PDB at a has just been overwritten with a fully defined or
+// undefined byte.  Forget its V bits, and the whole node if none of its
+// bytes has any left.
+static void clear_sec_vbits8(Addr a)
+{
+   Addr         aAligned = VG_ROUNDDN(a, BYTES_PER_SEC_VBIT_NODE);
+   Int          i, amod  = a % BYTES_PER_SEC_VBIT_NODE;
+   SecVBitNode* n        = lookup_secVBitNode(aAligned);
+   if (!n)
+      return;
+   n->vbits8[amod] = V_BITS8_UNDEFINED;
+   for (i = 0; i < BYTES_PER_SEC_VBIT_NODE; i++) {
+      if (n->vbits8[i] != V_BITS8_UNDEFINED)
+         return;
+   }
+   remove_secVBitNode(n - secVBitTable);
+   sec_vbits_cleared++;
+}
+
 /* --------------- Endianness helpers --------------- */
 
 /* Returns the offset in memory of the byteno-th most significant byte
@@ -1232,6 +1787,9 @@ void mc_LOADV_128_or_256_slow ( /*OUT*/ULong* res,
       res[j] = V_BITS64_UNDEFINED;
    }
 
+   if (UNLIKELY(n_compressed_SMs > 0))
+      expand_csm_if_hot(a);
+
    /* Make up a result V word, which contains the loaded data for
       valid addresses and Defined for invalid addresses.  Iterate over
       the bytes in the word, from the most significant down to the
@@ -1360,6 +1918,9 @@ ULong mc_LOADVn_slow ( Addr a, SizeT nBits, Bool bigendian )
    }
    /* ------------ END semi-fast cases ------------ */
 
+   if (UNLIKELY(n_compressed_SMs > 0))
+      expand_csm_if_hot(a);
+
    ULong  vbits64     = V_BITS64_UNDEFINED; /* result */
    ULong  pessim64    = V_BITS64_DEFINED;   /* only used when p-l-ok=yes */
    SSizeT szB         = nBits / 8;
@@ -1561,7 +2122,10 @@ void mc_STOREVn_slow ( Addr a, SizeT nBits, ULong vbytes, Bool bigendian )
 static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
                                       UWord dsm_num )
 {
-   UWord    sm_off, sm_off16;
+   UWord    sm_off;
+#  ifndef PERF_FAST_BULK
+   UWord    sm_off16;
+#  endif
    UWord    vabits2 = vabits16 & 0x3;
    SizeT    lenA, lenB, len_to_next_secmap;
    Addr     aNext;
@@ -1583,6 +2147,8 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
    if (lenT == 0)
       return;
 
+   mark_dirty(a, lenT);
+
    if (lenT > 256 * 1024 * 1024) {
       if (VG_(clo_verbosity) > 0 && !VG_(clo_xml)) {
          const HChar* s = "unknown???";
@@ -1681,7 +2247,7 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
          lenA = 0;
       } else {
          PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_DIST_SM1);
-         *sm_ptr = copy_for_writing(*sm_ptr);
+         (void)install_copy_for_writing(sm_ptr, a);
       }
    }
    sm = *sm_ptr;
@@ -1697,6 +2263,15 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
       lenA -= 1;
    }
    // 8-aligned, 8 byte steps
+#  ifdef PERF_FAST_BULK
+   if (lenA >= 8) {
+      SizeT len8 = lenA & ~(SizeT)7;
+      PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_LOOP8A);
+      fill_vabits8( &sm->vabits8[SM_OFF(a)], (UChar)vabits16, len8 / 4 );
+      a    += len8;
+      lenA -= len8;
+   }
+#  else
    while (True) {
       if (lenA < 8) break;
       PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_LOOP8A);
@@ -1705,6 +2280,7 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
       a    += 8;
       lenA -= 8;
    }
+#  endif
    // 1 byte steps
    while (True) {
       if (lenA < 1) break;
@@ -1737,6 +2313,8 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
          // case happens moderately often, enough to be worthwhile.
          SysRes sres = VG_(am_munmap_valgrind)((Addr)*sm_ptr, sizeof(SecMap));
          tl_assert2(! sr_isError(sres), "SecMap valgrind munmap failure\n");
+      } else if (*sm_ptr == SM_COMPRESSED) {
+         free_csm(a);
       }
       update_SM_counts(*sm_ptr, example_dsm);
       // Make the sec-map entry point to the example DSM
@@ -1764,12 +2342,21 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
          return;
       } else {
          PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_DIST_SM2);
-         *sm_ptr = copy_for_writing(*sm_ptr);
+         (void)install_copy_for_writing(sm_ptr, a);
       }
    }
    sm = *sm_ptr;
 
    // 8-aligned, 8 byte steps
+#  ifdef PERF_FAST_BULK
+   if (lenB >= 8) {
+      SizeT len8 = lenB & ~(SizeT)7;
+      PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_LOOP8B);
+      fill_vabits8( &sm->vabits8[SM_OFF(a)], (UChar)vabits16, len8 / 4 );
+      a    += len8;
+      lenB -= len8;
+   }
+#  else
    while (True) {
       if (lenB < 8) break;
       PROF_EVENT(MCPE_SET_ADDRESS_RANGE_PERMS_LOOP8B);
@@ -1778,6 +2365,7 @@ static void set_address_range_perms ( Addr a, SizeT lenT, UWord vabits16,
       a    += 8;
       lenB -= 8;
    }
+#  endif
    // 1 byte steps
    while (True) {
       if (lenB < 1) return;
@@ -1912,14 +2500,48 @@ void MC_(copy_address_range_state) ( Addr src, Addr dst, SizeT len )
    if (len == 0 || src == dst)
       return;
 
+   mark_dirty(dst, len);
+
    aligned   = VG_IS_4_ALIGNED(src) && VG_IS_4_ALIGNED(dst);
    nooverlap = src+len <= dst || dst+len <= src;
 
    if (nooverlap && aligned) {
 
       /* Vectorised fast case, when no overlap and suitably aligned */
-      /* vector loop */
       i = 0;
+#     ifdef PERF_FAST_BULK
+      /* bulk loop: as much as lies in the current src and dst SecMaps */
+      while (len >= 4) {
+         SizeT   n, k;
+         SecMap* src_sm = get_secmap_for_reading( src+i );
+         SecMap* dst_sm;
+         if (UNLIKELY(src_sm == SM_COMPRESSED)) {
+            /* Rather than decode it here, make it normal again. */
+            src_sm = install_copy_for_writing( get_secmap_ptr(src+i),
+                                               src+i );
+         }
+         n = (start_of_this_sm(src+i) + SM_SIZE - (src+i)) / 4;
+         k = (start_of_this_sm(dst+i) + SM_SIZE - (dst+i)) / 4;
+         if (k < n)       n = k;
+         if (len / 4 < n) n = len / 4;
+         PROF_EVENT(MCPE_COPY_ADDRESS_RANGE_STATE_BULK);
+         dst_sm = get_secmap_for_reading( dst+i );
+         if (!(is_distinguished_sm(src_sm) && src_sm == dst_sm)) {
+            dst_sm = get_secmap_for_writing( dst+i );
+            if (copy_vabits8( &dst_sm->vabits8[SM_OFF(dst+i)],
+                              &src_sm->vabits8[SM_OFF(src+i)], n )) {
+               /* have to copy secondary map info */
+               for (j = 0; j < 4*n; j++) {
+                  if (VA_BITS2_PARTDEFINED == get_vabits2( src+i+j ))
+                     set_sec_vbits8( dst+i+j, get_sec_vbits8( src+i+j ) );
+               }
+            }
+         }
+         i   += 4*n;
+         len -= 4*n;
+      }
+#     endif
+      /* vector loop */
       while (len >= 4) {
          vabits8 = get_vabits8_for_aligned_word32( src+i );
          set_vabits8_for_aligned_word32( dst+i, vabits8 );
@@ -2057,8 +2679,12 @@ void MC_(copy_address_range_state) ( Addr src, Addr dst, SizeT len )
 
    Memory is shadowed using a two level cache structure (ocacheL1 and
    ocacheL2).  Memory references are first directed to ocacheL1.  This
-   is a traditional 2-way set associative cache with 32-byte lines and
-   approximate LRU replacement within each set.
+   is a traditional set associative cache with 32-byte lines and
+   approximate LRU replacement within each set.  By default it has
+   2^20 sets of 2 ways; both can be changed at startup
+   (--origin-cache-sets, --origin-cache-ways), and with
+   --origin-cache-grow=yes, the number of sets is doubled whenever the
+   cache is seen to thrash.
 
    A naive implementation would require storing one 32 bit otag for
    each byte of memory covered, a 4:1 space overhead.  Instead, there
@@ -2076,8 +2702,8 @@ void MC_(copy_address_range_state) ( Addr src, Addr dst, SizeT len )
    zeroes to be installed.  However, ejecting a line containing
    nonzeroes risks losing origin information permanently.  In order to
    prevent such lossage, ejected nonzero lines are placed in a
-   secondary cache (ocacheL2), which is an OSet (AVL tree) of cache
-   lines.  This can grow arbitrarily large, and so should ensure that
+   secondary cache (ocacheL2), which is a hash table of cache lines.
+   This can grow arbitrarily large, and so should ensure that
    Memcheck runs out of memory in preference to losing useful origin
    info due to cache size limitations.
 
@@ -2317,15 +2943,21 @@ static INLINE Bool is_valid_oc_tag ( Addr tag ) {
    return 0 == (tag & ((1 << OC_BITS_PER_LINE) - 1));
 }
 
-#define OC_LINES_PER_SET 2
-
-#define OC_N_SET_BITS    20
-#define OC_N_SETS        (1 << OC_N_SET_BITS)
-
-/* These settings give:
+/* The geometry of ocacheL1.  Both are powers of 2, and there are at
+   least 2 lines per set.  The default settings (2^20 sets of 2 lines)
+   give:
    64 bit host: ocache:  100,663,296 sizeB    67,108,864 useful
    32 bit host: ocache:   92,274,688 sizeB    67,108,864 useful
 */
+static UWord oc_n_sets             = 0;
+static UWord oc_lines_per_set      = 0;
+static UWord oc_lines_per_set_bits = 0;
+
+/* With --origin-cache-grow=yes, every OC_GROW_CHECK_EVERY misses, see
+   whether the cache is thrashing, and if so double the number of
+   sets, up to OC_MAX_SETS. */
+#define OC_GROW_CHECK_EVERY (1 << 20)
+#define OC_MAX_SETS         (1 << 24)
 
 #define OC_MOVE_FORWARDS_EVERY_BITS 7
 
@@ -2355,49 +2987,78 @@ static UChar classify_OCacheLine ( OCacheLine* line )
    return 'z'; /* ZERO - no useful info */
 }
 
-typedef
-   struct {
-      OCacheLine line[OC_LINES_PER_SET];
-   }
-   OCacheSet;
+/* ocacheL1 is oc_n_sets sets of oc_lines_per_set lines, one set
+   after the other. */
+static OCacheLine* ocacheL1 = NULL;
+static UWord       ocacheL1_event_ctr = 0;
 
-typedef
-   struct {
-      OCacheSet set[OC_N_SETS];
-   }
-   OCache;
+static UWord oc_grow_check_at     = ~(UWord)0;
+static UWord oc_grow_last_find    = 0;
+static UWord oc_grow_last_lossage = 0;
+static UWord stats_ocacheL1_grows = 0;
+
+static INLINE SizeT sizeof_OCacheL1 ( void )
+{
+   return oc_n_sets * oc_lines_per_set * sizeof(OCacheLine);
+}
 
-static OCache* ocacheL1 = NULL;
-static UWord   ocacheL1_event_ctr = 0;
+/* The first line of the set for a. */
+static INLINE OCacheLine* get_OCacheSet ( Addr a )
+{
+   UWord setno = (a >> OC_BITS_PER_LINE) & (oc_n_sets - 1);
+   return &ocacheL1[setno << oc_lines_per_set_bits];
+}
 
-static void init_ocacheL2 ( void ); /* fwds */
-static void init_OCache ( void )
+static void alloc_OCacheL1 ( UWord n_sets )
 {
-   UWord line, set;
-   tl_assert(MC_(clo_mc_level) >= 3);
-   tl_assert(ocacheL1 == NULL);
-   ocacheL1 = VG_(am_shadow_alloc)(sizeof(OCache));
+   UWord i;
+   oc_n_sets = n_sets;
+   ocacheL1 = VG_(am_shadow_alloc)(sizeof_OCacheL1());
    if (ocacheL1 == NULL) {
       VG_(out_of_memory_NORETURN)( "memcheck:allocating ocacheL1", 
-                                   sizeof(OCache) );
+                                   sizeof_OCacheL1() );
    }
    tl_assert(ocacheL1 != NULL);
-   for (set = 0; set < OC_N_SETS; set++) {
-      for (line = 0; line < OC_LINES_PER_SET; line++) {
-         ocacheL1->set[set].line[line].tag = 1/*invalid*/;
-      }
+   for (i = 0; i < oc_n_sets * oc_lines_per_set; i++) {
+      ocacheL1[i].tag = 1/*invalid*/;
    }
+}
+
+/* Largest power of 2 <= n, which must be nonzero. */
+static UWord round_down_to_power_of_2 ( UWord n )
+{
+   UWord p = 1;
+   tl_assert(n > 0);
+   while (2 * p <= n)
+      p *= 2;
+   return p;
+}
+
+static void init_ocacheL2 ( void ); /* fwds */
+static void init_OCache ( void )
+{
+   tl_assert(MC_(clo_mc_level) >= 3);
+   tl_assert(ocacheL1 == NULL);
+   oc_lines_per_set = round_down_to_power_of_2(MC_(clo_origin_cache_ways));
+   tl_assert(oc_lines_per_set >= 2);
+   for (oc_lines_per_set_bits = 0;
+        (1UL << oc_lines_per_set_bits) < oc_lines_per_set;
+        oc_lines_per_set_bits++)
+      ;
+   alloc_OCacheL1( round_down_to_power_of_2(MC_(clo_origin_cache_sets)) );
    init_ocacheL2();
+   if (MC_(clo_origin_cache_grow))
+      oc_grow_check_at = OC_GROW_CHECK_EVERY;
 }
 
-static void moveLineForwards ( OCacheSet* set, UWord lineno )
+static void moveLineForwards ( OCacheLine* set, UWord lineno )
 {
    OCacheLine tmp;
    stats_ocacheL1_movefwds++;
-   tl_assert(lineno > 0 && lineno < OC_LINES_PER_SET);
-   tmp = set->line[lineno-1];
-   set->line[lineno-1] = set->line[lineno];
-   set->line[lineno] = tmp;
+   tl_assert(lineno > 0 && lineno < oc_lines_per_set);
+   tmp = set[lineno-1];
+   set[lineno-1] = set[lineno];
+   set[lineno] = tmp;
 }
 
 static void zeroise_OCacheLine ( OCacheLine* line, Addr tag ) {
@@ -2412,65 +3073,156 @@ static void zeroise_OCacheLine ( OCacheLine* line, Addr tag ) {
 //////////////////////////////////////////////////////////////
 //// OCache backing store
 
-static OSet* ocacheL2 = NULL;
+/* The backing store is an open-addressing hash table of pointers to
+   lines, with linear probing.  It is kept between 1/8 and 1/2 full
+   (but never smaller than 1 << OC_L2_MIN_SLOTS_BITS slots), so probe
+   sequences stay short.  Deletion moves later entries of the probe
+   sequence back, so there are no tombstones to clean up.  The lines
+   themselves are pool-allocated. */
 
-static void* ocacheL2_malloc ( const HChar* cc, SizeT szB ) {
-   return VG_(malloc)(cc, szB);
-}
-static void ocacheL2_free ( void* v ) {
-   VG_(free)( v );
-}
+#define OC_L2_MIN_SLOTS_BITS 12
+
+typedef
+   struct {
+      UWord        slots_bits;
+      UWord        n_slots;    /* 1 << slots_bits */
+      UWord        n_used;
+      OCacheLine** slots;      /* NULL means empty */
+      PoolAlloc*   lines;
+   }
+   OCacheL2;
+
+static OCacheL2* ocacheL2 = NULL;
 
-/* Stats: # nodes currently in tree */
+/* Stats: # nodes currently in the table, # probes past the first slot
+   and # times the table was resized */
 static UWord stats__ocacheL2_n_nodes = 0;
+static UWord stats__ocacheL2_probes  = 0;
+static UWord stats__ocacheL2_resizes = 0;
+
+static INLINE UWord ocacheL2_hash ( Addr tag, UWord slots_bits )
+{
+   /* Lines often have consecutive tags, which mustn't end up in
+      consecutive slots, so mix them up (Fibonacci hashing). */
+   UWord k = tag >> OC_BITS_PER_LINE;
+   k *= sizeof(UWord) == 8 ? (UWord)0x9E3779B97F4A7C15ULL
+                           : (UWord)0x9E3779B9UL;
+   return k >> (8 * sizeof(UWord) - slots_bits);
+}
+
+static void ocacheL2_resize ( UWord slots_bits )
+{
+   OCacheLine** old_slots   = ocacheL2->slots;
+   UWord        old_n_slots = ocacheL2->n_slots;
+   UWord        mask        = ((UWord)1 << slots_bits) - 1;
+   UWord        i, j;
+
+   stats__ocacheL2_resizes++;
+   ocacheL2->slots_bits = slots_bits;
+   ocacheL2->n_slots    = mask + 1;
+   ocacheL2->slots      = VG_(calloc)("mc.ioL2.2", ocacheL2->n_slots,
+                                      sizeof(OCacheLine*));
+   for (i = 0; i < old_n_slots; i++) {
+      if (old_slots[i] == NULL)
+         continue;
+      j = ocacheL2_hash(old_slots[i]->tag, slots_bits);
+      while (ocacheL2->slots[j] != NULL)
+         j = (j + 1) & mask;
+      ocacheL2->slots[j] = old_slots[i];
+   }
+   if (old_slots)
+      VG_(free)(old_slots);
+}
 
 static void init_ocacheL2 ( void )
 {
    tl_assert(!ocacheL2);
-   tl_assert(sizeof(Word) == sizeof(Addr)); /* since OCacheLine.tag :: Addr */
-   tl_assert(0 == offsetof(OCacheLine,tag));
-   ocacheL2 
-      = VG_(OSetGen_Create)( offsetof(OCacheLine,tag), 
-                             NULL, /* fast cmp */
-                             ocacheL2_malloc, "mc.ioL2", ocacheL2_free);
+   ocacheL2 = VG_(malloc)("mc.ioL2.1", sizeof(OCacheL2));
+   ocacheL2->slots_bits = 0;
+   ocacheL2->n_slots    = 0;
+   ocacheL2->n_used     = 0;
+   ocacheL2->slots      = NULL;
+   ocacheL2->lines      = VG_(newPA)(sizeof(OCacheLine), 1000, VG_(malloc),
+                                     "mc.ioL2.3 (OCacheLine pools)",
+                                     VG_(free));
+   ocacheL2_resize(OC_L2_MIN_SLOTS_BITS);
+   stats__ocacheL2_resizes = 0;
    stats__ocacheL2_n_nodes = 0;
 }
 
-/* Find line with the given tag in the tree, or NULL if not found. */
-static OCacheLine* ocacheL2_find_tag ( Addr tag )
+/* The slot holding the line with the given tag, or if there is none,
+   the empty slot where it would go. */
+static INLINE UWord ocacheL2_slot_for ( Addr tag )
 {
+   UWord       mask = ocacheL2->n_slots - 1;
+   UWord       i    = ocacheL2_hash(tag, ocacheL2->slots_bits);
    OCacheLine* line;
+   while ((line = ocacheL2->slots[i]) != NULL && line->tag != tag) {
+      stats__ocacheL2_probes++;
+      i = (i + 1) & mask;
+   }
+   return i;
+}
+
+/* Find line with the given tag in the table, or NULL if not found. */
+static OCacheLine* ocacheL2_find_tag ( Addr tag )
+{
    tl_assert(is_valid_oc_tag(tag));
    stats__ocacheL2_refs++;
-   line = VG_(OSetGen_Lookup)( ocacheL2, &tag );
-   return line;
+   return ocacheL2->slots[ ocacheL2_slot_for(tag) ];
 }
 
-/* Delete the line with the given tag from the tree, if it is present, and
-   free up the associated memory. */
+/* Delete the line with the given tag from the table, if it is
+   present, and free up the associated memory. */
 static void ocacheL2_del_tag ( Addr tag )
 {
-   OCacheLine* line;
+   OCacheLine** slots = ocacheL2->slots;
+   UWord        mask  = ocacheL2->n_slots - 1;
+   UWord        i, j, k;
+
    tl_assert(is_valid_oc_tag(tag));
    stats__ocacheL2_refs++;
-   line = VG_(OSetGen_Remove)( ocacheL2, &tag );
-   if (line) {
-      VG_(OSetGen_FreeNode)(ocacheL2, line);
-      tl_assert(stats__ocacheL2_n_nodes > 0);
-      stats__ocacheL2_n_nodes--;
+   i = ocacheL2_slot_for(tag);
+   if (slots[i] == NULL)
+      return;
+   VG_(freeEltPA)(ocacheL2->lines, slots[i]);
+   slots[i] = NULL;
+   ocacheL2->n_used--;
+   tl_assert(stats__ocacheL2_n_nodes > 0);
+   stats__ocacheL2_n_nodes--;
+
+   /* Close the gap at i: move back any later line in the same run of
+      full slots whose home slot k is not cyclically in (i, j]. */
+   for (j = (i + 1) & mask; slots[j] != NULL; j = (j + 1) & mask) {
+      k = ocacheL2_hash(slots[j]->tag, ocacheL2->slots_bits);
+      if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+         continue;
+      slots[i] = slots[j];
+      slots[j] = NULL;
+      i = j;
    }
+
+   if (ocacheL2->slots_bits > OC_L2_MIN_SLOTS_BITS
+       && 8 * ocacheL2->n_used < ocacheL2->n_slots)
+      ocacheL2_resize(ocacheL2->slots_bits - 1);
 }
 
-/* Add a copy of the given line to the tree.  It must not already be
+/* Add a copy of the given line to the table.  It must not already be
    present. */
 static void ocacheL2_add_line ( OCacheLine* line )
 {
    OCacheLine* copy;
+   UWord       i;
    tl_assert(is_valid_oc_tag(line->tag));
-   copy = VG_(OSetGen_AllocNode)( ocacheL2, sizeof(OCacheLine) );
+   if (2 * (ocacheL2->n_used + 1) > ocacheL2->n_slots)
+      ocacheL2_resize(ocacheL2->slots_bits + 1);
+   copy = VG_(allocEltPA)(ocacheL2->lines);
    *copy = *line;
    stats__ocacheL2_refs++;
-   VG_(OSetGen_Insert)( ocacheL2, copy );
+   i = ocacheL2_slot_for(line->tag);
+   tl_assert(ocacheL2->slots[i] == NULL);
+   ocacheL2->slots[i] = copy;
+   ocacheL2->n_used++;
    stats__ocacheL2_n_nodes++;
    if (stats__ocacheL2_n_nodes > stats__ocacheL2_n_nodes_max)
       stats__ocacheL2_n_nodes_max = stats__ocacheL2_n_nodes;
@@ -2479,44 +3231,12 @@ static void ocacheL2_add_line ( OCacheLine* line )
 ////
 //////////////////////////////////////////////////////////////
 
-__attribute__((noinline))
-static OCacheLine* find_OCacheLine_SLOW ( Addr a )
+/* Make sure the backing store holds whatever useful origins 'victim'
+   has, since it is about to leave the L1. */
+static void write_back_OCacheLine ( OCacheLine* victim )
 {
-   OCacheLine *victim, *inL2;
-   UChar c;
-   UWord line;
-   UWord setno   = (a >> OC_BITS_PER_LINE) & (OC_N_SETS - 1);
-   UWord tagmask = ~((1 << OC_BITS_PER_LINE) - 1);
-   UWord tag     = a & tagmask;
-   tl_assert(setno >= 0 && setno < OC_N_SETS);
-
-   /* we already tried line == 0; skip therefore. */
-   for (line = 1; line < OC_LINES_PER_SET; line++) {
-      if (ocacheL1->set[setno].line[line].tag == tag) {
-         if (line == 1) {
-            stats_ocacheL1_found_at_1++;
-         } else {
-            stats_ocacheL1_found_at_N++;
-         }
-         if (UNLIKELY(0 == (ocacheL1_event_ctr++ 
-                            & ((1<<OC_MOVE_FORWARDS_EVERY_BITS)-1)))) {
-            moveLineForwards( &ocacheL1->set[setno], line );
-            line--;
-         }
-         return &ocacheL1->set[setno].line[line];
-      }
-   }
-
-   /* A miss.  Use the last slot.  Implicitly this means we're
-      ejecting the line in the last slot. */
-   stats_ocacheL1_misses++;
-   tl_assert(line == OC_LINES_PER_SET);
-   line--;
-   tl_assert(line > 0);
-
-   /* First, move the to-be-ejected line to the L2 cache. */
-   victim = &ocacheL1->set[setno].line[line];
-   c = classify_OCacheLine(victim);
+   OCacheLine* inL2;
+   UChar c = classify_OCacheLine(victim);
    switch (c) {
       case 'e':
          /* the line is empty (has invalid tag); ignore it. */
@@ -2543,43 +3263,121 @@ static OCacheLine* find_OCacheLine_SLOW ( Addr a )
       default:
          tl_assert(0);
    }
+}
+
+/* Replace ocacheL1 by one with n_sets sets.  Every line holding an
+   origin is written back to ocacheL2 first, and will be reloaded from
+   there on demand, so no origins are lost. */
+static void resize_OCacheL1 ( UWord n_sets )
+{
+   UWord  i;
+   SysRes sres;
+   for (i = 0; i < oc_n_sets * oc_lines_per_set; i++)
+      write_back_OCacheLine( &ocacheL1[i] );
+   sres = VG_(am_munmap_valgrind)( (Addr)ocacheL1, sizeof_OCacheL1() );
+   tl_assert2(! sr_isError(sres), "ocacheL1 valgrind munmap failure\n");
+   alloc_OCacheL1( n_sets );
+   if (VG_(clo_verbosity) > 1)
+      VG_(message)(Vg_DebugMsg,
+                   "memcheck: origin cache grown to %lu sets (%luk)\n",
+                   oc_n_sets, sizeof_OCacheL1() / 1024);
+}
+
+/* Called every OC_GROW_CHECK_EVERY misses with --origin-cache-grow=yes.
+   If more than 1 in 16 lookups missed, and more than 1 in 4 misses
+   pushed useful origins out to ocacheL2, the cache is too small. */
+static void maybe_grow_OCacheL1 ( void )
+{
+   UWord finds   = stats_ocacheL1_find    - oc_grow_last_find;
+   UWord lossage = stats_ocacheL1_lossage - oc_grow_last_lossage;
+
+   if (oc_n_sets < OC_MAX_SETS
+       && finds < 16 * (UWord)OC_GROW_CHECK_EVERY
+       && 4 * lossage > OC_GROW_CHECK_EVERY) {
+      stats_ocacheL1_grows++;
+      resize_OCacheL1( 2 * oc_n_sets );
+   }
+   oc_grow_last_find    = stats_ocacheL1_find;
+   oc_grow_last_lossage = stats_ocacheL1_lossage;
+   oc_grow_check_at     = stats_ocacheL1_misses + OC_GROW_CHECK_EVERY;
+}
+
+__attribute__((noinline))
+static OCacheLine* find_OCacheLine_SLOW ( Addr a )
+{
+   OCacheLine *set, *inL2;
+   UWord line;
+   UWord tagmask = ~((1 << OC_BITS_PER_LINE) - 1);
+   UWord tag     = a & tagmask;
+
+   if (UNLIKELY(stats_ocacheL1_misses >= oc_grow_check_at))
+      maybe_grow_OCacheL1();
+   set = get_OCacheSet(a);
+
+   /* we already tried line == 0; skip therefore. */
+   for (line = 1; line < oc_lines_per_set; line++) {
+      if (set[line].tag == tag) {
+         if (line == 1) {
+            stats_ocacheL1_found_at_1++;
+         } else {
+            stats_ocacheL1_found_at_N++;
+         }
+         if (UNLIKELY(0 == (ocacheL1_event_ctr++ 
+                            & ((1<<OC_MOVE_FORWARDS_EVERY_BITS)-1)))) {
+            moveLineForwards( set, line );
+            line--;
+         }
+         return &set[line];
+      }
+   }
+
+   /* A miss.  Use the last slot.  Implicitly this means we're
+      ejecting the line in the last slot. */
+   stats_ocacheL1_misses++;
+   tl_assert(line == oc_lines_per_set);
+   line--;
+   tl_assert(line > 0);
+
+   /* First, move the to-be-ejected line to the L2 cache. */
+   write_back_OCacheLine( &set[line] );
 
    /* Now we must reload the L1 cache from the backing tree, if
       possible. */
-   tl_assert(tag != victim->tag); /* stay sane */
+   tl_assert(tag != set[line].tag); /* stay sane */
    inL2 = ocacheL2_find_tag( tag );
    if (inL2) {
       /* We're in luck.  It's in the L2. */
-      ocacheL1->set[setno].line[line] = *inL2;
+      set[line] = *inL2;
    } else {
       /* Missed at both levels of the cache hierarchy.  We have to
          declare it as full of zeroes (unknown origins). */
       stats__ocacheL2_misses++;
-      zeroise_OCacheLine( &ocacheL1->set[setno].line[line], tag );
+      zeroise_OCacheLine( &set[line], tag );
    }
 
    /* Move it one forwards */
-   moveLineForwards( &ocacheL1->set[setno], line );
+   moveLineForwards( set, line );
    line--;
 
-   return &ocacheL1->set[setno].line[line];
+   return &set[line];
 }
 
 static INLINE OCacheLine* find_OCacheLine ( Addr a )
 {
-   UWord setno   = (a >> OC_BITS_PER_LINE) & (OC_N_SETS - 1);
-   UWord tagmask = ~((1 << OC_BITS_PER_LINE) - 1);
-   UWord tag     = a & tagmask;
+   OCacheLine* set     = get_OCacheSet(a);
+   UWord       tagmask = ~((1 << OC_BITS_PER_LINE) - 1);
+   UWord       tag     = a & tagmask;
 
    stats_ocacheL1_find++;
 
    if (OC_ENABLE_ASSERTIONS) {
-      tl_assert(setno >= 0 && setno < OC_N_SETS);
+      tl_assert(set >= ocacheL1
+                && set < ocacheL1 + oc_n_sets * oc_lines_per_set);
       tl_assert(0 == (tag & (4 * OC_W32S_PER_LINE - 1)));
    }
 
-   if (LIKELY(ocacheL1->set[setno].line[0].tag == tag)) {
-      return &ocacheL1->set[setno].line[0];
+   if (LIKELY(set[0].tag == tag)) {
+      return &set[0];
    }
 
    return find_OCacheLine_SLOW( a );
@@ -3400,23 +4198,61 @@ static void VG_REGPARM(1) mc_die_mem_stack_160(Addr new_SP)
 
 /*--------------- adjustment by N bytes ---------------*/
 
+/* The core also calls these for SP changes by a constant it has no
+   specialised handler for, which are mostly bigger frames.  Those that
+   are 8-aligned, a multiple of 8 bytes, and not too big, are done a
+   word at a time like the specialised cases; bigger ones are left to
+   set_address_range_perms, which is quicker for them. */
+#define STACK_WORDWISE_MAX_SZB 512
+
+static INLINE Bool stack_wordwise ( Addr a, SizeT len )
+{
+#  ifdef PERF_FAST_STACK2
+   return len <= STACK_WORDWISE_MAX_SZB && VG_IS_8_ALIGNED(a | len);
+#  else
+   return False;
+#  endif
+}
+
 static void mc_new_mem_stack_w_ECU ( Addr a, SizeT len, UInt ecu )
 {
    UInt otag = ecu | MC_OKIND_STACK;
    PROF_EVENT(MCPE_NEW_MEM_STACK);
-   MC_(make_mem_undefined_w_otag) ( -VG_STACK_REDZONE_SZB + a, len, otag );
+   if (stack_wordwise( -VG_STACK_REDZONE_SZB + a, len )) {
+      SizeT i;
+      for (i = 0; i < len; i += 8)
+         make_aligned_word64_undefined_w_otag ( -VG_STACK_REDZONE_SZB + a+i,
+                                                otag );
+      mark_dirty ( -VG_STACK_REDZONE_SZB + a, len );
+   } else {
+      MC_(make_mem_undefined_w_otag) ( -VG_STACK_REDZONE_SZB + a, len, otag );
+   }
 }
 
 static void mc_new_mem_stack ( Addr a, SizeT len )
 {
    PROF_EVENT(MCPE_NEW_MEM_STACK);
-   make_mem_undefined ( -VG_STACK_REDZONE_SZB + a, len );
+   if (stack_wordwise( -VG_STACK_REDZONE_SZB + a, len )) {
+      SizeT i;
+      for (i = 0; i < len; i += 8)
+         make_aligned_word64_undefined ( -VG_STACK_REDZONE_SZB + a+i );
+      mark_dirty ( -VG_STACK_REDZONE_SZB + a, len );
+   } else {
+      make_mem_undefined ( -VG_STACK_REDZONE_SZB + a, len );
+   }
 }
 
 static void mc_die_mem_stack ( Addr a, SizeT len )
 {
    PROF_EVENT(MCPE_DIE_MEM_STACK);
-   MC_(make_mem_noaccess) ( -VG_STACK_REDZONE_SZB + a, len );
+   if (stack_wordwise( -VG_STACK_REDZONE_SZB + a, len )) {
+      SizeT i;
+      for (i = 0; i < len; i += 8)
+         make_aligned_word64_noaccess ( -VG_STACK_REDZONE_SZB + a+i );
+      mark_dirty ( -VG_STACK_REDZONE_SZB + a, len );
+   } else {
+      MC_(make_mem_noaccess) ( -VG_STACK_REDZONE_SZB + a, len );
+   }
 }
 
 
@@ -3535,6 +4371,7 @@ void MC_(helperc_MAKE_STACK_UNINIT_w_o) ( Addr base, UWord len, Addr nia )
    if (0)
       VG_(printf)("helperc_MAKE_STACK_UNINIT_w_o (%#lx,%lu,nia=%#lx)\n",
                   base, len, nia );
+   mark_dirty(base, len);
 
    UInt ecu = convert_nia_to_ecu ( nia );
    tl_assert(VG_(is_plausible_ECU)(ecu));
@@ -3737,6 +4574,7 @@ void MC_(helperc_MAKE_STACK_UNINIT_no_o) ( Addr base, UWord len )
    if (0)
       VG_(printf)("helperc_MAKE_STACK_UNINIT_no_o (%#lx,%lu)\n",
                   base, len );
+   mark_dirty(base, len);
 
 #  if 0
    /* Slow(ish) version, which is fairly easily seen to be correct.
@@ -3881,6 +4719,7 @@ void MC_(helperc_MAKE_STACK_UNINIT_128_no_o) ( Addr base )
    PROF_EVENT(MCPE_MAKE_STACK_UNINIT_128_NO_O);
    if (0)
       VG_(printf)("helperc_MAKE_STACK_UNINIT_128_no_o (%#lx)\n", base );
+   mark_dirty(base, 128);
 
 #  if 0
    /* Slow(ish) version, which is fairly easily seen to be correct.
@@ -4071,6 +4910,18 @@ static MC_ReadResult is_mem_defined ( Addr a, SizeT len,
    if (otag)     *otag = 0;
    if (bad_addr) *bad_addr = 0;
    for (i = 0; i < len; i++) {
+#     ifdef PERF_FAST_BULK
+      if (VG_IS_4_ALIGNED(a) && len - i >= 16) {
+         /* Skip over any run of wholly defined words. */
+         SizeT n = count_vabits8_run(a, (len - i) / 4, VA_BITS8_DEFINED);
+         PROF_EVENT(MCPE_IS_MEM_DEFINED_BULK);
+         if (n > 0) {
+            a += 4*n;
+            i += 4*n - 1;
+            continue;
+         }
+      }
+#     endif
       PROF_EVENT(MCPE_IS_MEM_DEFINED_LOOP);
       vabits2 = get_vabits2(a);
       if (VA_BITS2_DEFINED != vabits2) {
@@ -4333,6 +5184,7 @@ static
 void mc_new_mem_mmap ( Addr a, SizeT len, Bool rr, Bool ww, Bool xx,
                        ULong di_handle )
 {
+   MC_(maybe_compress_secmaps)();
    if (rr || ww || xx) {
       /* (2) mmap/mprotect other -> defined */
       MC_(make_mem_defined)(a, len);
@@ -4345,6 +5197,9 @@ void mc_new_mem_mmap ( Addr a, SizeT len, Bool rr, Bool ww, Bool xx,
 static
 void mc_new_mem_mprotect ( Addr a, SizeT len, Bool rr, Bool ww, Bool xx )
 {
+   /* Whether or not the V+A bits change, the leak checker may no
+      longer be able to read the memory, or now be able to. */
+   mark_dirty(a, len);
    if (rr || ww || xx) {
       /* (4) mprotect other  ->  change any "noaccess" to "defined" */
       make_mem_defined_if_noaccess(a, len);
@@ -5544,6 +6399,60 @@ UWord MC_(helperc_LOADV8) ( Addr a )
 }
 #endif
 
+/*------------------------------------------------------------*/
+/*--- LOADV_RANGE_DEFINED                                  ---*/
+/*------------------------------------------------------------*/
+
+/* Called once for a group of loads in the same superblock which
+   mc_translate.c has found to fall within a few dozen bytes of each
+   other (see "Coalescing shadow loads" there).  Returns 1 if all of
+   [a, a+len) is known to be addressable and defined, in which case
+   the loads' own LOADV helpers need not be called at all, and 0 if
+   they have to be.  A 0 is only ever a missed opportunity, so
+   anything awkward -- the range straddling two secondaries, being
+   above MAX_PRIMARY_ADDRESS, or not being all defined -- just gives
+   0, and the per-access helpers then do the real work, including any
+   error reporting. */
+VG_REGPARM(2)
+UWord MC_(helperc_LOADV_RANGE_DEFINED) ( Addr a, UWord len )
+{
+   PROF_EVENT(MCPE_LOADV_RANGE);
+
+#ifndef PERF_FAST_LOADV
+   return 0;
+#else
+   {
+      Addr    last = a + len - 1;
+      SecMap* sm;
+      UWord   sm_off, sm_off_last;
+
+      if (UNLIKELY(len == 0 || last < a || last > MAX_PRIMARY_ADDRESS
+                   || start_of_this_sm(a) != start_of_this_sm(last))) {
+         PROF_EVENT(MCPE_LOADV_RANGE_SLOW1);
+         return 0;
+      }
+
+      sm = get_secmap_for_reading_low(a);
+      if (LIKELY(sm == &sm_distinguished[SM_DIST_DEFINED]))
+         return 1;
+
+      /* Each vabits8 covers an aligned 4 bytes, so this also looks at
+         up to 3 bytes either side of the range.  That can only make
+         the answer 0 when it need not be.  SM_COMPRESSED is full of
+         VA_BITS2_PARTDEFINED, so it always fails here. */
+      sm_off      = SM_OFF(a);
+      sm_off_last = SM_OFF(last);
+      for (; sm_off <= sm_off_last; sm_off++) {
+         if (sm->vabits8[sm_off] != VA_BITS8_DEFINED) {
+            PROF_EVENT(MCPE_LOADV_RANGE_SLOW2);
+            return 0;
+         }
+      }
+      return 1;
+   }
+#endif
+}
+
 /*------------------------------------------------------------*/
 /*--- STOREV8                                              ---*/
 /*------------------------------------------------------------*/
@@ -5801,6 +6710,32 @@ Bool MC_(is_valid_aligned_word) ( Addr a )
       return True;
 }
 
+/* For the memory leak detector: how many of the nwords words starting
+   at a are valid, in the sense of MC_(is_valid_aligned_word), before
+   the first one that isn't?  The answer may stop short at the end of
+   a's secondary map, so it is only 0 if the word at a is invalid. */
+SizeT MC_(count_valid_aligned_words) ( Addr a, SizeT nwords )
+{
+   const SizeT vabits8_per_word = sizeof(UWord) / 4;
+   SizeT       n;
+
+   tl_assert(VG_IS_WORD_ALIGNED(a));
+   n = count_vabits8_run(a, nwords * vabits8_per_word, VA_BITS8_DEFINED)
+       / vabits8_per_word;
+   if (n > 0 && UNLIKELY(gIgnoredAddressRanges != NULL)) {
+      UWord how     = IAR_INVALID;
+      UWord key_min = ~(UWord)0;
+      UWord key_max =  (UWord)0;
+      VG_(lookupRangeMap)(&key_min, &key_max, &how, gIgnoredAddressRanges, a);
+      tl_assert(key_min <= a && a <= key_max);
+      if (how != IAR_NotIgnored)
+         return 0;
+      if ((key_max - a) / sizeof(UWord) < n)
+         n = (key_max - a) / sizeof(UWord) + 1;
+   }
+   return n;
+}
+
 
 /*------------------------------------------------------------*/
 /*--- Initialisation                                       ---*/
@@ -5826,6 +6761,11 @@ static void init_shadow_memory ( void )
    sm = &sm_distinguished[SM_DIST_DEFINED];
    for (i = 0; i < SM_CHUNKS; i++) sm->vabits8[i] = VA_BITS8_DEFINED;
 
+   /* And the marker for compressed secondaries */
+   sm = SM_COMPRESSED;
+   for (i = 0; i < SM_CHUNKS; i++) sm->vabits8[i] = 0xFF;
+   csm_table = VG_(HT_construct)( "MC_(csm_table)" );
+
    /* Set up the primary map. */
    /* These entries gradually get overwritten as the used address
       space expands. */
@@ -5839,7 +6779,7 @@ static void init_shadow_memory ( void )
       no ... these are statically initialised */
 
    /* Secondary V bit table */
-   secVBitTable = createSecVBitTable();
+   alloc_secVBitTable(SEC_VBIT_MIN_SLOTS);
 }
 
 
@@ -5896,6 +6836,12 @@ static Bool mc_expensive_sanity_check ( void )
       if (sm->vabits8[i] != VA_BITS8_DEFINED)
          bad = True;
 
+   /* Check the compressed SM marker. */
+   sm = SM_COMPRESSED;
+   for (i = 0; i < SM_CHUNKS; i++)
+      if (sm->vabits8[i] != 0xFF)
+         bad = True;
+
    if (bad) {
       VG_(printf)("memcheck expensive sanity: "
                   "distinguished_secondaries have changed\n");
@@ -5905,7 +6851,7 @@ static Bool mc_expensive_sanity_check ( void )
    /* If we're not checking for undefined value errors, the secondary V bit
     * table should be empty. */
    if (MC_(clo_mc_level) == 1) {
-      if (0 != VG_(OSetGen_Size)(secVBitTable))
+      if (0 != n_secVBit_nodes)
          return False;
    }
 
@@ -5933,6 +6879,8 @@ static Bool mc_expensive_sanity_check ( void )
       are reachable (iow, no secmap leaks) */
    if (n_secmaps_found != (n_issued_SMs - n_deissued_SMs))
       bad = True;
+   if (VG_(HT_count_nodes)(csm_table) != n_compressed_SMs)
+      bad = True;
 
    if (bad) {
       VG_(printf)("memcheck expensive sanity: "
@@ -5976,6 +6924,11 @@ KeepStacktraces MC_(clo_keep_stacktraces)     = KS_alloc_and_free;
 Int           MC_(clo_mc_level)               = 2;
 Bool          MC_(clo_show_mismatched_frees)  = True;
 Bool          MC_(clo_expensive_definedness_checks) = False;
+Bool          MC_(clo_shadow_compression)     = False;
+Int           MC_(clo_origin_cache_sets)      = 1 << 20;
+Int           MC_(clo_origin_cache_ways)      = 2;
+Bool          MC_(clo_origin_cache_grow)      = False;
+Bool          MC_(clo_incremental_leak_check) = False;
 
 static const HChar * MC_(parse_leak_heuristics_tokens) =
    "-,stdstring,length64,newarray,multipleinheritance";
@@ -6124,6 +7077,16 @@ static Bool mc_process_cmd_line_options(const HChar* arg)
                        MC_(clo_show_mismatched_frees)) {}
    else if VG_BOOL_CLO(arg, "--expensive-definedness-checks",
                        MC_(clo_expensive_definedness_checks)) {}
+   else if VG_BOOL_CLO(arg, "--shadow-compression",
+                       MC_(clo_shadow_compression)) {}
+   else if VG_BINT_CLO(arg, "--origin-cache-sets",
+                       MC_(clo_origin_cache_sets), 1024, OC_MAX_SETS) {}
+   else if VG_BINT_CLO(arg, "--origin-cache-ways",
+                       MC_(clo_origin_cache_ways), 2, 8) {}
+   else if VG_BOOL_CLO(arg, "--origin-cache-grow",
+                       MC_(clo_origin_cache_grow)) {}
+   else if VG_BOOL_CLO(arg, "--incremental-leak-check",
+                       MC_(clo_incremental_leak_check)) {}
 
    else
       return VG_(replacement_malloc_process_cmd_line_option)(arg);
@@ -6156,8 +7119,12 @@ static void mc_print_usage(void)
 "                                     same as --show-leak-kinds=definite,possible\n"
 "    --show-reachable=no --show-possibly-lost=no\n"
 "                                     same as --show-leak-kinds=definite\n"
+"    --incremental-leak-check=no|yes  reuse unchanged memory's leak scan? [no]\n"
 "    --undef-value-errors=no|yes      check for undefined value errors [yes]\n"
 "    --track-origins=no|yes           show origins of undefined values? [no]\n"
+"    --origin-cache-sets=<number>     sets in the origin cache [1048576]\n"
+"    --origin-cache-ways=<number>     lines per origin cache set, 2..8 [2]\n"
+"    --origin-cache-grow=no|yes       grow the origin cache if it thrashes? [no]\n"
 "    --partial-loads-ok=no|yes        too hard to explain here; see manual [yes]\n"
 "    --expensive-definedness-checks=no|yes\n"
 "                                     Use extra-precise definedness tracking [no]\n"
@@ -6170,6 +7137,7 @@ static void mc_print_usage(void)
 "    --keep-stacktraces=alloc|free|alloc-and-free|alloc-then-free|none\n"
 "        stack trace(s) to keep for malloc'd/free'd areas       [alloc-and-free]\n"
 "    --show-mismatched-frees=no|yes   show frees that don't match the allocator? [yes]\n"
+"    --shadow-compression=no|yes      compress uniform shadow memory? [no]\n"
    );
 }
 
@@ -7108,8 +8076,9 @@ static Bool mc_handle_client_request ( ThreadId tid, UWord* arg, UWord* ret )
       case VG_USERREQ__ENABLE_ADDR_ERROR_REPORTING_IN_RANGE: {
          Bool addRange
             = arg[0] == VG_USERREQ__DISABLE_ADDR_ERROR_REPORTING_IN_RANGE;
-         Bool ok
-            = modify_ignore_ranges(addRange, arg[1], arg[2]);
+         Bool ok;
+         mark_dirty(arg[1], arg[2]);
+         ok = modify_ignore_ranges(addRange, arg[1], arg[2]);
          *ret = ok ? 1 : 0;
          return True;
       }
@@ -7165,12 +8134,14 @@ static const HChar* MC_(event_ctr_name)[MCPE_LAST] = {
    [MCPE_COPY_ADDRESS_RANGE_STATE] = "copy_address_range_state",
    [MCPE_COPY_ADDRESS_RANGE_STATE_LOOP1] = "copy_address_range_state(loop1)",
    [MCPE_COPY_ADDRESS_RANGE_STATE_LOOP2] = "copy_address_range_state(loop2)",
+   [MCPE_COPY_ADDRESS_RANGE_STATE_BULK] = "copy_address_range_state(bulk)",
    [MCPE_CHECK_MEM_IS_NOACCESS] = "check_mem_is_noaccess",
    [MCPE_CHECK_MEM_IS_NOACCESS_LOOP] = "check_mem_is_noaccess(loop)",
    [MCPE_IS_MEM_ADDRESSABLE] = "is_mem_addressable",
    [MCPE_IS_MEM_ADDRESSABLE_LOOP] = "is_mem_addressable(loop)",
    [MCPE_IS_MEM_DEFINED] = "is_mem_defined",
    [MCPE_IS_MEM_DEFINED_LOOP] = "is_mem_defined(loop)",
+   [MCPE_IS_MEM_DEFINED_BULK] = "is_mem_defined(bulk)",
    [MCPE_IS_MEM_DEFINED_COMPREHENSIVE] = "is_mem_defined_comprehensive",
    [MCPE_IS_MEM_DEFINED_COMPREHENSIVE_LOOP] =
         "is_mem_defined_comprehensive(loop)",
@@ -7232,6 +8203,9 @@ static const HChar* MC_(event_ctr_name)[MCPE_LAST] = {
    [MCPE_LOADV8]         = "LOADV8",
    [MCPE_LOADV8_SLOW1]   = "LOADV8-slow1",
    [MCPE_LOADV8_SLOW2]   = "LOADV8-slow2",
+   [MCPE_LOADV_RANGE]       = "LOADV_RANGE",
+   [MCPE_LOADV_RANGE_SLOW1] = "LOADV_RANGE-slow1",
+   [MCPE_LOADV_RANGE_SLOW2] = "LOADV_RANGE-slow2",
    [MCPE_STOREV8]        = "STOREV8",
    [MCPE_STOREV8_SLOW1]  = "STOREV8-slow1",
    [MCPE_STOREV8_SLOW2]  = "STOREV8-slow2",
@@ -7671,38 +8645,69 @@ static void mc_post_clo_init ( void )
 
    tl_assert( MC_(clo_mc_level) >= 1 && MC_(clo_mc_level) <= 3 );
 
+   /* Origin tracking embeds ExeContext uniques in the generated code,
+      and incremental leak checking the address of MC_(dirty_secmaps),
+      and those differ from run to run. */
+   if (MC_(clo_mc_level) < 3 && !MC_(clo_incremental_leak_check))
+      VG_(needs_cacheable_translations)();
+
+   /* The specialised stack handlers change V+A bits directly, without
+      telling the leak checker's change tracking.  So with incremental
+      leak checking, only the general ones are used. */
+   if (MC_(clo_incremental_leak_check))
+      init_dirty_secmaps();
+
    if (MC_(clo_mc_level) == 3) {
       /* We're doing origin tracking. */
 #     ifdef PERF_FAST_STACK
-      VG_(track_new_mem_stack_4_w_ECU)   ( mc_new_mem_stack_4_w_ECU   );
-      VG_(track_new_mem_stack_8_w_ECU)   ( mc_new_mem_stack_8_w_ECU   );
-      VG_(track_new_mem_stack_12_w_ECU)  ( mc_new_mem_stack_12_w_ECU  );
-      VG_(track_new_mem_stack_16_w_ECU)  ( mc_new_mem_stack_16_w_ECU  );
-      VG_(track_new_mem_stack_32_w_ECU)  ( mc_new_mem_stack_32_w_ECU  );
-      VG_(track_new_mem_stack_112_w_ECU) ( mc_new_mem_stack_112_w_ECU );
-      VG_(track_new_mem_stack_128_w_ECU) ( mc_new_mem_stack_128_w_ECU );
-      VG_(track_new_mem_stack_144_w_ECU) ( mc_new_mem_stack_144_w_ECU );
-      VG_(track_new_mem_stack_160_w_ECU) ( mc_new_mem_stack_160_w_ECU );
+      if (!MC_(clo_incremental_leak_check)) {
+         VG_(track_new_mem_stack_4_w_ECU)   ( mc_new_mem_stack_4_w_ECU   );
+         VG_(track_new_mem_stack_8_w_ECU)   ( mc_new_mem_stack_8_w_ECU   );
+         VG_(track_new_mem_stack_12_w_ECU)  ( mc_new_mem_stack_12_w_ECU  );
+         VG_(track_new_mem_stack_16_w_ECU)  ( mc_new_mem_stack_16_w_ECU  );
+         VG_(track_new_mem_stack_32_w_ECU)  ( mc_new_mem_stack_32_w_ECU  );
+         VG_(track_new_mem_stack_112_w_ECU) ( mc_new_mem_stack_112_w_ECU );
+         VG_(track_new_mem_stack_128_w_ECU) ( mc_new_mem_stack_128_w_ECU );
+         VG_(track_new_mem_stack_144_w_ECU) ( mc_new_mem_stack_144_w_ECU );
+         VG_(track_new_mem_stack_160_w_ECU) ( mc_new_mem_stack_160_w_ECU );
+      }
 #     endif
       VG_(track_new_mem_stack_w_ECU)     ( mc_new_mem_stack_w_ECU     );
       VG_(track_new_mem_stack_signal)    ( mc_new_mem_w_tid_make_ECU );
    } else {
       /* Not doing origin tracking */
 #     ifdef PERF_FAST_STACK
-      VG_(track_new_mem_stack_4)   ( mc_new_mem_stack_4   );
-      VG_(track_new_mem_stack_8)   ( mc_new_mem_stack_8   );
-      VG_(track_new_mem_stack_12)  ( mc_new_mem_stack_12  );
-      VG_(track_new_mem_stack_16)  ( mc_new_mem_stack_16  );
-      VG_(track_new_mem_stack_32)  ( mc_new_mem_stack_32  );
-      VG_(track_new_mem_stack_112) ( mc_new_mem_stack_112 );
-      VG_(track_new_mem_stack_128) ( mc_new_mem_stack_128 );
-      VG_(track_new_mem_stack_144) ( mc_new_mem_stack_144 );
-      VG_(track_new_mem_stack_160) ( mc_new_mem_stack_160 );
+      if (!MC_(clo_incremental_leak_check)) {
+         VG_(track_new_mem_stack_4)   ( mc_new_mem_stack_4   );
+         VG_(track_new_mem_stack_8)   ( mc_new_mem_stack_8   );
+         VG_(track_new_mem_stack_12)  ( mc_new_mem_stack_12  );
+         VG_(track_new_mem_stack_16)  ( mc_new_mem_stack_16  );
+         VG_(track_new_mem_stack_32)  ( mc_new_mem_stack_32  );
+         VG_(track_new_mem_stack_112) ( mc_new_mem_stack_112 );
+         VG_(track_new_mem_stack_128) ( mc_new_mem_stack_128 );
+         VG_(track_new_mem_stack_144) ( mc_new_mem_stack_144 );
+         VG_(track_new_mem_stack_160) ( mc_new_mem_stack_160 );
+      }
 #     endif
       VG_(track_new_mem_stack)     ( mc_new_mem_stack     );
       VG_(track_new_mem_stack_signal) ( mc_new_mem_w_tid_no_ECU );
    }
 
+#  ifdef PERF_FAST_STACK
+   if (!MC_(clo_incremental_leak_check)) {
+      VG_(track_die_mem_stack_4)     ( mc_die_mem_stack_4   );
+      VG_(track_die_mem_stack_8)     ( mc_die_mem_stack_8   );
+      VG_(track_die_mem_stack_12)    ( mc_die_mem_stack_12  );
+      VG_(track_die_mem_stack_16)    ( mc_die_mem_stack_16  );
+      VG_(track_die_mem_stack_32)    ( mc_die_mem_stack_32  );
+      VG_(track_die_mem_stack_112)   ( mc_die_mem_stack_112 );
+      VG_(track_die_mem_stack_128)   ( mc_die_mem_stack_128 );
+      VG_(track_die_mem_stack_144)   ( mc_die_mem_stack_144 );
+      VG_(track_die_mem_stack_160)   ( mc_die_mem_stack_160 );
+   }
+#  endif
+   VG_(track_die_mem_stack)       ( mc_die_mem_stack     );
+
    // We assume that brk()/sbrk() does not initialise new memory.  Is this
    // accurate?  John Reiser says:
    //
@@ -7828,27 +8833,33 @@ static void mc_print_stats (void)
    print_SM_info("max_undefined", max_undefined_SMs);
    print_SM_info("max_defined  ", max_defined_SMs);
    print_SM_info("max_non_DSM  ", max_non_DSM_SMs);
-
-   // Three DSMs, plus the non-DSM ones
-   max_SMs_szB = (3 + max_non_DSM_SMs) * sizeof(SecMap);
-   // The 3*sizeof(Word) bytes is the AVL node metadata size.
-   // The VG_ROUNDUP is because the OSet pool allocator will/must align
-   // the elements on pointer size.
-   // Note that the pool allocator has some additional small overhead
-   // which is not counted in the below.
-   // Hardwiring this logic sucks, but I don't see how else to do it.
-   max_secVBit_szB = max_secVBit_nodes * 
-         (3*sizeof(Word) + VG_ROUNDUP(sizeof(SecVBitNode), sizeof(void*)));
+   VG_(message)(Vg_DebugMsg,
+      " memcheck: SMs: compressed = %d, max %d (%luk); "
+      "%llu compressions, %llu expansions, %llu sweeps\n",
+      n_compressed_SMs, max_compressed_SMs,
+      max_compressed_SMs * sizeof(CSecMap) / 1024UL,
+      n_csm_compressions, n_csm_expansions, n_csm_sweeps );
+
+   // Four DSMs, plus the non-DSM ones, plus the compressed ones
+   max_SMs_szB = (4 + max_non_DSM_SMs) * sizeof(SecMap)
+                 + max_compressed_SMs * sizeof(CSecMap);
+   // The sec V bit table's nodes are stored in its slots.
+   max_secVBit_szB = max_secVBit_slots * sizeof(SecVBitNode);
    max_shmem_szB   = sizeof(primary_map) + max_SMs_szB + max_secVBit_szB;
 
    VG_(message)(Vg_DebugMsg,
-      " memcheck: max sec V bit nodes:    %d (%luk, %luM)\n",
-      max_secVBit_nodes, max_secVBit_szB / 1024,
+      " memcheck: max sec V bit nodes:    %d in %lu slots (%luk, %luM)\n",
+      max_secVBit_nodes, max_secVBit_slots, max_secVBit_szB / 1024,
                          max_secVBit_szB / (1024 * 1024));
    VG_(message)(Vg_DebugMsg,
       " memcheck: set_sec_vbits8 calls: %llu (new: %llu, updates: %llu)\n",
       sec_vbits_new_nodes + sec_vbits_updates,
       sec_vbits_new_nodes, sec_vbits_updates );
+   VG_(message)(Vg_DebugMsg,
+      " memcheck: sec V bit nodes removed: %llu cleared, %llu swept;"
+      " %llu resizes, %d nodes now\n",
+      sec_vbits_cleared, sec_vbits_swept, sec_vbits_resizes,
+      n_secVBit_nodes );
    VG_(message)(Vg_DebugMsg,
       " memcheck: max shadow mem size:   %luk, %luM\n",
       max_shmem_szB / 1024, max_shmem_szB / (1024 * 1024));
@@ -7870,9 +8881,12 @@ static void mc_print_stats (void)
                    stats_ocacheL1_found_at_N,
                    stats_ocacheL1_movefwds );
       VG_(message)(Vg_DebugMsg,
-                   " ocacheL1: %'12lu sizeB  %'12d useful\n",
-                   (SizeT)sizeof(OCache),
-                   4 * OC_W32S_PER_LINE * OC_LINES_PER_SET * OC_N_SETS );
+                   " ocacheL1: %'12lu sizeB  %'12lu useful\n",
+                   sizeof_OCacheL1(),
+                   4 * OC_W32S_PER_LINE * oc_lines_per_set * oc_n_sets );
+      VG_(message)(Vg_DebugMsg,
+                   " ocacheL1: %'12lu sets   %'12lu ways   (%'lu grows)\n",
+                   oc_n_sets, oc_lines_per_set, stats_ocacheL1_grows );
       VG_(message)(Vg_DebugMsg,
                    " ocacheL2: %'12lu refs   %'12lu misses\n",
                    stats__ocacheL2_refs, 
@@ -7881,6 +8895,11 @@ static void mc_print_stats (void)
                    " ocacheL2:    %'9lu max nodes %'9lu curr nodes\n",
                    stats__ocacheL2_n_nodes_max,
                    stats__ocacheL2_n_nodes );
+      VG_(message)(Vg_DebugMsg,
+                   " ocacheL2: %'12lu slots  %'12lu probes  %'lu resizes\n",
+                   ocacheL2->n_slots,
+                   stats__ocacheL2_probes,
+                   stats__ocacheL2_resizes );
       VG_(message)(Vg_DebugMsg,
                    " niacache: %'12lu refs   %'12lu misses\n",
                    stats__nia_cache_queries, stats__nia_cache_misses);
@@ -8058,22 +9077,9 @@ static void mc_pre_clo_init(void)
    VG_(track_die_mem_brk)         ( MC_(make_mem_noaccess) );
    VG_(track_die_mem_munmap)      ( MC_(make_mem_noaccess) ); 
 
-   /* Defer the specification of the new_mem_stack functions to the
-      post_clo_init function, since we need to first parse the command
-      line before deciding which set to use. */
-
-#  ifdef PERF_FAST_STACK
-   VG_(track_die_mem_stack_4)     ( mc_die_mem_stack_4   );
-   VG_(track_die_mem_stack_8)     ( mc_die_mem_stack_8   );
-   VG_(track_die_mem_stack_12)    ( mc_die_mem_stack_12  );
-   VG_(track_die_mem_stack_16)    ( mc_die_mem_stack_16  );
-   VG_(track_die_mem_stack_32)    ( mc_die_mem_stack_32  );
-   VG_(track_die_mem_stack_112)   ( mc_die_mem_stack_112 );
-   VG_(track_die_mem_stack_128)   ( mc_die_mem_stack_128 );
-   VG_(track_die_mem_stack_144)   ( mc_die_mem_stack_144 );
-   VG_(track_die_mem_stack_160)   ( mc_die_mem_stack_160 );
-#  endif
-   VG_(track_die_mem_stack)       ( mc_die_mem_stack     );
+   /* Defer the specification of the new_mem_stack and die_mem_stack
+      functions to the post_clo_init function, since we need to first
+      parse the command line before deciding which set to use. */
    
    VG_(track_ban_mem_stack)       ( MC_(make_mem_noaccess) );
 
@@ -81,45 +81,121 @@ static inline
 void delete_MC_Chunk (MC_Chunk* mc);
 
 /* Records blocks after freeing. */
-/* Blocks freed by the client are queued in one of two lists of
+/* Blocks freed by the client are queued in one of two queues of
    freed blocks not yet physically freed:
-   "big blocks" freed list.
-   "small blocks" freed list
+   "big blocks" freed queue.
+   "small blocks" freed queue
    The blocks with a size >= MC_(clo_freelist_big_blocks)
-   are linked in the big blocks freed list.
+   are put in the big blocks freed queue.
    This allows a client to allocate and free big blocks
    (e.g. bigger than VG_(clo_freelist_vol)) without losing
    immediately all protection against dangling pointers.
-   position [0] is for big blocks, [1] is for small blocks. */
-static MC_Chunk* freed_list_start[2]  = {NULL, NULL};
-static MC_Chunk* freed_list_end[2]    = {NULL, NULL};
+   position [0] is for big blocks, [1] is for small blocks.
+
+   The MC_Chunk of a freed block is not kept: all that is needed later
+   is the block's extent, how to release it, and the stack traces for
+   error messages, which are recorded by their ECU.  Each queue is a
+   ring buffer of these records, doubled in size when it fills up, so
+   a large --freelist-vol costs 16 or 24 bytes of metadata per queued
+   block.  The block's memory itself stays noaccess until released. */
+typedef
+   struct {
+      Addr         data;
+      SizeT        szB : (sizeof(SizeT)*8)-2;
+      MC_AllocKind allockind : 2;
+      UInt         alloc_ecu;   // 0 if not recorded
+      UInt         freed_ecu;   // 0 if not recorded
+   }
+   FreedBlock;
+
+typedef
+   struct {
+      FreedBlock* ring;
+      UWord       size;     // 0 or a power of 2
+      UWord       head;     // index of the oldest block
+      UWord       used;
+   }
+   FreedQueue;
+
+static FreedQueue freed_queue[2];
+
+static inline FreedBlock* freed_queue_nth ( FreedQueue* q, UWord n )
+{
+   return &q->ring[(q->head + n) & (q->size - 1)];
+}
+
+static void grow_freed_queue ( FreedQueue* q )
+{
+   UWord       i;
+   UWord       new_size = q->size == 0 ? 64 : 2 * q->size;
+   FreedBlock* new_ring = VG_(malloc)("mc.gfq.1",
+                                      new_size * sizeof(FreedBlock));
+   for (i = 0; i < q->used; i++)
+      new_ring[i] = *freed_queue_nth(q, i);
+   if (q->ring)
+      VG_(free)(q->ring);
+   q->ring = new_ring;
+   q->size = new_size;
+   q->head = 0;
+}
 
-/* Put a shadow chunk on the freed blocks queue, possibly freeing up
-   some of the oldest blocks in the queue at the same time. */
+static inline UInt ecu_of ( ExeContext* ec )
+{
+   return ec == NULL ? 0 : VG_(get_ECU_from_ExeContext)(ec);
+}
+
+static ExeContext* ec_of ( UInt ecu )
+{
+   ExeContext* ec = ecu == 0 ? NULL : VG_(get_ExeContext_from_ECU)(ecu);
+   return ec == NULL ? VG_(null_ExeContext)() : ec;
+}
+
+/* Put a freed block on the freed blocks queue, and discard its shadow
+   chunk.  The oldest blocks in the queue are released when the next
+   block is allocated. */
 static void add_to_freed_queue ( MC_Chunk* mc )
 {
-   const Bool show = False;
-   const int l = (mc->szB >= MC_(clo_freelist_big_blocks) ? 0 : 1);
+   const Bool  show = False;
+   const int   l    = (mc->szB >= MC_(clo_freelist_big_blocks) ? 0 : 1);
+   FreedQueue* q    = &freed_queue[l];
+   FreedBlock* fb;
+
+   if (q->used == q->size)
+      grow_freed_queue(q);
 
-   /* Put it at the end of the freed list, unless the block
+   /* Put it at the end of the freed queue, unless the block
       would be directly released any way : in this case, we
-      put it at the head of the freed list. */
-   if (freed_list_end[l] == NULL) {
-      tl_assert(freed_list_start[l] == NULL);
-      mc->next = NULL;
-      freed_list_end[l]    = freed_list_start[l] = mc;
+      put it at the head of the freed queue. */
+   if (q->used > 0 && mc->szB >= MC_(clo_freelist_vol)) {
+      q->head = (q->head - 1) & (q->size - 1);
+      fb = freed_queue_nth(q, 0);
    } else {
-      tl_assert(freed_list_end[l]->next == NULL);
-      if (mc->szB >= MC_(clo_freelist_vol)) {
-         mc->next = freed_list_start[l];
-         freed_list_start[l] = mc;
-      } else {
-         mc->next = NULL;
-         freed_list_end[l]->next = mc;
-         freed_list_end[l]       = mc;
-      }
+      fb = freed_queue_nth(q, q->used);
    }
-   VG_(free_queue_volume) += (Long)mc->szB;
+   q->used++;
+
+   fb->data      = mc->data;
+   fb->szB       = mc->szB;
+   fb->allockind = mc->allockind;
+   /* The block is no longer live, so pick the stack traces the way
+      MC_(allocated_at) and MC_(freed_at) would for a freed block. */
+   switch (MC_(clo_keep_stacktraces)) {
+      case KS_none:
+         fb->alloc_ecu = fb->freed_ecu = 0; break;
+      case KS_alloc:
+         fb->alloc_ecu = ecu_of(mc->where[0]); fb->freed_ecu = 0; break;
+      case KS_free:
+      case KS_alloc_then_free:
+         fb->alloc_ecu = 0; fb->freed_ecu = ecu_of(mc->where[0]); break;
+      case KS_alloc_and_free:
+         fb->alloc_ecu = ecu_of(mc->where[0]);
+         fb->freed_ecu = ecu_of(mc->where[1]);
+         break;
+      default: tl_assert (0);
+   }
+   delete_MC_Chunk ( mc );
+
+   VG_(free_queue_volume) += (Long)fb->szB;
    if (show)
       VG_(printf)("mc_freelist: acquire: volume now %lld\n", 
                   VG_(free_queue_volume));
@@ -128,7 +204,7 @@ static void add_to_freed_queue ( MC_Chunk* mc )
 
 /* Release enough of the oldest blocks to bring the free queue
    volume below vg_clo_freelist_vol. 
-   Start with big block list first.
+   Start with big block queue first.
    On entry, VG_(free_queue_volume) must be > MC_(clo_freelist_vol).
    On exit, VG_(free_queue_volume) will be <= MC_(clo_freelist_vol). */
 static void release_oldest_block(void)
@@ -136,52 +212,51 @@ static void release_oldest_block(void)
    const Bool show = False;
    int i;
    tl_assert (VG_(free_queue_volume) > MC_(clo_freelist_vol));
-   tl_assert (freed_list_start[0] != NULL || freed_list_start[1] != NULL);
+   tl_assert (freed_queue[0].used > 0 || freed_queue[1].used > 0);
 
    for (i = 0; i < 2; i++) {
+      FreedQueue* q = &freed_queue[i];
       while (VG_(free_queue_volume) > MC_(clo_freelist_vol)
-             && freed_list_start[i] != NULL) {
-         MC_Chunk* mc1;
+             && q->used > 0) {
+         FreedBlock* fb = freed_queue_nth(q, 0);
 
-         tl_assert(freed_list_end[i] != NULL);
-         
-         mc1 = freed_list_start[i];
-         VG_(free_queue_volume) -= (Long)mc1->szB;
+         VG_(free_queue_volume) -= (Long)fb->szB;
          VG_(free_queue_length)--;
          if (show)
             VG_(printf)("mc_freelist: discard: volume now %lld\n", 
                         VG_(free_queue_volume));
          tl_assert(VG_(free_queue_volume) >= 0);
-         
-         if (freed_list_start[i] == freed_list_end[i]) {
-            freed_list_start[i] = freed_list_end[i] = NULL;
-         } else {
-            freed_list_start[i] = mc1->next;
-         }
-         mc1->next = NULL; /* just paranoia */
 
-         /* free MC_Chunk */
-         if (MC_AllocCustom != mc1->allockind)
-            VG_(cli_free) ( (void*)(mc1->data) );
-         delete_MC_Chunk ( mc1 );
+         q->head = (q->head + 1) & (q->size - 1);
+         q->used--;
+
+         if (MC_AllocCustom != fb->allockind)
+            VG_(cli_free) ( (void*)(fb->data) );
       }
    }
 }
 
-MC_Chunk* MC_(get_freed_block_bracketting) (Addr a)
+Bool MC_(get_freed_block_bracketting) (Addr a, /*OUT*/MC_FreedBlockInfo* res)
 {
    int i;
    for (i = 0; i < 2; i++) {
-      MC_Chunk*  mc;
-      mc = freed_list_start[i];
-      while (mc) {
-         if (VG_(addr_is_in_block)( a, mc->data, mc->szB,
-                                    MC_(Malloc_Redzone_SzB) ))
-            return mc;
-         mc = mc->next;
+      FreedQueue* q = &freed_queue[i];
+      UWord       n;
+      for (n = 0; n < q->used; n++) {
+         const FreedBlock* fb = freed_queue_nth(q, n);
+         if (VG_(addr_is_in_block)( a, fb->data, fb->szB,
+                                    MC_(Malloc_Redzone_SzB) )) {
+            if (res) {
+               res->data         = fb->data;
+               res->szB          = fb->szB;
+               res->allocated_at = ec_of(fb->alloc_ecu);
+               res->freed_at     = ec_of(fb->freed_ecu);
+            }
+            return True;
+         }
       }
    }
-   return NULL;
+   return False;
 }
 
 /* Allocate a shadow chunk, put it on the appropriate list.
@@ -342,6 +417,8 @@ void* MC_(new_block) ( ThreadId tid,
 {
    MC_Chunk* mc;
 
+   MC_(maybe_compress_secmaps)();
+
    // Allocate and zero if necessary
    if (p) {
       tl_assert(MC_AllocCustom == kind);
@@ -444,7 +521,7 @@ void die_and_free_mem ( ThreadId tid, MC_Chunk* mc, SizeT rzB )
 
    /* Record where freed */
    MC_(set_freed_at) (tid, mc);
-   /* Put it out of harm's way for a while */
+   /* Put it out of harm's way for a while.  This also disposes of mc. */
    add_to_freed_queue ( mc );
    /* If the free list volume is bigger than MC_(clo_freelist_vol),
       we wait till the next block allocation to release blocks.
@@ -216,6 +216,19 @@ typedef
          arguments of type 'HWord' to be passed to helper functions.
          Ity_I32 or Ity_I64 only. */
       IRType hWordTy;
+
+      /* READONLY: the host endianness, for stores done by the
+         instrumentation itself. */
+      IREndness hEnd;
+
+      /* MODIFIED: set, for the duration of one statement, when that
+         statement is a load belonging to a group of nearby loads
+         whose shadow state has been checked in one go.  It is then
+         an Ity_I1 atom which is True at run time if the whole group
+         is addressable and defined, so that the load's own helper
+         need not be called.  NULL otherwise.  See "Coalescing shadow
+         loads" below. */
+      IRExpr* loadsDefined;
    }
    MCEnv;
 
@@ -4797,6 +4810,20 @@ IRAtom* expr2vbits_Load_WRK ( MCEnv* mce,
          value (0b01 repeating, 0x55 etc) as that'll still look pretty
          undefined if it ever leaks out. */
    }
+
+   /* If this load's group has already been found to be all defined,
+      skip the call and use defined V bits instead.  Only unguarded
+      integer-sized loads are ever put in a group. */
+   IRAtom* loadsDefined = mce->loadsDefined;
+   if (loadsDefined && !guard && !ret_via_outparam) {
+      mce->loadsDefined = NULL;
+      di->guard = assignNew('V', mce, Ity_I1, unop(Iop_Not1, loadsDefined));
+      stmt( 'V', mce, IRStmt_Dirty(di) );
+      return assignNew('V', mce, ty,
+                       IRExpr_ITE(loadsDefined, definedOfType(ty),
+                                                mkexpr(datavbits)));
+   }
+
    stmt( 'V', mce, IRStmt_Dirty(di) );
 
    return mkexpr(datavbits);
@@ -5064,6 +5091,45 @@ IRExpr* zwidenToHostWord ( MCEnv* mce, IRAtom* vatom )
 }
 
 
+/* For --incremental-leak-check=yes: set the MC_(dirty_secmaps)
+   entries for the first and last bytes of a szB-byte store to
+   addr+bias.  This is done inline, rather than by the store helpers,
+   so that it costs nothing when not in use.  It isn't guarded:
+   spuriously marking a chunk dirty is harmless. */
+static void mark_secmaps_dirty ( MCEnv* mce, IRAtom* addr, UInt bias,
+                                 Int szB )
+{
+   IRType  tyAddr = mce->hWordTy;
+   Bool    is64   = tyAddr == Ity_I64;
+   IRAtom* limit  = is64 ? mkU64(MC_(n_dirty_secmaps))
+                         : mkU32(MC_(n_dirty_secmaps));
+   IRAtom* map    = is64 ? mkU64((HWord)MC_(dirty_secmaps))
+                         : mkU32((HWord)MC_(dirty_secmaps));
+   UInt    off[2];
+   Int     i;
+
+   off[0] = bias;
+   off[1] = bias + szB - 1;
+   for (i = 0; i < (szB > 1 ? 2 : 1); i++) {
+      IRAtom *ea, *ix, *inRange, *p;
+      ea = off[i] == 0
+              ? addr
+              : assignNew('V', mce, tyAddr,
+                          binop(is64 ? Iop_Add64 : Iop_Add32, addr,
+                                is64 ? mkU64(off[i]) : mkU32(off[i])));
+      ix = assignNew('V', mce, tyAddr,
+                     binop(is64 ? Iop_Shr64 : Iop_Shr32, ea, mkU8(16)));
+      inRange = assignNew('V', mce, Ity_I1,
+                          binop(is64 ? Iop_CmpLT64U : Iop_CmpLT32U,
+                                ix, limit));
+      ix = assignNew('V', mce, tyAddr, IRExpr_ITE(inRange, ix, limit));
+      p  = assignNew('V', mce, tyAddr,
+                     binop(is64 ? Iop_Add64 : Iop_Add32, map, ix));
+      stmt( 'V', mce, IRStmt_Store(mce->hEnd, p, mkU8(1)) );
+   }
+}
+
+
 /* Generate a shadow store.  |addr| is always the original address
    atom.  You can pass in either originals or V-bits for the data
    atom, but obviously not both.  This function generates a check for
@@ -5135,6 +5201,9 @@ void do_shadow_Store ( MCEnv* mce,
       those actions are gated on |guard|. */
    complainIfUndefined( mce, addr, guard );
 
+   if (MC_(dirty_secmaps) != NULL)
+      mark_secmaps_dirty( mce, addr, bias, sizeofIRType(ty) );
+
    /* Now decide which helper function to call to write the data V
       bits into shadow memory. */
    if (end == Iend_LE) {
@@ -6325,6 +6394,216 @@ static Bool checkForBogusLiterals ( /*FLAT*/ IRStmt* st )
 }
 
 
+/*------------------------------------------------------------*/
+/*--- Coalescing shadow loads                              ---*/
+/*------------------------------------------------------------*/
+
+/* Code touching consecutive fields of a struct, or a few elements of
+   an array, does several loads from the same base address plus small
+   constant offsets, each of which costs a call to a LOADV helper.  So
+   before instrumenting a superblock, we look for groups of at least
+   two such loads spanning no more than MC_COALESCE_SPAN bytes, with
+   nothing in between that could change shadow memory.  At the first
+   load of a group we emit a single call to
+   MC_(helperc_LOADV_RANGE_DEFINED) for the whole span.  The group's
+   loads then call their own helpers only if that said no; when it
+   said yes, their V bits are all-defined and there cannot be an
+   addressing error to report.  The range helper declines anything
+   crossing a secondary map boundary, so such groups quietly fall back
+   to the per-access helpers.
+
+   Stores are not coalesced: each one has to write shadow memory
+   anyway, and it is that write, not the lookup, which costs. */
+
+#define MC_COALESCE_SPAN    64
+#define MC_COALESCE_ACTIVE  4
+
+typedef
+   struct {
+      IRTemp  base;    /* IRTemp_INVALID for constant addresses */
+      Long    lo, hi;  /* the group covers [base+lo, base+hi) */
+      Int     leader;  /* index in sb_in of the first load */
+      Int     n_loads;
+      IRAtom* ok;      /* Ity_I1, made when the leader is instrumented */
+   }
+   CoalescedLoads;
+
+/* Express address atom |a| as |*base| plus |*off|, where the
+   tmp-to-(base,offset) mapping built so far is in |tBase|/|tOff|. */
+static void coalesce_resolve_addr ( IRExpr* a,
+                                    const IRTemp* tBase, const Long* tOff,
+                                    /*OUT*/IRTemp* base, /*OUT*/Long* off )
+{
+   if (a->tag == Iex_RdTmp) {
+      *base = tBase[a->Iex.RdTmp.tmp];
+      *off  = tOff[a->Iex.RdTmp.tmp];
+      return;
+   }
+   tl_assert(a->tag == Iex_Const);
+   *base = IRTemp_INVALID;
+   *off  = a->Iex.Const.con->tag == Ico_U32
+              ? (Long)a->Iex.Const.con->Ico.U32
+              : (Long)a->Iex.Const.con->Ico.U64;
+}
+
+/* Fill in |groupOf|, indexed by statement number, with the index in
+   |groups| of the group each load in |sb_in| belongs to, or -1.  Only
+   statements from |first| onwards are considered.  Both arrays must
+   have room for sb_in->stmts_used entries. */
+static void find_coalescable_loads ( IRSB* sb_in, Int first, IRType hWordTy,
+                                     /*OUT*/Int* groupOf,
+                                     /*OUT*/CoalescedLoads* groups )
+{
+   Int     i, j, n_groups = 0, n_active = 0;
+   Int     active[MC_COALESCE_ACTIVE];
+   Int     n_tmps = sb_in->tyenv->types_used;
+   IRTemp* tBase  = VG_(malloc)("mc.find_coalescable_loads.1",
+                                n_tmps * sizeof(IRTemp));
+   Long*   tOff   = VG_(malloc)("mc.find_coalescable_loads.2",
+                                n_tmps * sizeof(Long));
+   IROp    opAdd  = hWordTy == Ity_I32 ? Iop_Add32 : Iop_Add64;
+   IROp    opSub  = hWordTy == Ity_I32 ? Iop_Sub32 : Iop_Sub64;
+
+   for (i = 0; i < n_tmps; i++) {
+      tBase[i] = i;
+      tOff[i]  = 0;
+   }
+
+   for (i = 0; i < sb_in->stmts_used; i++) {
+      IRStmt* st = sb_in->stmts[i];
+      groupOf[i] = -1;
+
+      switch (st->tag) {
+         case Ist_Store: case Ist_StoreG: case Ist_Dirty:
+         case Ist_CAS: case Ist_LLSC: case Ist_AbiHint:
+            /* Anything which may change shadow memory ends all
+               groups. */
+            n_active = 0;
+            continue;
+         case Ist_WrTmp:
+            break;
+         default:
+            continue;
+      }
+
+      IRTemp  t = st->Ist.WrTmp.tmp;
+      IRExpr* e = st->Ist.WrTmp.data;
+
+      /* Track tmps which are a constant offset from some other tmp. */
+      if (e->tag == Iex_RdTmp) {
+         tBase[t] = tBase[e->Iex.RdTmp.tmp];
+         tOff[t]  = tOff[e->Iex.RdTmp.tmp];
+      }
+      else if (e->tag == Iex_Binop
+               && (e->Iex.Binop.op == opAdd || e->Iex.Binop.op == opSub)) {
+         IRExpr* a1 = e->Iex.Binop.arg1;
+         IRExpr* a2 = e->Iex.Binop.arg2;
+         if (e->Iex.Binop.op == opAdd && a1->tag == Iex_Const) {
+            IRExpr* tmp = a1; a1 = a2; a2 = tmp;
+         }
+         if (a1->tag == Iex_RdTmp && a2->tag == Iex_Const) {
+            Long c = a2->Iex.Const.con->tag == Ico_U32
+                        ? (Long)(Int)a2->Iex.Const.con->Ico.U32
+                        : (Long)a2->Iex.Const.con->Ico.U64;
+            tBase[t] = tBase[a1->Iex.RdTmp.tmp];
+            tOff[t]  = tOff[a1->Iex.RdTmp.tmp]
+                       + (e->Iex.Binop.op == opAdd ? c : -c);
+         }
+      }
+
+      if (i < first || e->tag != Iex_Load)
+         continue;
+      switch (shadowTypeV(e->Iex.Load.ty)) {
+         case Ity_I8: case Ity_I16: case Ity_I32: case Ity_I64: break;
+         default: continue;
+      }
+
+      IRTemp base;
+      Long   off;
+      Long   szB = sizeofIRType(e->Iex.Load.ty);
+      coalesce_resolve_addr(e->Iex.Load.addr, tBase, tOff, &base, &off);
+
+      for (j = 0; j < n_active; j++) {
+         CoalescedLoads* g = &groups[active[j]];
+         if (g->base == base
+             && (off + szB > g->hi ? off + szB : g->hi)
+                - (off < g->lo ? off : g->lo) <= MC_COALESCE_SPAN) {
+            if (off < g->lo)       g->lo = off;
+            if (off + szB > g->hi) g->hi = off + szB;
+            g->n_loads++;
+            groupOf[i] = active[j];
+            break;
+         }
+      }
+      if (groupOf[i] >= 0)
+         continue;
+
+      /* Start a new group, forgetting the oldest one if need be. */
+      if (n_active == MC_COALESCE_ACTIVE) {
+         for (j = 1; j < n_active; j++)
+            active[j-1] = active[j];
+         n_active--;
+      }
+      groups[n_groups].base    = base;
+      groups[n_groups].lo      = off;
+      groups[n_groups].hi      = off + szB;
+      groups[n_groups].leader  = i;
+      groups[n_groups].n_loads = 1;
+      groups[n_groups].ok      = NULL;
+      groupOf[i] = n_groups;
+      active[n_active++] = n_groups++;
+   }
+
+   /* A group of one gains nothing. */
+   for (i = first; i < sb_in->stmts_used; i++) {
+      if (groupOf[i] >= 0 && groups[groupOf[i]].n_loads < 2)
+         groupOf[i] = -1;
+   }
+
+   VG_(free)(tBase);
+   VG_(free)(tOff);
+}
+
+/* Generate the range check for group |g|, at its leader, and return
+   the Ity_I1 atom saying whether the whole group is defined. */
+static IRAtom* gen_coalesced_loads_check ( MCEnv* mce,
+                                           const CoalescedLoads* g )
+{
+   IRType  tyH  = mce->hWordTy;
+   IRAtom* addr;
+   IRTemp  okW  = newTemp(mce, tyH, VSh);
+   IRDirty* di;
+
+   tl_assert(tyH == Ity_I32 || tyH == Ity_I64);
+   if (g->base == IRTemp_INVALID) {
+      addr = tyH == Ity_I32 ? mkU32((UInt)g->lo) : mkU64((ULong)g->lo);
+   } else if (g->lo == 0) {
+      addr = mkexpr(g->base);
+   } else {
+      addr = assignNew('V', mce, tyH,
+                       tyH == Ity_I32
+                          ? binop(Iop_Add32, mkexpr(g->base),
+                                             mkU32((UInt)g->lo))
+                          : binop(Iop_Add64, mkexpr(g->base),
+                                             mkU64((ULong)g->lo)));
+   }
+
+   di = unsafeIRDirty_1_N( okW, 2/*regparms*/,
+                           "MC_(helperc_LOADV_RANGE_DEFINED)",
+                           VG_(fnptr_to_fnentry)(
+                              &MC_(helperc_LOADV_RANGE_DEFINED) ),
+                           mkIRExprVec_2( addr,
+                                          mkIRExpr_HWord(g->hi - g->lo) ) );
+   setHelperAnns( mce, di );
+   stmt( 'V', mce, IRStmt_Dirty(di) );
+
+   return assignNew('V', mce, Ity_I1,
+                    tyH == Ity_I32
+                       ? binop(Iop_CmpNE32, mkexpr(okW), mkU32(0))
+                       : binop(Iop_CmpNE64, mkexpr(okW), mkU64(0)));
+}
+
+
 IRSB* MC_(instrument) ( VgCallbackClosure* closure,
                         IRSB* sb_in, 
                         const VexGuestLayout* layout, 
@@ -6337,6 +6616,8 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
    IRStmt* st;
    MCEnv   mce;
    IRSB*   sb_out;
+   Int*    groupOf;
+   CoalescedLoads* groups;
 
    if (gWordTy != hWordTy) {
       /* We don't currently support this case. */
@@ -6366,6 +6647,8 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
    mce.trace          = verboze;
    mce.layout         = layout;
    mce.hWordTy        = hWordTy;
+   mce.hEnd           = archinfo_host->endness == VexEndnessLE
+                           ? Iend_LE : Iend_BE;
    mce.bogusLiterals  = False;
 
    /* Do expensive interpretation for Iop_Add32 and Iop_Add64 on
@@ -6490,11 +6773,26 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
    tl_assert(i < sb_in->stmts_used);
    tl_assert(sb_in->stmts[i]->tag == Ist_IMark);
 
+   groupOf = VG_(malloc)("mc.MC_(instrument).2",
+                         sb_in->stmts_used * sizeof(Int));
+   groups  = VG_(malloc)("mc.MC_(instrument).3",
+                         sb_in->stmts_used * sizeof(CoalescedLoads));
+   find_coalescable_loads(sb_in, i, hWordTy, groupOf, groups);
+
    for (/* use current i*/; i < sb_in->stmts_used; i++) {
 
       st = sb_in->stmts[i];
       first_stmt = sb_out->stmts_used;
 
+      mce.loadsDefined = NULL;
+      if (groupOf[i] >= 0) {
+         CoalescedLoads* g = &groups[groupOf[i]];
+         if (g->leader == i)
+            g->ok = gen_coalesced_loads_check(&mce, g);
+         tl_assert(g->ok);
+         mce.loadsDefined = g->ok;
+      }
+
       if (verboze) {
          VG_(printf)("\n");
          ppIRStmt(st);
@@ -6606,6 +6904,10 @@ IRSB* MC_(instrument) ( VgCallbackClosure* closure,
          stmt('C', &mce, st);
    }
 
+   mce.loadsDefined = NULL;
+   VG_(free)(groupOf);
+   VG_(free)(groups);
+
    /* Now we need to complain if the jump target is undefined. */
    first_stmt = sb_out->stmts_used;
 
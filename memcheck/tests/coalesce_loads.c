@@ -0,0 +1,38 @@
+/* Loads of nearby fields are checked together by Memcheck, with one
+   shadow lookup for the whole group (see find_coalescable_loads in
+   mc_translate.c).  If one of the loads is undefined or unaddressable,
+   the group check fails and each load is checked on its own; the error
+   must then be reported just once, and for the right load. */
+
+#include <stdlib.h>
+
+/* Four loads from the same base register, all within 16 bytes. */
+__attribute__((noinline))
+static int sum4 ( const int* p )
+{
+   return p[0] + p[1] + p[2] + p[3];
+}
+
+static volatile int sink;
+
+int main ( void )
+{
+   int* p = malloc(4 * sizeof(int));
+   int* q = malloc(3 * sizeof(int));
+
+   p[0] = 1; p[1] = 2; p[2] = 3; p[3] = 4;
+   if (sum4(p) != 10)                    // all defined: no error
+      sink++;
+
+   p[2] = *(volatile int*)&q[1];         // q[1] is undefined
+   if (sum4(p) == 0)                     // error here, once
+      sink++;
+
+   q[0] = 1; q[1] = 2; q[2] = 3;
+   if (sum4(q) != 0)                     // invalid read of q[3], once
+      sink++;
+
+   free(p);
+   free(q);
+   return 0;
+}
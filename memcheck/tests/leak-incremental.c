@@ -0,0 +1,28 @@
+#include <stdlib.h>
+#include "../memcheck.h"
+
+/* A 2MB table of pointers to blocks, which does not change between
+   leak searches.  With --incremental-leak-check=yes, the first search
+   has to scan it, and the later ones should reuse what it found. */
+
+#define TABLE_SZB  (2 * 1024 * 1024)
+#define N_BLOCKS   1024
+
+int main ( void )
+{
+   size_t n = TABLE_SZB / sizeof(void*);
+   void** table = malloc(TABLE_SZB);
+   size_t i;
+
+   for (i = 0; i < n; i++)
+      table[i] = i < N_BLOCKS ? malloc(16) : table[i % N_BLOCKS];
+
+   VALGRIND_DO_LEAK_CHECK;
+   VALGRIND_DO_ADDED_LEAK_CHECK;
+   VALGRIND_DO_ADDED_LEAK_CHECK;
+
+   for (i = 0; i < N_BLOCKS; i++)
+      free(table[i]);
+   free(table);
+   return 0;
+}
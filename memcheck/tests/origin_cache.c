@@ -0,0 +1,26 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+/* With a small origin cache that may grow, set origins for far more
+   memory than fits in it, so that lines get evicted and the cache is
+   resized.  Check that the origins of both the old and the new
+   undefined values are still reported. */
+
+#define BIG  (48 * 1024 * 1024)
+
+int main ( void )
+{
+   int*  small = malloc(16 * sizeof(int));
+   char* big   = malloc(BIG);
+   int   n     = 0;
+
+   if (small[3] == 1)          /* origin: small's malloc */
+      n++;
+   if (big[BIG / 2] == 1)      /* origin: big's malloc */
+      n++;
+
+   free(big);
+   free(small);
+   printf("done\n");
+   return 0;
+}
@@ -0,0 +1,239 @@
+// Tests the bulk paths memcheck takes when setting, copying and checking
+// the V+A bits of address ranges (fill_vabits8, copy_vabits8 and
+// find_vabits8_not, in mc_main.c).  Each result is compared with one
+// got without them:
+//
+// - set:   one VALGRIND_MAKE_MEM_* over a range, against the same done
+//          in 7 byte pieces, which are too short for the bulk path;
+// - copy:  realloc, against the V bits of the source, read byte by
+//          byte beforehand;
+// - check: the write() syscall's check of its buffer, against
+//          VALGRIND_CHECK_MEM_IS_DEFINED, which looks at every byte.
+//          Both must report an error for the same byte, which shows
+//          up in the .exp file.
+//
+// The blocks are aligned to a SecMap (64KB), so that the ranges, with
+// their unaligned starts and ends, cross the SecMap boundaries at known
+// offsets.  The source V bits have partially defined bytes scattered
+// through them, and around the boundaries.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "memcheck/memcheck.h"
+
+#define SM_SIZE   65536
+#define BLOCK_SZB (3 * SM_SIZE)
+#define PIECE_SZB 7
+
+#define NOACCESS  0x100    // in a snapshot: byte is not addressable
+
+typedef unsigned char  U1;
+typedef unsigned short U2;
+
+static U2 snap1[BLOCK_SZB], snap2[BLOCK_SZB];
+static U1 vbits[BLOCK_SZB];
+
+static char* new_block ( size_t szB )
+{
+   void* p;
+   if (posix_memalign(&p, SM_SIZE, szB) != 0) {
+      fprintf(stderr, "posix_memalign failed\n");
+      exit(1);
+   }
+   return p;
+}
+
+// The V bits of p[0 .. len-1], or NOACCESS.
+static void snapshot ( U2* snap, const char* p, size_t len )
+{
+   size_t i;
+   U1     v;
+   if (VALGRIND_GET_VBITS(p, vbits, len) == 1) {
+      for (i = 0; i < len; i++)
+         snap[i] = vbits[i];
+      return;
+   }
+   for (i = 0; i < len; i++) {
+      if (VALGRIND_GET_VBITS(p + i, &v, 1) == 1)
+         snap[i] = v;
+      else
+         snap[i] = NOACCESS;
+   }
+}
+
+static void compare ( const char* what, size_t len )
+{
+   size_t i;
+   for (i = 0; i < len; i++) {
+      if (snap1[i] != snap2[i]) {
+         printf("%s: differ at offset %lu: %x vs %x\n",
+                what, (unsigned long)i, snap1[i], snap2[i]);
+         return;
+      }
+   }
+   printf("%s: same\n", what);
+}
+
+// Undefined and partially defined bytes, some in every word, and a few
+// either side of each SecMap boundary.
+static void set_pattern ( char* p, size_t len )
+{
+   size_t i;
+   (void)VALGRIND_MAKE_MEM_DEFINED(p, len);
+   for (i = 0; i < len; i++) {
+      size_t off = i % SM_SIZE;
+      if (i % 13 == 0)
+         vbits[i] = 0xff;
+      else if (i % 5 == 0 || off < 3 || off > SM_SIZE - 3)
+         vbits[i] = 0x0f << (i % 5);
+      else
+         vbits[i] = 0;
+   }
+   (void)VALGRIND_SET_VBITS(p, vbits, len);
+}
+
+
+//---------------------------------------------------------------------------
+// Set
+//---------------------------------------------------------------------------
+
+enum { DEFINED, UNDEFINED, NOACCESS_ };
+
+static void make_mem ( int how, char* p, size_t len )
+{
+   switch (how) {
+   case DEFINED:   (void)VALGRIND_MAKE_MEM_DEFINED(p, len);   break;
+   case UNDEFINED: (void)VALGRIND_MAKE_MEM_UNDEFINED(p, len); break;
+   case NOACCESS_: (void)VALGRIND_MAKE_MEM_NOACCESS(p, len);  break;
+   }
+}
+
+static void test_set ( void )
+{
+   static const struct { size_t start, len; } ranges[] = {
+      { SM_SIZE - 3,      SM_SIZE + 9 },        // crosses two boundaries
+      { 5,                BLOCK_SZB - 11 },     // covers a whole SecMap
+      { SM_SIZE - 13,     30 },                 // short, across one
+      { 2 * SM_SIZE + 7,  1001 },               // inside one SecMap
+   };
+   static const char* how_name[] = { "defined", "undefined", "noaccess" };
+   char*  b1 = new_block(BLOCK_SZB);
+   char*  b2 = new_block(BLOCK_SZB);
+   char   what[80];
+   size_t r, i;
+   int    how;
+
+   for (r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+      size_t start = ranges[r].start, len = ranges[r].len;
+      for (how = DEFINED; how <= NOACCESS_; how++) {
+         set_pattern(b1, BLOCK_SZB);
+         set_pattern(b2, BLOCK_SZB);
+
+         make_mem(how, b1 + start, len);
+         for (i = 0; i < len; i += PIECE_SZB)
+            make_mem(how, b2 + start + i,
+                     len - i < PIECE_SZB ? len - i : PIECE_SZB);
+
+         snapshot(snap1, b1, BLOCK_SZB);
+         snapshot(snap2, b2, BLOCK_SZB);
+         sprintf(what, "set %lu bytes at %lu %s",
+                 (unsigned long)len, (unsigned long)start, how_name[how]);
+         compare(what, BLOCK_SZB);
+      }
+   }
+   (void)VALGRIND_MAKE_MEM_DEFINED(b1, BLOCK_SZB);
+   (void)VALGRIND_MAKE_MEM_DEFINED(b2, BLOCK_SZB);
+   free(b1);
+   free(b2);
+}
+
+
+//---------------------------------------------------------------------------
+// Copy
+//---------------------------------------------------------------------------
+
+// realloc's copies always start at the (aligned) start of the blocks;
+// the new block is not SecMap aligned, so the source and destination
+// cross their boundaries at different places.
+static void test_copy ( const char* what, size_t old_szB, size_t new_szB )
+{
+   char*  p = new_block(old_szB);
+   size_t len = old_szB < new_szB ? old_szB : new_szB;
+
+   set_pattern(p, old_szB);
+   // Some inaccessible bytes across a boundary too.
+   (void)VALGRIND_MAKE_MEM_NOACCESS(p + SM_SIZE - 10, 21);
+   snapshot(snap1, p, len);
+
+   p = realloc(p, new_szB);
+   snapshot(snap2, p, len);
+   compare(what, len);
+
+   (void)VALGRIND_MAKE_MEM_DEFINED(p, new_szB);
+   free(p);
+}
+
+
+//---------------------------------------------------------------------------
+// Check
+//---------------------------------------------------------------------------
+
+static void prepare_check ( char* p, size_t bad, U1 bad_vbits )
+{
+   (void)VALGRIND_MAKE_MEM_DEFINED(p, BLOCK_SZB);
+   (void)VALGRIND_SET_VBITS(p + bad, &bad_vbits, 1);
+}
+
+static void report_check ( const char* what, const char* p, size_t res )
+{
+   if (res == 0)
+      printf("%s: no error\n", what);
+   else
+      printf("%s: first bad byte at %lu\n", what,
+             (unsigned long)((const char*)res - p));
+}
+
+int main ( void )
+{
+   char* p;
+   int   fd;
+
+   test_set();
+
+   test_copy("copy, growing",   2 * SM_SIZE + 13, 2 * SM_SIZE + 100);
+   test_copy("copy, shrinking", BLOCK_SZB,        SM_SIZE + SM_SIZE / 2 + 3);
+
+   fd = open("/dev/null", O_WRONLY);
+   if (fd < 0) {
+      fprintf(stderr, "open failed\n");
+      return 1;
+   }
+   p = new_block(BLOCK_SZB);
+
+   // Partially defined, just after the first boundary.
+   prepare_check(p, SM_SIZE + 1, 0x01);
+   (void)write(fd, p + SM_SIZE - 5, SM_SIZE + 10);
+   report_check("check 1", p, VALGRIND_CHECK_MEM_IS_DEFINED(p + SM_SIZE - 5, SM_SIZE + 10));
+
+   // Undefined, the last byte, after the second boundary.
+   prepare_check(p, 2 * SM_SIZE + 4, 0xff);
+   (void)write(fd, p + SM_SIZE - 5, SM_SIZE + 10);
+   report_check("check 2", p, VALGRIND_CHECK_MEM_IS_DEFINED(p + SM_SIZE - 5, SM_SIZE + 10));
+
+   // Partially defined, just before the second boundary.
+   prepare_check(p, 2 * SM_SIZE - 1, 0x80);
+   (void)write(fd, p + 3, BLOCK_SZB - 4);
+   report_check("check 3", p, VALGRIND_CHECK_MEM_IS_DEFINED(p + 3, BLOCK_SZB - 4));
+
+   // Nothing wrong.
+   (void)VALGRIND_MAKE_MEM_DEFINED(p, BLOCK_SZB);
+   (void)write(fd, p + 3, BLOCK_SZB - 4);
+   report_check("check 4", p, VALGRIND_CHECK_MEM_IS_DEFINED(p + 3, BLOCK_SZB - 4));
+
+   free(p);
+   close(fd);
+   return 0;
+}
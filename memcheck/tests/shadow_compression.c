@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Make enough shadow memory for --shadow-compression=yes to sweep it,
+   most of it in 64KB areas with only a few runs of equal state, so
+   that they get compressed.  Then check that the undefined and
+   unaddressable bytes there are still reported, and the defined ones
+   are not, both before and after the areas are expanded again. */
+
+#define CHUNK    (64 * 1024)
+#define NCHUNKS  1280
+
+int main ( void )
+{
+   char* big = malloc(NCHUNKS * CHUNK);
+   void* m;
+   int   i, n = 0;
+
+   for (i = 0; i < NCHUNKS; i++)
+      memset(&big[i * CHUNK], 1, 16);
+
+   /* Memcheck sweeps when it sees a new mapping. */
+   m = mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS,
+            -1, 0);
+   munmap(m, 4096);
+
+   if (big[5 * CHUNK + 8] == 1)          /* defined */
+      n++;
+   if (big[6 * CHUNK + 100] == 1)        /* undefined */
+      n++;
+   big[7 * CHUNK + 100] = 3;
+   if (big[7 * CHUNK + 100] == 3)        /* defined by now */
+      n++;
+   for (i = 0; i < 100; i++) {           /* read often, so expanded */
+      if (big[8 * CHUNK + 8] == 1)
+         n++;
+   }
+   if (big[8 * CHUNK + 100] == 1)        /* still undefined */
+      n++;
+   if (big[NCHUNKS * CHUNK] == 1)        /* unaddressable */
+      n++;
+
+   free(big);
+   printf("done\n");
+   return 0;
+}
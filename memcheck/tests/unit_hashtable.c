@@ -0,0 +1,415 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pub_core_basics.h"
+#include "pub_core_debuglog.h"
+#include "pub_core_hashtable.h"
+#include "pub_core_libcassert.h"
+#include "pub_core_libcbase.h"
+#include "pub_core_libcprint.h"
+#include "pub_core_mallocfree.h"
+
+// Crudely redirect various VG_(foo)() functions to their libc equivalents.
+#undef vg_assert
+#define vg_assert(e)                   assert(e)
+#undef vg_assert2
+#define vg_assert2(e, fmt, args...)    assert(e)
+
+#define vgPlain_printf                 printf
+#define vgPlain_memset                 memset
+#define vgPlain_calloc(cc,n,s)         calloc(n,s)
+#define vgPlain_malloc(cc,s)           malloc(s)
+#define vgPlain_free                   free
+#define vgPlain_message(kind, fmt, args...)     printf(fmt, ## args)
+#define vgPlain_debugLog(level, mod, fmt, args...)  ((void)0)
+
+#include "coregrind/m_hashtable.c"
+
+// The table is tested through its interface, checking every result
+// against a model, and looking inside it only to make sure that the
+// interesting states -- an incremental resize in progress, DELETED
+// slots being reused -- have actually been reached.
+
+#define N_OPS    200000    // Operations in the random test
+#define N_WINDOW 2000      // Keys in use at any one time
+#define N_SLIDE  5         // Operations per step of the window
+#define N_KEYS   (N_OPS / N_SLIDE + N_WINDOW)  // Size of the universe of keys
+#define N_CHECK  1000      // Operations between full checks
+
+
+/* Consistent random number generator, so it produces the
+   same results on all platforms. */
+
+#define random error_do_not_use_libc_random
+
+static UInt seed = 0;
+static UInt myrandom( void )
+{
+  seed = (1103515245 * seed + 12345);
+  return seed >> 8;
+}
+
+typedef
+   struct _Node {
+      struct _Node* next;
+      UWord         key;
+      UInt          val;     // tells apart nodes with the same key
+      UInt          seen;    // times returned by an iteration
+   }
+   Node;
+
+// Keys look like addresses, as most of the tools' keys do.
+static UWord key_of ( UInt i )
+{
+   return 0x4000000 + 16 * (UWord)i;
+}
+
+static Node* new_node ( UWord key, UInt val )
+{
+   Node* n = calloc(1, sizeof(Node));
+   assert(n);
+   n->key = key;
+   n->val = val;
+   return n;
+}
+
+static Word cmp_val ( const void* v1, const void* v2 )
+{
+   const Node* n1 = v1;
+   const Node* n2 = v2;
+   return n1->val < n2->val ? -1 : n1->val > n2->val ? 1 : 0;
+}
+
+static Bool migrating ( const VgHashTable* t )
+{
+   return t->old_slots != NULL;
+}
+
+
+//---------------------------------------------------------------------------
+// Random operations against a model
+//---------------------------------------------------------------------------
+
+// Each key is either absent or has one node, model[i].  Keys are added
+// and removed at random from a window of N_WINDOW keys, which slides
+// through the universe, removing the keys it leaves behind; so the
+// table grows at first, and is then rehashed at the same size as the
+// DELETED slots pile up, many times over.  Every operation's result is
+// compared with the model, many of them while a resize is still in
+// progress, and every so often the whole window is checked.
+
+static void test_random ( void )
+{
+   static Node* model[N_KEYS];
+   VgHashTable* t = VG_(HT_construct)("test_random");
+   UInt  i, op, base, n_model = 0, max_model = 0;
+   UInt  n_ops_migrating = 0, n_resizes = 0;
+   HTSlot* prev_slots = t->slots;
+   Node* n;
+
+   for (op = 0; op < N_OPS; op++) {
+      UInt  k;
+
+      base = op / N_SLIDE;
+      if (op % N_SLIDE == 0 && base > 0 && model[base - 1]) {
+         assert(VG_(HT_remove)(t, key_of(base - 1)) == model[base - 1]);
+         free(model[base - 1]);
+         model[base - 1] = NULL;
+         n_model--;
+      }
+
+      if (migrating(t))
+         n_ops_migrating++;
+
+      k = base + myrandom() % N_WINDOW;
+      if (myrandom() % 2 == 0) {
+         if (model[k] == NULL) {
+            model[k] = new_node(key_of(k), op);
+            VG_(HT_add_node)(t, model[k]);
+            n_model++;
+         }
+      } else {
+         n = VG_(HT_remove)(t, key_of(k));
+         assert(n == model[k]);
+         if (n) {
+            free(n);
+            model[k] = NULL;
+            n_model--;
+         }
+      }
+      if (n_model > max_model)
+         max_model = n_model;
+
+      // A lookup of some other key, as it may be in either array.
+      k = base + myrandom() % N_WINDOW;
+      assert(VG_(HT_lookup)(t, key_of(k)) == model[k]);
+      assert(VG_(HT_count_nodes)(t) == n_model);
+
+      if (t->slots != prev_slots) {
+         n_resizes++;
+         prev_slots = t->slots;
+      }
+
+      if (op % N_CHECK == 0) {
+         for (i = base < N_WINDOW ? 0 : base - N_WINDOW;
+              i < base + N_WINDOW; i++)
+            assert(VG_(HT_lookup)(t, key_of(i)) == model[i]);
+         assert(2 * (ULong)t->n_used <= (1ULL << t->log2_slots));
+      }
+   }
+
+   // The test is only worth anything if the table has been resized,
+   // both to grow and to clear out DELETED slots, and has been used
+   // while it was being.
+   assert(max_model > N_WINDOW / 4);
+   assert(n_resizes > 20);
+   assert(n_ops_migrating > N_OPS / 100);
+
+   for (i = 0; i < N_KEYS; i++) {
+      if (model[i]) {
+         assert(VG_(HT_remove)(t, key_of(i)) == model[i]);
+         free(model[i]);
+         model[i] = NULL;
+      }
+   }
+   assert(VG_(HT_count_nodes)(t) == 0);
+   VG_(HT_destruct)(t, free);
+
+   printf("random add/lookup/remove: ok\n");
+}
+
+
+//---------------------------------------------------------------------------
+// DELETED slots and duplicate keys
+//---------------------------------------------------------------------------
+
+// Finds the next key, from key_of(*next_i) on, whose home slot is
+// 'home'.
+static UWord key_with_home ( UWord home, UInt log2_slots, UInt* next_i )
+{
+   for (;;) {
+      UWord key = key_of((*next_i)++);
+      if (slot_no(key, log2_slots) == home)
+         return key;
+   }
+}
+
+static void test_deleted ( void )
+{
+   VgHashTable* t = VG_(HT_construct)("test_deleted");
+   UInt   i = 0, round, n_used, n_resizes = 0;
+   HTSlot* prev_slots;
+   UWord  a, b, c, home;
+   Node  *na, *nb, *nc, *n;
+
+   // Three keys with the same home slot: b is probed for past a's slot,
+   // and must still be found once a is removed; c then reuses a's slot.
+   a    = key_of(i++);
+   home = slot_no(a, t->log2_slots);
+   b    = key_with_home(home, t->log2_slots, &i);
+   c    = key_with_home(home, t->log2_slots, &i);
+   na   = new_node(a, 1);
+   nb   = new_node(b, 2);
+   nc   = new_node(c, 3);
+
+   VG_(HT_add_node)(t, na);
+   VG_(HT_add_node)(t, nb);
+   assert(t->slots[home].node == (VgHashNode*)na);
+   n_used = t->n_used;
+
+   assert(VG_(HT_remove)(t, a) == na);
+   assert(t->slots[home].node == DELETED);
+   assert(VG_(HT_lookup)(t, a) == NULL);
+   assert(VG_(HT_lookup)(t, b) == nb);
+
+   VG_(HT_add_node)(t, nc);
+   assert(t->slots[home].node == (VgHashNode*)nc);
+   assert(t->n_used == n_used);
+   assert(VG_(HT_lookup)(t, b) == nb);
+   assert(VG_(HT_lookup)(t, c) == nc);
+
+   assert(VG_(HT_remove)(t, b) == nb);
+   assert(VG_(HT_remove)(t, c) == nc);
+   assert(VG_(HT_count_nodes)(t) == 0);
+   free(na);
+   free(nb);
+   free(nc);
+
+   // Keys come and go, never more than a few at a time: the DELETED
+   // slots they leave behind must make the table rehash at the same
+   // size, not grow.
+   prev_slots = t->slots;
+   for (round = 0; round < 200; round++) {
+      UInt first = round * 40;
+      for (i = first; i < first + 40; i++)
+         VG_(HT_add_node)(t, new_node(key_of(i), i));
+      for (i = first; i < first + 40; i++) {
+         n = VG_(HT_remove)(t, key_of(i));
+         assert(n && n->val == i);
+         free(n);
+      }
+      assert(t->log2_slots == MIN_LOG2_SLOTS);
+      if (t->slots != prev_slots) {
+         n_resizes++;
+         prev_slots = t->slots;
+      }
+   }
+   assert(n_resizes > 0);
+   assert(VG_(HT_count_nodes)(t) == 0);
+   VG_(HT_destruct)(t, free);
+
+   printf("DELETED slots: ok\n");
+}
+
+// Nodes with the same key, found and removed by value with
+// HT_gen_lookup and HT_gen_remove, once with the table at rest and
+// once while the key's slot is still waiting to be migrated.  The key
+// may already have a node, 'below', which must stay where it is.
+static void test_dup_keys_in ( VgHashTable* t, UWord key )
+{
+   Node   *n1 = new_node(key, N_OPS + 1), *n2 = new_node(key, N_OPS + 2),
+          *n3 = new_node(key, N_OPS + 3);
+   Node   *below = VG_(HT_lookup)(t, key);
+   Node   probe;
+   UInt   n_nodes = VG_(HT_count_nodes)(t);
+
+   memset(&probe, 0, sizeof(probe));
+   probe.key = key;
+
+   VG_(HT_add_node)(t, n1);
+   VG_(HT_add_node)(t, n2);
+   VG_(HT_add_node)(t, n3);
+   assert(VG_(HT_count_nodes)(t) == n_nodes + 3);
+
+   // The most recently added node comes first.
+   assert(VG_(HT_lookup)(t, key) == n3);
+   probe.val = n1->val;
+   assert(VG_(HT_gen_lookup)(t, &probe, cmp_val) == n1);
+   probe.val = n2->val;
+   assert(VG_(HT_gen_lookup)(t, &probe, cmp_val) == n2);
+   probe.val = N_OPS + 9;
+   assert(VG_(HT_gen_lookup)(t, &probe, cmp_val) == NULL);
+   assert(VG_(HT_gen_remove)(t, &probe, cmp_val) == NULL);
+
+   // From the middle, then the front, then the last one.
+   probe.val = n2->val;
+   assert(VG_(HT_gen_remove)(t, &probe, cmp_val) == n2);
+   assert(VG_(HT_gen_lookup)(t, &probe, cmp_val) == NULL);
+   assert(VG_(HT_lookup)(t, key) == n3);
+   probe.val = n3->val;
+   assert(VG_(HT_gen_remove)(t, &probe, cmp_val) == n3);
+   assert(VG_(HT_lookup)(t, key) == n1);
+   probe.val = n1->val;
+   assert(VG_(HT_gen_remove)(t, &probe, cmp_val) == n1);
+   assert(VG_(HT_lookup)(t, key) == below);
+   assert(VG_(HT_gen_remove)(t, &probe, cmp_val) == NULL);
+   assert(VG_(HT_count_nodes)(t) == n_nodes);
+
+   // The key can be used again.
+   VG_(HT_add_node)(t, n2);
+   assert(VG_(HT_remove)(t, key) == n2);
+   assert(VG_(HT_count_nodes)(t) == n_nodes);
+
+   free(n1);
+   free(n2);
+   free(n3);
+}
+
+static void test_dup_keys ( void )
+{
+   VgHashTable* t = VG_(HT_construct)("test_dup_keys");
+   UInt  i;
+   UWord last_key;
+
+   test_dup_keys_in(t, key_of(7));
+   assert(VG_(HT_count_nodes)(t) == 0);
+
+   // Fill the table until it starts resizing; the last slot of the old
+   // array is the last to be migrated, so a key living there is in
+   // old_slots for a while yet.
+   for (i = 0; !migrating(t); i++)
+      VG_(HT_add_node)(t, new_node(key_of(i), i));
+   last_key = 0;
+   for (i = 0; i < 1u << t->old_log2_slots; i++) {
+      if (slot_in_use(&t->old_slots[i]))
+         last_key = t->old_slots[i].key;
+   }
+   assert(last_key != 0);
+   assert(find_in(t->old_slots, t->old_log2_slots, last_key) != NULL);
+   test_dup_keys_in(t, last_key);
+   assert(migrating(t));
+
+   VG_(HT_destruct)(t, free);
+
+   printf("duplicate keys: ok\n");
+}
+
+
+//---------------------------------------------------------------------------
+// Iteration during a resize
+//---------------------------------------------------------------------------
+
+static void check_seen_once ( Node** nodes, UInt n_nodes )
+{
+   UInt i;
+   for (i = 0; i < n_nodes; i++) {
+      assert(nodes[i]->seen == 1);
+      nodes[i]->seen = 0;
+   }
+}
+
+static void test_iter ( void )
+{
+   VgHashTable* t = VG_(HT_construct)("test_iter");
+   Node*  nodes[1000];
+   UInt   i, n_nodes = 0, n_elems;
+   VgHashNode** arr;
+   Node*  n;
+
+   // Some keys with several nodes, so that HT_Next has to follow the
+   // chains as well as the slots.
+   while (!migrating(t)) {
+      UInt k = n_nodes % 3 == 2 ? n_nodes - 1 : n_nodes;
+      nodes[n_nodes] = new_node(key_of(k), n_nodes);
+      VG_(HT_add_node)(t, nodes[n_nodes]);
+      n_nodes++;
+   }
+   // Migrate some, but not all, of the old slots.
+   for (i = 0; i < 5; i++) {
+      nodes[n_nodes] = new_node(key_of(n_nodes), n_nodes);
+      VG_(HT_add_node)(t, nodes[n_nodes]);
+      n_nodes++;
+   }
+   assert(migrating(t));
+   assert(t->old_next > 0);
+
+   VG_(HT_ResetIter)(t);
+   while ((n = VG_(HT_Next)(t)) != NULL)
+      n->seen++;
+   check_seen_once(nodes, n_nodes);
+
+   arr = VG_(HT_to_array)(t, &n_elems);
+   assert(n_elems == n_nodes);
+   for (i = 0; i < n_elems; i++)
+      ((Node*)arr[i])->seen++;
+   check_seen_once(nodes, n_nodes);
+   free(arr);
+
+   // Neither of them may have moved anything.
+   assert(migrating(t));
+
+   VG_(HT_destruct)(t, free);
+
+   printf("iteration during a resize: ok\n");
+}
+
+int main(void)
+{
+   test_random();
+   test_deleted();
+   test_dup_keys();
+   test_iter();
+   return 0;
+}
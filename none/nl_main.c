@@ -33,6 +33,7 @@
 
 static void nl_post_clo_init(void)
 {
+   VG_(needs_cacheable_translations)();
 }
 
 static
@@ -65,7 +66,9 @@ static void nl_pre_clo_init(void)
                                  nl_instrument,
                                  nl_fini);
 
-   /* No needs, no core events to track */
+   /* The instrumentation adds nothing, so it is trivially thread-safe.
+      No core events to track. */
+   VG_(needs_thread_safe_instrumentation)();
 }
 
 VG_DETERMINE_INTERFACE_VERSION(nl_pre_clo_init)
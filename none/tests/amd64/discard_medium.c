@@ -0,0 +1,110 @@
+
+/* Test VG_(discard_translations) with ranges that span several 8KB
+   address-range equivalence classes but are far too small to need a
+   scan of every translation.  Run with --smc-check=none, so that only
+   the discard requests tell Valgrind the code has changed.
+
+   Little functions "mov $n, %eax ; ret" are placed all over a code
+   area, some of them straddling an equivalence class boundary (so
+   that their translations go in the catch-all class), and the area
+   is placed so that it also spans a 4MB boundary, where the class
+   numbers wrap around.  Ranges of functions are then rewritten to
+   return different values and discarded, and everything is run
+   again.  A function that still returns its old value was not
+   discarded when it should have been. */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include "tests/sys_mman.h"
+#include "../../../include/valgrind.h"
+
+#define EC_SZB     8192              /* size of an equivalence class */
+#define WRAP_SZB   (512 * EC_SZB)    /* 512 classes: 4MB */
+#define AREA_SZB   (32 * EC_SZB)
+#define FN_STEP    512               /* a function every 512 bytes ... */
+#define FN_SZB     6
+#define N_FNS      (AREA_SZB / FN_STEP)
+
+static unsigned char* area;
+static unsigned int   expected[N_FNS];
+
+/* ... except that every fourth class starts with one straddling the
+   boundary. */
+static unsigned char* fn_addr ( int i )
+{
+   unsigned long off = (unsigned long)i * FN_STEP;
+   if ((off % (4 * EC_SZB)) == 0 && off > 0)
+      off -= FN_SZB / 2;
+   return area + off;
+}
+
+static void set_fn ( int i, unsigned int val )
+{
+   unsigned char* p = fn_addr(i);
+   p[0] = 0xB8;                 /* mov $val, %eax */
+   memcpy(&p[1], &val, 4);
+   p[5] = 0xC3;                 /* ret */
+   expected[i] = val;
+}
+
+static int check_all ( const char* what )
+{
+   int i, n_bad = 0;
+   for (i = 0; i < N_FNS; i++) {
+      unsigned int (*fn)(void) = (unsigned int (*)(void))fn_addr(i);
+      if (fn() != expected[i])
+         n_bad++;
+   }
+   printf("%-28s %d of %d functions wrong\n", what, n_bad, N_FNS);
+   return n_bad;
+}
+
+/* Rewrite every function starting in [lo, hi) and discard exactly
+   that range. */
+static void rewrite_and_discard ( unsigned long lo, unsigned long hi,
+                                  unsigned int delta )
+{
+   int i;
+   for (i = 0; i < N_FNS; i++) {
+      unsigned long off = fn_addr(i) - area;
+      if (off >= lo && off + FN_SZB <= hi)
+         set_fn(i, expected[i] + delta);
+   }
+   VALGRIND_DISCARD_TRANSLATIONS(area + lo, hi - lo);
+}
+
+int main ( void )
+{
+   unsigned char* mem;
+   unsigned long  a;
+   int            i;
+
+   /* Find a 4MB boundary with room either side of it. */
+   mem = mmap(NULL, 2 * WRAP_SZB + AREA_SZB,
+              PROT_READ|PROT_WRITE|PROT_EXEC,
+              MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   assert(mem != MAP_FAILED);
+   a = ((unsigned long)mem + WRAP_SZB - 1) & ~(unsigned long)(WRAP_SZB - 1);
+   area = (unsigned char*)(a - AREA_SZB / 2);
+
+   for (i = 0; i < N_FNS; i++)
+      set_fn(i, 1000 + i);
+   check_all("initial");
+
+   /* Not aligned to class boundaries; covers 3 whole classes and
+      parts of 2 more, including a straddling function. */
+   rewrite_and_discard(EC_SZB + 100, 5 * EC_SZB - 100, 100000);
+   check_all("5 classes");
+
+   /* Across the 4MB boundary, where class numbers wrap. */
+   rewrite_and_discard(AREA_SZB / 2 - 3 * EC_SZB + 7,
+                       AREA_SZB / 2 + 2 * EC_SZB + 7, 200000);
+   check_all("5 classes, wrapping");
+
+   /* Most of the area. */
+   rewrite_and_discard(FN_STEP, AREA_SZB - FN_STEP, 300000);
+   check_all("30 classes");
+
+   return 0;
+}
@@ -0,0 +1,77 @@
+/* Test --smc-write-protect=yes with a thread whose CLONE_CHILD_CLEARTID
+   word is on a page that code is run from.  The kernel clears the word
+   and wakes its waiters when the thread exits, but only if the write
+   succeeds; if the page had been write-protected, the parent below
+   would wait for ever (here: until the timeout). */
+
+#define _GNU_SOURCE
+#include <assert.h>
+#include <linux/futex.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "tests/sys_mman.h"
+
+#define STACK_SZB (64 * 1024)
+
+typedef unsigned int (*Fn)(void);
+
+static unsigned char* page;
+static volatile int*  ctid;
+
+static void set_fn ( unsigned char* p, unsigned int val )
+{
+   p[0] = 0xB8;                 /* mov $val, %eax */
+   memcpy(&p[1], &val, 4);
+   p[5] = 0xC3;                 /* ret */
+}
+
+static int child ( void* arg )
+{
+   /* Give the parent time to run the code again. */
+   struct timespec ts = { 0, 100 * 1000 * 1000 };
+   syscall(SYS_nanosleep, &ts, NULL);
+   return 0;
+}
+
+int main ( void )
+{
+   char* stack;
+   int   pid, tries;
+   unsigned int sum = 0;
+
+   page = mmap(NULL, 4096, PROT_READ|PROT_WRITE|PROT_EXEC,
+               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   assert(page != MAP_FAILED);
+   ctid = (volatile int*)(page + 2048);
+   set_fn(page, 42);
+   sum += ((Fn)page)();
+
+   stack = malloc(STACK_SZB);
+   assert(stack);
+   *ctid = -1;   /* becomes the child's tid, then 0 when it exits */
+   pid = clone(child, stack + STACK_SZB,
+               CLONE_VM | CLONE_FS | CLONE_FILES | CLONE_SIGHAND
+               | CLONE_THREAD | CLONE_SYSVSEM
+               | CLONE_CHILD_SETTID | CLONE_CHILD_CLEARTID,
+               NULL, NULL, NULL, (int*)ctid);
+   assert(pid > 0);
+
+   /* Translate code from the page while the child runs. */
+   set_fn(page, 43);
+   sum += ((Fn)page)();
+
+   for (tries = 0; tries < 100 && *ctid != 0; tries++) {
+      struct timespec ts = { 0, 100 * 1000 * 1000 };
+      int val = *ctid;
+      if (val != 0)
+         syscall(SYS_futex, ctid, FUTEX_WAIT, val, &ts, NULL, 0);
+   }
+   printf("sum %u, child tid %s\n", sum,
+          *ctid == 0 ? "cleared" : "NOT CLEARED");
+   return 0;
+}
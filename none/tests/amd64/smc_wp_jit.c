@@ -0,0 +1,107 @@
+/* Test --smc-write-protect=yes with code that gets rewritten.
+
+   A little function "mov $n, %eax ; ret" is rewritten in place over
+   and over, in three kinds of memory:
+
+   - a private anonymous mapping, which Valgrind write-protects, so
+     that each rewrite faults;
+
+   - a file mapped twice, MAP_SHARED, once to write the code and once
+     to run it.  Writes through the first mapping never fault, so the
+     code must not be protected but self-checked instead;
+
+   - a MAP_SHARED anonymous mapping written by a child process, which
+     likewise is never seen by Valgrind.
+
+   A function that returns its old value was not retranslated when it
+   should have been. */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "tests/sys_mman.h"
+
+#define N_ROUNDS 20
+
+typedef unsigned int (*Fn)(void);
+
+static void set_fn ( unsigned char* p, unsigned int val )
+{
+   p[0] = 0xB8;                 /* mov $val, %eax */
+   memcpy(&p[1], &val, 4);
+   p[5] = 0xC3;                 /* ret */
+}
+
+static void private_anon ( void )
+{
+   int i, n_bad = 0;
+   unsigned char* code = mmap(NULL, 4096, PROT_READ|PROT_WRITE|PROT_EXEC,
+                              MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   assert(code != MAP_FAILED);
+   for (i = 0; i < N_ROUNDS; i++) {
+      set_fn(code, 1000 + i);
+      if (((Fn)code)() != 1000 + i)
+         n_bad++;
+      /* Data next to the code: also a write to a protected page. */
+      code[2048 + i] = i;
+      if (((Fn)code)() != 1000 + i)
+         n_bad++;
+   }
+   printf("private anonymous: %d wrong\n", n_bad);
+}
+
+static void shared_file ( void )
+{
+   int i, n_bad = 0, fd;
+   unsigned char *wr, *ex;
+
+   fd = open("smc_wp_jit.tmp", O_RDWR|O_CREAT|O_TRUNC, 0600);
+   assert(fd >= 0);
+   unlink("smc_wp_jit.tmp");
+   assert(ftruncate(fd, 4096) == 0);
+   wr = mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+   ex = mmap(NULL, 4096, PROT_READ|PROT_EXEC, MAP_SHARED, fd, 0);
+   assert(wr != MAP_FAILED && ex != MAP_FAILED);
+   for (i = 0; i < N_ROUNDS; i++) {
+      set_fn(wr, 2000 + i);
+      if (((Fn)ex)() != 2000 + i)
+         n_bad++;
+   }
+   printf("shared file: %d wrong\n", n_bad);
+   close(fd);
+}
+
+static void shared_anon ( void )
+{
+   int i, n_bad = 0;
+   pid_t pid;
+   unsigned char* code = mmap(NULL, 4096, PROT_READ|PROT_WRITE|PROT_EXEC,
+                              MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+   assert(code != MAP_FAILED);
+   for (i = 0; i < N_ROUNDS; i++) {
+      set_fn(code, 3000 + i);
+      if (((Fn)code)() != 3000 + i)
+         n_bad++;
+      pid = fork();
+      assert(pid >= 0);
+      if (pid == 0) {
+         set_fn(code, 4000 + i);
+         _exit(0);
+      }
+      assert(waitpid(pid, NULL, 0) == pid);
+      if (((Fn)code)() != 4000 + i)
+         n_bad++;
+   }
+   printf("shared anonymous: %d wrong\n", n_bad);
+}
+
+int main ( void )
+{
+   private_anon();
+   shared_file();
+   shared_anon();
+   return 0;
+}
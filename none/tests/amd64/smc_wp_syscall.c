@@ -0,0 +1,74 @@
+/* Test --smc-write-protect=yes with syscalls writing into a page that
+   code is run from.  The kernel's writes to a write-protected page
+   don't fault, they fail with EFAULT, so Valgrind has to keep such
+   pages unprotected for as long as the kernel may write to them:
+
+   - a read() straight into the page;
+
+   - a read() into the page which blocks, while another thread runs
+     (and so translates, and would protect) code from the page;
+
+   - a read() into a bad address, which must still fail with EFAULT
+     even though protected pages are around. */
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "tests/sys_mman.h"
+
+typedef unsigned int (*Fn)(void);
+
+static unsigned char* page;
+static int            fds[2];
+
+static void set_fn ( unsigned char* p, unsigned int val )
+{
+   p[0] = 0xB8;                 /* mov $val, %eax */
+   memcpy(&p[1], &val, 4);
+   p[5] = 0xC3;                 /* ret */
+}
+
+static void* reader ( void* arg )
+{
+   ssize_t n = read(fds[0], page + 2048, 6);
+   printf("blocking read: %d \"%.5s\"\n", (int)n,
+          n == 6 ? (char*)page + 2048 : "");
+   return NULL;
+}
+
+int main ( void )
+{
+   pthread_t t;
+   char* volatile bad = (char*)8;
+   unsigned int i, sum = 0;
+   ssize_t n;
+
+   page = mmap(NULL, 4096, PROT_READ|PROT_WRITE|PROT_EXEC,
+               MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   assert(page != MAP_FAILED);
+   assert(pipe(fds) == 0);
+
+   set_fn(page, 1);
+   sum += ((Fn)page)();
+   assert(write(fds[1], "hello", 6) == 6);
+   n = read(fds[0], page + 1024, 6);
+   printf("read: %d \"%.5s\"\n", (int)n, n == 6 ? (char*)page + 1024 : "");
+
+   pthread_create(&t, NULL, reader, NULL);
+   usleep(100 * 1000);
+   for (i = 2; i < 10; i++) {
+      set_fn(page, i);
+      sum += ((Fn)page)();
+   }
+   assert(write(fds[1], "world", 6) == 6);
+   pthread_join(t, NULL);
+
+   assert(write(fds[1], "again", 6) == 6);
+   n = read(fds[0], bad, 6);
+   printf("bad read: %d %s\n", (int)n, errno == EFAULT ? "EFAULT" : "?");
+   printf("sum %u\n", sum);
+   return 0;
+}
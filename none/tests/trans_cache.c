@@ -0,0 +1,80 @@
+/* Runs itself twice (under --trace-children=yes), so that the second
+   run can load the translation cache written by the first.  In
+   between, the cache file is damaged as asked for by argv[1]:
+
+     reuse     -- left alone
+     truncate  -- the last few bytes are chopped off
+     foreign   -- the header claims a different file format version
+
+   The expected output is in the "translation cache:" lines printed
+   at -v by each of the three processes.  Each test uses its own
+   cache file, trans_cache_<argv[1]>.tmp, so that none of them starts
+   with a file left behind by another. */
+
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static unsigned work ( void )
+{
+   unsigned i, h = 5381;
+   char buf[64];
+   for (i = 0; i < 1000; i++) {
+      sprintf(buf, "%u", i);
+      h = h * 33 + (unsigned)strlen(buf);
+   }
+   return h;
+}
+
+static void run_child ( const char* self )
+{
+   int   status;
+   pid_t pid = fork();
+   assert(pid >= 0);
+   if (pid == 0) {
+      execl(self, self, "child", (char*)NULL);
+      perror("execl");
+      _exit(1);
+   }
+   assert(waitpid(pid, &status, 0) == pid);
+   assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+int main ( int argc, char** argv )
+{
+   struct stat st;
+   int         fd;
+   char        cache_file[64];
+
+   assert(argc == 2);
+   if (strcmp(argv[1], "child") == 0) {
+      printf("child: %u\n", work());
+      return 0;
+   }
+
+   run_child(argv[0]);
+
+   snprintf(cache_file, sizeof(cache_file), "trans_cache_%s.tmp", argv[1]);
+   if (strcmp(argv[1], "truncate") == 0) {
+      assert(stat(cache_file, &st) == 0);
+      assert(truncate(cache_file, st.st_size - 10) == 0);
+   } else if (strcmp(argv[1], "foreign") == 0) {
+      unsigned version = 0xdead;
+      fd = open(cache_file, O_WRONLY);
+      assert(fd >= 0);
+      /* The version follows the 4-byte magic number. */
+      assert(pwrite(fd, &version, sizeof(version), 4) == sizeof(version));
+      close(fd);
+   } else {
+      assert(strcmp(argv[1], "reuse") == 0);
+   }
+
+   run_child(argv[0]);
+   return 0;
+}
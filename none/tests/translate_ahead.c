@@ -0,0 +1,67 @@
+/* Blocking reads from a pipe, each followed by code not run before,
+   for --translate-ahead.  A second thread keeps computing for the
+   first half of the reads, so that translating ahead is skipped then
+   (another thread is ready to run), and done afterwards. */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define N_READS 10
+
+#define F(n) \
+   static __attribute__((noinline)) unsigned f##n ( unsigned x ) \
+   { return x * (2 * n + 1) + (x >> n); }
+F(0) F(1) F(2) F(3) F(4) F(5) F(6) F(7) F(8) F(9)
+
+static unsigned (* const fns[N_READS])(unsigned)
+   = { f0, f1, f2, f3, f4, f5, f6, f7, f8, f9 };
+
+static int fds[2];
+static volatile int stop_spinning = 0;
+static volatile unsigned spin_result;
+
+static void* writer ( void* arg )
+{
+   struct timespec ts = { 0, 10 * 1000 * 1000 };
+   int i;
+   for (i = 0; i < N_READS; i++) {
+      nanosleep(&ts, NULL);
+      assert(write(fds[1], "x", 1) == 1);
+   }
+   return NULL;
+}
+
+static void* spinner ( void* arg )
+{
+   unsigned x = 0;
+   while (!stop_spinning)
+      x = x * 33 + 1;
+   spin_result = x;
+   return NULL;
+}
+
+int main ( void )
+{
+   pthread_t tw, ts;
+   unsigned  x = 1;
+   char      c;
+   int       i;
+
+   assert(pipe(fds) == 0);
+   assert(pthread_create(&tw, NULL, writer, NULL) == 0);
+   assert(pthread_create(&ts, NULL, spinner, NULL) == 0);
+   for (i = 0; i < N_READS; i++) {
+      if (i == N_READS / 2) {
+         stop_spinning = 1;
+         assert(pthread_join(ts, NULL) == 0);
+      }
+      assert(read(fds[0], &c, 1) == 1);
+      x = fns[i](x);
+   }
+   assert(pthread_join(tw, NULL) == 0);
+   printf("%u\n", x);
+   return 0;
+}
@@ -0,0 +1,83 @@
+// This artificial program runs a lot of code once each, in batches,
+// with a blocking read from a pipe before each batch.  The other end
+// of the pipe is written by a thread which sleeps a little first, so
+// the reads really block and the process is idle meanwhile.
+//
+// It is meant for comparing runs with and without --translate-ahead
+// (see blockio1 and blockio2): time spent translating the next batch
+// during the idle periods does not count.
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define N_BATCHES 20   // Batches of 100 functions each
+
+#define F(n) \
+   static __attribute__((noinline)) unsigned f##n ( unsigned x ) \
+   { return (x ^ (x >> 7)) * 2654435761u + n; }
+#define F10(n)   F(n##0) F(n##1) F(n##2) F(n##3) F(n##4) \
+                 F(n##5) F(n##6) F(n##7) F(n##8) F(n##9)
+#define F100(n)  F10(n##0) F10(n##1) F10(n##2) F10(n##3) F10(n##4) \
+                 F10(n##5) F10(n##6) F10(n##7) F10(n##8) F10(n##9)
+
+#define C(n)     x = f##n(x);
+#define C10(n)   C(n##0) C(n##1) C(n##2) C(n##3) C(n##4) \
+                 C(n##5) C(n##6) C(n##7) C(n##8) C(n##9)
+#define C100(n)  C10(n##0) C10(n##1) C10(n##2) C10(n##3) C10(n##4) \
+                 C10(n##5) C10(n##6) C10(n##7) C10(n##8) C10(n##9)
+
+F100(10) F100(11) F100(12) F100(13) F100(14)
+F100(15) F100(16) F100(17) F100(18) F100(19)
+F100(20) F100(21) F100(22) F100(23) F100(24)
+F100(25) F100(26) F100(27) F100(28) F100(29)
+
+static unsigned run_batch ( int i, unsigned x )
+{
+   switch (i) {
+      case  0: C100(10) break;   case  1: C100(11) break;
+      case  2: C100(12) break;   case  3: C100(13) break;
+      case  4: C100(14) break;   case  5: C100(15) break;
+      case  6: C100(16) break;   case  7: C100(17) break;
+      case  8: C100(18) break;   case  9: C100(19) break;
+      case 10: C100(20) break;   case 11: C100(21) break;
+      case 12: C100(22) break;   case 13: C100(23) break;
+      case 14: C100(24) break;   case 15: C100(25) break;
+      case 16: C100(26) break;   case 17: C100(27) break;
+      case 18: C100(28) break;   case 19: C100(29) break;
+   }
+   return x;
+}
+
+static int fds[2];
+
+static void* writer ( void* arg )
+{
+   struct timespec ts = { 0, 20 * 1000 * 1000 };
+   int i;
+   for (i = 0; i < N_BATCHES; i++) {
+      nanosleep(&ts, NULL);
+      assert(write(fds[1], "x", 1) == 1);
+   }
+   return NULL;
+}
+
+int main ( void )
+{
+   pthread_t t;
+   unsigned  x = 1;
+   char      c;
+   int       i;
+
+   assert(pipe(fds) == 0);
+   assert(pthread_create(&t, NULL, writer, NULL) == 0);
+   for (i = 0; i < N_BATCHES; i++) {
+      assert(read(fds[0], &c, 1) == 1);
+      x = run_batch(i, x);
+   }
+   assert(pthread_join(t, NULL) == 0);
+   printf("%u\n", x);
+   return 0;
+}
@@ -0,0 +1,45 @@
+// Reads several fields of each of a lot of small structs, as code
+// walking an array of records does.  Each struct's fields are loaded
+// together, with no stores in between, so Memcheck can check them
+// with one shadow lookup instead of one per field.  With an argument
+// of 1, a field in the middle of every struct, which is never read, is
+// left undefined, so that every such combined check fails and each
+// field has to be checked on its own.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NRECS  (64*1024)
+#define NPASS  1000
+
+typedef struct { int a, b, c, d, e, f, g, h; } Rec;
+
+__attribute__((noinline))
+static unsigned int sum_recs ( const Rec* r, int n, int pass )
+{
+   unsigned int sum = 0;
+   int i;
+   for (i = 0; i < n; i++)
+      sum += (r[i].a ^ r[i].b) + (r[i].c ^ r[i].d) + r[i].h * pass;
+   return sum;
+}
+
+int main ( int argc, char* argv[] )
+{
+   int i, pass;
+   int undef = argc > 1 ? atoi(argv[1]) : 0;
+   unsigned int sum = 0;
+   Rec* r = malloc(NRECS * sizeof(Rec));
+
+   for (i = 0; i < NRECS; i++) {
+      r[i].a = i;     r[i].b = i * 3; r[i].c = i + 7; r[i].d = i ^ 5;
+      r[i].e = i * 5; r[i].g = i;     r[i].h = 1;
+      if (!undef)
+         r[i].f = i;   // never read
+   }
+   for (pass = 0; pass < NPASS; pass++)
+      sum += sum_recs(r, NRECS, pass);
+   printf("sum = %u\n", sum);
+   free(r);
+   return 0;
+}
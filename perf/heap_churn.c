@@ -0,0 +1,47 @@
+// Like heap.c, does lots of malloc and free, but the number of live
+// blocks keeps swinging between none and a lot, and blocks are freed in
+// a scattered order rather than oldest first.  So, unlike heap.c, the
+// tool's table of live blocks keeps filling up and emptying out (its
+// bucket array never shrinks, so after the first wave it is mostly
+// empty much of the time), and lookups in it don't follow allocation
+// order.  A quarter of the frees are done by realloc-ing the block
+// first.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NMAX   (2*1000*1000)   // Most blocks live at once
+#define NWAVES 4
+
+static char* arr[NMAX];
+
+int main ( int argc, char* argv[] )
+{
+   int i, w, nbytes = 1;
+   int nwaves = argc > 1 ? atoi(argv[1]) : NWAVES;
+   unsigned long sum = 0;
+
+   for (w = 0; w < nwaves; w++) {
+      // Grow the live set, in steps, to NMAX blocks.
+      for (i = 0; i < NMAX; i++) {
+         arr[i] = malloc(nbytes);
+         arr[i][0] = (char)i;
+         nbytes += 8;
+         if (nbytes > 48)
+            nbytes = 1;
+      }
+      // Free them all again, in a scattered order (7919 is prime, and
+      // so co-prime with NMAX).
+      for (i = 0; i < NMAX; i++) {
+         int j = (int)(((unsigned long)i * 7919ul) % NMAX);
+         sum += (unsigned char)arr[j][0];
+         if ((i & 3) == 0)
+            arr[j] = realloc(arr[j], 64);
+         free(arr[j]);
+         arr[j] = NULL;
+      }
+   }
+
+   printf("done, sum = %lu\n", sum);
+   return 0;
+}
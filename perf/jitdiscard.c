@@ -0,0 +1,117 @@
+
+// This artificial program behaves a bit like a JIT compiler: it fills
+// a large code area with small functions, and then keeps replacing
+// individual functions with different code and running them, telling
+// Valgrind each time (as JITs do) that the old code is gone.
+//
+// It's a stress test for discarding translations: every replacement
+// discards the translations of one small range, while lots of other
+// code stays translated.  Run it with --smc-check=all to stress the
+// self-modifying-code checks as well.
+//
+// The optional second argument is how many adjacent functions are
+// replaced together, with one discard request covering all of them.
+// With the default of 1, each range lies within one of the transtab's
+// 8KB address-range equivalence classes, or straddles two; with 64
+// (64KB), each spans 8 or 9 classes.
+//
+// Like bigcode.c, this "generates" code by copying compiled functions,
+// so it only works on targets where f() and g() are position
+// independent and fit in FN_SIZE bytes.
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+#if defined(__mips__)
+#include <asm/cachectl.h>
+#include <sys/syscall.h>
+#elif defined(__tilegx__)
+#include <asm/cachectl.h>
+#endif
+#include "tests/sys_mman.h"
+#include "valgrind.h"
+
+#define FN_SIZE     1024    // Must be big enough to hold the compiled
+                            // f() and g() and any literal pool used
+#define N_SLOTS     4096    // Number of functions in the code area
+#define N_REPLACE   100000  // Number of functions replaced
+
+int f(int x, int y)
+{
+   int i;
+   for (i = 0; i < 20; i++) {
+      if (x & 1) y += x; else y ^= i;
+      x >>= 1;
+   }
+   return y;
+}
+
+int g(int x, int y)
+{
+   int i;
+   for (i = 0; i < 20; i++) {
+      if (y & 1) x -= y; else x += i;
+      y >>= 1;
+   }
+   return x;
+}
+
+static void flush_icache(char* p, int len)
+{
+#if defined(__mips__)
+   syscall(__NR_cacheflush, p, len, ICACHE);
+#elif defined(__tilegx__)
+   cacheflush(p, len, ICACHE);
+#elif defined(__GNUC__)
+   __builtin___clear_cache(p, p + len);
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+   int i, sum = 0;
+   int n_replace = argc > 1 ? atoi(argv[1]) : N_REPLACE;
+   int n_group   = argc > 2 ? atoi(argv[2]) : 1;
+
+   assert(n_group >= 1 && N_SLOTS % n_group == 0);
+
+   char* a = mmap(0, FN_SIZE * N_SLOTS,
+                     PROT_EXEC|PROT_WRITE|PROT_READ,
+                     MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+   assert(a != (char*)MAP_FAILED);
+
+   // Fill the code area, and run everything once, so that it is all
+   // translated.
+   for (i = 0; i < N_SLOTS; i++)
+      memcpy(&a[FN_SIZE*i], (i & 1) ? (void*)g : (void*)f, FN_SIZE);
+   flush_icache(a, FN_SIZE * N_SLOTS);
+   for (i = 0; i < N_SLOTS; i++) {
+      int(*fn)(int,int) = (void*)&a[FN_SIZE*i];
+      sum += fn(i, N_SLOTS-i);
+   }
+
+   // Now keep replacing groups of functions, scattered around the
+   // code area, and running the new code a few times.
+   for (i = 0; i < n_replace; i += n_group) {
+      int   slot = (int)(((unsigned)i / n_group * 7919u)
+                         % (N_SLOTS / n_group)) * n_group;
+      char* p    = &a[FN_SIZE*slot];
+      int   j, k;
+      for (k = 0; k < n_group; k++)
+         memcpy(p + FN_SIZE*k, ((i + k + slot) & 1) ? (void*)f : (void*)g,
+                FN_SIZE);
+      flush_icache(p, FN_SIZE * n_group);
+      VALGRIND_DISCARD_TRANSLATIONS(p, FN_SIZE * n_group);
+      for (k = 0; k < n_group; k++) {
+         for (j = 0; j < 4; j++) {
+            int(*fn)(int,int) = (void*)(p + FN_SIZE*k);
+            sum += fn(i + k + j, slot + k);
+         }
+      }
+   }
+
+   printf("%d functions replaced, %d at a time, result = %d\n",
+          n_replace, n_group, sum);
+   return 0;
+}
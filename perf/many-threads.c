@@ -0,0 +1,86 @@
+// Many threads synchronising through a small set of shared locks.
+//
+// Every lock hand-over between two threads makes Helgrind join the
+// vector timestamps (one entry per thread that has synchronised) of
+// the releasing and acquiring threads, and every memory access
+// compares them.  With a hundred or more threads these vectors are
+// long, so this measures the cost of Helgrind's VTS operations and
+// of the caches in front of them, which ordinary programs with a
+// handful of threads do not.
+//
+// Usage: many-threads [nthreads [iterations per thread]]
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define N_LOCKS 16
+
+static pthread_mutex_t locks[N_LOCKS];
+static long            shared[N_LOCKS];
+
+static pthread_mutex_t start_mx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  start_cv = PTHREAD_COND_INITIALIZER;
+static int             started  = 0;
+
+static int n_iters = 1000;
+
+static void* worker(void* arg)
+{
+   long me = (long)arg;
+   int  i;
+
+   // Wait until all threads exist, so that they all run at once.
+   pthread_mutex_lock(&start_mx);
+   while (!started)
+      pthread_cond_wait(&start_cv, &start_mx);
+   pthread_mutex_unlock(&start_mx);
+
+   for (i = 0; i < n_iters; i++) {
+      int l = (int)((me * 7 + i) % N_LOCKS);
+      pthread_mutex_lock(&locks[l]);
+      shared[l] += me;
+      pthread_mutex_unlock(&locks[l]);
+   }
+   return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+   int            n_threads = argc > 1 ? atoi(argv[1]) : 128;
+   pthread_t*     tids;
+   pthread_attr_t attr;
+   long           total = 0;
+   int            i;
+
+   if (argc > 2)
+      n_iters = atoi(argv[2]);
+
+   for (i = 0; i < N_LOCKS; i++)
+      pthread_mutex_init(&locks[i], NULL);
+
+   tids = malloc(n_threads * sizeof(pthread_t));
+   pthread_attr_init(&attr);
+   pthread_attr_setstacksize(&attr, 256 * 1024);
+   for (i = 0; i < n_threads; i++) {
+      if (pthread_create(&tids[i], &attr, worker, (void*)(long)i) != 0) {
+         perror("pthread_create");
+         return 1;
+      }
+   }
+
+   pthread_mutex_lock(&start_mx);
+   started = 1;
+   pthread_cond_broadcast(&start_cv);
+   pthread_mutex_unlock(&start_mx);
+
+   for (i = 0; i < n_threads; i++)
+      pthread_join(tids[i], NULL);
+   for (i = 0; i < N_LOCKS; i++)
+      total += shared[i];
+
+   printf("%d threads x %d iterations, total %ld\n",
+          n_threads, n_iters, total);
+   free(tids);
+   return 0;
+}
@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
 
 // memrw provides a simulation of an application
@@ -18,6 +19,10 @@
 // It would be nice to enhance this program to cope with a richer
 // model e.g. multiple threads, many different stack traces touching
 // the memory, better working set distribution, ...
+// With -c, it also copies the working set around with realloc, and
+// writes it to /dev/null, as memcpy/realloc heavy programs do.  For
+// memcheck, that exercises copying and checking the V+A bits of big
+// ranges.
 
 static int sz_b; // size of a block
 static int nr_b; // total nr of blocks used by the program
@@ -25,6 +30,7 @@ static int nr_b_ws; // nr_b in program working set
 static int nr_loops; // nr of loops reading or writing the ws
 static int nr_thr; // nr of threads (hardcoded to 1 currently)
 static int nr_repeat; // nr of times we will allocate, use, then free total+ws
+static int nr_copies; // nr of times the ws is realloc-ed and written out
 
 // Note: the total nr of MB is what is explicitely allocated.
 // On top of that, we have the stacks, local vars, lib vars, ...
@@ -64,6 +70,26 @@ static void *memrw_fn(void *v)
    return NULL;
 }
 
+static void copy_ws (void)
+{
+   int c, m;
+   int fd = open("/dev/null", O_WRONLY);
+   if (fd < 0)
+      perror("open /dev/null");
+
+   for (c = 0; c < nr_copies; c++) {
+      for (m = 0; m < nr_b_ws; m++) {
+         t_b[m] = realloc(t_b[m], sz_b);
+         if (t_b[m] == NULL)
+            perror("realloc t_b[m]");
+         if (fd >= 0 && write(fd, t_b[m], sz_b) != sz_b)
+            perror("write t_b[m]");
+      }
+   }
+   if (fd >= 0)
+      close(fd);
+}
+
 int main (int argc, char *argv[])
 {
    int a;
@@ -76,6 +102,7 @@ int main (int argc, char *argv[])
    //              [-t nr_b default 10] [-w nr_b_ws default 10]
    //              [-l nr_loops_on_ws default 3]
    //              [-r nr_repeat default 1]
+   //              [-c nr_copies default 0]
    //              [-f fan_out default 0]
    //              [-v verbosity default 0]
    sz_b = 1024 * 1024;
@@ -83,6 +110,7 @@ int main (int argc, char *argv[])
    nr_b_ws = 10;
    nr_loops = 3;
    nr_repeat = 1;
+   nr_copies = 0;
    verbose = 0;
    for (a = 1; a < argc; a+=2) {
       if        (strcmp(argv[a], "-b") == 0) {
@@ -95,6 +123,8 @@ int main (int argc, char *argv[])
          nr_loops = atoi(argv[a+1]);
       } else if (strcmp(argv[a], "-r") == 0) {
          nr_repeat = atoi(argv[a+1]);
+      } else if (strcmp(argv[a], "-c") == 0) {
+         nr_copies = atoi(argv[a+1]);
       } else if (strcmp(argv[a], "-v") == 0) {
          verbose = atoi(argv[a+1]);
       } else {
@@ -139,6 +169,11 @@ int main (int argc, char *argv[])
          perror("pthread_join");
       printf("thread terminated\n");
 
+      if (nr_copies > 0) {
+         printf("copying the working set -c %d times\n", nr_copies);
+         copy_ws();
+      }
+
       /* Now, free the memory used, for the next repeat */
       for (i = 0; i < nr_b; i++)
          free (t_b[i]);